@@ -0,0 +1,466 @@
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include "CacheSeeder.h"
+#include "Mercator.h"
+#include "OpenStreetMap.h"
+#include "Trace.h"
+#include "ExecApi.h"
+
+static const double MAX_LATITUDE = 85.0511287798; // edge of the mercator map
+
+CCacheSeeder::CCacheSeeder()
+   : mRequest(),
+     mTileFormat(TileFormat::PNG),
+     mCursor(),
+     mCursorMinX(0),
+     mCursorMaxX(-1),
+     mCursorMaxY(-1),
+     mTotal(0),
+     mCached(0),
+     mDownloaded(0),
+     mFailed(0),
+     mBytes(0),
+     mElapsedUs(0),
+     mZoom(0),
+     mActiveWorkers(0),
+     mTerminate(false),
+     mIsOpen(false)
+{
+}
+
+CCacheSeeder::~CCacheSeeder()
+{
+   Close();
+}
+
+void CCacheSeeder::Close()
+{
+   Stop();
+
+   for (auto& wmts_if : mWmtsIf)
+      wmts_if.Close();
+
+   mIsOpen = false;
+}
+
+uint64_t CCacheSeeder::CountTiles(const TSeedRequest& Request)
+{
+   TTilePolygon tile_polygon;
+   uint64_t     count = 0;
+
+   for (int zoom = Request.MinZoom; zoom <= Request.MaxZoom; zoom++)
+   {
+      int min_x, min_y, max_x, max_y;
+
+      GetTilePolygon(tile_polygon, Request.Polygon, zoom);
+      GetTileRange(tile_polygon, zoom, min_x, min_y, max_x, max_y);
+
+      for (int y = min_y; y <= max_y; y++)
+         for (int x = min_x; x <= max_x; x++)
+            if (IsTileInPolygon(tile_polygon, x, y))
+               count++;
+   }
+
+   return count;
+}
+
+TSeedProgress CCacheSeeder::GetProgress() const
+{
+   TSeedProgress progress;
+
+   progress.Total      = mTotal;
+   progress.Cached     = mCached;
+   progress.Downloaded = mDownloaded;
+   progress.Failed     = mFailed;
+   progress.Bytes      = mBytes;
+   progress.Zoom       = mZoom;
+
+   if (IsRunning())
+      progress.ElapsedSec = std::chrono::duration<double>(std::chrono::steady_clock::now() - mStartTime).count();
+   else
+      progress.ElapsedSec = mElapsedUs / 1e6;
+
+   return progress;
+}
+
+void CCacheSeeder::GetTilePolygon(TTilePolygon& TilePolygon, const std::vector<TSeedPoint>& Polygon, int Zoom)
+{
+   size_t              count = Polygon.size();
+   std::vector<double> latitude(count), longitude(count), x(count), y(count);
+
+   for (size_t i = 0; i < count; i++)
+   {
+      latitude[i] = std::max(-MAX_LATITUDE, std::min(MAX_LATITUDE, Polygon[i].Latitude));
+      longitude[i] = Polygon[i].Longitude;
+   }
+
+   // same projection as the map, so both pick the same tiles at the edges
+   CMercator::Project(latitude.data(), longitude.data(), x.data(), y.data(), count, CMercator::GetTileScale(Zoom));
+
+   TilePolygon.clear();
+
+   for (size_t i = 0; i < count; i++)
+      TilePolygon.emplace_back(x[i], y[i]);
+}
+
+void CCacheSeeder::GetTileRange(const TTilePolygon& TilePolygon, int Zoom, int& MinX, int& MinY, int& MaxX, int& MaxY)
+{
+   int max_tile = (1 << Zoom) - 1;
+
+   MinX = MinY = max_tile;
+   MaxX = MaxY = 0;
+
+   for (const auto& point : TilePolygon)
+   {
+      MinX = std::min(MinX, (int)floor(point.first));
+      MaxX = std::max(MaxX, (int)floor(point.first));
+      MinY = std::min(MinY, (int)floor(point.second));
+      MaxY = std::max(MaxY, (int)floor(point.second));
+   }
+
+   MinX = std::max(MinX, 0);
+   MinY = std::max(MinY, 0);
+   MaxX = std::min(MaxX, max_tile);
+   MaxY = std::min(MaxY, max_tile);
+}
+
+bool CCacheSeeder::IsTileInPolygon(const TTilePolygon& TilePolygon, int X, int Y)
+{
+   size_t count = TilePolygon.size();
+   double center_x = X + 0.5;
+   double center_y = Y + 0.5;
+   bool   inside = false;
+
+   if (count < 3)
+      return false;
+
+   for (size_t i = 0, j = count - 1; i < count; j = i++)
+   {
+      double x0 = TilePolygon[j].first;
+      double y0 = TilePolygon[j].second;
+      double x1 = TilePolygon[i].first;
+      double y1 = TilePolygon[i].second;
+
+      // even-odd crossing test for the tile center
+      if ((y1 > center_y) != (y0 > center_y) &&
+          center_x < (x0 - x1) * (center_y - y1) / (y0 - y1) + x1)
+         inside = !inside;
+
+      // an edge through the tile, clipped against it Liang-Barsky style,
+      // edges only touching the tile border don't count
+      double t0 = 0.0;
+      double t1 = 1.0;
+      double dx = x1 - x0;
+      double dy = y1 - y0;
+      double p[4] = { -dx, dx, -dy, dy };
+      double q[4] = { x0 - X, X + 1 - x0, y0 - Y, Y + 1 - y0 };
+      bool   clipped = false;
+
+      for (int k = 0; k < 4 && !clipped; k++)
+      {
+         if (p[k] == 0.0)
+         {
+            clipped = q[k] <= 0.0;
+         }
+         else
+         {
+            double t = q[k] / p[k];
+
+            if (p[k] < 0.0)
+               t0 = std::max(t0, t);
+            else
+               t1 = std::min(t1, t);
+
+            clipped = t0 >= t1;
+         }
+      }
+
+      if (!clipped)
+         return true;
+   }
+
+   return inside;
+}
+
+std::vector<TSeedPoint> CCacheSeeder::MakeBoundingBox(double MinLatitude,
+                                                      double MinLongitude,
+                                                      double MaxLatitude,
+                                                      double MaxLongitude)
+{
+   return { { MinLatitude, MinLongitude },
+            { MaxLatitude, MinLongitude },
+            { MaxLatitude, MaxLongitude },
+            { MinLatitude, MaxLongitude } };
+}
+
+bool CCacheSeeder::NextTile(TTileCursor& Tile)
+{
+   std::lock_guard<std::mutex> lock(mCursorMutex);
+
+   while (mCursor.Zoom <= mRequest.MaxZoom)
+   {
+      // next tile in the row
+      while (mCursor.Y <= mCursorMaxY)
+      {
+         while (mCursor.X <= mCursorMaxX)
+         {
+            int x = mCursor.X++;
+
+            if (IsTileInPolygon(mCursorPolygon, x, mCursor.Y))
+            {
+               Tile.Zoom = mCursor.Zoom;
+               Tile.X = x;
+               Tile.Y = mCursor.Y;
+               mZoom = mCursor.Zoom;
+               return true;
+            }
+         }
+
+         mCursor.Y++;
+         mCursor.X = mCursorMinX;
+      }
+
+      // next zoom level
+      if (++mCursor.Zoom > mRequest.MaxZoom)
+         break;
+
+      GetTilePolygon(mCursorPolygon, mRequest.Polygon, mCursor.Zoom);
+      GetTileRange(mCursorPolygon, mCursor.Zoom, mCursorMinX, mCursor.Y, mCursorMaxX, mCursorMaxY);
+      mCursor.X = mCursorMinX;
+   }
+
+   return false;
+}
+
+bool CCacheSeeder::Open(const char* WmtsUrl, const char* CachePath)
+{
+   Close();
+
+   if (!WmtsUrl || !CachePath || strlen(CachePath) == 0)
+   {
+      ExecApiLogWarning("Seeder: needs a tile server and a cache directory");
+      return false;
+   }
+
+   mWmtsUrl = WmtsUrl;
+   mCachePath = CachePath;
+
+   // append '/' to the path if not already there
+   if (mCachePath[mCachePath.length() - 1] != '/')
+      mCachePath += '/';
+
+   std::error_code err;
+   std::filesystem::create_directories(mCachePath, err);
+
+   if (err)
+   {
+      ExecApiLogWarning("Seeder: unable to create %s, %s", mCachePath.c_str(), err.message().c_str());
+      return false;
+   }
+
+   // curl is initialized here, not on the workers, and every Start reuses
+   // the connections and capabilities
+   for (auto& wmts_if : mWmtsIf)
+   {
+      if (!wmts_if.Open(mWmtsUrl.c_str(), 10))
+      {
+         ExecApiLogWarning("Seeder: unable to open the tile server %s", mWmtsUrl.c_str());
+         Close();
+         return false;
+      }
+   }
+
+   // the format and url template the map will look for, saved where the
+   // map reads them when it starts offline
+   unsigned char* buffer;
+   int            size;
+
+   if (mWmtsIf[0].GetWmtsCapabilitiesXml(&buffer, size) && mWmtsIf[0].LoadCapabilities(buffer, size))
+   {
+      std::ofstream capabilities_file(mCachePath + WMTS_CAPABILITIES_FILENAME,
+                                      std::ios::out | std::ios::binary | std::ios::trunc);
+
+      capabilities_file.write((const char*)buffer, size);
+   }
+
+   for (int i = 1; i < SEED_MAX_CONNECTIONS; i++)
+      mWmtsIf[i].SetTileSource(mWmtsIf[0].GetTileSource());
+
+   mTileFormat = mWmtsIf[0].GetTileSource().Format;
+
+   mIsOpen = true;
+
+   return true;
+}
+
+bool CCacheSeeder::Start(const TSeedRequest& Request)
+{
+   if (!mIsOpen || IsRunning())
+      return false;
+
+   Stop();
+
+   if (Request.Polygon.size() < 3 || Request.MinZoom < 0 || Request.MaxZoom >= MAX_ZOOM_LEVELS ||
+       Request.MinZoom > Request.MaxZoom)
+   {
+      ExecApiLogWarning("Seeder: bad request, %d points, zoom %d to %d",
+                        (int)Request.Polygon.size(), Request.MinZoom, Request.MaxZoom);
+      return false;
+   }
+
+   int connections = std::max(1, std::min(Request.Connections, SEED_MAX_CONNECTIONS));
+
+   mRequest = Request;
+   mTotal = CountTiles(Request);
+   mCached = 0;
+   mDownloaded = 0;
+   mFailed = 0;
+   mBytes = 0;
+   mElapsedUs = 0;
+   mTerminate = false;
+
+   mCursor.Zoom = Request.MinZoom;
+   GetTilePolygon(mCursorPolygon, Request.Polygon, mCursor.Zoom);
+   GetTileRange(mCursorPolygon, mCursor.Zoom, mCursorMinX, mCursor.Y, mCursorMaxX, mCursorMaxY);
+   mCursor.X = mCursorMinX;
+   mZoom = mCursor.Zoom;
+
+   mStartTime = std::chrono::steady_clock::now();
+   mNextRequestTime = mStartTime;
+
+   mActiveWorkers = connections;
+
+   for (int i = 0; i < connections; i++)
+      mWorkers.emplace_back(&CCacheSeeder::WorkerThread, this, i);
+
+   return true;
+}
+
+void CCacheSeeder::Stop()
+{
+   {
+      std::lock_guard<std::mutex> lock(mRateMutex);
+      mTerminate = true;
+   }
+
+   mRateCondition.notify_all();
+
+   for (auto& worker : mWorkers)
+      worker.join();
+
+   mWorkers.clear();
+}
+
+void CCacheSeeder::WaitForRateLimit()
+{
+   if (mRequest.RequestsPerSec <= 0.0)
+      return;
+
+   // every request takes the next slot on one shared schedule
+   auto                         interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                              std::chrono::duration<double>(1.0 / mRequest.RequestsPerSec));
+   std::unique_lock<std::mutex> lock(mRateMutex);
+   auto                         slot = std::max(mNextRequestTime, std::chrono::steady_clock::now());
+
+   mNextRequestTime = slot + interval;
+   mRateCondition.wait_until(lock, slot, [this]() { return mTerminate.load(); });
+}
+
+void CCacheSeeder::WorkerThread(int Connection)
+{
+   TTileCursor tile;
+
+   CTrace::SetThreadName("Seeder");
+
+   while (!mTerminate && NextTile(tile))
+   {
+      // skipping what is on disk is also what resumes an interrupted run
+      std::string tile_filename = COpenStreetMap::ConstructFilename(mCachePath, tile.Zoom, tile.X, tile.Y, mTileFormat);
+      std::error_code err;
+
+      if (std::filesystem::exists(tile_filename, err))
+      {
+         mCached++;
+         continue;
+      }
+
+      bool got_tile = false;
+
+      for (int attempt = 0; attempt <= mRequest.Retries && !got_tile && !mTerminate; attempt++)
+      {
+         unsigned char* buffer;
+         int            size;
+
+         // back off a little more after each failure
+         if (attempt > 0)
+         {
+            std::unique_lock<std::mutex> lock(mRateMutex);
+            mRateCondition.wait_for(lock, std::chrono::milliseconds(250 << std::min(attempt, 4)),
+                                    [this]() { return mTerminate.load(); });
+         }
+
+         WaitForRateLimit();
+
+         if (mTerminate)
+            break;
+
+         if (mWmtsIf[Connection].GetMapTileBuffer(tile.Zoom, tile.X, tile.Y, &buffer, size) &&
+             WriteTile(tile, buffer, size))
+         {
+            got_tile = true;
+            mBytes += size;
+         }
+      }
+
+      if (got_tile)
+      {
+         mDownloaded++;
+      }
+      else if (!mTerminate)
+      {
+         mFailed++;
+         ExecApiLogWarning("Seeder: gave up on tile %d/%d/%d", tile.Zoom, tile.X, tile.Y);
+      }
+   }
+
+   // the last one out stops the clock
+   if (--mActiveWorkers == 0)
+      mElapsedUs = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - mStartTime).count();
+}
+
+bool CCacheSeeder::WriteTile(const TTileCursor& Tile, const unsigned char* Buffer, int Size)
+{
+   TRACE_SCOPE("DiskWrite", "disk");
+
+   // the map never sees a half written tile, it only looks for the final name
+   std::string     tile_filename = COpenStreetMap::ConstructFilename(mCachePath, Tile.Zoom, Tile.X, Tile.Y, mTileFormat);
+   std::string     part_filename = tile_filename + ".part";
+   std::error_code err;
+
+   {
+      std::ofstream tile_file(part_filename, std::ios::out | std::ios::binary | std::ios::trunc);
+
+      tile_file.write((const char*)Buffer, Size);
+
+      if (!tile_file.good())
+      {
+         ExecApiLogWarning("Seeder: unable to write %s", part_filename.c_str());
+         return false;
+      }
+   }
+
+   std::filesystem::rename(part_filename, tile_filename, err);
+
+   if (err)
+   {
+      ExecApiLogWarning("Seeder: unable to rename %s, %s", part_filename.c_str(), err.message().c_str());
+      std::filesystem::remove(part_filename, err);
+      return false;
+   }
+
+   return true;
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "WmtsIf.h"
+
+#define SEED_MAX_CONNECTIONS 32
+
+struct TSeedPoint
+{
+   double Latitude;
+   double Longitude;
+};
+
+// Area and zoom levels to download. The polygon is closed implicitly, its
+// edges are straight lines on the mercator map.
+struct TSeedRequest
+{
+   std::vector<TSeedPoint> Polygon;
+   int                     MinZoom;
+   int                     MaxZoom;
+   int                     Connections;    // parallel downloads
+   double                  RequestsPerSec; // across all connections, 0 is unlimited
+   int                     Retries;        // per tile, after the first attempt
+};
+
+struct TSeedProgress
+{
+   uint64_t Total;      // tiles in the area
+   uint64_t Cached;     // already on disk, skipped
+   uint64_t Downloaded;
+   uint64_t Failed;     // gave up after the retries
+   uint64_t Bytes;      // downloaded
+   double   ElapsedSec;
+   int      Zoom;       // level being worked on
+};
+
+// Fills the disk cache COpenStreetMap reads for offline use. Tiles already
+// on disk are skipped, and every tile is written to a .part file and renamed
+// into place, so an interrupted run is resumed by starting it again.
+class CCacheSeeder
+{
+public:
+   CCacheSeeder();
+   ~CCacheSeeder();
+
+   void Close();
+
+   // tiles the request covers, without touching the disk or the server
+   static uint64_t CountTiles(const TSeedRequest& Request);
+
+   TSeedProgress GetProgress() const;
+
+   // true until every tile is cached, failed or Stop is called
+   bool IsRunning() const { return mActiveWorkers.load() > 0; }
+
+   static std::vector<TSeedPoint> MakeBoundingBox(double MinLatitude,
+                                                  double MinLongitude,
+                                                  double MaxLatitude,
+                                                  double MaxLongitude);
+
+   bool Open(const char* WmtsUrl, const char* CachePath);
+
+   // downloads on background threads, poll IsRunning and GetProgress
+   bool Start(const TSeedRequest& Request);
+
+   // finishes the downloads in flight and joins the workers
+   void Stop();
+
+private:
+
+   struct TTileCursor
+   {
+      int Zoom;
+      int X;
+      int Y;
+   };
+
+   // polygon in fractional tile coordinates of one zoom level
+   using TTilePolygon = std::vector<std::pair<double, double>>;
+
+   static void GetTilePolygon(TTilePolygon& TilePolygon, const std::vector<TSeedPoint>& Polygon, int Zoom);
+
+   static void GetTileRange(const TTilePolygon& TilePolygon, int Zoom, int& MinX, int& MinY, int& MaxX, int& MaxY);
+
+   static bool IsTileInPolygon(const TTilePolygon& TilePolygon, int X, int Y);
+
+   bool NextTile(TTileCursor& Tile);
+
+   void WaitForRateLimit();
+
+   void WorkerThread(int Connection);
+
+   bool WriteTile(const TTileCursor& Tile, const unsigned char* Buffer, int Size);
+
+   CWmtsIf                  mWmtsIf[SEED_MAX_CONNECTIONS];
+   std::vector<std::thread> mWorkers;
+   TSeedRequest             mRequest;
+   std::string              mCachePath;
+   std::string              mWmtsUrl;
+   TileFormat               mTileFormat;   // from the server's capabilities
+
+   // the cursor walks zoom, then row, then column
+   std::mutex               mCursorMutex;
+   TTilePolygon             mCursorPolygon;
+   TTileCursor              mCursor;
+   int                      mCursorMinX;
+   int                      mCursorMaxX;
+   int                      mCursorMaxY;
+
+   std::mutex                            mRateMutex;
+   std::condition_variable               mRateCondition;
+   std::chrono::steady_clock::time_point mNextRequestTime;
+
+   std::chrono::steady_clock::time_point mStartTime;
+   std::atomic<uint64_t>                 mTotal;
+   std::atomic<uint64_t>                 mCached;
+   std::atomic<uint64_t>                 mDownloaded;
+   std::atomic<uint64_t>                 mFailed;
+   std::atomic<uint64_t>                 mBytes;
+   std::atomic<int64_t>                  mElapsedUs; // set when the last worker exits
+   std::atomic<int>                      mZoom;
+   std::atomic<int>                      mActiveWorkers;
+   std::atomic<bool>                     mTerminate;
+   bool                                  mIsOpen;
+};
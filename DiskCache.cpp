@@ -0,0 +1,476 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include "DiskCache.h"
+#include "OpenStreetMap.h"
+#include "Trace.h"
+#include "ExecApi.h"
+
+static const uint32_t INDEX_MAGIC   = 0x4144534f; // "OSDA"
+static const uint32_t INDEX_VERSION = 2; // morton ordered tile keys
+
+CDiskCache::CDiskCache()
+   : mBytes(0),
+     mBudgetBytes(0),
+     mMinAgeSec(DISK_CACHE_MIN_AGE_SEC),
+     mPinnedTiles(0),
+     mEvictedTiles(0),
+     mEvictedBytes(0),
+     mCollections(0),
+     mLastCollectionMs(0.0),
+     mIndexDirty(false),
+     mCollectNow(false),
+     mTerminate(false)
+{
+}
+
+CDiskCache::~CDiskCache()
+{
+   Close();
+}
+
+void CDiskCache::Add(TTileKey Key, uint64_t Bytes, TileFormat Format)
+{
+   std::lock_guard<std::mutex> lock(mMutex);
+   TEntry&                     entry = mEntries[Key];
+
+   // a rewritten tile replaces its old size
+   mBytes -= entry.Bytes;
+   mBytes += Bytes;
+
+   entry.Bytes = (uint32_t)Bytes;
+   entry.LastAccess = GetNow();
+   entry.Format = Format;
+   mIndexDirty = true;
+
+   if (mBudgetBytes && mBytes > mBudgetBytes && !mCollectNow)
+   {
+      mCollectNow = true;
+      mCondition.notify_one();
+   }
+}
+
+void CDiskCache::Close()
+{
+   if (mCollectorThread.joinable())
+   {
+      {
+         std::lock_guard<std::mutex> lock(mMutex);
+         mTerminate = true;
+      }
+
+      mCondition.notify_one();
+      mCollectorThread.join();
+   }
+
+   std::lock_guard<std::mutex> lock(mMutex);
+
+   mEntries.clear();
+   mBytes = 0;
+   mPinnedTiles = 0;
+   mIndexDirty = false;
+   mCollectNow = false;
+   mTerminate = false;
+}
+
+void CDiskCache::Collect()
+{
+   struct TCandidate
+   {
+      TTileKey Key;
+      uint32_t LastAccess;
+      int      Zoom;
+   };
+
+   auto                                        start = std::chrono::steady_clock::now();
+   std::vector<TCandidate>                     candidates;
+   std::vector<std::pair<TTileKey, TileFormat>> victims;
+   uint64_t                                    freed = 0;
+
+   {
+      std::lock_guard<std::mutex> lock(mMutex);
+      uint32_t                    now = GetNow();
+      uint64_t                    pinned = 0;
+
+      for (const auto& entry : mEntries)
+      {
+         if (IsPinned(entry.first))
+            pinned++;
+         else if (mBudgetBytes && mBytes > mBudgetBytes && (int64_t)now - entry.second.LastAccess >= mMinAgeSec)
+            candidates.push_back({ entry.first, entry.second.LastAccess, entry.first.GetZoom() });
+      }
+
+      mPinnedTiles = pinned;
+
+      if (candidates.empty())
+         return;
+
+      // least valuable first, the oldest, then the deepest zoom
+      std::sort(candidates.begin(), candidates.end(), [](const TCandidate& A, const TCandidate& B)
+      {
+         return A.LastAccess != B.LastAccess ? A.LastAccess < B.LastAccess : A.Zoom > B.Zoom;
+      });
+
+      uint64_t target = (uint64_t)(mBudgetBytes * DISK_CACHE_LOW_WATERMARK);
+
+      for (size_t i = 0; i < candidates.size() && mBytes > target; i++)
+      {
+         auto it = mEntries.find(candidates[i].Key);
+
+         mBytes -= it->second.Bytes;
+         freed += it->second.Bytes;
+         victims.emplace_back(candidates[i].Key, it->second.Format);
+         mEntries.erase(it);
+      }
+
+      mIndexDirty = true;
+   }
+
+   TRACE_SCOPE("DiskEvict", "disk");
+
+   for (const auto& victim : victims)
+   {
+      {
+         // written again since it was picked
+         std::lock_guard<std::mutex> lock(mMutex);
+
+         if (mEntries.count(victim.first) || mTerminate)
+            continue;
+      }
+
+      std::error_code err;
+      std::filesystem::remove(COpenStreetMap::ConstructFilename(mCachePath, victim.first, victim.second), err);
+   }
+
+   std::lock_guard<std::mutex> lock(mMutex);
+
+   mEvictedTiles += victims.size();
+   mEvictedBytes += freed;
+   mCollections++;
+   mLastCollectionMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void CDiskCache::CollectorThread()
+{
+   std::unordered_map<TTileKey, uint32_t> saved_access;
+
+   CTrace::SetThreadName("DiskCache");
+
+#ifdef __linux__
+   // nice applies per thread on linux, keep the scans and deletes out of the
+   // way of the coverage and render threads
+   setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), 19);
+#endif
+
+   LoadIndex(saved_access);
+   Scan(saved_access);
+   saved_access.clear();
+
+   auto last_scan = std::chrono::steady_clock::now();
+
+   while (true)
+   {
+      {
+         std::unique_lock<std::mutex> lock(mMutex);
+
+         mCondition.wait_for(lock, std::chrono::seconds(DISK_CACHE_GC_INTERVAL_SEC),
+                             [this]() { return mTerminate || mCollectNow; });
+
+         if (mTerminate)
+            break;
+
+         mCollectNow = false;
+      }
+
+      if (std::chrono::steady_clock::now() - last_scan > std::chrono::seconds(DISK_CACHE_RESCAN_SEC))
+      {
+         Scan(saved_access);
+         last_scan = std::chrono::steady_clock::now();
+      }
+
+      Collect();
+      SaveIndex();
+   }
+
+   SaveIndex();
+}
+
+uint32_t CDiskCache::GetNow()
+{
+   return (uint32_t)time(nullptr);
+}
+
+TDiskCacheStats CDiskCache::GetStats() const
+{
+   std::lock_guard<std::mutex> lock(mMutex);
+   TDiskCacheStats             stats;
+
+   stats.Bytes            = mBytes;
+   stats.BudgetBytes      = mBudgetBytes;
+   stats.Tiles            = mEntries.size();
+   stats.PinnedTiles      = mPinnedTiles;
+   stats.EvictedTiles     = mEvictedTiles;
+   stats.EvictedBytes     = mEvictedBytes;
+   stats.Collections      = mCollections;
+   stats.LastCollectionMs = mLastCollectionMs;
+
+   return stats;
+}
+
+bool CDiskCache::IsPinned(TTileKey Key) const
+{
+   int zoom = Key.GetZoom();
+   int x = Key.GetX();
+   int y = Key.GetY();
+
+   for (const auto& pin : mPins)
+   {
+      if (zoom == pin.Zoom && x >= pin.MinX && x <= pin.MaxX && y >= pin.MinY && y <= pin.MaxY)
+         return true;
+   }
+
+   return false;
+}
+
+void CDiskCache::LoadIndex(std::unordered_map<TTileKey, uint32_t>& LastAccess)
+{
+   std::ifstream index_file(mCachePath + DISK_CACHE_INDEX_FILENAME, std::ios::in | std::ios::binary);
+   uint32_t      header[2] = { 0, 0 };
+   uint64_t      key;
+   uint32_t      last_access;
+
+   if (!index_file)
+      return;
+
+   index_file.read((char*)header, sizeof(header));
+
+   if (header[0] != INDEX_MAGIC || header[1] != INDEX_VERSION)
+   {
+      ExecApiLogWarning("DiskCache: ignoring %s%s, unknown format", mCachePath.c_str(), DISK_CACHE_INDEX_FILENAME);
+      return;
+   }
+
+   while (index_file.read((char*)&key, sizeof(key)) && index_file.read((char*)&last_access, sizeof(last_access)))
+      LastAccess[TTileKey{ key }] = last_access;
+}
+
+bool CDiskCache::Open(const char* CachePath)
+{
+   Close();
+
+   if (!CachePath || strlen(CachePath) == 0)
+      return false;
+
+   mCachePath = CachePath;
+
+   // append '/' to the path if not already there
+   if (mCachePath[mCachePath.length() - 1] != '/')
+      mCachePath += '/';
+
+   mCollectorThread = std::thread(&CDiskCache::CollectorThread, this);
+
+   return true;
+}
+
+void CDiskCache::PinRegion(double MinLatitude, double MinLongitude, double MaxLatitude, double MaxLongitude, int MinZoom, int MaxZoom)
+{
+   std::lock_guard<std::mutex> lock(mMutex);
+
+   for (int zoom = std::max(MinZoom, 0); zoom <= std::min(MaxZoom, MAX_ZOOM_LEVELS - 1); zoom++)
+   {
+      int max_tile = (1 << zoom) - 1;
+
+      // tile y grows southward
+      mPins.push_back({ zoom,
+                        std::max(COpenStreetMap::GetTileX(MinLongitude, zoom), 0),
+                        std::max(COpenStreetMap::GetTileY(MaxLatitude, zoom), 0),
+                        std::min(COpenStreetMap::GetTileX(MaxLongitude, zoom), max_tile),
+                        std::min(COpenStreetMap::GetTileY(MinLatitude, zoom), max_tile) });
+   }
+}
+
+void CDiskCache::PinZoomLevels(int MinZoom, int MaxZoom)
+{
+   std::lock_guard<std::mutex> lock(mMutex);
+
+   for (int zoom = std::max(MinZoom, 0); zoom <= std::min(MaxZoom, MAX_ZOOM_LEVELS - 1); zoom++)
+      mPins.push_back({ zoom, 0, 0, (1 << zoom) - 1, (1 << zoom) - 1 });
+}
+
+void CDiskCache::SaveIndex()
+{
+   std::vector<std::pair<uint64_t, uint32_t>> records;
+
+   {
+      std::lock_guard<std::mutex> lock(mMutex);
+
+      if (!mIndexDirty)
+         return;
+
+      records.reserve(mEntries.size());
+
+      for (const auto& entry : mEntries)
+         records.emplace_back(entry.first.Value, entry.second.LastAccess);
+
+      mIndexDirty = false;
+   }
+
+   // written next to the index and renamed, a crash leaves the old one
+   std::string     index_filename = mCachePath + DISK_CACHE_INDEX_FILENAME;
+   std::string     temp_filename = index_filename + ".tmp";
+   std::error_code err;
+
+   {
+      std::ofstream index_file(temp_filename, std::ios::out | std::ios::binary | std::ios::trunc);
+      uint32_t      header[2] = { INDEX_MAGIC, INDEX_VERSION };
+
+      index_file.write((const char*)header, sizeof(header));
+
+      for (const auto& record : records)
+      {
+         index_file.write((const char*)&record.first, sizeof(record.first));
+         index_file.write((const char*)&record.second, sizeof(record.second));
+      }
+
+      if (!index_file.good())
+         return;
+   }
+
+   std::filesystem::rename(temp_filename, index_filename, err);
+}
+
+void CDiskCache::Scan(const std::unordered_map<TTileKey, uint32_t>& SavedAccess)
+{
+   TRACE_SCOPE("DiskScan", "disk");
+
+   std::unordered_map<TTileKey, TEntry> entries;
+   std::unordered_map<TTileKey, time_t> modified;   // of the file an entry was made from
+   std::vector<std::string>             stale;      // older copies in another format
+   std::error_code                      err;
+   uint32_t                             scan_start = GetNow();
+
+   for (const auto& file : std::filesystem::directory_iterator(mCachePath, err))
+   {
+      std::string name = file.path().filename().string();
+      int         zoom, x, y, length = 0;
+      TileFormat  format;
+      struct stat file_stat;
+
+      // only finished tiles, not .part files or the capabilities xml
+      if (sscanf(name.c_str(), "%d_%d_%d.%n", &zoom, &x, &y, &length) != 3 ||
+          !GetTileFormatFromExtension(name.substr(length), format) ||
+          name.compare(length, std::string::npos, GetTileFormatExtension(format)) != 0 ||
+          zoom < 0 || zoom >= MAX_ZOOM_LEVELS)
+         continue;
+
+      if (stat(file.path().c_str(), &file_stat) != 0 || !S_ISREG(file_stat.st_mode))
+         continue;
+
+      TTileKey key = TTileKey::Make(zoom, x, y);
+      auto     saved = SavedAccess.find(key);
+      auto     previous = modified.find(key);
+
+      // the server's format changed since the tile was first cached
+      if (previous != modified.end())
+      {
+         if (previous->second > file_stat.st_mtime)
+         {
+            stale.push_back(file.path().string());
+            continue;
+         }
+
+         stale.push_back(COpenStreetMap::ConstructFilename(mCachePath, key, entries[key].Format));
+      }
+
+      TEntry& entry = entries[key];
+
+      entry.Bytes = (uint32_t)file_stat.st_size;
+      entry.LastAccess = (saved != SavedAccess.end()) ? saved->second : (uint32_t)file_stat.st_mtime;
+      entry.Format = format;
+      modified[key] = file_stat.st_mtime;
+   }
+
+   if (err)
+      ExecApiLogWarning("DiskCache: unable to scan %s, %s", mCachePath.c_str(), err.message().c_str());
+
+   for (const auto& filename : stale)
+   {
+      std::error_code remove_err;
+      std::filesystem::remove(filename, remove_err);
+   }
+
+   std::lock_guard<std::mutex> lock(mMutex);
+
+   for (const auto& entry : mEntries)
+   {
+      auto it = entries.find(entry.first);
+
+      if (it != entries.end())
+         it->second.LastAccess = std::max(it->second.LastAccess, entry.second.LastAccess);
+      else if (entry.second.LastAccess >= scan_start)
+         entries.insert(entry); // added while the scan ran
+   }
+
+   mEntries.swap(entries);
+   mBytes = 0;
+
+   for (const auto& entry : mEntries)
+      mBytes += entry.second.Bytes;
+
+   mIndexDirty = true;
+
+   if (mBudgetBytes && mBytes > mBudgetBytes)
+      mCollectNow = true;
+}
+
+void CDiskCache::SetBudget(uint64_t BudgetBytes)
+{
+   std::lock_guard<std::mutex> lock(mMutex);
+
+   mBudgetBytes = BudgetBytes;
+
+   // a smaller budget is enforced right away
+   if (mBudgetBytes && mBytes > mBudgetBytes)
+   {
+      mCollectNow = true;
+      mCondition.notify_one();
+   }
+}
+
+void CDiskCache::SetMinAge(uint32_t MinAgeSec)
+{
+   std::lock_guard<std::mutex> lock(mMutex);
+
+   mMinAgeSec = MinAgeSec;
+}
+
+void CDiskCache::Touch(TTileKey Key)
+{
+   std::lock_guard<std::mutex> lock(mMutex);
+   auto                        it = mEntries.find(Key);
+   uint32_t                    now = GetNow();
+
+   // the tiles on screen are touched every coverage pass, the index only
+   // changes once a second
+   if (it == mEntries.end() || it->second.LastAccess == now)
+      return;
+
+   it->second.LastAccess = now;
+   mIndexDirty = true;
+}
+
+void CDiskCache::UnpinAll()
+{
+   std::lock_guard<std::mutex> lock(mMutex);
+
+   mPins.clear();
+}
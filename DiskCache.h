@@ -0,0 +1,129 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "TileFormat.h"
+#include "TileKey.h"
+
+#define DISK_CACHE_INDEX_FILENAME "access.idx"
+#define DISK_CACHE_GC_INTERVAL_SEC 30   // between budget checks when nothing is added
+#define DISK_CACHE_RESCAN_SEC      600  // picks up tiles written by other processes, e.g. osm_seed
+#define DISK_CACHE_MIN_AGE_SEC     60   // recently used tiles may still be waiting on a texture load
+#define DISK_CACHE_LOW_WATERMARK   0.9  // fraction of the budget a collection frees down to
+
+struct TDiskCacheStats
+{
+   uint64_t Bytes;
+   uint64_t BudgetBytes;   // 0 is unlimited
+   uint64_t Tiles;
+   uint64_t PinnedTiles;
+   uint64_t EvictedTiles;
+   uint64_t EvictedBytes;
+   uint64_t Collections;
+   double   LastCollectionMs;
+};
+
+// Keeps the tile files under the cache path within a byte budget.
+//
+// Last access times live in memory and are saved to DISK_CACHE_INDEX_FILENAME
+// by the collector, so reads cost a hash lookup instead of a utime call. The
+// collector runs on a low priority thread and deletes the least valuable
+// tiles first, the ones longest unused and, for the same age, the ones at
+// deeper zoom levels, which are the cheapest to fetch again. Pinned regions
+// and zoom levels are never evicted.
+class CDiskCache
+{
+public:
+   CDiskCache();
+   ~CDiskCache();
+
+   // a new tile file was written
+   void Add(TTileKey Key, uint64_t Bytes, TileFormat Format = TileFormat::PNG);
+
+   void Close();
+
+   TDiskCacheStats GetStats() const;
+
+   bool IsOpen() const { return mCollectorThread.joinable(); }
+
+   // starts the collector, which loads the index and scans the directory.
+   // The budget is kept across Close and Open.
+   bool Open(const char* CachePath);
+
+   void PinRegion(double MinLatitude, double MinLongitude, double MaxLatitude, double MaxLongitude, int MinZoom, int MaxZoom);
+
+   void PinZoomLevels(int MinZoom, int MaxZoom);
+
+   // 0 is unlimited, usage is still tracked
+   void SetBudget(uint64_t BudgetBytes);
+
+   // tiles used within the last MinAgeSec are never evicted,
+   // DISK_CACHE_MIN_AGE_SEC until set
+   void SetMinAge(uint32_t MinAgeSec);
+
+   // a tile was used, read from its file or found already loaded
+   void Touch(TTileKey Key);
+
+   void UnpinAll();
+
+private:
+
+   struct TEntry
+   {
+      uint32_t   Bytes;
+      uint32_t   LastAccess; // unix seconds
+      TileFormat Format;     // the file extension
+   };
+
+   // inclusive tile range at one zoom level
+   struct TPin
+   {
+      int Zoom;
+      int MinX;
+      int MinY;
+      int MaxX;
+      int MaxY;
+   };
+
+   void Collect();
+
+   void CollectorThread();
+
+   static uint32_t GetNow();
+
+   bool IsPinned(TTileKey Key) const;
+
+   void LoadIndex(std::unordered_map<TTileKey, uint32_t>& LastAccess);
+
+   void SaveIndex();
+
+   // rebuilds the entries from the directory, access times come from the
+   // entries, then SavedAccess, then the file time. A tile cached in two
+   // formats keeps the newer file.
+   void Scan(const std::unordered_map<TTileKey, uint32_t>& SavedAccess);
+
+   std::unordered_map<TTileKey, TEntry> mEntries;
+   std::vector<TPin>                    mPins;
+   mutable std::mutex                   mMutex;
+   std::condition_variable              mCondition;
+   std::thread                          mCollectorThread;
+   std::string                          mCachePath;
+   uint64_t                             mBytes;
+   uint64_t                             mBudgetBytes;
+   uint32_t                             mMinAgeSec;
+   uint64_t                             mPinnedTiles;
+   uint64_t                             mEvictedTiles;
+   uint64_t                             mEvictedBytes;
+   uint64_t                             mCollections;
+   double                               mLastCollectionMs;
+   bool                                 mIndexDirty;
+   bool                                 mCollectNow;
+   bool                                 mTerminate;
+};
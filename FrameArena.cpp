@@ -0,0 +1,79 @@
+#include <stdlib.h>
+#include <algorithm>
+#include <new>
+#include "FrameArena.h"
+
+CFrameArena::CFrameArena(size_t Bytes)
+   : mBlock(nullptr),
+     mCapacity(0),
+     mUsed(0),
+     mRequested(0),
+     mPeak(0),
+     mOverflows(0)
+{
+   mCapacity = (Bytes + FRAME_ARENA_ALIGNMENT - 1) & ~(size_t)(FRAME_ARENA_ALIGNMENT - 1);
+   mBlock = (unsigned char*)aligned_alloc(FRAME_ARENA_ALIGNMENT, mCapacity);
+
+   if (!mBlock)
+      mCapacity = 0;
+}
+
+CFrameArena::~CFrameArena()
+{
+   Reset();
+   free(mBlock);
+}
+
+void* CFrameArena::Allocate(size_t Bytes, size_t Alignment)
+{
+   uintptr_t top = (uintptr_t)mBlock + mUsed;
+   size_t    offset = mUsed + (((top + Alignment - 1) & ~(uintptr_t)(Alignment - 1)) - top);
+
+   // counted with the most padding it could need, a block of the peak fits
+   // the same frame again wherever its allocations land
+   mRequested += Bytes + Alignment - 1;
+
+   if (mBlock && offset + Bytes <= mCapacity)
+   {
+      mUsed = offset + Bytes;
+      return mBlock + offset;
+   }
+
+   // past the block, it's held until the next Reset grows the block
+   size_t         alignment = std::max(Alignment, (size_t)FRAME_ARENA_ALIGNMENT);
+   unsigned char* memory = (unsigned char*)aligned_alloc(alignment, (Bytes + alignment - 1) & ~(alignment - 1));
+
+   if (!memory)
+      throw std::bad_alloc();
+
+   mOverflow.push_back(memory);
+   mOverflows++;
+
+   return memory;
+}
+
+void CFrameArena::Reset()
+{
+   if (mRequested > mPeak)
+      mPeak = mRequested;
+
+   for (unsigned char* memory : mOverflow)
+      free(memory);
+
+   // a frame that overflowed fits next time
+   if (!mOverflow.empty())
+   {
+      size_t capacity = mCapacity ? mCapacity : FRAME_ARENA_BYTES;
+
+      while (capacity < mPeak)
+         capacity *= 2;
+
+      free(mBlock);
+      mBlock = (unsigned char*)aligned_alloc(FRAME_ARENA_ALIGNMENT, capacity);
+      mCapacity = mBlock ? capacity : 0;
+   }
+
+   mOverflow.clear();
+   mUsed = 0;
+   mRequested = 0;
+}
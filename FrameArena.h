@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#define FRAME_ARENA_BYTES     65536   // first block, it grows to the peak a frame needed
+#define FRAME_ARENA_ALIGNMENT 16      // of every block
+
+// Linear arena for memory that lives for one frame or one pass of a loop.
+// Allocate moves a pointer along one block and Reset releases everything at
+// the end of the frame, nothing is freed on its own. What doesn't fit goes to
+// the heap until the next Reset, which grows the block to the most a frame
+// asked for, so frames after the first few allocate nothing. Not thread safe,
+// each thread has its own.
+class CFrameArena
+{
+public:
+   explicit CFrameArena(size_t Bytes = FRAME_ARENA_BYTES);
+   ~CFrameArena();
+
+   CFrameArena(const CFrameArena&) = delete;
+   CFrameArena& operator=(const CFrameArena&) = delete;
+
+   void* Allocate(size_t Bytes, size_t Alignment);
+
+   size_t GetCapacity() const { return mCapacity; }
+
+   // allocations that didn't fit the block
+   uint64_t GetOverflows() const { return mOverflows; }
+
+   // most bytes asked for between two Resets
+   size_t GetPeak() const { return mPeak; }
+
+   // bytes asked for since the last Reset
+   size_t GetUsed() const { return mRequested; }
+
+   // everything allocated since the last Reset is released, the memory must
+   // not be used after
+   void Reset();
+
+private:
+
+   unsigned char*              mBlock;
+   size_t                      mCapacity;
+   size_t                      mUsed;       // of the block
+   size_t                      mRequested;  // since the last Reset, overflow included
+   size_t                      mPeak;
+   uint64_t                    mOverflows;
+   std::vector<unsigned char*> mOverflow;   // heap blocks until the next Reset
+};
+
+// Standard allocator over a CFrameArena, for containers that only live for a
+// frame. Deallocate does nothing, the memory goes back on the arena's Reset.
+template <typename T>
+class TArenaAllocator
+{
+public:
+   using value_type = T;
+
+   explicit TArenaAllocator(CFrameArena& Arena) : mArena(&Arena) {}
+
+   template <typename U>
+   TArenaAllocator(const TArenaAllocator<U>& That) : mArena(That.GetArena()) {}
+
+   T* allocate(size_t Count) { return (T*)mArena->Allocate(Count * sizeof(T), alignof(T)); }
+
+   void deallocate(T*, size_t) {}
+
+   CFrameArena* GetArena() const { return mArena; }
+
+   template <typename U>
+   bool operator==(const TArenaAllocator<U>& That) const { return mArena == That.GetArena(); }
+
+   template <typename U>
+   bool operator!=(const TArenaAllocator<U>& That) const { return mArena != That.GetArena(); }
+
+private:
+
+   CFrameArena* mArena;
+};
+
+template <typename T>
+using TArenaVector = std::vector<T, TArenaAllocator<T>>;
@@ -18,7 +18,7 @@ bool CGlLineStrip::mLineStripInitialized = false;
 CGlLineStrip::CGlLineStrip(std::shared_ptr<CShader>& Shader, float X, float Y, float Width, float Height)
    : CGlObject(Shader, X, Y, Width, Height),
      mModel(1.0f),
-     mLineWidth(1.0f), mVertices(nullptr), mAllowMultipleDrawCalls(true)
+     mLineWidth(1.0f), mVertices(nullptr), mVertexCount(0), mAllowMultipleDrawCalls(true)
 {
    if (!mLineStripInitialized)
       InitBuffers();
@@ -63,9 +63,10 @@ void CGlLineStrip::SetRotation(float Rotation)
    mModel = glm::rotate(mModel, Rotation, glm::vec3(0.0f, 0.0f, 1.0f));
 }
 
-void CGlLineStrip::SetVertices(std::vector<glm::vec3>* Vertices)
+void CGlLineStrip::SetVertices(const glm::vec3* Vertices, size_t Count)
 {
    mVertices = Vertices;
+   mVertexCount = Count;
 }
 
 void CGlLineStrip::Render(const glm::mat4& Projection)
@@ -76,7 +77,7 @@ void CGlLineStrip::Render(const glm::mat4& Projection)
       return;
    }
 
-   if (!mVertices || mVertices->size() < 1)
+   if (!mVertices || mVertexCount < 1)
       return;
 
    mShader->Use();
@@ -92,31 +93,31 @@ void CGlLineStrip::Render(const glm::mat4& Projection)
 
    GLCALL(glBindBuffer(GL_ARRAY_BUFFER, mVBO));
 
-   if (mVertices->size() <= MAX_POINTS)
+   if (mVertexCount <= MAX_POINTS)
    {
       // Update vertex buffer data
-      GLCALL(glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(glm::vec3) * mVertices->size(), mVertices->data()));
-      GLCALL(glDrawArrays(GL_LINE_STRIP, 0, mVertices->size()));
+      GLCALL(glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(glm::vec3) * mVertexCount, mVertices));
+      GLCALL(glDrawArrays(GL_LINE_STRIP, 0, mVertexCount));
    }
    else
    {
       size_t start = 0;
       size_t end = MAX_POINTS-1;
 
-      while (start < mVertices->size() - 1)
+      while (start < mVertexCount - 1)
       {
          int num_vertices = end - start + 1;
          int size = sizeof(glm::vec3) * num_vertices;
 
          // Update vertex buffer data
-         GLCALL(glBufferSubData(GL_ARRAY_BUFFER, 0, size, &mVertices->data()[start]));
+         GLCALL(glBufferSubData(GL_ARRAY_BUFFER, 0, size, &mVertices[start]));
          GLCALL(glDrawArrays(GL_LINE_STRIP, 0, num_vertices));
 
          start = end;
          end += MAX_POINTS-1;
 
-         if (end > mVertices->size() - 1)
-            end = mVertices->size() - 1;
+         if (end > mVertexCount - 1)
+            end = mVertexCount - 1;
 
          if (!mAllowMultipleDrawCalls)
             break;
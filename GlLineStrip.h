@@ -26,7 +26,11 @@ public:
 
    void SetRotation(float Rotation);
 
-   void SetVertices(std::vector<glm::vec3>* Vertices);
+   // the vertices aren't copied, they have to stay put until Render
+   void SetVertices(const glm::vec3* Vertices, size_t Count);
+
+   template <typename TAllocator>
+   void SetVertices(const std::vector<glm::vec3, TAllocator>* Vertices) { SetVertices(Vertices->data(), Vertices->size()); }
 
 private:
    void InitBuffers();     // Initialize VAO, VBO
@@ -36,7 +40,8 @@ private:
    glm::mat4 mModel;
    glm::vec4 mColor;
    float mLineWidth;
-   std::vector<glm::vec3>* mVertices;
+   const glm::vec3* mVertices;
+   size_t mVertexCount;
    bool mAllowMultipleDrawCalls;
 
    static bool mLineStripInitialized;
@@ -0,0 +1,126 @@
+#include "GlTimerQuery.h"
+#include "GlDebug.h"
+#ifdef __EMSCRIPTEN__
+#include <emscripten/emscripten.h>
+#define GLFW_INCLUDE_ES3
+#include <GLFW/glfw3.h>
+#else
+#include <glad/glad.h>
+#endif
+
+CGlTimerQuery::CGlTimerQuery()
+   : mQueries{},
+     mPending{},
+     mGpuWindow{},
+     mCpuWindow{},
+     mDroppedFrames(0),
+     mIndex(0),
+     mActive(false),
+     mInitialized(false)
+{
+}
+
+CGlTimerQuery::~CGlTimerQuery()
+{
+#ifndef __EMSCRIPTEN__
+   // the queries die with the context if it's already gone
+   if (mInitialized && glDeleteQueries)
+      glDeleteQueries(TIMER_QUERY_BUFFERS, mQueries);
+#endif
+}
+
+void CGlTimerQuery::Begin()
+{
+   mCpuStart = std::chrono::steady_clock::now();
+
+#ifndef __EMSCRIPTEN__
+   // the queries are created on first use, once a context is current
+   if (!mInitialized)
+   {
+      GLCALL(glGenQueries(TIMER_QUERY_BUFFERS, mQueries));
+      mInitialized = true;
+   }
+
+   CollectResults();
+
+   // only start a query if the slot's previous result has been read
+   if (mPending[mIndex])
+   {
+      mDroppedFrames++;
+      return;
+   }
+
+   GLCALL(glBeginQuery(GL_TIME_ELAPSED, mQueries[mIndex]));
+   mActive = true;
+#endif
+}
+
+void CGlTimerQuery::CollectResults()
+{
+#ifndef __EMSCRIPTEN__
+   for (int i = 0; i < TIMER_QUERY_BUFFERS; i++)
+   {
+      GLint    available = 0;
+      GLuint64 elapsed_ns = 0;
+
+      if (!mPending[i])
+         continue;
+
+      GLCALL(glGetQueryObjectiv(mQueries[i], GL_QUERY_RESULT_AVAILABLE, &available));
+
+      if (!available)
+         continue;
+
+      GLCALL(glGetQueryObjectui64v(mQueries[i], GL_QUERY_RESULT, &elapsed_ns));
+      mGpuWindow.Add((double)elapsed_ns / 1.0e6);
+      mPending[i] = false;
+   }
+#endif
+}
+
+void CGlTimerQuery::End()
+{
+#ifndef __EMSCRIPTEN__
+   if (mActive)
+   {
+      GLCALL(glEndQuery(GL_TIME_ELAPSED));
+      mPending[mIndex] = true;
+      mIndex = (mIndex + 1) % TIMER_QUERY_BUFFERS;
+      mActive = false;
+   }
+#endif
+
+   mCpuWindow.Add(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - mCpuStart).count());
+}
+
+void CGlTimerQuery::Reset()
+{
+   mGpuWindow = TWindow{};
+   mCpuWindow = TWindow{};
+   mDroppedFrames = 0;
+}
+
+void CGlTimerQuery::TWindow::Add(double Sample)
+{
+   if (Count == TIMER_QUERY_WINDOW)
+      Sum -= Samples[Index];
+   else
+      Count++;
+
+   Samples[Index] = Sample;
+   Sum += Sample;
+   Index = (Index + 1) % TIMER_QUERY_WINDOW;
+}
+
+double CGlTimerQuery::TWindow::GetMax() const
+{
+   double max = 0.0;
+
+   for (int i = 0; i < Count; i++)
+   {
+      if (Samples[i] > max)
+         max = Samples[i];
+   }
+
+   return max;
+}
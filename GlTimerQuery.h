@@ -0,0 +1,61 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+#define TIMER_QUERY_BUFFERS 2  // queries in flight, results are read a frame late
+#define TIMER_QUERY_WINDOW  60 // samples in the rolling average
+
+// Times a block of GL commands on the GPU with GL_TIME_ELAPSED queries, and the
+// CPU time spent submitting them. The queries are double buffered and a result
+// is only read once the GPU reports it available, so timing never stalls the
+// pipeline. A frame whose query slot is still busy is not measured.
+class CGlTimerQuery
+{
+public:
+   CGlTimerQuery();
+   ~CGlTimerQuery();
+
+   void Begin();
+
+   void End();
+
+   double GetCpuMs() const { return mCpuWindow.GetAverage(); }
+
+   double GetCpuMaxMs() const { return mCpuWindow.GetMax(); }
+
+   double GetGpuMs() const { return mGpuWindow.GetAverage(); }
+
+   double GetGpuMaxMs() const { return mGpuWindow.GetMax(); }
+
+   uint64_t GetDroppedFrames() const { return mDroppedFrames; }
+
+   void Reset();
+
+private:
+
+   // rolling window of samples in milliseconds
+   struct TWindow
+   {
+      double Samples[TIMER_QUERY_WINDOW];
+      double Sum;
+      int    Count;
+      int    Index;
+
+      void Add(double Sample);
+      double GetAverage() const { return Count ? Sum / Count : 0.0; }
+      double GetMax() const;
+   };
+
+   void CollectResults();
+
+   unsigned int                          mQueries[TIMER_QUERY_BUFFERS];
+   bool                                  mPending[TIMER_QUERY_BUFFERS];
+   TWindow                               mGpuWindow;
+   TWindow                               mCpuWindow;
+   std::chrono::steady_clock::time_point mCpuStart;
+   uint64_t                              mDroppedFrames;
+   int                                   mIndex;
+   bool                                  mActive;
+   bool                                  mInitialized;
+};
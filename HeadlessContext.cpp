@@ -0,0 +1,165 @@
+#include <string.h>
+#include <glad/glad.h>
+#define EGL_NO_X11
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include "HeadlessContext.h"
+#include "ExecApi.h"
+
+CHeadlessContext::CHeadlessContext()
+   : mDisplay(EGL_NO_DISPLAY),
+     mContext(nullptr),
+     mSurface(EGL_NO_SURFACE)
+{
+}
+
+CHeadlessContext::~CHeadlessContext()
+{
+   Close();
+}
+
+void CHeadlessContext::Close()
+{
+   if (mDisplay == EGL_NO_DISPLAY)
+      return;
+
+   eglMakeCurrent(mDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+
+   if (mSurface != EGL_NO_SURFACE)
+      eglDestroySurface(mDisplay, mSurface);
+
+   if (mContext)
+      eglDestroyContext(mDisplay, mContext);
+
+   eglTerminate(mDisplay);
+
+   mDisplay = EGL_NO_DISPLAY;
+   mContext = nullptr;
+   mSurface = EGL_NO_SURFACE;
+   mRenderer.clear();
+}
+
+bool CHeadlessContext::Open()
+{
+   EGLDisplay display = EGL_NO_DISPLAY;
+   EGLConfig  config;
+   EGLint     num_configs = 0;
+   EGLint     major;
+   EGLint     minor;
+   bool       surfaceless = false;
+
+   const EGLint pbuffer_config_attribs[] =
+   {
+      EGL_SURFACE_TYPE,    EGL_PBUFFER_BIT,
+      EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+      EGL_RED_SIZE,        8,
+      EGL_GREEN_SIZE,      8,
+      EGL_BLUE_SIZE,       8,
+      EGL_ALPHA_SIZE,      8,
+      EGL_NONE
+   };
+
+   const EGLint surfaceless_config_attribs[] =
+   {
+      EGL_SURFACE_TYPE,    0,
+      EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+      EGL_NONE
+   };
+
+   const EGLint context_attribs[] =
+   {
+      EGL_CONTEXT_MAJOR_VERSION,       3,
+      EGL_CONTEXT_MINOR_VERSION,       3,
+      EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+      EGL_NONE
+   };
+
+   const EGLint pbuffer_attribs[] =
+   {
+      EGL_WIDTH,  1,
+      EGL_HEIGHT, 1,
+      EGL_NONE
+   };
+
+   if (IsOpen())
+      Close();
+
+   // prefer the surfaceless platform, it needs no gpu, X or wayland
+   const char* client_extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+   auto        get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+
+   if (get_platform_display && client_extensions && strstr(client_extensions, "EGL_MESA_platform_surfaceless"))
+      display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+
+   if (display == EGL_NO_DISPLAY)
+      display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+   if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor))
+   {
+      ExecApiLogWarning("Headless: no EGL display available");
+      return false;
+   }
+
+   mDisplay = display;
+
+   if (!eglBindAPI(EGL_OPENGL_API))
+   {
+      ExecApiLogWarning("Headless: EGL %d.%d has no desktop OpenGL", major, minor);
+      Close();
+      return false;
+   }
+
+   // the framebuffer object is the real render target, a surface is only
+   // needed if the driver can't make a context current without one
+   const char* display_extensions = eglQueryString(display, EGL_EXTENSIONS);
+
+   if (display_extensions && strstr(display_extensions, "EGL_KHR_surfaceless_context"))
+      surfaceless = eglChooseConfig(display, surfaceless_config_attribs, &config, 1, &num_configs) && num_configs > 0;
+
+   if (!surfaceless && !(eglChooseConfig(display, pbuffer_config_attribs, &config, 1, &num_configs) && num_configs > 0))
+   {
+      ExecApiLogWarning("Headless: no suitable EGL config");
+      Close();
+      return false;
+   }
+
+   mContext = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attribs);
+
+   if (mContext == EGL_NO_CONTEXT)
+   {
+      ExecApiLogWarning("Headless: unable to create an OpenGL 3.3 core context");
+      mContext = nullptr;
+      Close();
+      return false;
+   }
+
+   if (!surfaceless)
+   {
+      mSurface = eglCreatePbufferSurface(display, config, pbuffer_attribs);
+
+      if (mSurface == EGL_NO_SURFACE)
+      {
+         ExecApiLogWarning("Headless: unable to create a pbuffer surface");
+         Close();
+         return false;
+      }
+   }
+
+   if (!eglMakeCurrent(display, mSurface, mSurface, mContext))
+   {
+      ExecApiLogWarning("Headless: unable to make the context current");
+      Close();
+      return false;
+   }
+
+   if (!gladLoadGLLoader((GLADloadproc)eglGetProcAddress))
+   {
+      ExecApiLogWarning("Headless: failed to load the OpenGL functions");
+      Close();
+      return false;
+   }
+
+   mRenderer = (const char*)glGetString(GL_RENDERER);
+
+   return true;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <string>
+
+// An OpenGL 3.3 core context with no window or display server, for rendering
+// into framebuffer objects on build servers. Uses the EGL surfaceless platform
+// when the driver has it, Mesa llvmpipe does, and otherwise the default EGL
+// display with a 1x1 pbuffer.
+class CHeadlessContext
+{
+public:
+   CHeadlessContext();
+   ~CHeadlessContext();
+
+   void Close();
+
+   // GL_RENDERER of the context, e.g. "llvmpipe (LLVM 15.0.6, 256 bits)"
+   const std::string& GetRenderer() const { return mRenderer; }
+
+   bool IsOpen() const { return mContext != nullptr; }
+
+   // creates the context, makes it current on the calling thread and loads
+   // the GL function pointers
+   bool Open();
+
+private:
+
+   // EGLDisplay, EGLContext and EGLSurface, kept opaque so the EGL headers
+   // stay out of this header
+   void*       mDisplay;
+   void*       mContext;
+   void*       mSurface;
+   std::string mRenderer;
+};
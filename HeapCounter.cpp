@@ -0,0 +1,77 @@
+#include <stdlib.h>
+#include <new>
+#include "HeapCounter.h"
+
+static thread_local uint64_t thread_allocations = 0;
+
+uint64_t GetThreadAllocations()
+{
+   return thread_allocations;
+}
+
+// the replaced global allocation functions, they only add the count to what
+// the library ones do
+void* operator new(size_t Size)
+{
+   thread_allocations++;
+
+   if (Size == 0)
+      Size = 1;
+
+   while (true)
+   {
+      void* memory = malloc(Size);
+
+      if (memory)
+         return memory;
+
+      std::new_handler handler = std::get_new_handler();
+
+      if (!handler)
+         throw std::bad_alloc();
+
+      handler();
+   }
+}
+
+void* operator new[](size_t Size)
+{
+   return operator new(Size);
+}
+
+void* operator new(size_t Size, const std::nothrow_t&) noexcept
+{
+   try
+   {
+      return operator new(Size);
+   }
+   catch (...)
+   {
+      return nullptr;
+   }
+}
+
+void* operator new[](size_t Size, const std::nothrow_t&) noexcept
+{
+   return operator new(Size, std::nothrow);
+}
+
+void operator delete(void* Memory) noexcept
+{
+   free(Memory);
+}
+
+void operator delete[](void* Memory) noexcept
+{
+   free(Memory);
+}
+
+void operator delete(void* Memory, size_t) noexcept
+{
+   free(Memory);
+}
+
+void operator delete[](void* Memory, size_t) noexcept
+{
+   free(Memory);
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <cstdint>
+
+// Heap allocations the calling thread has made since it started. The global
+// operator new in HeapCounter.cpp counts them, the difference of two reads is
+// what the work between them allocated.
+uint64_t GetThreadAllocations();
@@ -0,0 +1,131 @@
+#include "Histogram.h"
+
+CLatencyHistogram::CLatencyHistogram()
+{
+   Reset();
+}
+
+int CLatencyHistogram::GetBucketIndex(uint64_t Value)
+{
+   // values below the first magnitude map one to one onto the sub-buckets
+   if (Value < HISTOGRAM_SUB_BUCKETS)
+      return (int)Value;
+
+   int msb = 63 - __builtin_clzll(Value);
+   int magnitude = msb - HISTOGRAM_SUB_BITS + 1;
+
+   if (magnitude > HISTOGRAM_MAGNITUDES)
+      return HISTOGRAM_BUCKETS - 1;
+
+   // the top HISTOGRAM_SUB_BITS bits below the msb pick the sub-bucket
+   int sub_bucket = (int)((Value >> (magnitude - 1)) & (HISTOGRAM_SUB_BUCKETS - 1));
+
+   return (magnitude * HISTOGRAM_SUB_BUCKETS) + sub_bucket;
+}
+
+uint64_t CLatencyHistogram::GetBucketValue(int Index)
+{
+   int magnitude = Index / HISTOGRAM_SUB_BUCKETS;
+   int sub_bucket = Index % HISTOGRAM_SUB_BUCKETS;
+
+   if (magnitude == 0)
+      return (uint64_t)sub_bucket;
+
+   // report the midpoint of the bucket
+   uint64_t low = ((uint64_t)(HISTOGRAM_SUB_BUCKETS + sub_bucket)) << (magnitude - 1);
+   uint64_t width = 1ULL << (magnitude - 1);
+
+   return low + (width / 2);
+}
+
+double CLatencyHistogram::GetMean() const
+{
+   uint64_t count = GetCount();
+
+   if (count == 0) return 0.0;
+
+   return (double)GetTotal() / (double)count;
+}
+
+uint64_t CLatencyHistogram::GetMin() const
+{
+   return GetCount() ? mMin.load(std::memory_order_relaxed) : 0;
+}
+
+uint64_t CLatencyHistogram::GetPercentile(double Percentile) const
+{
+   uint64_t count = GetCount();
+   uint64_t target;
+   uint64_t running = 0;
+
+   if (count == 0) return 0;
+
+   if (Percentile <= 0.0) return GetMin();
+   if (Percentile >= 100.0) return GetMax();
+
+   target = (uint64_t)((Percentile / 100.0) * (double)count + 0.5);
+   if (target == 0) target = 1;
+
+   for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+   {
+      running += mBuckets[i].load(std::memory_order_relaxed);
+
+      if (running >= target)
+      {
+         uint64_t value = GetBucketValue(i);
+
+         // never report outside the observed range
+         if (value > GetMax()) value = GetMax();
+         if (value < GetMin()) value = GetMin();
+
+         return value;
+      }
+   }
+
+   return GetMax();
+}
+
+void CLatencyHistogram::Merge(const CLatencyHistogram& That)
+{
+   uint64_t that_count = That.GetCount();
+
+   if (that_count == 0) return;
+
+   for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+      mBuckets[i].fetch_add(That.mBuckets[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+
+   mCount.fetch_add(that_count, std::memory_order_relaxed);
+   mTotal.fetch_add(That.GetTotal(), std::memory_order_relaxed);
+
+   uint64_t that_min = That.GetMin();
+   uint64_t that_max = That.GetMax();
+   uint64_t min = mMin.load(std::memory_order_relaxed);
+   uint64_t max = mMax.load(std::memory_order_relaxed);
+
+   while (that_min < min && !mMin.compare_exchange_weak(min, that_min, std::memory_order_relaxed));
+   while (that_max > max && !mMax.compare_exchange_weak(max, that_max, std::memory_order_relaxed));
+}
+
+void CLatencyHistogram::Record(uint64_t Value)
+{
+   mBuckets[GetBucketIndex(Value)].fetch_add(1, std::memory_order_relaxed);
+   mCount.fetch_add(1, std::memory_order_relaxed);
+   mTotal.fetch_add(Value, std::memory_order_relaxed);
+
+   uint64_t min = mMin.load(std::memory_order_relaxed);
+   uint64_t max = mMax.load(std::memory_order_relaxed);
+
+   while (Value < min && !mMin.compare_exchange_weak(min, Value, std::memory_order_relaxed));
+   while (Value > max && !mMax.compare_exchange_weak(max, Value, std::memory_order_relaxed));
+}
+
+void CLatencyHistogram::Reset()
+{
+   for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+      mBuckets[i].store(0, std::memory_order_relaxed);
+
+   mCount.store(0, std::memory_order_relaxed);
+   mTotal.store(0, std::memory_order_relaxed);
+   mMin.store(UINT64_MAX, std::memory_order_relaxed);
+   mMax.store(0, std::memory_order_relaxed);
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Log-linear latency histogram in the style of HdrHistogram. Each power of two
+// range is split into 2^HISTOGRAM_SUB_BITS linear sub-buckets, which keeps the
+// relative error of any percentile under about 3% over the full range.
+// Recording is a couple of relaxed atomic increments, so any thread can record
+// into the same histogram without taking a lock.
+
+#define HISTOGRAM_SUB_BITS    5
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_MAGNITUDES  40
+#define HISTOGRAM_BUCKETS     ((HISTOGRAM_MAGNITUDES + 1) * HISTOGRAM_SUB_BUCKETS)
+
+class CLatencyHistogram
+{
+public:
+   CLatencyHistogram();
+
+   uint64_t GetCount() const { return mCount.load(std::memory_order_relaxed); }
+
+   uint64_t GetMax() const { return mMax.load(std::memory_order_relaxed); }
+
+   double GetMean() const;
+
+   uint64_t GetMin() const;
+
+   // Percentile is in the range 0.0 to 100.0
+   uint64_t GetPercentile(double Percentile) const;
+
+   uint64_t GetTotal() const { return mTotal.load(std::memory_order_relaxed); }
+
+   void Merge(const CLatencyHistogram& That);
+
+   void Record(uint64_t Value);
+
+   void Reset();
+
+private:
+
+   static int GetBucketIndex(uint64_t Value);
+
+   static uint64_t GetBucketValue(int Index);
+
+   std::atomic<uint64_t> mBuckets[HISTOGRAM_BUCKETS];
+   std::atomic<uint64_t> mCount;
+   std::atomic<uint64_t> mTotal;
+   std::atomic<uint64_t> mMin;
+   std::atomic<uint64_t> mMax;
+};
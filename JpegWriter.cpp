@@ -0,0 +1,417 @@
+#include <math.h>
+#include <cstdint>
+#include <algorithm>
+#include "JpegWriter.h"
+
+// the tables are the example ones from annex K of the jpeg standard, every
+// decoder handles them
+
+// natural order index of each zigzag position
+static const unsigned char zigzag[64] =
+{
+    0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+   12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+   35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+   58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63
+};
+
+// in natural order
+static const unsigned char luma_quant[64] =
+{
+   16, 11, 10, 16,  24,  40,  51,  61,
+   12, 12, 14, 19,  26,  58,  60,  55,
+   14, 13, 16, 24,  40,  57,  69,  56,
+   14, 17, 22, 29,  51,  87,  80,  62,
+   18, 22, 37, 56,  68, 109, 103,  77,
+   24, 35, 55, 64,  81, 104, 113,  92,
+   49, 64, 78, 87, 103, 121, 120, 101,
+   72, 92, 95, 98, 112, 100, 103,  99
+};
+
+static const unsigned char chroma_quant[64] =
+{
+   17, 18, 24, 47, 99, 99, 99, 99,
+   18, 21, 26, 66, 99, 99, 99, 99,
+   24, 26, 56, 99, 99, 99, 99, 99,
+   47, 66, 99, 99, 99, 99, 99, 99,
+   99, 99, 99, 99, 99, 99, 99, 99,
+   99, 99, 99, 99, 99, 99, 99, 99,
+   99, 99, 99, 99, 99, 99, 99, 99,
+   99, 99, 99, 99, 99, 99, 99, 99
+};
+
+// codes of each length, then the symbols in code order
+static const unsigned char luma_dc_bits[16] = { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 };
+static const unsigned char chroma_dc_bits[16] = { 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 };
+static const unsigned char dc_values[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+
+static const unsigned char luma_ac_bits[16] = { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d };
+static const unsigned char luma_ac_values[162] =
+{
+   0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+   0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+   0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+   0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+   0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+   0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+   0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+   0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+   0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+   0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+   0xf9, 0xfa
+};
+
+static const unsigned char chroma_ac_bits[16] = { 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 };
+static const unsigned char chroma_ac_values[162] =
+{
+   0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+   0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+   0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+   0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+   0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+   0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+   0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+   0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+   0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+   0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+   0xf9, 0xfa
+};
+
+struct THuffmanCode
+{
+   uint16_t Code;
+   uint8_t  Length;
+};
+
+// one component's tables and the dc value of its last block
+struct TComponent
+{
+   float        Quant[64];  // natural order, with the dct scale folded in
+   THuffmanCode Dc[256];
+   THuffmanCode Ac[256];
+   int          LastDc;
+};
+
+// entropy coded bits, a 0xff byte is followed by a stuffed zero
+struct TBitWriter
+{
+   std::vector<unsigned char>& Buffer;
+   uint32_t                    Bits;
+   int                         Count;
+
+   void Put(uint32_t Value, int Length)
+   {
+      Bits = (Bits << Length) | (Value & ((1u << Length) - 1));
+      Count += Length;
+
+      while (Count >= 8)
+      {
+         unsigned char byte = (Bits >> (Count - 8)) & 0xff;
+
+         Buffer.push_back(byte);
+         if (byte == 0xff)
+            Buffer.push_back(0);
+
+         Count -= 8;
+      }
+   }
+
+   // the last byte is padded with ones
+   void Flush()
+   {
+      if (Count > 0)
+         Put(0x7f, 8 - Count);
+   }
+};
+
+static void BuildHuffmanCodes(THuffmanCode* Codes, const unsigned char* Bits, const unsigned char* Values)
+{
+   uint16_t code = 0;
+   int      index = 0;
+
+   for (int length = 1; length <= 16; length++)
+   {
+      for (int i = 0; i < Bits[length - 1]; i++)
+      {
+         Codes[Values[index]].Code = code++;
+         Codes[Values[index]].Length = length;
+         index++;
+      }
+
+      code <<= 1;
+   }
+}
+
+static void BuildQuant(float* Quant, unsigned char* Table, const unsigned char* Base, int Quality)
+{
+   static const float dct_scale[8] = { 1.0f, 1.387039845f, 1.306562965f, 1.175875602f,
+                                       1.0f, 0.785694958f, 0.541196100f, 0.275899379f };
+   int                scale = (Quality < 50) ? 5000 / Quality : 200 - Quality * 2;
+
+   for (int i = 0; i < 64; i++)
+   {
+      int value = std::min(std::max((Base[i] * scale + 50) / 100, 1), 255);
+
+      Table[i] = value;
+      // the aan dct leaves each coefficient scaled by its row and column
+      // factors and by 8
+      Quant[i] = 1.0f / (value * dct_scale[i / 8] * dct_scale[i % 8] * 8.0f);
+   }
+}
+
+static void PutMarker(std::vector<unsigned char>& Buffer, unsigned char Marker, int Length)
+{
+   Buffer.push_back(0xff);
+   Buffer.push_back(Marker);
+   Buffer.push_back((Length >> 8) & 0xff);
+   Buffer.push_back(Length & 0xff);
+}
+
+static void PutHuffmanTable(std::vector<unsigned char>& Buffer, int ClassId, const unsigned char* Bits,
+                            const unsigned char* Values, int Count)
+{
+   Buffer.push_back(ClassId);
+   Buffer.insert(Buffer.end(), Bits, Bits + 16);
+   Buffer.insert(Buffer.end(), Values, Values + Count);
+}
+
+// the arai, agui and nakajima dct of one row or column, in place with a stride
+static void Dct8(float* Data, int Stride)
+{
+   float* d = Data;
+   float  tmp0 = d[0] + d[7 * Stride];
+   float  tmp7 = d[0] - d[7 * Stride];
+   float  tmp1 = d[Stride] + d[6 * Stride];
+   float  tmp6 = d[Stride] - d[6 * Stride];
+   float  tmp2 = d[2 * Stride] + d[5 * Stride];
+   float  tmp5 = d[2 * Stride] - d[5 * Stride];
+   float  tmp3 = d[3 * Stride] + d[4 * Stride];
+   float  tmp4 = d[3 * Stride] - d[4 * Stride];
+
+   // even part
+   float tmp10 = tmp0 + tmp3;
+   float tmp13 = tmp0 - tmp3;
+   float tmp11 = tmp1 + tmp2;
+   float tmp12 = tmp1 - tmp2;
+
+   d[0] = tmp10 + tmp11;
+   d[4 * Stride] = tmp10 - tmp11;
+
+   float z1 = (tmp12 + tmp13) * 0.707106781f;
+
+   d[2 * Stride] = tmp13 + z1;
+   d[6 * Stride] = tmp13 - z1;
+
+   // odd part
+   tmp10 = tmp4 + tmp5;
+   tmp11 = tmp5 + tmp6;
+   tmp12 = tmp6 + tmp7;
+
+   float z5 = (tmp10 - tmp12) * 0.382683433f;
+   float z2 = 0.541196100f * tmp10 + z5;
+   float z4 = 1.306562965f * tmp12 + z5;
+   float z3 = tmp11 * 0.707106781f;
+   float z11 = tmp7 + z3;
+   float z13 = tmp7 - z3;
+
+   d[5 * Stride] = z13 + z2;
+   d[3 * Stride] = z13 - z2;
+   d[Stride] = z11 + z4;
+   d[7 * Stride] = z11 - z4;
+}
+
+static void EncodeBlock(TBitWriter& Writer, TComponent& Component, float* Block)
+{
+   int coefficients[64];
+   int last_nonzero = 0;
+
+   for (int i = 0; i < 8; i++)
+      Dct8(&Block[i * 8], 1);
+
+   for (int i = 0; i < 8; i++)
+      Dct8(&Block[i], 8);
+
+   for (int i = 0; i < 64; i++)
+   {
+      coefficients[i] = (int)lroundf(Block[zigzag[i]] * Component.Quant[zigzag[i]]);
+
+      if (i > 0 && coefficients[i] != 0)
+         last_nonzero = i;
+   }
+
+   // a value is sent as its bit length, the symbol, then its bits, a
+   // negative one as its ones' complement
+   int diff = coefficients[0] - Component.LastDc;
+   int magnitude = (diff < 0) ? -diff : diff;
+   int length = 0;
+
+   Component.LastDc = coefficients[0];
+
+   while (magnitude >> length)
+      length++;
+
+   Writer.Put(Component.Dc[length].Code, Component.Dc[length].Length);
+   if (length)
+      Writer.Put((diff < 0) ? diff - 1 : diff, length);
+
+   int run = 0;
+
+   for (int i = 1; i <= last_nonzero; i++)
+   {
+      if (coefficients[i] == 0)
+      {
+         run++;
+         continue;
+      }
+
+      // sixteen zeros
+      while (run > 15)
+      {
+         Writer.Put(Component.Ac[0xf0].Code, Component.Ac[0xf0].Length);
+         run -= 16;
+      }
+
+      int value = coefficients[i];
+
+      magnitude = (value < 0) ? -value : value;
+      length = 0;
+
+      while (magnitude >> length)
+         length++;
+
+      int symbol = (run << 4) | length;
+
+      Writer.Put(Component.Ac[symbol].Code, Component.Ac[symbol].Length);
+      Writer.Put((value < 0) ? value - 1 : value, length);
+      run = 0;
+   }
+
+   // end of block
+   if (last_nonzero < 63)
+      Writer.Put(Component.Ac[0].Code, Component.Ac[0].Length);
+}
+
+bool WriteJpegBuffer(std::vector<unsigned char>& JpegBuffer,
+                     const unsigned char*        Pixels,
+                     int                         Width,
+                     int                         Height,
+                     int                         Channels,
+                     int                         Quality)
+{
+   unsigned char luma_table[64];
+   unsigned char chroma_table[64];
+   TComponent    components[3] = {};
+   float         blocks[3][64];
+   bool          color = Channels >= 3;
+   int           component_count = color ? 3 : 1;
+
+   if (!Pixels || Width <= 0 || Height <= 0 || Width > 65535 || Height > 65535 || Channels < 1 || Channels > 4)
+      return false;
+
+   Quality = std::min(std::max(Quality, 1), 100);
+
+   BuildQuant(components[0].Quant, luma_table, luma_quant, Quality);
+   BuildQuant(components[1].Quant, chroma_table, chroma_quant, Quality);
+   BuildHuffmanCodes(components[0].Dc, luma_dc_bits, dc_values);
+   BuildHuffmanCodes(components[0].Ac, luma_ac_bits, luma_ac_values);
+   BuildHuffmanCodes(components[1].Dc, chroma_dc_bits, dc_values);
+   BuildHuffmanCodes(components[1].Ac, chroma_ac_bits, chroma_ac_values);
+   components[2] = components[1];
+
+   JpegBuffer.clear();
+   JpegBuffer.reserve((size_t)Width * Height / 4 + 1024);
+
+   // start of image
+   JpegBuffer.push_back(0xff);
+   JpegBuffer.push_back(0xd8);
+
+   // quantization tables, in zigzag order
+   PutMarker(JpegBuffer, 0xdb, 2 + 65 * (color ? 2 : 1));
+   JpegBuffer.push_back(0);
+   for (int i = 0; i < 64; i++)
+      JpegBuffer.push_back(luma_table[zigzag[i]]);
+
+   if (color)
+   {
+      JpegBuffer.push_back(1);
+      for (int i = 0; i < 64; i++)
+         JpegBuffer.push_back(chroma_table[zigzag[i]]);
+   }
+
+   // baseline frame, no subsampling
+   PutMarker(JpegBuffer, 0xc0, 8 + 3 * component_count);
+   JpegBuffer.push_back(8);
+   JpegBuffer.push_back((Height >> 8) & 0xff);
+   JpegBuffer.push_back(Height & 0xff);
+   JpegBuffer.push_back((Width >> 8) & 0xff);
+   JpegBuffer.push_back(Width & 0xff);
+   JpegBuffer.push_back(component_count);
+   for (int i = 0; i < component_count; i++)
+   {
+      JpegBuffer.push_back(i + 1);
+      JpegBuffer.push_back(0x11);
+      JpegBuffer.push_back(i ? 1 : 0);
+   }
+
+   PutMarker(JpegBuffer, 0xc4, 2 + (17 + 12 + 17 + 162) * (color ? 2 : 1));
+   PutHuffmanTable(JpegBuffer, 0x00, luma_dc_bits, dc_values, 12);
+   PutHuffmanTable(JpegBuffer, 0x10, luma_ac_bits, luma_ac_values, 162);
+   if (color)
+   {
+      PutHuffmanTable(JpegBuffer, 0x01, chroma_dc_bits, dc_values, 12);
+      PutHuffmanTable(JpegBuffer, 0x11, chroma_ac_bits, chroma_ac_values, 162);
+   }
+
+   // start of scan
+   PutMarker(JpegBuffer, 0xda, 6 + 2 * component_count);
+   JpegBuffer.push_back(component_count);
+   for (int i = 0; i < component_count; i++)
+   {
+      JpegBuffer.push_back(i + 1);
+      JpegBuffer.push_back(i ? 0x11 : 0x00);
+   }
+   JpegBuffer.push_back(0);
+   JpegBuffer.push_back(63);
+   JpegBuffer.push_back(0);
+
+   TBitWriter writer = { JpegBuffer, 0, 0 };
+
+   for (int block_y = 0; block_y < Height; block_y += 8)
+   {
+      for (int block_x = 0; block_x < Width; block_x += 8)
+      {
+         // the edge pixels are repeated past the right and bottom of the image
+         for (int i = 0; i < 64; i++)
+         {
+            int                  x = std::min(block_x + i % 8, Width - 1);
+            int                  y = std::min(block_y + i / 8, Height - 1);
+            const unsigned char* pixel = &Pixels[((size_t)y * Width + x) * Channels];
+
+            if (!color)
+            {
+               blocks[0][i] = pixel[0] - 128.0f;
+               continue;
+            }
+
+            float r = pixel[0];
+            float g = pixel[1];
+            float b = pixel[2];
+
+            blocks[0][i] = 0.299f * r + 0.587f * g + 0.114f * b - 128.0f;
+            blocks[1][i] = -0.168736f * r - 0.331264f * g + 0.5f * b;
+            blocks[2][i] = 0.5f * r - 0.418688f * g - 0.081312f * b;
+         }
+
+         for (int i = 0; i < component_count; i++)
+            EncodeBlock(writer, components[i], blocks[i]);
+      }
+   }
+
+   writer.Flush();
+
+   // end of image
+   JpegBuffer.push_back(0xff);
+   JpegBuffer.push_back(0xd9);
+
+   return true;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <vector>
+
+// Encodes 8 bit gray, RGB or RGBA pixels as a baseline jpeg file with the
+// standard tables, alpha is dropped. Quality is 1 to 100 the way libjpeg
+// scales it. Rows are top to bottom, the same as WritePngBuffer.
+bool WriteJpegBuffer(std::vector<unsigned char>& JpegBuffer,
+                     const unsigned char*        Pixels,
+                     int                         Width,
+                     int                         Height,
+                     int                         Channels,
+                     int                         Quality = 90);
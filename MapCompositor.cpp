@@ -0,0 +1,636 @@
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <thread>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "MapCompositor.h"
+#include "Mercator.h"
+#include "OpenStreetMap.h"
+#include "WmtsIf.h"
+#include "Trace.h"
+#include "ExecApi.h"
+#include "TileFormat.h"
+
+static const double        DEGREES_TO_RADIANS = M_PI / 180.0;
+static const unsigned char BACKGROUND_PIXEL[4] = { 128, 128, 128, 255 }; // same gray as the snapshot clear
+
+// where output pixels land in global tile pixels, g = Origin + Step * d
+// with d the output offset from the center, fixed point with 32 fraction bits
+struct TCompositeMapping
+{
+   unsigned char* Rgba;
+   double         CenterX;
+   double         CenterY;
+   double         StepXX;   // global x per output x
+   double         StepXY;   // global x per output y
+   double         StepYX;   // global y per output x
+   double         StepYY;   // global y per output y
+   int            Width;
+   int            Height;
+   int            Zoom;
+   bool           CopyPath;
+};
+
+// the request's north west and south east corners in global pixels, with
+// the projection the map's coverage uses so the tiles line up
+static void ProjectBounds(const TCompositeRequest& Request, int Zoom, double* X, double* Y)
+{
+   const double latitudes[2] = { Request.MaxLatitude, Request.MinLatitude };
+   const double longitudes[2] = { Request.MinLongitude, Request.MaxLongitude };
+
+   CMercator::Project(latitudes, longitudes, X, Y, 2, CMercator::GetPixelScale(Zoom));
+}
+
+// Top and Bottom each point at two horizontally adjacent rgba pixels,
+// weights are 8 bit fixed point
+static inline void BlendBilinear(const unsigned char* Top, const unsigned char* Bottom, int Fx, int Fy, unsigned char* Out)
+{
+   int w00 = ((256 - Fx) * (256 - Fy)) >> 8;
+   int w10 = (Fx * (256 - Fy)) >> 8;
+   int w01 = ((256 - Fx) * Fy) >> 8;
+   int w11 = 256 - w00 - w10 - w01;
+
+#ifdef __SSE2__
+   // the weights sum to 256 so every sum fits in 16 bits
+   __m128i zero = _mm_setzero_si128();
+   __m128i top = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)Top), zero);
+   __m128i bottom = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)Bottom), zero);
+   __m128i w_top = _mm_set_epi16(w10, w10, w10, w10, w00, w00, w00, w00);
+   __m128i w_bottom = _mm_set_epi16(w11, w11, w11, w11, w01, w01, w01, w01);
+   __m128i sum = _mm_add_epi16(_mm_mullo_epi16(top, w_top), _mm_mullo_epi16(bottom, w_bottom));
+
+   sum = _mm_add_epi16(sum, _mm_srli_si128(sum, 8));
+   sum = _mm_srli_epi16(sum, 8);
+
+   int pixel = _mm_cvtsi128_si32(_mm_packus_epi16(sum, zero));
+   memcpy(Out, &pixel, 4);
+#else
+   for (int c = 0; c < 4; c++)
+      Out[c] = (unsigned char)((Top[c] * w00 + Top[c + 4] * w10 + Bottom[c] * w01 + Bottom[c + 4] * w11) >> 8);
+#endif
+}
+
+class CMapCompositor::CWorker
+{
+public:
+   CWorker(CMapCompositor& Compositor, const TCompositeMapping& Mapping)
+      : mCompositor(Compositor),
+        mMapping(Mapping),
+        mLastTile(nullptr),
+        mLastX(-1),
+        mLastY(-1),
+        mWorldTiles(1 << Mapping.Zoom),
+        mWmtsOpen(false)
+   {
+   }
+
+   void Run(std::atomic<int>& NextBand, int Bands);
+
+private:
+
+   void CopyRow(int Y);
+
+   const unsigned char* GetTile(int X, int Y);
+
+   const unsigned char* GetPixel(int64_t X, int64_t Y);
+
+   void LoadTile(int X, int Y, TTileSlot& Slot);
+
+   void ResampleRow(int Y);
+
+   CMapCompositor&                        mCompositor;
+   const TCompositeMapping&               mMapping;
+   CWmtsIf                                mWmtsIf;
+   std::unordered_map<TTileKey, TSlotPtr> mBandSlots;
+   const unsigned char*                   mLastTile;
+   int                                    mLastX;
+   int                                    mLastY;
+   int                                    mWorldTiles;
+   bool                                   mWmtsOpen;
+};
+
+void CMapCompositor::CWorker::Run(std::atomic<int>& NextBand, int Bands)
+{
+   for (int band = NextBand.fetch_add(1); band < Bands; band = NextBand.fetch_add(1))
+   {
+      TRACE_SCOPE("CompositeBand", "composite");
+
+      int first_row = band * COMPOSITOR_BAND_ROWS;
+      int last_row = std::min(first_row + COMPOSITOR_BAND_ROWS, mMapping.Height);
+
+      for (int y = first_row; y < last_row; y++)
+      {
+         if (mMapping.CopyPath)
+            CopyRow(y);
+         else
+            ResampleRow(y);
+      }
+
+      // the shared cache decides what stays decoded between bands
+      mBandSlots.clear();
+      mLastTile = nullptr;
+      mLastX = -1;
+      mLastY = -1;
+   }
+}
+
+void CMapCompositor::CWorker::CopyRow(int Y)
+{
+   unsigned char* out = mMapping.Rgba + (size_t)Y * mMapping.Width * 4;
+   int64_t        gx = (int64_t)llround(mMapping.CenterX - mMapping.Width * 0.5);
+   int64_t        gy = (int64_t)llround(mMapping.CenterY - mMapping.Height * 0.5) + Y;
+   int            x = 0;
+
+   // whole runs of tile row, memcpy moves them with the widest vector
+   // instructions the cpu has
+   while (x < mMapping.Width)
+   {
+      int64_t              tx = gx >> 8;
+      int                  offset = (int)(gx & (OSM_TILE_SIZE - 1));
+      int                  count = std::min(OSM_TILE_SIZE - offset, mMapping.Width - x);
+      const unsigned char* tile = GetTile((int)tx, (int)(gy >> 8));
+
+      if (tile)
+      {
+         memcpy(out, tile + ((gy & (OSM_TILE_SIZE - 1)) * OSM_TILE_SIZE + offset) * 4, count * 4);
+      }
+      else
+      {
+         for (int i = 0; i < count; i++)
+            memcpy(out + i * 4, BACKGROUND_PIXEL, 4);
+      }
+
+      out += count * 4;
+      gx += count;
+      x += count;
+   }
+}
+
+const unsigned char* CMapCompositor::CWorker::GetTile(int X, int Y)
+{
+   // consecutive pixels mostly hit the same tile
+   if (X == mLastX && Y == mLastY)
+      return mLastTile;
+
+   if (Y < 0 || Y >= mWorldTiles)
+      return nullptr;
+
+   mLastX = X;
+   mLastY = Y;
+
+   // the map wraps east to west
+   X %= mWorldTiles;
+
+   if (X < 0)
+      X += mWorldTiles;
+
+   TTileKey key = TTileKey::Make(mMapping.Zoom, X, Y);
+   auto     it = mBandSlots.find(key);
+
+   if (it == mBandSlots.end())
+   {
+      TSlotPtr slot = mCompositor.GetSlot(mMapping.Zoom, X, Y);
+
+      {
+         std::lock_guard<std::mutex> lock(slot->Mutex);
+
+         if (!slot->Loaded)
+         {
+            LoadTile(X, Y, *slot);
+            slot->Loaded = true;
+         }
+      }
+
+      it = mBandSlots.emplace(key, slot).first;
+   }
+
+   mLastTile = it->second->Rgba.empty() ? nullptr : it->second->Rgba.data();
+
+   return mLastTile;
+}
+
+const unsigned char* CMapCompositor::CWorker::GetPixel(int64_t X, int64_t Y)
+{
+   const unsigned char* tile = GetTile((int)(X >> 8), (int)(Y >> 8));
+
+   if (!tile)
+      return BACKGROUND_PIXEL;
+
+   return tile + ((Y & (OSM_TILE_SIZE - 1)) * OSM_TILE_SIZE + (X & (OSM_TILE_SIZE - 1))) * 4;
+}
+
+void CMapCompositor::CWorker::LoadTile(int X, int Y, TTileSlot& Slot)
+{
+   std::vector<unsigned char> tile;
+   std::string                tile_filename;
+   TileFormat                 format = mCompositor.mTileSource.Format;
+   bool                       got_file = false;
+
+   if (!mCompositor.mCachePath.empty())
+   {
+      TRACE_SCOPE("DiskLookup", "disk");
+
+      tile_filename = COpenStreetMap::ConstructFilename(mCompositor.mCachePath, mMapping.Zoom, X, Y, format);
+
+      std::ifstream tile_file(tile_filename, std::ios::in | std::ios::binary);
+
+      if (tile_file)
+      {
+         tile.assign(std::istreambuf_iterator<char>(tile_file), std::istreambuf_iterator<char>());
+         got_file = !tile.empty();
+      }
+
+      if (got_file)
+         mCompositor.mDiskCache.Touch(TTileKey::Make(mMapping.Zoom, X, Y));
+   }
+
+   if (!got_file && !mCompositor.mWmtsUrl.empty() && mCompositor.mWmtsOnline)
+   {
+      unsigned char* buffer;
+      int            size;
+
+      if (!mWmtsOpen)
+      {
+         mWmtsOpen = mWmtsIf.Open(mCompositor.mWmtsUrl.c_str(), 10);
+         mWmtsIf.SetTileSource(mCompositor.mTileSource);
+      }
+
+      if (mWmtsOpen && mWmtsIf.GetMapTileBuffer(mMapping.Zoom, X, Y, &buffer, size))
+      {
+         tile.assign(buffer, buffer + size);
+         got_file = true;
+         mCompositor.mTilesFetched++;
+
+         if (!tile_filename.empty())
+            mCompositor.WriteTile(TTileKey::Make(mMapping.Zoom, X, Y), buffer, size);
+      }
+      else if (mCompositor.mWmtsOnline.exchange(false))
+      {
+         // like the map, stop asking once the server fails, otherwise every
+         // missing tile waits out the timeout
+         ExecApiLogWarning("Compositor: tile server failed at %d/%d/%d, using the disk cache only",
+                           mMapping.Zoom, X, Y);
+      }
+   }
+
+   if (got_file)
+   {
+      TRACE_SCOPE("Decode", "texture");
+
+      int            width;
+      int            height;
+      int            channels;
+      // the map's textures are loaded flipped, the export isn't
+      unsigned char* data = DecodeTileImage(tile.data(), tile.size(), 4, false, width, height, channels);
+
+      if (data && width == OSM_TILE_SIZE && height == OSM_TILE_SIZE)
+         Slot.Rgba.assign(data, data + OSM_TILE_SIZE * OSM_TILE_SIZE * 4);
+      else
+         ExecApiLogWarning("Compositor: bad tile image %d/%d/%d", mMapping.Zoom, X, Y);
+
+      FreeTileImage(data);
+      mCompositor.mTilesDecoded++;
+   }
+
+   if (Slot.Rgba.empty())
+      mCompositor.mTilesMissing++;
+}
+
+void CMapCompositor::CWorker::ResampleRow(int Y)
+{
+   const double fixed_one = 4294967296.0;
+   unsigned char* out = mMapping.Rgba + (size_t)Y * mMapping.Width * 4;
+   double         dx = 0.5 - mMapping.Width * 0.5;
+   double         dy = Y + 0.5 - mMapping.Height * 0.5;
+
+   // bilinear taps are centered on texels, hence the half pixel
+   int64_t sx = (int64_t)((mMapping.CenterX + mMapping.StepXX * dx + mMapping.StepXY * dy - 0.5) * fixed_one);
+   int64_t sy = (int64_t)((mMapping.CenterY + mMapping.StepYX * dx + mMapping.StepYY * dy - 0.5) * fixed_one);
+   int64_t step_x = (int64_t)(mMapping.StepXX * fixed_one);
+   int64_t step_y = (int64_t)(mMapping.StepYX * fixed_one);
+
+   for (int x = 0; x < mMapping.Width; x++, out += 4, sx += step_x, sy += step_y)
+   {
+      int64_t ix = sx >> 32;
+      int64_t iy = sy >> 32;
+      int     fx = (int)((sx >> 24) & 0xff);
+      int     fy = (int)((sy >> 24) & 0xff);
+      int     px = (int)(ix & (OSM_TILE_SIZE - 1));
+      int     py = (int)(iy & (OSM_TILE_SIZE - 1));
+
+      // all four taps in one tile, the common case
+      if (px != OSM_TILE_SIZE - 1 && py != OSM_TILE_SIZE - 1)
+      {
+         const unsigned char* tile = GetTile((int)(ix >> 8), (int)(iy >> 8));
+
+         if (tile)
+         {
+            const unsigned char* top = tile + (py * OSM_TILE_SIZE + px) * 4;
+            BlendBilinear(top, top + OSM_TILE_SIZE * 4, fx, fy, out);
+         }
+         else
+         {
+            memcpy(out, BACKGROUND_PIXEL, 4);
+         }
+
+         continue;
+      }
+
+      // taps straddle tiles
+      unsigned char top[8];
+      unsigned char bottom[8];
+
+      memcpy(top, GetPixel(ix, iy), 4);
+      memcpy(top + 4, GetPixel(ix + 1, iy), 4);
+      memcpy(bottom, GetPixel(ix, iy + 1), 4);
+      memcpy(bottom + 4, GetPixel(ix + 1, iy + 1), 4);
+
+      BlendBilinear(top, bottom, fx, fy, out);
+   }
+}
+
+CMapCompositor::CMapCompositor()
+   : mStats(),
+     mTilesDecoded(0),
+     mTilesFetched(0),
+     mTilesMissing(0),
+     mWmtsOnline(false),
+     mThreads(1),
+     mIsOpen(false)
+{
+}
+
+CMapCompositor::~CMapCompositor()
+{
+   Close();
+}
+
+void CMapCompositor::Close()
+{
+   std::lock_guard<std::mutex> lock(mTileCacheMutex);
+
+   mTileCache.clear();
+   mTileAge.clear();
+   mDiskCache.Close();
+   mCachePath.clear();
+   mWmtsUrl.clear();
+   mTileSource = TWmtsTileSource();
+   mIsOpen = false;
+}
+
+CMapCompositor::TSlotPtr CMapCompositor::GetSlot(int Zoom, int X, int Y)
+{
+   TTileKey                    key = TTileKey::Make(Zoom, X, Y);
+   std::lock_guard<std::mutex> lock(mTileCacheMutex);
+   auto                        it = mTileCache.find(key);
+
+   if (it != mTileCache.end())
+   {
+      mTileAge.splice(mTileAge.begin(), mTileAge, it->second.Age);
+      return it->second.Slot;
+   }
+
+   // workers still holding an evicted slot keep it alive until their band ends
+   if (mTileCache.size() >= COMPOSITOR_TILE_CACHE_SIZE)
+   {
+      mTileCache.erase(mTileAge.back());
+      mTileAge.pop_back();
+   }
+
+   TCacheEntry entry;
+
+   mTileAge.push_front(key);
+   entry.Slot = std::make_shared<TTileSlot>();
+   entry.Age = mTileAge.begin();
+   mTileCache.emplace(key, entry);
+
+   return entry.Slot;
+}
+
+bool CMapCompositor::Open(const char* WmtsUrl, const char* CachePath, int Threads)
+{
+   Close();
+
+   if (!WmtsUrl && !CachePath)
+   {
+      ExecApiLogWarning("Compositor: no tile server or disk cache");
+      return false;
+   }
+
+   if (CachePath && strlen(CachePath) > 0)
+   {
+      mCachePath = CachePath;
+
+      // append '/' to the path if not already there
+      if (mCachePath[mCachePath.length() - 1] != '/')
+         mCachePath += '/';
+
+      mDiskCache.Open(mCachePath.c_str());
+   }
+
+   if (WmtsUrl)
+      mWmtsUrl = WmtsUrl;
+
+   // the format and url template the tiles are fetched and cached with,
+   // from the server or the capabilities the map last saved
+   CWmtsIf        wmts_if;
+   unsigned char* buffer;
+   int            size;
+
+   if (!mWmtsUrl.empty() && wmts_if.Open(mWmtsUrl.c_str(), 10) &&
+       wmts_if.GetWmtsCapabilitiesXml(&buffer, size) && wmts_if.LoadCapabilities(buffer, size))
+      mTileSource = wmts_if.GetTileSource();
+   else if (!mCachePath.empty() && wmts_if.LoadCapabilitiesFile(mCachePath + WMTS_CAPABILITIES_FILENAME))
+      mTileSource = wmts_if.GetTileSource();
+
+   wmts_if.Close();
+
+   mThreads = Threads > 0 ? Threads : std::max(1u, std::thread::hardware_concurrency());
+   mIsOpen = true;
+
+   return true;
+}
+
+int CMapCompositor::PickZoomLevel(const TCompositeRequest& Request)
+{
+   // tile pixels per output pixel halve with each level down, stop at the
+   // last level that still has at least one
+   for (int zoom = MAX_ZOOM_LEVELS - 1; zoom > 0; zoom--)
+   {
+      double x[2];
+      double y[2];
+
+      ProjectBounds(Request, zoom - 1, x, y);
+
+      if (std::max((x[1] - x[0]) / Request.Width, (y[1] - y[0]) / Request.Height) < 1.0)
+         return zoom;
+   }
+
+   return 0;
+}
+
+bool CMapCompositor::Render(const TCompositeRequest& Request, std::vector<unsigned char>& Rgba)
+{
+   auto start = std::chrono::steady_clock::now();
+
+   if (!mIsOpen)
+      return false;
+
+   if (Request.Width <= 0 || Request.Height <= 0 ||
+       Request.MaxLatitude <= Request.MinLatitude || Request.MaxLongitude <= Request.MinLongitude)
+   {
+      ExecApiLogWarning("Compositor: empty export %d x %d", Request.Width, Request.Height);
+      return false;
+   }
+
+   int zoom = Request.ZoomLevel < 0 ? PickZoomLevel(Request) : Request.ZoomLevel;
+
+   if (zoom >= MAX_ZOOM_LEVELS)
+   {
+      ExecApiLogWarning("Compositor: zoom level %d out of range", zoom);
+      return false;
+   }
+
+   double x[2];
+   double y[2];
+
+   ProjectBounds(Request, zoom, x, y);
+
+   double min_x = x[0];
+   double max_x = x[1];
+   double min_y = y[0];
+   double max_y = y[1];
+
+   // one scale for both axes, the box is fitted inside the output
+   double scale = std::max((max_x - min_x) / Request.Width, (max_y - min_y) / Request.Height);
+
+   if (scale > COMPOSITOR_MAX_DOWNSAMPLE)
+   {
+      ExecApiLogWarning("Compositor: zoom level %d needs %.1f tile pixels per output pixel, at most %.0f",
+                        zoom, scale, COMPOSITOR_MAX_DOWNSAMPLE);
+      return false;
+   }
+
+   // the view turns clockwise so the map turns counterclockwise on the output
+   TCompositeMapping mapping;
+   double            rotation = Request.RotationDeg * DEGREES_TO_RADIANS;
+
+   mapping.CenterX  = (min_x + max_x) * 0.5;
+   mapping.CenterY  = (min_y + max_y) * 0.5;
+   mapping.StepXX   = scale * cos(rotation);
+   mapping.StepXY   = -scale * sin(rotation);
+   mapping.StepYX   = scale * sin(rotation);
+   mapping.StepYY   = scale * cos(rotation);
+   mapping.Width    = Request.Width;
+   mapping.Height   = Request.Height;
+   mapping.Zoom     = zoom;
+
+   // unrotated, 1:1 and landing on whole texels, then no resampling is needed
+   double origin_x = mapping.CenterX - Request.Width * 0.5;
+   double origin_y = mapping.CenterY - Request.Height * 0.5;
+
+   mapping.CopyPath = fmod(Request.RotationDeg, 360.0) == 0.0 &&
+                      fabs(scale - 1.0) < 1e-9 &&
+                      fabs(origin_x - round(origin_x)) < 1e-6 &&
+                      fabs(origin_y - round(origin_y)) < 1e-6;
+
+   Rgba.resize((size_t)Request.Width * Request.Height * 4);
+   mapping.Rgba = Rgba.data();
+
+   mTilesDecoded = 0;
+   mTilesFetched = 0;
+   mTilesMissing = 0;
+   mWmtsOnline = !mWmtsUrl.empty();
+
+   // tiles missing last time are looked up again, the server may be back or
+   // another process may have cached them since
+   {
+      std::lock_guard<std::mutex> lock(mTileCacheMutex);
+
+      for (auto& entry : mTileCache)
+      {
+         if (entry.second.Slot->Rgba.empty())
+            entry.second.Slot->Loaded = false;
+      }
+   }
+
+   int                      bands = (Request.Height + COMPOSITOR_BAND_ROWS - 1) / COMPOSITOR_BAND_ROWS;
+   int                      threads = std::min(mThreads, bands);
+   std::atomic<int>         next_band(0);
+   std::vector<std::thread> pool;
+
+   // the calling thread is the last worker
+   for (int i = 0; i < threads - 1; i++)
+   {
+      pool.emplace_back([this, &mapping, &next_band, bands]()
+      {
+         CTrace::SetThreadName("Compositor");
+
+         CWorker worker(*this, mapping);
+         worker.Run(next_band, bands);
+      });
+   }
+
+   {
+      CWorker worker(*this, mapping);
+      worker.Run(next_band, bands);
+   }
+
+   for (auto& thread : pool)
+      thread.join();
+
+   mStats.ZoomLevel                = zoom;
+   mStats.Threads                  = threads;
+   mStats.Bands                    = bands;
+   mStats.TilesDecoded             = mTilesDecoded;
+   mStats.TilesFetched             = mTilesFetched;
+   mStats.TilesMissing             = mTilesMissing;
+   mStats.TilePixelsPerOutputPixel = scale;
+   mStats.CopyPath                 = mapping.CopyPath;
+   mStats.ElapsedSec               = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+   return true;
+}
+
+bool CMapCompositor::WriteTile(TTileKey Key, const unsigned char* Buffer, int Size)
+{
+   TRACE_SCOPE("DiskWrite", "disk");
+
+   // a map reading the same cache never sees a half written tile
+   std::string     tile_filename = COpenStreetMap::ConstructFilename(mCachePath, Key, mTileSource.Format);
+   std::string     part_filename = tile_filename + ".part";
+   std::error_code err;
+
+   std::filesystem::create_directory(mCachePath, err);
+
+   {
+      std::ofstream tile_file(part_filename, std::ios::out | std::ios::binary | std::ios::trunc);
+
+      tile_file.write((const char*)Buffer, Size);
+
+      if (!tile_file.good())
+      {
+         ExecApiLogWarning("Compositor: unable to write %s", part_filename.c_str());
+         return false;
+      }
+   }
+
+   std::filesystem::rename(part_filename, tile_filename, err);
+
+   if (err)
+   {
+      ExecApiLogWarning("Compositor: unable to rename %s, %s", part_filename.c_str(), err.message().c_str());
+      std::filesystem::remove(part_filename, err);
+      return false;
+   }
+
+   mDiskCache.Add(Key, Size, mTileSource.Format);
+
+   return true;
+}
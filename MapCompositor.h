@@ -0,0 +1,109 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "DiskCache.h"
+#include "TileKey.h"
+#include "WmtsCapabilities.h"
+
+#define COMPOSITOR_TILE_CACHE_SIZE 1024 // decoded tiles kept between bands, 256 KiB each
+#define COMPOSITOR_BAND_ROWS       64   // output rows handed to a worker at a time
+#define COMPOSITOR_MAX_DOWNSAMPLE  8.0  // tile pixels per output pixel allowed
+
+// What to export. The bounding box is fitted into Width x Height, keeping the
+// map's aspect, and rotated about its center.
+struct TCompositeRequest
+{
+   double MinLatitude;
+   double MinLongitude;
+   double MaxLatitude;
+   double MaxLongitude;
+   double RotationDeg;   // clockwise, the same as COpenStreetMap::SetMapRotation
+   int    Width;
+   int    Height;
+   int    ZoomLevel;     // -1 picks the coarsest level that isn't upsampled
+};
+
+struct TCompositeStats
+{
+   int    ZoomLevel;
+   int    Threads;
+   int    Bands;
+   int    TilesDecoded;  // includes tiles decoded again after eviction
+   int    TilesFetched;  // from the tile server
+   int    TilesMissing;  // no data anywhere, left as background
+   double TilePixelsPerOutputPixel;
+   double ElapsedSec;
+   bool   CopyPath;      // unrotated 1:1 export, rows are copied instead of resampled
+};
+
+// Builds one large raster from map tiles on the cpu, for exports too big for
+// a gl framebuffer. Tiles come from the same disk cache and tile server as
+// COpenStreetMap. The output is split into bands of rows that a pool of
+// workers resample bilinearly from the decoded tiles.
+class CMapCompositor
+{
+public:
+   CMapCompositor();
+   ~CMapCompositor();
+
+   void Close();
+
+   const TCompositeStats& GetStats() const { return mStats; }
+
+   // either source may be null, Threads 0 uses every core
+   bool Open(const char* WmtsUrl, const char* CachePath, int Threads = 0);
+
+   static int PickZoomLevel(const TCompositeRequest& Request);
+
+   // Rgba is Width x Height x 4, rows top to bottom
+   bool Render(const TCompositeRequest& Request, std::vector<unsigned char>& Rgba);
+
+private:
+
+   // a decoded tile, empty Rgba means there was no data for it, the next
+   // Render tries again
+   struct TTileSlot
+   {
+      std::mutex                 Mutex;
+      std::vector<unsigned char> Rgba;
+      bool                       Loaded = false;
+   };
+
+   using TSlotPtr = std::shared_ptr<TTileSlot>;
+
+   struct TCacheEntry
+   {
+      TSlotPtr                      Slot;
+      std::list<TTileKey>::iterator Age;
+   };
+
+   // per thread state, each has its own tile server connection
+   class CWorker;
+
+   TSlotPtr GetSlot(int Zoom, int X, int Y);
+
+   bool WriteTile(TTileKey Key, const unsigned char* Buffer, int Size);
+
+   // workers share one slot per tile, the first one to need it decodes it
+   std::unordered_map<TTileKey, TCacheEntry> mTileCache;
+   std::list<TTileKey>                       mTileAge;
+   std::mutex                                mTileCacheMutex;
+   std::string                               mCachePath;
+   CDiskCache                                mDiskCache;   // the fetched tiles count against the map's budget
+   std::string                               mWmtsUrl;
+   TWmtsTileSource                           mTileSource;  // every worker fetches the same
+   TCompositeStats                           mStats;
+   std::atomic<int>                          mTilesDecoded;
+   std::atomic<int>                          mTilesFetched;
+   std::atomic<int>                          mTilesMissing;
+   std::atomic<bool>                         mWmtsOnline;
+   int                                       mThreads;
+   bool                                      mIsOpen;
+};
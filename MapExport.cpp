@@ -0,0 +1,158 @@
+#include <algorithm>
+#include <cstring>
+#include "MapExport.h"
+#include "OpenStreetMap.h"
+#include "ExecApi.h"
+
+CMapExport::CMapExport()
+   : mFramePeriodMs(0.0),
+     mFrameTotalMs(0.0),
+     mFrameMaxMs(0.0),
+     mFrameMinMs(0.0),
+     mFrameAllocations(0),
+     mFrameCount(0),
+     mCoverageCount(0),
+     mCoverageTotalUs(0),
+     mDrawAllocCount(0),
+     mDrawAllocTotal(0),
+     mCoverageAllocCount(0),
+     mCoverageAllocTotal(0),
+     mIsOpen(false)
+{
+   memset(&mGlobals, 0, sizeof(mGlobals));
+}
+
+CMapExport::~CMapExport()
+{
+}
+
+bool CMapExport::Open(const char* Name, double FramePeriodMs)
+{
+   if (mIsOpen)
+      return false;
+
+   mFramePeriodMs = FramePeriodMs;
+   mNextRefresh = TClock::now();
+
+   // the global is registered by address, the frontend reads it from then on
+   ExecApiLoadGlobals(MAP_EXPORT_GLOBALS_FILE, Name, &mGlobals, sizeof(mGlobals));
+
+   mIsOpen = true;
+
+   return true;
+}
+
+void CMapExport::RecordFrame(double FrameMs, uint64_t Allocations)
+{
+   if (!mIsOpen)
+      return;
+
+   mGlobals.RenderFrames++;
+
+   if (FrameMs > mFramePeriodMs)
+      mGlobals.RenderOverruns++;
+
+   mFrameMaxMs = (mFrameCount == 0) ? FrameMs : std::max(mFrameMaxMs, FrameMs);
+   mFrameMinMs = (mFrameCount == 0) ? FrameMs : std::min(mFrameMinMs, FrameMs);
+   mFrameTotalMs += FrameMs;
+   mFrameAllocations += Allocations;
+   mFrameCount++;
+}
+
+void CMapExport::Update(COpenStreetMap& Map)
+{
+   TClock::time_point now = TClock::now();
+
+   if (!mIsOpen || now < mNextRefresh)
+      return;
+
+   mNextRefresh = now + std::chrono::milliseconds(MAP_EXPORT_REFRESH_MS);
+
+   CMapStats&               stats = Map.GetStats();
+   const CLatencyHistogram& coverage = stats.GetLatency(TileStage::COVERAGE);
+   const CLatencyHistogram& fetch = stats.GetLatency(TileStage::NETWORK);
+   uint64_t                 coverage_count = coverage.GetCount();
+   uint64_t                 coverage_total_us = coverage.GetTotal();
+
+   // the window stats start over every refresh, like the exec thread stats
+   if (mFrameCount > 0)
+   {
+      mGlobals.RenderFrameTimeAvgMs = (float)(mFrameTotalMs / mFrameCount);
+      mGlobals.RenderFrameTimeMaxMs = (float)mFrameMaxMs;
+      mGlobals.RenderFrameTimeMinMs = (float)mFrameMinMs;
+      mGlobals.FrameAllocations     = (float)mFrameAllocations / mFrameCount;
+   }
+
+   mFrameTotalMs = 0.0;
+   mFrameAllocations = 0;
+   mFrameCount = 0;
+
+   if (coverage_count > mCoverageCount)
+      mGlobals.CoverageLoopAvgMs = (float)((coverage_total_us - mCoverageTotalUs) / 1000.0 / (coverage_count - mCoverageCount));
+
+   mCoverageCount = coverage_count;
+   mCoverageTotalUs = coverage_total_us;
+
+   const CLatencyHistogram& draw_allocations = stats.GetAllocations(AllocPass::DRAW);
+   const CLatencyHistogram& coverage_allocations = stats.GetAllocations(AllocPass::COVERAGE);
+
+   if (draw_allocations.GetCount() > mDrawAllocCount)
+      mGlobals.DrawAllocations = (float)(draw_allocations.GetTotal() - mDrawAllocTotal) / (draw_allocations.GetCount() - mDrawAllocCount);
+
+   if (coverage_allocations.GetCount() > mCoverageAllocCount)
+      mGlobals.CoverageAllocations = (float)(coverage_allocations.GetTotal() - mCoverageAllocTotal) /
+                                     (coverage_allocations.GetCount() - mCoverageAllocCount);
+
+   mDrawAllocCount = draw_allocations.GetCount();
+   mDrawAllocTotal = draw_allocations.GetTotal();
+   mCoverageAllocCount = coverage_allocations.GetCount();
+   mCoverageAllocTotal = coverage_allocations.GetTotal();
+
+   mGlobals.CoverageLoops     = coverage_count;
+   mGlobals.CoverageLoopP99Ms = coverage.GetPercentile(99.0) / 1000.0f;
+   mGlobals.CoverageLoopMaxMs = coverage.GetMax() / 1000.0f;
+
+   mGlobals.FetchMeanMs    = fetch.GetMean() / 1000.0f;
+   mGlobals.FetchP50Ms     = fetch.GetPercentile(50.0) / 1000.0f;
+   mGlobals.FetchP99Ms     = fetch.GetPercentile(99.0) / 1000.0f;
+   mGlobals.FetchMaxMs     = fetch.GetMax() / 1000.0f;
+   mGlobals.DiskReadMeanMs = stats.GetLatency(TileStage::DISK).GetMean() / 1000.0f;
+   mGlobals.DecodeMeanMs   = stats.GetLatency(TileStage::DECODE).GetMean() / 1000.0f;
+   mGlobals.UploadMeanMs   = stats.GetLatency(TileStage::UPLOAD).GetMean() / 1000.0f;
+   mGlobals.DrawMeanMs     = stats.GetLatency(TileStage::DRAW).GetMean() / 1000.0f;
+   mGlobals.TilesFetched   = fetch.GetCount();
+   mGlobals.FetchFailures  = stats.GetMisses(CacheTier::WMTS);
+   mGlobals.BytesFetched   = stats.GetBytesFetched();
+   mGlobals.BytesRead      = stats.GetBytesRead();
+
+   mGlobals.MemoryHitRate = stats.GetHitRate(CacheTier::MEMORY) * 100.0f;
+   mGlobals.DiskHitRate   = stats.GetHitRate(CacheTier::DISK) * 100.0f;
+   mGlobals.WmtsHitRate   = stats.GetHitRate(CacheTier::WMTS) * 100.0f;
+
+   mGlobals.ZoomLevel        = Map.GetZoomLevel();
+   mGlobals.ViewportComplete = Map.IsViewportComplete();
+
+   // a map that isn't open has no tile service
+   if (!Map.GetTileService())
+      return;
+
+   CTileService&        service = *Map.GetTileService();
+   TTileServiceStats    service_stats = service.GetStats();
+   TDiskCacheStats      disk = service.GetDiskCache().GetStats();
+   TSharedTilePoolStats pool = service.GetSharedPool().GetStats();
+
+   mGlobals.TileRecords           = service_stats.Records;
+   mGlobals.Textures              = service_stats.Textures;
+   mGlobals.ReferencedTextures    = service_stats.ReferencedTextures;
+   mGlobals.EvictedTextures       = service_stats.EvictedTextures;
+   mGlobals.DiskCacheBytes        = disk.Bytes;
+   mGlobals.DiskCacheBudgetBytes  = disk.BudgetBytes;
+   mGlobals.DiskCacheTiles        = disk.Tiles;
+   mGlobals.DiskCacheEvictedTiles = disk.EvictedTiles;
+   mGlobals.SharedPoolTiles       = pool.Tiles;
+   mGlobals.SharedPoolClients     = pool.Clients;
+   mGlobals.PendingLookups        = service_stats.PendingLookups;
+   mGlobals.PreloadQueue          = service_stats.PreloadQueue;
+   mGlobals.PendingDeletes        = service_stats.PendingDeletes;
+   mGlobals.ServerState           = (uint8_t)service_stats.State;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include "MapGlobals.h"
+
+#define MAP_EXPORT_GLOBALS_FILE "MapGlobals.h"  // read by the exec frontend, relative to the working directory
+#define MAP_EXPORT_REFRESH_MS   250
+
+class COpenStreetMap;
+
+// Publishes a map's pipeline metrics, cache sizes, hit rates, queue depths,
+// fetch latency, frame time and coverage loop time, as an ExecApi global, so
+// the exec frontend can watch and plot a running map without the debug
+// window. The frontend reads the global's memory directly, Update refreshes
+// it on the render thread every MAP_EXPORT_REFRESH_MS.
+class CMapExport
+{
+public:
+   CMapExport();
+   ~CMapExport();
+
+   const TMapGlobals& GetGlobals() const { return mGlobals; }
+
+   bool IsOpen() const { return mIsOpen; }
+
+   // ExecApiInit has to have been called. FramePeriodMs is what a render
+   // frame counts as an overrun past.
+   bool Open(const char* Name, double FramePeriodMs);
+
+   // render thread, once a frame after the frame's work, with the heap
+   // allocations the frame made
+   void RecordFrame(double FrameMs, uint64_t Allocations);
+
+   // render thread, refreshes the global when the refresh period is up
+   void Update(COpenStreetMap& Map);
+
+private:
+
+   using TClock = std::chrono::steady_clock;
+
+   TMapGlobals        mGlobals;
+   TClock::time_point mNextRefresh;
+   double             mFramePeriodMs;
+   double             mFrameTotalMs;   // since the last refresh
+   double             mFrameMaxMs;
+   double             mFrameMinMs;
+   uint64_t           mFrameAllocations;
+   uint32_t           mFrameCount;
+   uint64_t           mCoverageCount;  // at the last refresh
+   uint64_t           mCoverageTotalUs;
+   uint64_t           mDrawAllocCount;
+   uint64_t           mDrawAllocTotal;
+   uint64_t           mCoverageAllocCount;
+   uint64_t           mCoverageAllocTotal;
+   bool               mIsOpen;
+};
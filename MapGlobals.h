@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+
+// The map pipeline metrics CMapExport publishes through ExecApiLoadGlobals.
+// The exec frontend reads this file at runtime to find the variables, its
+// parser lays the struct out packed and knows the fixed width types only.
+// Times are milliseconds, the Avg, Max and Min ones cover the last refresh
+// and the rest everything since the map opened.
+
+#pragma pack(1)
+struct TMapGlobals
+{
+   // render loop, the fields of an exec TStatsThread
+   uint32_t RenderFrames;
+   uint32_t RenderOverruns;          // frames longer than the frame period
+   float    RenderFrameTimeAvgMs;
+   float    RenderFrameTimeMaxMs;
+   float    RenderFrameTimeMinMs;
+
+   // coverage thread, one pass without the sleep
+   uint64_t CoverageLoops;
+   float    CoverageLoopAvgMs;
+   float    CoverageLoopP99Ms;
+   float    CoverageLoopMaxMs;
+
+   // heap allocations, means over the last refresh
+   float    FrameAllocations;        // render thread, a whole frame
+   float    DrawAllocations;         // COpenStreetMap::Draw
+   float    CoverageAllocations;     // a coverage thread pass
+
+   // tile pipeline
+   float    FetchMeanMs;
+   float    FetchP50Ms;
+   float    FetchP99Ms;
+   float    FetchMaxMs;
+   float    DiskReadMeanMs;
+   float    DecodeMeanMs;
+   float    UploadMeanMs;
+   float    DrawMeanMs;
+   uint64_t TilesFetched;
+   uint64_t FetchFailures;
+   uint64_t BytesFetched;
+   uint64_t BytesRead;
+
+   // hit rates, percent
+   float    MemoryHitRate;
+   float    DiskHitRate;
+   float    WmtsHitRate;
+
+   // caches
+   uint64_t TileRecords;
+   uint64_t Textures;
+   uint64_t ReferencedTextures;
+   uint64_t EvictedTextures;
+   uint64_t DiskCacheBytes;
+   uint64_t DiskCacheBudgetBytes;   // 0 is unlimited
+   uint64_t DiskCacheTiles;
+   uint64_t DiskCacheEvictedTiles;
+   uint64_t SharedPoolTiles;
+   uint64_t SharedPoolClients;
+
+   // queues
+   uint32_t PendingLookups;         // tiles being looked up or fetched
+   uint32_t PreloadQueue;           // tiles left to preload
+   uint32_t PendingDeletes;         // textures waiting for the render thread
+
+   // map state
+   int32_t  ZoomLevel;
+   uint8_t  ServerState;            // NONE, DISCOVERING, ONLINE, OFFLINE
+   bool     ViewportComplete;
+};
+#pragma pack()
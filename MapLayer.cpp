@@ -0,0 +1,49 @@
+#include <cmath>
+#include <algorithm>
+#include <glm/gtc/matrix_transform.hpp>
+#include "MapLayer.h"
+
+glm::mat4 CMapLayer::GetScreenTransform(const TMapView& View, const glm::mat4& Projection)
+{
+   glm::mat4 model(1.0f);
+
+   // the same model the tiles are drawn with, less the tile placement
+   model = glm::translate(model, glm::vec3((float)View.OffsetX, (float)View.OffsetY, 0.0f));
+   model = glm::rotate(model, (float)(-View.RotationDeg * M_PI / 180.0), glm::vec3(0.0f, 0.0f, 1.0f));
+
+   return Projection * model;
+}
+
+void CMapLayer::GetWorldPosition(const TMapView& View, double X, double Y, double& WorldX, double& WorldY)
+{
+   double radians = View.RotationDeg * M_PI / 180.0;
+   double dx = X - View.OffsetX;
+   double dy = Y - View.OffsetY;
+
+   // undo the rotation, then the scale and the flip to y south
+   WorldX = View.CenterX + (dx * cos(radians) - dy * sin(radians)) / View.PixelsPerWorldX;
+   WorldY = View.CenterY - (dx * sin(radians) + dy * cos(radians)) / View.PixelsPerWorldY;
+}
+
+void CMapLayer::GetVisibleWorldRect(const TMapView& View,
+                                    double          MarginPix,
+                                    double&         MinX,
+                                    double&         MinY,
+                                    double&         MaxX,
+                                    double&         MaxY)
+{
+   double half_width = View.WidthPix * 0.5 + MarginPix;
+   double half_height = View.HeightPix * 0.5 + MarginPix;
+   double radians = View.RotationDeg * M_PI / 180.0;
+   double c = fabs(cos(radians));
+   double s = fabs(sin(radians));
+
+   // extent of the rotated map rectangle along the world axes
+   double extent_x = half_width * c + half_height * s;
+   double extent_y = half_width * s + half_height * c;
+
+   MinX = View.CenterX - extent_x / View.PixelsPerWorldX;
+   MaxX = View.CenterX + extent_x / View.PixelsPerWorldX;
+   MinY = View.CenterY - extent_y / View.PixelsPerWorldY;
+   MaxY = View.CenterY + extent_y / View.PixelsPerWorldY;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+// Where the map is on screen, filled in by COpenStreetMap::Draw from the
+// tiles it drew so overlays line up with them.
+//
+// World coordinates are normalized web mercator, x east and y south in
+// [0, 1), CMercator with a Scale of 1. Screen coordinates are the pixels of
+// the map projection with y up:
+//
+//    screen = Offset + R(-Rotation) * ((x - CenterX) * PixelsPerWorldX, -(y - CenterY) * PixelsPerWorldY)
+struct TMapView
+{
+   double CenterX;
+   double CenterY;
+   double PixelsPerWorldX;
+   double PixelsPerWorldY;
+   double RotationDeg;  // clockwise
+   double OffsetX;
+   double OffsetY;
+   int    WidthPix;     // map size
+   int    HeightPix;
+   int    ZoomLevel;    // of the tiles drawn
+};
+
+// Something drawn over the tiles in the overlay pass, in world coordinates
+class CMapLayer
+{
+public:
+   virtual ~CMapLayer() = default;
+
+   // render thread, the map's shaders and clip are set up
+   virtual void Draw(const TMapView& View, const glm::mat4& Projection) = 0;
+
+   // projection * offset * rotation, takes screen pixels relative to the
+   // map center
+   static glm::mat4 GetScreenTransform(const TMapView& View, const glm::mat4& Projection);
+
+   // world position of a point in map projection pixels
+   static void GetWorldPosition(const TMapView& View, double X, double Y, double& WorldX, double& WorldY);
+
+   // world rectangle covering the map, grown by MarginPix on every side
+   static void GetVisibleWorldRect(const TMapView& View,
+                                   double          MarginPix,
+                                   double&         MinX,
+                                   double&         MinY,
+                                   double&         MaxX,
+                                   double&         MaxY);
+};
@@ -0,0 +1,159 @@
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include <glad/glad.h>
+#include <glm/gtc/matrix_transform.hpp>
+#include "MapSnapshot.h"
+#include "GlDebug.h"
+#include "ExecApi.h"
+
+CMapSnapshot::CMapSnapshot()
+   : mShaderRect(nullptr),
+     mShaderLine(nullptr),
+     mShaderTile(nullptr),
+     mFramebuffer(0),
+     mColorBuffer(0),
+     mTargetWidth(0),
+     mTargetHeight(0)
+{
+}
+
+CMapSnapshot::~CMapSnapshot()
+{
+   Close();
+}
+
+void CMapSnapshot::Close()
+{
+   mMap.Close();
+
+   if (mFramebuffer)
+   {
+      GLCALL(glDeleteFramebuffers(1, &mFramebuffer));
+      GLCALL(glDeleteRenderbuffers(1, &mColorBuffer));
+      mFramebuffer = 0;
+      mColorBuffer = 0;
+      mTargetWidth = 0;
+      mTargetHeight = 0;
+   }
+
+   mShaderRect = nullptr;
+   mShaderLine = nullptr;
+   mShaderTile = nullptr;
+}
+
+bool CMapSnapshot::Open(const char* WmtsUrl, const char* CachePath)
+{
+   mShaderRect = std::make_shared<CShader>("data/shaders/rect.vert", "data/shaders/rect.frag");
+   mShaderLine = std::make_shared<CShader>("data/shaders/line.vert", "data/shaders/line.frag");
+   mShaderTile = std::make_shared<CShader>("data/shaders/tile.vert", "data/shaders/tile.frag");
+
+   mMap.SetShaders(mShaderRect, mShaderLine, mShaderTile);
+   mMap.SetCoverageRadiusScaleFactor(1.0f);
+
+   // every snapshot is a still view, its level is the one for its scale
+   // and is fetched straight away
+   mMap.SetZoomHysteresis(0.0);
+   mMap.SetZoomSettleMs(0);
+
+   return mMap.Open(WmtsUrl != nullptr, WmtsUrl, CachePath != nullptr, CachePath);
+}
+
+bool CMapSnapshot::Render(const TSnapshotView& View, std::vector<unsigned char>& Rgba, double TimeoutSec)
+{
+   auto   start = std::chrono::steady_clock::now();
+   size_t row_size = (size_t)View.Width * 4;
+
+   if (!ResizeTarget(View.Width, View.Height))
+      return false;
+
+   mMap.SetMapSize(View.Width, View.Height);
+   mMap.SetWindowSize(View.Width, View.Height);
+   mMap.SetMapCenter(View.Latitude, View.Longitude);
+   mMap.SetMapScaleFactor(View.ScaleFactor);
+   mMap.SetMapRotation(View.RotationDeg);
+   mMap.SetProjection(glm::ortho(-(float)View.Width * 0.5f,
+                                  (float)View.Width * 0.5f,
+                                 -(float)View.Height * 0.5f,
+                                  (float)View.Height * 0.5f, -1.0f, 1.0f));
+   mMap.Update();
+
+   // wait for the coverage thread to put every tile on the display list,
+   // Draw then loads all of their textures
+   while (!mMap.IsViewportComplete())
+   {
+      if (std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() > TimeoutSec)
+      {
+         ExecApiLogWarning("Snapshot: timed out waiting for tiles at %f, %f", View.Latitude, View.Longitude);
+         return false;
+      }
+
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      mMap.Update();
+   }
+
+   GLCALL(glBindFramebuffer(GL_FRAMEBUFFER, mFramebuffer));
+   GLCALL(glViewport(0, 0, View.Width, View.Height));
+   GLCALL(glClearColor(0.5f, 0.5f, 0.5f, 1.0f));
+   GLCALL(glClear(GL_COLOR_BUFFER_BIT));
+   GLCALL(glEnable(GL_BLEND));
+   GLCALL(glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA));
+
+   mMap.Draw();
+
+   Rgba.resize(row_size * View.Height);
+
+   GLCALL(glPixelStorei(GL_PACK_ALIGNMENT, 1));
+   GLCALL(glReadPixels(0, 0, View.Width, View.Height, GL_RGBA, GL_UNSIGNED_BYTE, Rgba.data()));
+   GLCALL(glBindFramebuffer(GL_FRAMEBUFFER, 0));
+
+   // gl rows are bottom to top
+   std::vector<unsigned char> row(row_size);
+
+   for (int y = 0; y < View.Height / 2; y++)
+   {
+      unsigned char* top = Rgba.data() + y * row_size;
+      unsigned char* bottom = Rgba.data() + (View.Height - 1 - y) * row_size;
+
+      memcpy(row.data(), top, row_size);
+      memcpy(top, bottom, row_size);
+      memcpy(bottom, row.data(), row_size);
+   }
+
+   return true;
+}
+
+bool CMapSnapshot::ResizeTarget(int Width, int Height)
+{
+   if (Width <= 0 || Height <= 0)
+      return false;
+
+   if (mFramebuffer && Width == mTargetWidth && Height == mTargetHeight)
+      return true;
+
+   if (!mFramebuffer)
+   {
+      GLCALL(glGenFramebuffers(1, &mFramebuffer));
+      GLCALL(glGenRenderbuffers(1, &mColorBuffer));
+   }
+
+   GLCALL(glBindRenderbuffer(GL_RENDERBUFFER, mColorBuffer));
+   GLCALL(glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, Width, Height));
+   GLCALL(glBindFramebuffer(GL_FRAMEBUFFER, mFramebuffer));
+   GLCALL(glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, mColorBuffer));
+
+   GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+
+   GLCALL(glBindFramebuffer(GL_FRAMEBUFFER, 0));
+
+   if (status != GL_FRAMEBUFFER_COMPLETE)
+   {
+      ExecApiLogWarning("Snapshot: framebuffer incomplete (0x%x) at %d x %d", status, Width, Height);
+      return false;
+   }
+
+   mTargetWidth = Width;
+   mTargetHeight = Height;
+
+   return true;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include "OpenStreetMap.h"
+#include "Shader.h"
+
+// What to render, the same inputs main.cpp feeds the map every frame
+struct TSnapshotView
+{
+   double Latitude;
+   double Longitude;
+   double ScaleFactor;
+   double RotationDeg;   // clockwise
+   int    Width;
+   int    Height;
+};
+
+// Renders map views into a framebuffer object and reads them back as RGBA.
+// Needs a current GL context, from CHeadlessContext or a window.
+class CMapSnapshot
+{
+public:
+   CMapSnapshot();
+   ~CMapSnapshot();
+
+   void Close();
+
+   // the map behind the snapshots, for stats and zoom level
+   COpenStreetMap& GetMap() { return mMap; }
+
+   bool Open(const char* WmtsUrl, const char* CachePath);
+
+   // waits up to TimeoutSec for every tile in the view, then renders it.
+   // Rgba is Width x Height x 4, rows top to bottom.
+   bool Render(const TSnapshotView& View, std::vector<unsigned char>& Rgba, double TimeoutSec);
+
+private:
+
+   bool ResizeTarget(int Width, int Height);
+
+   COpenStreetMap           mMap;
+   std::shared_ptr<CShader> mShaderRect;
+   std::shared_ptr<CShader> mShaderLine;
+   std::shared_ptr<CShader> mShaderTile;
+   unsigned int             mFramebuffer;
+   unsigned int             mColorBuffer;
+   int                      mTargetWidth;
+   int                      mTargetHeight;
+};
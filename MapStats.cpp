@@ -0,0 +1,93 @@
+#include <algorithm>
+#include "MapStats.h"
+
+CMapStats::CMapStats()
+{
+   for (int i = 0; i < (int)StartupEvent::NUM_EVENTS; i++)
+      mStartupUs[i].store(0, std::memory_order_relaxed);
+
+   Reset();
+}
+
+const char* CMapStats::GetAllocPassName(AllocPass Pass)
+{
+   switch (Pass)
+   {
+      case AllocPass::DRAW:     return "Draw";
+      case AllocPass::COVERAGE: return "Coverage";
+      default:                  return "Unknown";
+   }
+}
+
+double CMapStats::GetHitRate(CacheTier Tier) const
+{
+   uint64_t hits = GetHits(Tier);
+   uint64_t total = hits + GetMisses(Tier);
+
+   if (total == 0) return 0.0;
+
+   return (double)hits / (double)total;
+}
+
+const char* CMapStats::GetStageName(TileStage Stage)
+{
+   switch (Stage)
+   {
+      case TileStage::COVERAGE: return "Coverage";
+      case TileStage::DISK:     return "Disk";
+      case TileStage::NETWORK:  return "Network";
+      case TileStage::DECODE:   return "Decode";
+      case TileStage::UPLOAD:   return "Upload";
+      case TileStage::DRAW:     return "Draw";
+      default:                  return "Unknown";
+   }
+}
+
+const char* CMapStats::GetStartupEventName(StartupEvent Event)
+{
+   switch (Event)
+   {
+      case StartupEvent::OPEN:          return "Open";
+      case StartupEvent::FIRST_TILES:   return "First tiles";
+      case StartupEvent::SERVER_ONLINE: return "Server online";
+      default:                          return "Unknown";
+   }
+}
+
+const char* CMapStats::GetTierName(CacheTier Tier)
+{
+   switch (Tier)
+   {
+      case CacheTier::MEMORY: return "Memory";
+      case CacheTier::DISK:   return "Disk";
+      case CacheTier::WMTS:   return "WMTS";
+      default:                return "Unknown";
+   }
+}
+
+void CMapStats::RecordStartup(StartupEvent Event, uint64_t Us)
+{
+   uint64_t expected = 0;
+
+   // an event under a microsecond still counts as recorded
+   mStartupUs[(int)Event].compare_exchange_strong(expected, std::max<uint64_t>(Us, 1), std::memory_order_relaxed);
+}
+
+void CMapStats::Reset()
+{
+   for (int i = 0; i < (int)TileStage::NUM_STAGES; i++)
+      mLatency[i].Reset();
+
+   for (int i = 0; i < (int)AllocPass::NUM_PASSES; i++)
+      mAllocations[i].Reset();
+
+   for (int i = 0; i < (int)CacheTier::NUM_TIERS; i++)
+   {
+      mHits[i].store(0, std::memory_order_relaxed);
+      mMisses[i].store(0, std::memory_order_relaxed);
+   }
+
+   mBytesFetched.store(0, std::memory_order_relaxed);
+   mBytesRead.store(0, std::memory_order_relaxed);
+   mZoomChanges.store(0, std::memory_order_relaxed);
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include "HeapCounter.h"
+#include "Histogram.h"
+
+// Pipeline stages timed for every tile, latencies are in microseconds
+enum class TileStage
+{
+   COVERAGE, // one pass of the coverage thread
+   DISK,     // disk cache lookup and read
+   NETWORK,  // WMTS request
+   DECODE,   // png decode
+   UPLOAD,   // texture upload, cpu side
+   DRAW,     // COpenStreetMap::Draw, cpu side
+   NUM_STAGES
+};
+
+// Places a tile can be found, from cheapest to most expensive
+enum class CacheTier
+{
+   MEMORY,
+   DISK,
+   WMTS,
+   NUM_TIERS
+};
+
+// Points in opening a map, timed once from the start of Open
+enum class StartupEvent
+{
+   OPEN,          // Open returned
+   FIRST_TILES,   // the coverage thread first put tiles with map data up
+   SERVER_ONLINE, // the tile server answered its first probe
+   NUM_EVENTS
+};
+
+// Passes whose heap allocations are counted, per pass
+enum class AllocPass
+{
+   DRAW,     // COpenStreetMap::Draw, one frame
+   COVERAGE, // one pass of the coverage thread
+   NUM_PASSES
+};
+
+class CMapStats
+{
+public:
+   CMapStats();
+
+   void AddBytesFetched(uint64_t Bytes) { mBytesFetched.fetch_add(Bytes, std::memory_order_relaxed); }
+   void AddBytesRead(uint64_t Bytes) { mBytesRead.fetch_add(Bytes, std::memory_order_relaxed); }
+
+   void AddZoomChange() { mZoomChanges.fetch_add(1, std::memory_order_relaxed); }
+
+   static const char* GetAllocPassName(AllocPass Pass);
+
+   // heap allocations per pass, the count is the passes
+   CLatencyHistogram& GetAllocations(AllocPass Pass) { return mAllocations[(int)Pass]; }
+   const CLatencyHistogram& GetAllocations(AllocPass Pass) const { return mAllocations[(int)Pass]; }
+
+   uint64_t GetBytesFetched() const { return mBytesFetched.load(std::memory_order_relaxed); }
+   uint64_t GetBytesRead() const { return mBytesRead.load(std::memory_order_relaxed); }
+
+   double GetHitRate(CacheTier Tier) const;
+
+   uint64_t GetHits(CacheTier Tier) const { return mHits[(int)Tier].load(std::memory_order_relaxed); }
+
+   CLatencyHistogram& GetLatency(TileStage Stage) { return mLatency[(int)Stage]; }
+   const CLatencyHistogram& GetLatency(TileStage Stage) const { return mLatency[(int)Stage]; }
+
+   uint64_t GetMisses(CacheTier Tier) const { return mMisses[(int)Tier].load(std::memory_order_relaxed); }
+
+   static const char* GetStageName(TileStage Stage);
+
+   static const char* GetStartupEventName(StartupEvent Event);
+
+   // 0 until the event happened
+   uint64_t GetStartupUs(StartupEvent Event) const { return mStartupUs[(int)Event].load(std::memory_order_relaxed); }
+
+   static const char* GetTierName(CacheTier Tier);
+
+   uint64_t GetZoomChanges() const { return mZoomChanges.load(std::memory_order_relaxed); }
+
+   void RecordHit(CacheTier Tier) { mHits[(int)Tier].fetch_add(1, std::memory_order_relaxed); }
+   void RecordMiss(CacheTier Tier) { mMisses[(int)Tier].fetch_add(1, std::memory_order_relaxed); }
+
+   // only the first time an event is recorded counts
+   void RecordStartup(StartupEvent Event, uint64_t Us);
+
+   // the startup times are kept, they only happen once
+   void Reset();
+
+private:
+
+   CLatencyHistogram     mLatency[(int)TileStage::NUM_STAGES];
+   CLatencyHistogram     mAllocations[(int)AllocPass::NUM_PASSES];
+   std::atomic<uint64_t> mHits[(int)CacheTier::NUM_TIERS];
+   std::atomic<uint64_t> mMisses[(int)CacheTier::NUM_TIERS];
+   std::atomic<uint64_t> mBytesFetched;
+   std::atomic<uint64_t> mBytesRead;
+   std::atomic<uint64_t> mZoomChanges;
+   std::atomic<uint64_t> mStartupUs[(int)StartupEvent::NUM_EVENTS];
+};
+
+// Records the heap allocations the thread made from construction to
+// destruction into a pass histogram
+class CAllocCounter
+{
+public:
+   explicit CAllocCounter(CLatencyHistogram& Histogram)
+      : mHistogram(Histogram),
+        mStart(GetThreadAllocations())
+   {
+   }
+
+   ~CAllocCounter()
+   {
+      mHistogram.Record(GetThreadAllocations() - mStart);
+   }
+
+private:
+   CLatencyHistogram& mHistogram;
+   uint64_t           mStart;
+};
+
+// Records the time from construction to destruction into a stage histogram
+class CStageTimer
+{
+public:
+   explicit CStageTimer(CLatencyHistogram& Histogram)
+      : mHistogram(Histogram),
+        mStart(std::chrono::steady_clock::now())
+   {
+   }
+
+   ~CStageTimer()
+   {
+      mHistogram.Record(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - mStart).count());
+   }
+
+private:
+   CLatencyHistogram&                    mHistogram;
+   std::chrono::steady_clock::time_point mStart;
+};
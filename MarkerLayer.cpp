@@ -0,0 +1,561 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <glad/glad.h>
+#include "MarkerLayer.h"
+#include "GlDebug.h"
+#include "Mercator.h"
+#include "ExecApi.h"
+#include "Trace.h"
+
+static uint32_t PackColor(const glm::vec4& Color)
+{
+   glm::vec4 clamped = glm::clamp(Color, 0.0f, 1.0f) * 255.0f + 0.5f;
+
+   return (uint32_t)clamped.r | ((uint32_t)clamped.g << 8) | ((uint32_t)clamped.b << 16) | ((uint32_t)clamped.a << 24);
+}
+
+static uint32_t FloatBits(float Value)
+{
+   uint32_t bits;
+
+   memcpy(&bits, &Value, sizeof(bits));
+   return bits;
+}
+
+CMarkerLayer::CMarkerLayer()
+   : mStats{},
+     mMaxSizePix(0.0f),
+     mVAO(0),
+     mMarkerBuffer(0),
+     mMarkerTexture(0),
+     mVisibleBuffer(0),
+     mMarkerCapacity(0),
+     mVisibleCapacity(0)
+{
+   Clear();
+}
+
+CMarkerLayer::~CMarkerLayer()
+{
+   Close();
+}
+
+int CMarkerLayer::Add(double Latitude, double Longitude, const glm::vec4& Color, float SizePix)
+{
+   TMarker marker;
+
+   CMercator::Project(&Latitude, &Longitude, &marker.X, &marker.Y, 1, 1.0);
+
+   marker.Color   = PackColor(Color);
+   marker.SizePix = std::max(SizePix, 1.0f);
+   marker.Id      = (int)mIndex.size();
+   marker.Node    = -1;
+   marker.Item    = 0;
+
+   mMarkers.push_back(marker);
+   mDirtyFlags.push_back(0);
+   mIndex.push_back((int)(mMarkers.size() - 1));
+   mMaxSizePix = std::max(mMaxSizePix, marker.SizePix);
+
+   Insert((uint32_t)(mMarkers.size() - 1));
+   MarkDirty((uint32_t)(mMarkers.size() - 1));
+
+   return marker.Id;
+}
+
+void CMarkerLayer::Clear()
+{
+   TNode root;
+
+   root.MinX     = 0.0;
+   root.MinY     = 0.0;
+   root.Size     = 1.0;
+   root.Depth    = 0;
+   std::fill(root.Children, root.Children + 4, -1);
+
+   mMarkers.clear();
+   mIndex.clear();
+   mDirty.clear();
+   mDirtyFlags.clear();
+   mNodes.clear();
+   mNodes.push_back(root);
+   mMaxSizePix = 0.0f;
+}
+
+void CMarkerLayer::Close()
+{
+   if (mVAO)
+   {
+      GLCALL(glDeleteTextures(1, &mMarkerTexture));
+      GLCALL(glDeleteBuffers(1, &mMarkerBuffer));
+      GLCALL(glDeleteBuffers(1, &mVisibleBuffer));
+      GLCALL(glDeleteVertexArrays(1, &mVAO));
+      mVAO = 0;
+   }
+
+   mMarkerCapacity  = 0;
+   mVisibleCapacity = 0;
+   mShader          = nullptr;
+
+   // everything has to go up again if the layer is opened again
+   mDirty.clear();
+   std::fill(mDirtyFlags.begin(), mDirtyFlags.end(), 0);
+}
+
+void CMarkerLayer::Draw(const TMapView& View, const glm::mat4& Projection)
+{
+   if (!mShader)
+      return;
+
+   TRACE_SCOPE("MarkerDraw", "render");
+
+   Upload();
+
+   mStats.Markers = mMarkers.size();
+   mStats.Nodes   = mNodes.size();
+   mStats.Visible = 0;
+
+   if (mMarkers.empty())
+      return;
+
+   double min_x, min_y, max_x, max_y;
+   bool   all_visible;
+   auto   query_start = std::chrono::steady_clock::now();
+
+   GetVisibleWorldRect(View, mMaxSizePix, min_x, min_y, max_x, max_y);
+
+   // zoomed out over the whole world the instance is the marker, no list needed
+   all_visible = min_x <= 0.0 && min_y <= 0.0 && max_x >= 1.0 && max_y >= 1.0;
+
+   if (!all_visible)
+   {
+      QueryMarkers(min_x, min_y, max_x, max_y, mVisible);
+
+      if (!mVisible.empty())
+      {
+         GLCALL(glBindBuffer(GL_ARRAY_BUFFER, mVisibleBuffer));
+
+         if (mVisible.size() > mVisibleCapacity)
+         {
+            mVisibleCapacity = mVisible.size() * 2;
+            GLCALL(glBufferData(GL_ARRAY_BUFFER, mVisibleCapacity * sizeof(uint32_t), nullptr, GL_STREAM_DRAW));
+         }
+
+         GLCALL(glBufferSubData(GL_ARRAY_BUFFER, 0, mVisible.size() * sizeof(uint32_t), mVisible.data()));
+         GLCALL(glBindBuffer(GL_ARRAY_BUFFER, 0));
+
+         mStats.UploadedBytes += mVisible.size() * sizeof(uint32_t);
+         mStats.UploadCalls++;
+      }
+   }
+
+   mStats.QueryMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - query_start).count();
+   mStats.Visible = all_visible ? mMarkers.size() : mVisible.size();
+
+   if (mStats.Visible == 0)
+      return;
+
+   float center_x = (float)View.CenterX;
+   float center_y = (float)View.CenterY;
+
+   mShader->Use();
+   mShader->SetUniform("transform", GetScreenTransform(View, Projection));
+   mShader->SetUniform("uCenter", glm::vec4(center_x, center_y,
+                                            (float)(View.CenterX - (double)center_x),
+                                            (float)(View.CenterY - (double)center_y)));
+   mShader->SetUniform("uPixelsPerWorld", glm::vec2((float)View.PixelsPerWorldX, (float)View.PixelsPerWorldY));
+   mShader->SetUniform("uMarkers", 0);
+   mShader->SetUniform("uAllVisible", all_visible ? 1 : 0);
+
+   GLCALL(glActiveTexture(GL_TEXTURE0));
+   GLCALL(glBindTexture(GL_TEXTURE_BUFFER, mMarkerTexture));
+   GLCALL(glBindVertexArray(mVAO));
+
+   // with the list disabled every instance reads the generic value and the
+   // shader uses the instance number instead
+   if (all_visible)
+   {
+      GLCALL(glDisableVertexAttribArray(0));
+   }
+   else
+   {
+      GLCALL(glEnableVertexAttribArray(0));
+   }
+
+   GLCALL(glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (GLsizei)mStats.Visible));
+
+   GLCALL(glBindVertexArray(0));
+   GLCALL(glBindTexture(GL_TEXTURE_BUFFER, 0));
+}
+
+int CMarkerLayer::Find(int Id) const
+{
+   return (Id >= 0 && Id < (int)mIndex.size()) ? mIndex[Id] : -1;
+}
+
+void CMarkerLayer::Insert(uint32_t Marker)
+{
+   TMarker& marker = mMarkers[Marker];
+   double   x = std::min(std::max(marker.X, 0.0), std::nextafter(1.0, 0.0));
+   double   y = std::min(std::max(marker.Y, 0.0), std::nextafter(1.0, 0.0));
+   int      node = 0;
+
+   while (true)
+   {
+      if (mNodes[node].Children[0] < 0)
+      {
+         if (mNodes[node].Items.size() < MARKER_LEAF_CAPACITY || mNodes[node].Depth >= MARKER_MAX_DEPTH)
+            break;
+
+         Split(node);
+      }
+
+      double half = mNodes[node].Size * 0.5;
+      int    quadrant = (x >= mNodes[node].MinX + half ? 1 : 0) + (y >= mNodes[node].MinY + half ? 2 : 0);
+
+      node = mNodes[node].Children[quadrant];
+   }
+
+   marker.Node = node;
+   marker.Item = (uint32_t)mNodes[node].Items.size();
+   mNodes[node].Items.push_back(Marker);
+}
+
+void CMarkerLayer::MarkDirty(uint32_t Marker)
+{
+   if (!mDirtyFlags[Marker])
+   {
+      mDirtyFlags[Marker] = 1;
+      mDirty.push_back(Marker);
+   }
+}
+
+bool CMarkerLayer::Move(int Id, double Latitude, double Longitude)
+{
+   if (Find(Id) < 0)
+      return false;
+
+   Move(&Id, &Latitude, &Longitude, 1);
+
+   return true;
+}
+
+void CMarkerLayer::Move(const int* Ids, const double* Latitude, const double* Longitude, size_t Count)
+{
+   std::vector<double> x(Count);
+   std::vector<double> y(Count);
+
+   CMercator::Project(Latitude, Longitude, x.data(), y.data(), Count, 1.0);
+
+   for (size_t i = 0; i < Count; i++)
+   {
+      int index = Find(Ids[i]);
+
+      if (index < 0)
+         continue;
+
+      TMarker&     marker = mMarkers[index];
+      const TNode& leaf = mNodes[marker.Node];
+
+      marker.X = x[i];
+      marker.Y = y[i];
+
+      // most moves are small and stay in the same leaf
+      if (x[i] < leaf.MinX || x[i] >= leaf.MinX + leaf.Size || y[i] < leaf.MinY || y[i] >= leaf.MinY + leaf.Size)
+      {
+         Unlink(index);
+         Insert(index);
+      }
+
+      MarkDirty(index);
+   }
+}
+
+bool CMarkerLayer::Open(std::shared_ptr<CShader> Shader)
+{
+   if (!Shader)
+   {
+      ExecApiLogWarning("MarkerLayer: no shader");
+      return false;
+   }
+
+   mShader = Shader;
+
+   if (!mVAO)
+   {
+      GLCALL(glGenVertexArrays(1, &mVAO));
+      GLCALL(glGenBuffers(1, &mMarkerBuffer));
+      GLCALL(glGenBuffers(1, &mVisibleBuffer));
+      GLCALL(glGenTextures(1, &mMarkerTexture));
+
+      // one visible marker index per instance
+      GLCALL(glBindVertexArray(mVAO));
+      GLCALL(glBindBuffer(GL_ARRAY_BUFFER, mVisibleBuffer));
+      GLCALL(glVertexAttribIPointer(0, 1, GL_UNSIGNED_INT, sizeof(uint32_t), (void*)0));
+      GLCALL(glVertexAttribDivisor(0, 1));
+      GLCALL(glBindVertexArray(0));
+      GLCALL(glBindBuffer(GL_ARRAY_BUFFER, 0));
+   }
+
+   // the buffer is created on the next Draw with every marker in it
+   for (uint32_t i = 0; i < mMarkers.size(); i++)
+      MarkDirty(i);
+
+   return true;
+}
+
+int CMarkerLayer::Pick(const TMapView& View, double X, double Y) const
+{
+   std::vector<uint32_t> candidates;
+   double                world_x, world_y;
+   double                radius_x = (mMaxSizePix * 0.5) / View.PixelsPerWorldX;
+   double                radius_y = (mMaxSizePix * 0.5) / View.PixelsPerWorldY;
+   double                best = 0.0;
+   int                   id = -1;
+
+   GetWorldPosition(View, X, Y, world_x, world_y);
+   QueryMarkers(world_x - radius_x, world_y - radius_y, world_x + radius_x, world_y + radius_y, candidates);
+
+   for (uint32_t index : candidates)
+   {
+      const TMarker& marker = mMarkers[index];
+      double         dx = (marker.X - world_x) * View.PixelsPerWorldX;
+      double         dy = (marker.Y - world_y) * View.PixelsPerWorldY;
+      double         distance2 = dx * dx + dy * dy;
+      double         radius = marker.SizePix * 0.5;
+
+      if (distance2 <= radius * radius && (id < 0 || distance2 < best))
+      {
+         best = distance2;
+         id = marker.Id;
+      }
+   }
+
+   return id;
+}
+
+void CMarkerLayer::Query(double MinX, double MinY, double MaxX, double MaxY, std::vector<int>& Ids) const
+{
+   std::vector<uint32_t> markers;
+
+   QueryMarkers(MinX, MinY, MaxX, MaxY, markers);
+
+   Ids.clear();
+
+   for (uint32_t index : markers)
+      Ids.push_back(mMarkers[index].Id);
+}
+
+void CMarkerLayer::QueryMarkers(double MinX, double MinY, double MaxX, double MaxY, std::vector<uint32_t>& Markers) const
+{
+   int stack[MARKER_MAX_DEPTH * 3 + 4];
+   int depth = 0;
+
+   Markers.clear();
+   stack[depth++] = 0;
+
+   while (depth > 0)
+   {
+      const TNode& node = mNodes[stack[--depth]];
+
+      if (node.MinX > MaxX || node.MinY > MaxY || node.MinX + node.Size < MinX || node.MinY + node.Size < MinY)
+         continue;
+
+      if (node.Children[0] >= 0)
+      {
+         for (int i = 0; i < 4; i++)
+            stack[depth++] = node.Children[i];
+
+         continue;
+      }
+
+      // leaves inside the rectangle need no per marker test
+      bool inside = node.MinX >= MinX && node.MinY >= MinY &&
+                    node.MinX + node.Size <= MaxX && node.MinY + node.Size <= MaxY;
+
+      for (uint32_t index : node.Items)
+      {
+         const TMarker& marker = mMarkers[index];
+
+         if (inside || (marker.X >= MinX && marker.X <= MaxX && marker.Y >= MinY && marker.Y <= MaxY))
+            Markers.push_back(index);
+      }
+   }
+}
+
+bool CMarkerLayer::Remove(int Id)
+{
+   int index = Find(Id);
+
+   if (index < 0)
+      return false;
+
+   uint32_t last = (uint32_t)(mMarkers.size() - 1);
+
+   Unlink(index);
+   mIndex[Id] = -1;
+
+   // the last marker fills the hole to keep the instances dense
+   if ((uint32_t)index != last)
+   {
+      mMarkers[index] = mMarkers[last];
+      mNodes[mMarkers[index].Node].Items[mMarkers[index].Item] = index;
+      mIndex[mMarkers[index].Id] = index;
+      MarkDirty(index);
+   }
+
+   mMarkers.pop_back();
+
+   // a pending upload of the old last slot is out of range now
+   if (mDirtyFlags[last])
+      mDirty.erase(std::find(mDirty.begin(), mDirty.end(), last));
+
+   mDirtyFlags.pop_back();
+
+   return true;
+}
+
+bool CMarkerLayer::SetColor(int Id, const glm::vec4& Color)
+{
+   int index = Find(Id);
+
+   if (index < 0)
+      return false;
+
+   mMarkers[index].Color = PackColor(Color);
+   MarkDirty(index);
+
+   return true;
+}
+
+void CMarkerLayer::Split(int Node)
+{
+   double half = mNodes[Node].Size * 0.5;
+   int    first = (int)mNodes.size();
+
+   for (int i = 0; i < 4; i++)
+   {
+      TNode child;
+
+      child.MinX  = mNodes[Node].MinX + ((i & 1) ? half : 0.0);
+      child.MinY  = mNodes[Node].MinY + ((i & 2) ? half : 0.0);
+      child.Size  = half;
+      child.Depth = mNodes[Node].Depth + 1;
+      std::fill(child.Children, child.Children + 4, -1);
+
+      mNodes.push_back(child);
+      mNodes[Node].Children[i] = first + i;
+   }
+
+   // the items move down a level, their children split later if needed
+   std::vector<uint32_t> items;
+
+   items.swap(mNodes[Node].Items);
+
+   for (uint32_t index : items)
+   {
+      TMarker& marker = mMarkers[index];
+      double   x = std::min(std::max(marker.X, 0.0), std::nextafter(1.0, 0.0));
+      double   y = std::min(std::max(marker.Y, 0.0), std::nextafter(1.0, 0.0));
+      int      child = first + (x >= mNodes[Node].MinX + half ? 1 : 0) + (y >= mNodes[Node].MinY + half ? 2 : 0);
+
+      marker.Node = child;
+      marker.Item = (uint32_t)mNodes[child].Items.size();
+      mNodes[child].Items.push_back(index);
+   }
+}
+
+void CMarkerLayer::Unlink(uint32_t Marker)
+{
+   TNode&   leaf = mNodes[mMarkers[Marker].Node];
+   uint32_t item = mMarkers[Marker].Item;
+   uint32_t last = leaf.Items.back();
+
+   leaf.Items[item] = last;
+   mMarkers[last].Item = item;
+   leaf.Items.pop_back();
+}
+
+void CMarkerLayer::Upload()
+{
+   size_t   count = mMarkers.size();
+   uint64_t bytes = 0;
+   uint64_t calls = 0;
+
+   mInstances.resize(count * 8);
+
+   // world position as float hi and lo bits, then color and size
+   for (uint32_t index : mDirty)
+   {
+      const TMarker& marker = mMarkers[index];
+      uint32_t*      instance = &mInstances[index * 8];
+      float          x = (float)marker.X;
+      float          y = (float)marker.Y;
+
+      instance[0] = FloatBits(x);
+      instance[1] = FloatBits(y);
+      instance[2] = FloatBits((float)(marker.X - (double)x));
+      instance[3] = FloatBits((float)(marker.Y - (double)y));
+      instance[4] = marker.Color;
+      instance[5] = FloatBits(marker.SizePix);
+      instance[6] = 0;
+      instance[7] = 0;
+
+      mDirtyFlags[index] = 0;
+   }
+
+   if (!mDirty.empty() && mVAO)
+   {
+      TRACE_SCOPE("MarkerUpload", "texture");
+
+      GLCALL(glBindBuffer(GL_TEXTURE_BUFFER, mMarkerBuffer));
+
+      if (count > mMarkerCapacity)
+      {
+         // the texture buffer is attached again after the storage changes
+         mMarkerCapacity = std::max((size_t)1024, count * 2);
+         GLCALL(glBufferData(GL_TEXTURE_BUFFER, mMarkerCapacity * 8 * sizeof(uint32_t), nullptr, GL_DYNAMIC_DRAW));
+         GLCALL(glBindTexture(GL_TEXTURE_BUFFER, mMarkerTexture));
+         GLCALL(glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32UI, mMarkerBuffer));
+         GLCALL(glBindTexture(GL_TEXTURE_BUFFER, 0));
+
+         GLCALL(glBufferSubData(GL_TEXTURE_BUFFER, 0, count * 8 * sizeof(uint32_t), mInstances.data()));
+         bytes = count * 8 * sizeof(uint32_t);
+         calls = 1;
+      }
+      else if (mDirty.size() > MARKER_FULL_UPLOAD * count)
+      {
+         // scattered changes over much of the buffer go up in one copy
+         GLCALL(glBufferSubData(GL_TEXTURE_BUFFER, 0, count * 8 * sizeof(uint32_t), mInstances.data()));
+         bytes = count * 8 * sizeof(uint32_t);
+         calls = 1;
+      }
+      else
+      {
+         // runs of neighbouring markers, one copy each
+         std::sort(mDirty.begin(), mDirty.end());
+
+         for (size_t i = 0; i < mDirty.size();)
+         {
+            size_t run = 1;
+
+            while (i + run < mDirty.size() && mDirty[i + run] == mDirty[i] + run)
+               run++;
+
+            GLCALL(glBufferSubData(GL_TEXTURE_BUFFER, (size_t)mDirty[i] * 8 * sizeof(uint32_t),
+                                   run * 8 * sizeof(uint32_t), &mInstances[(size_t)mDirty[i] * 8]));
+            bytes += run * 8 * sizeof(uint32_t);
+            calls++;
+            i += run;
+         }
+      }
+
+      GLCALL(glBindBuffer(GL_TEXTURE_BUFFER, 0));
+   }
+
+   mDirty.clear();
+   mStats.UploadedBytes = bytes;
+   mStats.UploadCalls   = calls;
+}
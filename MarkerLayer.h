@@ -0,0 +1,123 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <glm/glm.hpp>
+#include "MapLayer.h"
+#include "Shader.h"
+
+#define MARKER_LEAF_CAPACITY 32    // markers in a quadtree leaf before it splits
+#define MARKER_MAX_DEPTH     24    // leaves stop splitting at about 2 m
+#define MARKER_FULL_UPLOAD   0.25  // share of changed markers past which the whole buffer is sent
+
+struct TMarkerStats
+{
+   uint64_t Markers;
+   uint64_t Nodes;
+   uint64_t Visible;        // the rest are from the last Draw
+   uint64_t UploadedBytes;
+   uint64_t UploadCalls;
+   double   QueryMs;
+};
+
+// Many small moving markers over the map, vehicles, aircraft and the like.
+//
+// Markers live in a quadtree over normalized mercator for viewport queries
+// and picking, and in a dense array mirrored to a texture buffer. Draw
+// sends only the markers changed since the last frame, finds the visible
+// ones in the quadtree and draws them with one instanced call, each a
+// circle of its own color and size. Render thread only.
+class CMarkerLayer : public CMapLayer
+{
+public:
+   CMarkerLayer();
+   ~CMarkerLayer();
+
+   // returns the id for the other calls
+   int Add(double Latitude, double Longitude, const glm::vec4& Color, float SizePix);
+
+   // ids start over from 0
+   void Clear();
+
+   // deletes the gpu buffers
+   void Close();
+
+   void Draw(const TMapView& View, const glm::mat4& Projection) override;
+
+   TMarkerStats GetStats() const { return mStats; }
+
+   bool Move(int Id, double Latitude, double Longitude);
+
+   // projects the whole batch at once, unknown ids are skipped
+   void Move(const int* Ids, const double* Latitude, const double* Longitude, size_t Count);
+
+   bool Open(std::shared_ptr<CShader> Shader);
+
+   // the marker under a point in map projection pixels closest to its
+   // center, or -1
+   int Pick(const TMapView& View, double X, double Y) const;
+
+   // ids of the markers inside a world rectangle
+   void Query(double MinX, double MinY, double MaxX, double MaxY, std::vector<int>& Ids) const;
+
+   bool Remove(int Id);
+
+   bool SetColor(int Id, const glm::vec4& Color);
+
+private:
+
+   struct TMarker
+   {
+      double   X;       // world
+      double   Y;
+      uint32_t Color;   // rgba8
+      float    SizePix;
+      int      Id;
+      int      Node;    // leaf and position in its items
+      uint32_t Item;
+   };
+
+   struct TNode
+   {
+      double                MinX;
+      double                MinY;
+      double                Size;
+      int                   Children[4];   // -1 for leaves
+      int                   Depth;
+      std::vector<uint32_t> Items;         // markers, leaves only
+   };
+
+   // marker of an id, or -1
+   int Find(int Id) const;
+
+   void Insert(uint32_t Marker);
+
+   void MarkDirty(uint32_t Marker);
+
+   // markers inside the rectangle, in no particular order
+   void QueryMarkers(double MinX, double MinY, double MaxX, double MaxY, std::vector<uint32_t>& Markers) const;
+
+   void Split(int Node);
+
+   void Unlink(uint32_t Marker);
+
+   void Upload();
+
+   std::vector<TMarker>              mMarkers;     // dense, in instance order
+   std::vector<TNode>                mNodes;       // 0 is the root and covers the world
+   std::vector<int>                  mIndex;       // id to marker, -1 once removed
+   std::vector<uint32_t>             mDirty;
+   std::vector<uint8_t>              mDirtyFlags;
+   std::vector<uint32_t>             mInstances;   // gpu copy, 8 words per marker
+   std::vector<uint32_t>             mVisible;
+   std::shared_ptr<CShader>          mShader;
+   TMarkerStats                      mStats;
+   float                             mMaxSizePix;
+   unsigned int                      mVAO;
+   unsigned int                      mMarkerBuffer;
+   unsigned int                      mMarkerTexture;
+   unsigned int                      mVisibleBuffer;
+   size_t                            mMarkerCapacity;
+   size_t                            mVisibleCapacity;
+};
@@ -0,0 +1,394 @@
+#include <math.h>
+#include <mutex>
+#include <vector>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "Mercator.h"
+#include "OpenStreetMap.h"
+
+static const double DEGREES_TO_RADIANS = M_PI / 180.0;
+static const double RADIANS_TO_DEGREES = 180.0 / M_PI;
+
+double CMercator::GetPixelScale(int Zoom)
+{
+   return (double)(OSM_TILE_SIZE << Zoom);
+}
+
+double CMercator::GetTileEdgeLatitude(int Y, int Zoom)
+{
+   const double* table = GetTileEdgeLatitudes(Zoom);
+
+   if (table && Y >= 0 && Y <= (1 << Zoom))
+      return table[Y];
+
+   double n = M_PI - 2.0 * M_PI * (double)Y / (double)(1 << Zoom);
+   return atan(0.5 * (exp(n) - exp(-n))) * RADIANS_TO_DEGREES;
+}
+
+const double* CMercator::GetTileEdgeLatitudes(int Zoom)
+{
+   static std::once_flag      built[MERCATOR_TABLE_MAX_ZOOM + 1];
+   static std::vector<double> tables[MERCATOR_TABLE_MAX_ZOOM + 1];
+
+   if (Zoom < 0 || Zoom > MERCATOR_TABLE_MAX_ZOOM)
+      return nullptr;
+
+   // the same expression as the computed case, so a lookup never changes
+   // a result
+   std::call_once(built[Zoom], [Zoom]()
+   {
+      int rows = 1 << Zoom;
+
+      tables[Zoom].resize(rows + 1);
+
+      for (int y = 0; y <= rows; y++)
+      {
+         double n = M_PI - 2.0 * M_PI * (double)y / (double)rows;
+         tables[Zoom][y] = atan(0.5 * (exp(n) - exp(-n))) * RADIANS_TO_DEGREES;
+      }
+   });
+
+   return tables[Zoom].data();
+}
+
+void CMercator::ProjectScalar(const double* Latitude,
+                              const double* Longitude,
+                              double*       X,
+                              double*       Y,
+                              size_t        Count,
+                              double        Scale)
+{
+   // GetTileX and GetTileY before the floor
+   for (size_t i = 0; i < Count; i++)
+   {
+      X[i] = (Longitude[i] + 180.0) / 360.0 * Scale;
+      Y[i] = (1.0 - asinh(tan(Latitude[i] * DEGREES_TO_RADIANS)) / M_PI) / 2.0 * Scale;
+   }
+}
+
+void CMercator::UnprojectScalar(const double* X,
+                                const double* Y,
+                                double*       Latitude,
+                                double*       Longitude,
+                                size_t        Count,
+                                double        Scale)
+{
+   // GetLongitudeFromTileX and GetLatitudeFromTileY with fractional tiles
+   for (size_t i = 0; i < Count; i++)
+   {
+      double n = M_PI - 2.0 * M_PI * Y[i] / Scale;
+
+      Longitude[i] = X[i] / Scale * 360.0 - 180.0;
+      Latitude[i] = atan(0.5 * (exp(n) - exp(-n))) * RADIANS_TO_DEGREES;
+   }
+}
+
+#ifdef __SSE2__
+
+// Two lanes of double precision at a time. The polynomials are the cephes
+// ones, accurate to a few ulp over the reduced ranges used here.
+
+static inline __m128d Select(__m128d Mask, __m128d IfTrue, __m128d IfFalse)
+{
+   return _mm_or_pd(_mm_and_pd(Mask, IfTrue), _mm_andnot_pd(Mask, IfFalse));
+}
+
+static inline __m128d Polynomial(__m128d X, const double* Coefficients, int Degree)
+{
+   __m128d result = _mm_set1_pd(Coefficients[0]);
+
+   for (int i = 1; i <= Degree; i++)
+      result = _mm_add_pd(_mm_mul_pd(result, X), _mm_set1_pd(Coefficients[i]));
+
+   return result;
+}
+
+// leading coefficient of 1
+static inline __m128d Polynomial1(__m128d X, const double* Coefficients, int Degree)
+{
+   __m128d result = _mm_add_pd(X, _mm_set1_pd(Coefficients[0]));
+
+   for (int i = 1; i < Degree; i++)
+      result = _mm_add_pd(_mm_mul_pd(result, X), _mm_set1_pd(Coefficients[i]));
+
+   return result;
+}
+
+// sine and cosine of |X| <= pi/4
+static inline void SinCosPi4(__m128d X, __m128d& Sin, __m128d& Cos)
+{
+   static const double sin_coefficients[] =
+   {
+       1.58962301576546568060E-10,
+      -2.50507477628578072866E-8,
+       2.75573136213857245213E-6,
+      -1.98412698295895385996E-4,
+       8.33333333332211858878E-3,
+      -1.66666666666666307295E-1
+   };
+   static const double cos_coefficients[] =
+   {
+      -1.13585365213876817300E-11,
+       2.08757008419747316778E-9,
+      -2.75573141792967388112E-7,
+       2.48015872888517045348E-5,
+      -1.38888888888730564116E-3,
+       4.16666666666665929218E-2
+   };
+
+   __m128d z = _mm_mul_pd(X, X);
+
+   Sin = _mm_add_pd(X, _mm_mul_pd(_mm_mul_pd(X, z), Polynomial(z, sin_coefficients, 5)));
+   Cos = _mm_add_pd(_mm_sub_pd(_mm_set1_pd(1.0), _mm_mul_pd(_mm_set1_pd(0.5), z)),
+                    _mm_mul_pd(_mm_mul_pd(z, z), Polynomial(z, cos_coefficients, 5)));
+}
+
+// natural log of positive normal numbers
+static inline __m128d Log(__m128d X)
+{
+   static const double p[] =
+   {
+      1.01875663804580931796E-4,
+      4.97494994976747001425E-1,
+      4.70579119878881725854E0,
+      1.44989225341610930846E1,
+      1.79368678507819816313E1,
+      7.70838733755885391666E0
+   };
+   static const double q[] =
+   {
+      1.12873587189167450590E1,
+      4.52279145837532221105E1,
+      8.29875266912776603211E1,
+      7.11544750618563894466E1,
+      2.31251620126765340583E1
+   };
+
+   const __m128i exponent_mask = _mm_set1_epi64x(0x7ff);
+   const __m128i mantissa_mask = _mm_set1_epi64x(0x000fffffffffffffll);
+   const __m128d magic = _mm_set1_pd(4503599627370496.0); // 2^52
+
+   // X = m * 2^e with m in [0.5, 1)
+   __m128i bits = _mm_castpd_si128(X);
+   __m128i biased = _mm_and_si128(_mm_srli_epi64(bits, 52), exponent_mask);
+   __m128d e = _mm_sub_pd(_mm_castsi128_pd(_mm_or_si128(biased, _mm_castpd_si128(magic))), magic);
+   __m128d m = _mm_castsi128_pd(_mm_or_si128(_mm_and_si128(bits, mantissa_mask), _mm_castpd_si128(_mm_set1_pd(0.5))));
+
+   e = _mm_sub_pd(e, _mm_set1_pd(1022.0));
+
+   // keep m near 1, in [sqrt(0.5), sqrt(2))
+   __m128d small = _mm_cmplt_pd(m, _mm_set1_pd(0.70710678118654752440));
+
+   e = _mm_sub_pd(e, _mm_and_pd(small, _mm_set1_pd(1.0)));
+   m = _mm_sub_pd(_mm_add_pd(m, _mm_and_pd(small, m)), _mm_set1_pd(1.0));
+
+   __m128d z = _mm_mul_pd(m, m);
+   __m128d y = _mm_mul_pd(m, _mm_div_pd(_mm_mul_pd(z, Polynomial(m, p, 5)), Polynomial1(m, q, 5)));
+
+   y = _mm_sub_pd(y, _mm_mul_pd(e, _mm_set1_pd(2.121944400546905827679e-4)));
+   y = _mm_sub_pd(y, _mm_mul_pd(_mm_set1_pd(0.5), z));
+
+   return _mm_add_pd(_mm_add_pd(m, y), _mm_mul_pd(e, _mm_set1_pd(0.693359375)));
+}
+
+// e^X for -708 < X <= 0
+static inline __m128d ExpNegative(__m128d X)
+{
+   static const double p[] =
+   {
+      1.26177193074810590878E-4,
+      3.02994407707441961300E-2,
+      9.99999999999999999910E-1
+   };
+   static const double q[] =
+   {
+      3.00198505138664455042E-6,
+      2.52448340349684104192E-3,
+      2.27265548208155028766E-1,
+      2.00000000000000000009E0
+   };
+
+   const __m128d round_magic = _mm_set1_pd(6755399441055744.0); // 1.5 * 2^52
+
+   // X = n ln2 + r, |r| <= ln2 / 2
+   __m128d n = _mm_sub_pd(_mm_add_pd(_mm_mul_pd(X, _mm_set1_pd(1.4426950408889634073599)), round_magic), round_magic);
+
+   X = _mm_sub_pd(X, _mm_mul_pd(n, _mm_set1_pd(6.93145751953125E-1)));
+   X = _mm_sub_pd(X, _mm_mul_pd(n, _mm_set1_pd(1.42860682030941723212E-6)));
+
+   __m128d xx = _mm_mul_pd(X, X);
+   __m128d px = _mm_mul_pd(X, Polynomial(xx, p, 2));
+
+   X = _mm_div_pd(px, _mm_sub_pd(Polynomial(xx, q, 3), px));
+   X = _mm_add_pd(_mm_set1_pd(1.0), _mm_add_pd(X, X));
+
+   // 2^n from the integer in the low mantissa bits
+   __m128d biased = _mm_add_pd(_mm_add_pd(n, _mm_set1_pd(1023.0)), _mm_set1_pd(4503599627370496.0));
+   __m128d scale = _mm_castsi128_pd(_mm_slli_epi64(_mm_castpd_si128(biased), 52));
+
+   return _mm_mul_pd(X, scale);
+}
+
+// arctangent of 0 <= X < 1
+static inline __m128d AtanUnit(__m128d X)
+{
+   static const double p[] =
+   {
+      -8.750608600031904122785E-1,
+      -1.615753718733365076637E1,
+      -7.500855792314704667340E1,
+      -1.228866684490136173410E2,
+      -6.485021904942025371773E1
+   };
+   static const double q[] =
+   {
+      2.485846490142306297962E1,
+      1.650270098316988542046E2,
+      4.328810604912902668951E2,
+      4.853903996359136964868E2,
+      1.945506571482613964425E2
+   };
+
+   // above 0.66 use atan(x) = pi/4 + atan((x - 1) / (x + 1))
+   __m128d one = _mm_set1_pd(1.0);
+   __m128d large = _mm_cmpgt_pd(X, _mm_set1_pd(0.66));
+   __m128d offset = _mm_and_pd(large, _mm_set1_pd(M_PI_4 + 0.5 * 6.123233995736765886130E-17));
+
+   X = Select(large, _mm_div_pd(_mm_sub_pd(X, one), _mm_add_pd(X, one)), X);
+
+   __m128d z = _mm_mul_pd(X, X);
+
+   z = _mm_div_pd(_mm_mul_pd(z, Polynomial(z, p, 4)), Polynomial1(z, q, 5));
+
+   return _mm_add_pd(offset, _mm_add_pd(_mm_mul_pd(X, z), X));
+}
+
+static inline __m128d ProjectY(__m128d Latitude, __m128d Scale)
+{
+   const __m128d sign_mask = _mm_set1_pd(-0.0);
+
+   // asinh(tan(lat)) = ln((1 + sin) / cos), worked on |lat| so 1 + sin
+   // never cancels and the sign put back at the end
+   __m128d radians = _mm_mul_pd(Latitude, _mm_set1_pd(DEGREES_TO_RADIANS));
+   __m128d sign = _mm_and_pd(radians, sign_mask);
+   __m128d a = _mm_andnot_pd(sign_mask, radians);
+   __m128d upper = _mm_cmpgt_pd(a, _mm_set1_pd(M_PI_4));
+   __m128d sin_a, cos_a, sin_r, cos_r;
+
+   // above pi/4 the sine and cosine of pi/2 - a swap places
+   __m128d r = Select(upper, _mm_sub_pd(_mm_set1_pd(M_PI_2), a), a);
+
+   SinCosPi4(r, sin_r, cos_r);
+
+   sin_a = Select(upper, cos_r, sin_r);
+   cos_a = Select(upper, sin_r, cos_r);
+
+   __m128d merc = Log(_mm_div_pd(_mm_add_pd(_mm_set1_pd(1.0), sin_a), cos_a));
+
+   merc = _mm_or_pd(merc, sign);
+
+   return _mm_mul_pd(_mm_sub_pd(_mm_set1_pd(0.5), _mm_mul_pd(merc, _mm_set1_pd(0.5 / M_PI))), Scale);
+}
+
+static inline __m128d UnprojectLatitude(__m128d Y, __m128d Scale)
+{
+   const __m128d sign_mask = _mm_set1_pd(-0.0);
+
+   // atan(sinh(n)) = 2 atan(tanh(n / 2)), with tanh(|n| / 2) = (1 - t) / (1 + t)
+   // and t = e^-|n| in (0, 1]
+   __m128d n = _mm_mul_pd(_mm_sub_pd(_mm_set1_pd(1.0), _mm_mul_pd(_mm_set1_pd(2.0), _mm_div_pd(Y, Scale))),
+                          _mm_set1_pd(M_PI));
+   __m128d sign = _mm_and_pd(n, sign_mask);
+   __m128d a = _mm_min_pd(_mm_andnot_pd(sign_mask, n), _mm_set1_pd(700.0));
+   __m128d t = ExpNegative(_mm_sub_pd(_mm_setzero_pd(), a));
+   __m128d one = _mm_set1_pd(1.0);
+   __m128d latitude = _mm_mul_pd(AtanUnit(_mm_div_pd(_mm_sub_pd(one, t), _mm_add_pd(one, t))),
+                                 _mm_set1_pd(2.0 * RADIANS_TO_DEGREES));
+
+   return _mm_or_pd(latitude, sign);
+}
+
+void CMercator::Project(const double* Latitude,
+                        const double* Longitude,
+                        double*       X,
+                        double*       Y,
+                        size_t        Count,
+                        double        Scale)
+{
+   __m128d scale = _mm_set1_pd(Scale);
+   __m128d x_scale = _mm_set1_pd(Scale / 360.0);
+   __m128d x_offset = _mm_set1_pd(180.0);
+   size_t  i = 0;
+
+   for (; i + 2 <= Count; i += 2)
+   {
+      __m128d longitude = _mm_loadu_pd(Longitude + i);
+
+      _mm_storeu_pd(X + i, _mm_mul_pd(_mm_add_pd(longitude, x_offset), x_scale));
+      _mm_storeu_pd(Y + i, ProjectY(_mm_loadu_pd(Latitude + i), scale));
+   }
+
+   // an odd one out goes through the same kernel so results don't depend
+   // on where a point falls in the batch
+   if (i < Count)
+   {
+      double out[2];
+
+      X[i] = (Longitude[i] + 180.0) * (Scale / 360.0);
+      _mm_storeu_pd(out, ProjectY(_mm_set1_pd(Latitude[i]), scale));
+      Y[i] = out[0];
+   }
+}
+
+void CMercator::Unproject(const double* X,
+                          const double* Y,
+                          double*       Latitude,
+                          double*       Longitude,
+                          size_t        Count,
+                          double        Scale)
+{
+   __m128d scale = _mm_set1_pd(Scale);
+   __m128d x_scale = _mm_set1_pd(360.0 / Scale);
+   __m128d x_offset = _mm_set1_pd(180.0);
+   size_t  i = 0;
+
+   for (; i + 2 <= Count; i += 2)
+   {
+      _mm_storeu_pd(Longitude + i, _mm_sub_pd(_mm_mul_pd(_mm_loadu_pd(X + i), x_scale), x_offset));
+      _mm_storeu_pd(Latitude + i, UnprojectLatitude(_mm_loadu_pd(Y + i), scale));
+   }
+
+   if (i < Count)
+   {
+      double out[2];
+
+      Longitude[i] = X[i] * (360.0 / Scale) - 180.0;
+      _mm_storeu_pd(out, UnprojectLatitude(_mm_set1_pd(Y[i]), scale));
+      Latitude[i] = out[0];
+   }
+}
+
+#else
+
+void CMercator::Project(const double* Latitude,
+                        const double* Longitude,
+                        double*       X,
+                        double*       Y,
+                        size_t        Count,
+                        double        Scale)
+{
+   ProjectScalar(Latitude, Longitude, X, Y, Count, Scale);
+}
+
+void CMercator::Unproject(const double* X,
+                          const double* Y,
+                          double*       Latitude,
+                          double*       Longitude,
+                          size_t        Count,
+                          double        Scale)
+{
+   UnprojectScalar(X, Y, Latitude, Longitude, Count, Scale);
+}
+
+#endif
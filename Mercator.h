@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+
+#define MERCATOR_TABLE_MAX_ZOOM 16 // tile edge tables above this are too big, 2^zoom + 1 entries each
+
+// Batch web mercator projection for overlays and coverage math.
+//
+// World coordinates are x east and y south, Scale is the size of the world:
+// OSM_TILE_SIZE << Zoom for pixels, 1 << Zoom for tiles. Project and
+// Unproject use SSE2 kernels for the transcendental parts where available,
+// the *Scalar versions are the libm reference they are checked against.
+// Latitudes are valid inside +/-85.0511, the edge of the map.
+class CMercator
+{
+public:
+   static double GetPixelScale(int Zoom);
+
+   // latitude of the north edge of tile row Y, from a table up to
+   // MERCATOR_TABLE_MAX_ZOOM and computed above it
+   static double GetTileEdgeLatitude(int Y, int Zoom);
+
+   // the 2^Zoom + 1 row edges, nullptr above MERCATOR_TABLE_MAX_ZOOM.
+   // Built on first use, safe from any thread.
+   static const double* GetTileEdgeLatitudes(int Zoom);
+
+   static double GetTileScale(int Zoom) { return (double)(1 << Zoom); }
+
+   static void Project(const double* Latitude,
+                       const double* Longitude,
+                       double*       X,
+                       double*       Y,
+                       size_t        Count,
+                       double        Scale);
+
+   static void ProjectScalar(const double* Latitude,
+                             const double* Longitude,
+                             double*       X,
+                             double*       Y,
+                             size_t        Count,
+                             double        Scale);
+
+   static void Unproject(const double* X,
+                         const double* Y,
+                         double*       Latitude,
+                         double*       Longitude,
+                         size_t        Count,
+                         double        Scale);
+
+   static void UnprojectScalar(const double* X,
+                               const double* Y,
+                               double*       Latitude,
+                               double*       Longitude,
+                               size_t        Count,
+                               double        Scale);
+};
@@ -1,5 +1,7 @@
 
+#include <algorithm>
 #include <cmath>
+#include <cstdio>
 #include <chrono>
 #include <cstring>
 #include <fstream>
@@ -9,13 +11,21 @@
 #include "OpenStreetMap.h"
 #include "GlLineStrip.h"
 #include "GlRect.h"
+#include "Mercator.h"
 #include "ExecApi.h"
+#include "Trace.h"
 
 const double EQUATOR_CIRCUMFERENCE_M = 40075017.0;
 const double DEGREES_TO_RADIANS      = M_PI / 180.0;
 const double RADIANS_TO_DEGREES      = 180.0 / M_PI;
 const double M_TO_DEG                = 1.0 / 111120.0;
 const int    EASE_AGE                = 120;
+const char*  NO_DATA_FILENAME        = "no_data.png";
+
+static const uint32_t SESSION_MAGIC   = 0x4e53534f; // "OSSN"
+static const uint32_t SESSION_VERSION = 1;
+
+unsigned int COpenStreetMap::mTileVAO = 0;
 
 const double COpenStreetMap::mMapScale[MAX_ZOOM_LEVELS] =
 {
@@ -47,7 +57,11 @@ COpenStreetMap::COpenStreetMap()
      mBorderColor(1.0f),
      mShaderRect(nullptr),
      mShaderLine(nullptr),
-     mNoDataTile{},
+     mShaderTile(nullptr),
+     mSession{},
+     mMapView{},
+     mOpenTime(),
+     mScaleChangeTime(),
      mMapCenterLat(0.0),
      mMapCenterLon(0.0),
      mMapZoom(1.0),
@@ -59,6 +73,8 @@ COpenStreetMap::COpenStreetMap()
      mDegPerPixEw(0.0),
      mMetersPerPixNs(0.0),
      mMetersPerPixEw(0.0),
+     mZoomHysteresis(ZOOM_HYSTERESIS),
+     mSettleScaleFactor(1.0),
      mMapScaleFactor(1.0f),
      mCoverageRadiusScaleFactor(1.0f),
      mCenterTileX(0),
@@ -68,15 +84,14 @@ COpenStreetMap::COpenStreetMap()
      mMapWidthPix(0),
      mMapHeightPix(0),
      mZoomLevel(0),
-     mWmtsTimeout(0),
+     mZoomSettleMs(ZOOM_SETTLE_MS),
+     mStateCallbackId(0),
      mTerminateCoverageThread(false),
      mDrawSubframeBoundaries(false),
      mEasingEnabled(false),
-     mCacheEnabled(false),
-     mWmtsEnabled(false),
-     mWmtsOnline(false),
      mBorderEnabled(false),
-     mClipEnabled(false)
+     mClipEnabled(false),
+     mSessionLoaded(false)
 {
 }
 
@@ -92,45 +107,82 @@ void COpenStreetMap::Close()
       mTerminateCoverageThread = true;
       mCoverageThread.join();
    }
+
+   if (!mSessionFilename.empty())
+      SaveSession();
+
+   mSessionFilename.clear();
+   mSessionLoaded = false;
+
+   if (mTileService && mStateCallbackId)
+      mTileService->RemoveStateCallback(mStateCallbackId);
+
+   mStateCallbackId = 0;
+
+   // the tiles are released before the service, which closes with the
+   // last map using it
+   mDisplayList.Clear();
+   mDisplayListEasing.clear();
+   mTileService.reset();
+}
+
+void COpenStreetMap::AddLayer(CMapLayer* Layer)
+{
+   if (Layer && std::find(mLayers.begin(), mLayers.end(), Layer) == mLayers.end())
+      mLayers.push_back(Layer);
 }
 
-std::string COpenStreetMap::ConstructFilename(int Zoom, int X, int Y)
+std::string COpenStreetMap::ConstructFilename(const std::string& CachePath, int Zoom, int X, int Y,
+                                             TileFormat Format)
 {
-   std::string filename = mCachePath;
+   std::string filename = CachePath;
 
    filename += std::to_string(Zoom);
    filename += "_";
    filename += std::to_string(X);
    filename += "_";
    filename += std::to_string(Y);
-   filename += ".png";
+   filename += ".";
+   filename += GetTileFormatExtension(Format);
 
    return filename;
 }
 
+bool COpenStreetMap::ConstructFilename(char* Filename, size_t Size, const std::string& CachePath, TTileKey Key,
+                                       TileFormat Format)
+{
+   int length = snprintf(Filename, Size, "%s%d_%d_%d.%s", CachePath.c_str(), Key.GetZoom(), Key.GetX(), Key.GetY(),
+                         GetTileFormatExtension(Format));
+
+   return length > 0 && (size_t)length < Size;
+}
+
 void COpenStreetMap::CoverageThread()
 {
-   TImageCache        image_cache;
-   TTileList          tile_list;
-   std::vector<TTile> display_list_trash_scratchpad;
-   std::vector<TTile> display_list_scratchpad;
-   double             map_center_lat;
-   double             map_center_lon;
-   double             coverage_radius_scale_factor;
-   double             coverage_radius_pixels;
-   double             scale_x;
-   double             scale_y;
-   int                zoom_level;
-   int                window_width;
-   int                window_height;
-   int                prev_zoom_level = 0;
-   bool               easing_enabled;
+   TTileList    tile_list;
+   TDisplayList display_list_scratchpad;
+   double       map_center_lat;
+   double       map_center_lon;
+   double       coverage_radius_scale_factor;
+   double       coverage_radius_pixels;
+   double       scale_x;
+   double       scale_y;
+   int          zoom_level;
+   int          window_width;
+   int          window_height;
+   bool         easing_enabled;
+   bool         cache_only;
+
+   CTrace::SetThreadName("Coverage");
 
    // loop until terminated
    while (!mTerminateCoverageThread)
    {
+      auto     loop_start = std::chrono::steady_clock::now();
+      uint64_t loop_allocations = GetThreadAllocations();
+
       // snapshot things that need to be thread safe
-      mMutex.lock();
+      TraceLock(mMutex, "CoverageMutexWait");
       map_center_lat               = mMapCenterLat;
       map_center_lon               = mMapCenterLon;
       coverage_radius_scale_factor = mCoverageRadiusScaleFactor;
@@ -141,18 +193,10 @@ void COpenStreetMap::CoverageThread()
       window_height                = mMapHeightPix;
       easing_enabled               = mEasingEnabled;
 
-      if (easing_enabled)
-      {
-         if (mDisplayList.size() && prev_zoom_level != zoom_level)
-         {
-            for (auto& tile : mDisplayList)
-            {
-               tile.Age = EASE_AGE;
-               mDisplayListEasing.push_back(tile);
-            }
-         }
-      }
-      prev_zoom_level = zoom_level;
+      // the levels a zoom gesture passes through are shown from what is
+      // cached, the level it stops at is fetched once the scale holds still
+      cache_only = (mZoomSettleMs > 0) &&
+                   (loop_start - mScaleChangeTime < std::chrono::milliseconds(mZoomSettleMs));
 
       mMutex.unlock();
 
@@ -164,47 +208,74 @@ void COpenStreetMap::CoverageThread()
       coverage_radius_pixels = sqrt((coverage_radial_x * coverage_radial_x) +
                                     (coverage_radial_y * coverage_radial_y));
 
-      if (mWmtsTimeout > 0)
-      {
-         mWmtsTimeout--;
-         if (mWmtsTimeout == 0)
-         {
-            mWmtsOnline = true;
-         }
-      }
-
       // get the tile list
       tile_list.clear();
       GetTileList(tile_list, map_center_lat, map_center_lon, zoom_level, scale_x, coverage_radius_pixels);
 
-      // clear the display list and display list trash scratchpads
-      display_list_scratchpad.clear();
-      display_list_trash_scratchpad.clear();
+      // clear the display list scratchpad
+      display_list_scratchpad.Clear();
 
-      // update the image cache
+      // look the tiles up in the tile service
       UpdateCache(tile_list,
                   display_list_scratchpad,
-                  display_list_trash_scratchpad,
-                  image_cache);
+                  cache_only);
+
+      TraceLock(mMutex, "CoverageMutexWait");
+
+      // without the center tile the new level isn't worth showing yet, the
+      // previous list stays up scaled to the new zoom
+      bool keep_previous = cache_only && !mDisplayList.Empty() &&
+                           (display_list_scratchpad.Empty() ||
+                            display_list_scratchpad.Keys[0] != tile_list[0]);
+
+      if (!keep_previous)
+      {
+         // the tiles of the level going away fade out over the new one
+         if (easing_enabled && !mDisplayList.Empty() && !display_list_scratchpad.Empty() &&
+             mDisplayList.Zoom != display_list_scratchpad.Zoom)
+         {
+            mDisplayList.Age = EASE_AGE;
+            mDisplayListEasing.push_back(mDisplayList);
+         }
+
+         // tiles still covered keep their texture, so the reference that
+         // keeps it resident in the tile service doesn't lapse between frames
+         for (size_t i = 0; i < display_list_scratchpad.Size() && i < mDisplayList.Size(); i++)
+         {
+            if (display_list_scratchpad.Keys[i] == mDisplayList.Keys[i] &&
+                display_list_scratchpad.HasData[i] == mDisplayList.HasData[i])
+               display_list_scratchpad.Textures[i] = mDisplayList.Textures[i];
+         }
+
+         std::swap(mDisplayList, display_list_scratchpad);
+
+         if (!mStats.GetStartupUs(StartupEvent::FIRST_TILES) &&
+             std::find(mDisplayList.HasData.begin(), mDisplayList.HasData.end(), 1) != mDisplayList.HasData.end())
+            mStats.RecordStartup(StartupEvent::FIRST_TILES, std::chrono::duration_cast<std::chrono::microseconds>(
+                  TClock::now() - mOpenTime).count());
+      }
 
-      mMutex.lock();
-      mDisplayList = display_list_scratchpad;
-      mDisplayListTrash = display_list_trash_scratchpad;
       mMutex.unlock();
 
+      // the sleep is left out of the loop time
+      CTrace::Record("Coverage", "coverage", loop_start);
+      mStats.GetLatency(TileStage::COVERAGE).Record(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - loop_start).count());
+      mStats.GetAllocations(AllocPass::COVERAGE).Record(GetThreadAllocations() - loop_allocations);
+
       std::this_thread::sleep_for(std::chrono::milliseconds(1));
    }
 }
 
-void COpenStreetMap::UpdateCache(TTileList&          TileList,
-                                 std::vector<TTile>& DisplayListScratchpad,
-                                 std::vector<TTile>& DisplayListTrashScratchpad,
-                                 TImageCache&        ImageCache)
+void COpenStreetMap::UpdateCache(TTileList&    TileList,
+                                 TDisplayList& DisplayListScratchpad,
+                                 bool          CacheOnly)
 {
-   TTile       tile;
-   TTile       trash_tile;
-   std::string png_filename;
-   bool        got_file = false;
+   TileStatus status;
+   int        first_x = 0;
+   int        first_y = 0;
+
+   TRACE_SCOPE("UpdateCache", "coverage");
 
    // loop over the subframe coverage list
    for (int i = 0; i < TileList.size(); i++)
@@ -212,112 +283,68 @@ void COpenStreetMap::UpdateCache(TTileList&          TileList,
       // check for terminate again to speed up exiting
       if (mTerminateCoverageThread) return;
 
-      if (!ImageCache.Get(tile, TileList[i]))
-      {
-         // check if map source includes the local disk
-         if (mCacheEnabled)
-         {
-            std::error_code err;
-
-            // construct the file name
-            png_filename = ConstructFilename(TileList[i].Zoom,
-                                             TileList[i].X,
-                                             TileList[i].Y);
-
-            got_file = std::filesystem::exists(png_filename);
-         }
-
-         // check if map source includes the WMTS server and nothing has
-         // been read in from the local png file
-         if (mWmtsOnline && mWmtsEnabled && !got_file)
-         {
-            unsigned char* buffer;
-            int            size;
-
-            // get the png file from the WMTS server
-            got_file = mWmtsIf.GetMapPngBuffer(TileList[i].Zoom,
-                                               TileList[i].X,
-                                               TileList[i].Y,
-                                               &buffer,
-                                               size);
+      status = mTileService->GetTile(TileList[i], CacheOnly, mStats);
 
-            if (got_file)
-            {
-               // write the buffer out to a new png file if map source
-               // includes the local png file
-               if (mCacheEnabled)
-               {
-                  std::error_code err;
-                  std::filesystem::create_directory(mCachePath, err);
+      // nothing is cached for a no data tile either, so the fetch
+      // happens once the scale settles
+      if (status == TileStatus::DEFERRED)
+         continue;
 
-                  std::ofstream png_file(png_filename, std::ios::out | std::ios::binary | std::ios::trunc);
+      int x = TileList[i].GetX();
+      int y = TileList[i].GetY();
 
-                  png_file.write((char*)buffer, size);
-               }
-            }
-            else
-            {
-               // bad png file from the tile server
-               mWmtsOnline = false;
-               mWmtsTimeout = SERVER_TIMEOUT;
-            }
-         }
+      // only the first tile has a position, the rest are placed from it
+      if (DisplayListScratchpad.Empty())
+      {
+         int zoom = TileList[i].GetZoom();
 
-         double ul_lat = GetLatitudeFromTileY(TileList[i].Y, TileList[i].Zoom);
-         double ul_lon = GetLongitudeFromTileX(TileList[i].X, TileList[i].Zoom);
-         double br_lat = GetLatitudeFromTileY(TileList[i].Y+1, TileList[i].Zoom);
-         double br_lon = GetLongitudeFromTileX(TileList[i].X+1, TileList[i].Zoom);
-
-         // allocate a new image
-         tile.Texture   = nullptr;
-         tile.Latitude  = (ul_lat + br_lat) / 2.0;
-         tile.Longitude = (ul_lon + br_lon) / 2.0;
-         tile.ZoomLevel = TileList[i].Zoom;
-         tile.TileX     = TileList[i].X;
-         tile.TileY     = TileList[i].Y;
-
-         // check that the png file was retrieved
-         if (got_file)
-         {
-            tile.Filename  = png_filename;
-         }
-         else
-         {
-            tile.Filename  = "no_data.png";
-         }
+         double ul_lat = GetLatitudeFromTileY(y, zoom);
+         double ul_lon = GetLongitudeFromTileX(x, zoom);
+         double br_lat = GetLatitudeFromTileY(y+1, zoom);
+         double br_lon = GetLongitudeFromTileX(x+1, zoom);
 
-         // check if the image cache is full
-         if (ImageCache.IsFull())
-         {
-            // remove the oldest image from the cache
-            ImageCache.GetBack(trash_tile);
+         DisplayListScratchpad.Latitude  = (ul_lat + br_lat) / 2.0;
+         DisplayListScratchpad.Longitude = (ul_lon + br_lon) / 2.0;
+         DisplayListScratchpad.Zoom      = zoom;
 
-            // move the old image onto the display list trash
-            // scratchpad
-            DisplayListTrashScratchpad.push_back(trash_tile);
-         }
-
-         // put the new image onto the cache
-         ImageCache.PutFront(tile, TileList[i]);
+         first_x = x;
+         first_y = y;
       }
 
-      // add the tile to the display list scratchpad
-      DisplayListScratchpad.push_back(tile);
+      // the texture is found in the tile service when the tile is drawn
+      DisplayListScratchpad.Keys.push_back(TileList[i]);
+      DisplayListScratchpad.Textures.push_back(nullptr);
+      DisplayListScratchpad.Offsets.push_back(glm::vec2((float)(x - first_x), (float)(y - first_y)));
+      DisplayListScratchpad.HasData.push_back(status == TileStatus::READY);
    }
 }
 
+void COpenStreetMap::TDisplayList::Clear()
+{
+   Keys.clear();
+   Textures.clear();
+   Offsets.clear();
+   HasData.clear();
+   Latitude  = 0.0;
+   Longitude = 0.0;
+   Zoom      = 0;
+   Age       = 0;
+}
+
 void COpenStreetMap::Draw()
 {
    double center_tile_pixels_x;
    double center_tile_pixels_y;
    double center_tile_x;
    double center_tile_y;
-   double offset_pixels_x;
-   double offset_pixels_y;
    double map_zoom;
    double map_scale_x;
    double map_scale_y;
 
+   CStageTimer   draw_timer(mStats.GetLatency(TileStage::DRAW));
+   CAllocCounter draw_allocations(mStats.GetAllocations(AllocPass::DRAW));
+   TRACE_SCOPE("Draw", "render");
+
    if (mClipEnabled)
    {
       int bottom = ((mWinHeightPix - mMapHeightPix) * 0.5) + mMapOffsetY;
@@ -330,28 +357,26 @@ void COpenStreetMap::Draw()
    }
 
    // grab the mutex
-   mMutex.lock();
+   TraceLock(mMutex, "DrawMutexWait");
 
-   if (mDisplayList.empty() && mDisplayListEasing.empty())
+   if (mDisplayList.Empty() && mDisplayListEasing.empty())
       ExecApiLogWarning("No tiles drawn");
 
-   CGlRect tile_rect = CGlRect(mShaderRect, 0.0f, 0.0f, (float)OSM_TILE_SIZE, (float)OSM_TILE_SIZE);
-
-   if (mDisplayList.size())
+   if (!mDisplayList.Empty())
    {
       // calculate the image offset in pixels from the map center of rotation
       // for the center tile
 
       // If zoom level just changed, but our display list is still the previous zoom level
       // then set the zoom/scaling based on the previous zoom level
-      if (mDisplayList[0].ZoomLevel != mZoomLevel)
+      if (mDisplayList.Zoom != mZoomLevel)
       {
-         map_zoom    = mMapScale[mDisplayList[0].ZoomLevel] / mMapScaleFactor;
+         map_zoom    = mMapScale[mDisplayList.Zoom] / mMapScaleFactor;
          map_scale_x = map_zoom * cos(mMapCenterLat * DEGREES_TO_RADIANS);
          map_scale_y = map_zoom * cos(mMapCenterLat * DEGREES_TO_RADIANS);
 
-         mMetersPerPixEw = GetMetersPerPixelEw(mMapCenterLat, mDisplayList[0].ZoomLevel);
-         mMetersPerPixNs = GetMetersPerPixelNs(mDisplayList[0].ZoomLevel);
+         mMetersPerPixEw = GetMetersPerPixelEw(mMapCenterLat, mDisplayList.Zoom);
+         mMetersPerPixNs = GetMetersPerPixelNs(mDisplayList.Zoom);
 
          mDegPerPixEw = mMetersPerPixEw * M_TO_DEG;
          mDegPerPixNs = mMetersPerPixNs * M_TO_DEG;
@@ -363,128 +388,95 @@ void COpenStreetMap::Draw()
          map_scale_y = mMapScaleY;
       }
 
-      center_tile_pixels_x = (mDisplayList[0].Longitude - mMapCenterLon) / mDegPerPixEw * map_zoom;
-      center_tile_pixels_y = (mDisplayList[0].Latitude - mMapCenterLat) / mDegPerPixNs * map_zoom;
-      center_tile_x        = mDisplayList[0].TileX;
-      center_tile_y        = mDisplayList[0].TileY;
+      center_tile_pixels_x = (mDisplayList.Longitude - mMapCenterLon) / mDegPerPixEw * map_zoom;
+      center_tile_pixels_y = (mDisplayList.Latitude - mMapCenterLat) / mDegPerPixNs * map_zoom;
+      center_tile_x        = mDisplayList.Keys[0].GetX();
+      center_tile_y        = mDisplayList.Keys[0].GetY();
       mCenterTileX         = mCenterTileX;
       mCenterTileY         = mCenterTileY;
+
+      // the world position of the map center follows from where the center
+      // tile is drawn, so the layers line up with the tiles exactly
+      double world_tiles = (double)(1 << mDisplayList.Zoom);
+
+      mMapView.PixelsPerWorldX = OSM_TILE_SIZE * world_tiles * map_scale_x;
+      mMapView.PixelsPerWorldY = OSM_TILE_SIZE * world_tiles * map_scale_y;
+      mMapView.CenterX         = (center_tile_x + 0.5) / world_tiles - center_tile_pixels_x / mMapView.PixelsPerWorldX;
+      mMapView.CenterY         = (center_tile_y + 0.5) / world_tiles + center_tile_pixels_y / mMapView.PixelsPerWorldY;
+      mMapView.ZoomLevel       = mDisplayList.Zoom;
    }
    else
    {
       mCenterTileX = 0;
       mCenterTileY = 0;
+
+      CMercator::Project(&mMapCenterLat, &mMapCenterLon, &mMapView.CenterX, &mMapView.CenterY, 1, 1.0);
+
+      mMapView.PixelsPerWorldX = OSM_TILE_SIZE * (double)(1 << mZoomLevel) * mMapScaleX;
+      mMapView.PixelsPerWorldY = OSM_TILE_SIZE * (double)(1 << mZoomLevel) * mMapScaleY;
+      mMapView.ZoomLevel       = mZoomLevel;
    }
 
-   // loop through the display list
-   for (auto& tile : mDisplayList)
-   {
-      if (!tile.Texture)
-      {
-         tile.Texture = GetOrCreateTexture(tile.Filename.c_str(), true);
-      }
+   mMapView.RotationDeg = mMapRotation;
+   mMapView.OffsetX     = mMapOffsetX;
+   mMapView.OffsetY     = mMapOffsetY;
+   mMapView.WidthPix    = mMapWidthPix;
+   mMapView.HeightPix   = mMapHeightPix;
 
-      //if (!tile.Texture || tile.ZoomLevel != mZoomLevel)
-      if (!tile.Texture)
-         continue;
+   mSubframeModels.clear();
 
-      offset_pixels_x = (tile.TileX - center_tile_x) * OSM_TILE_SIZE * map_scale_x;
-      offset_pixels_y = -(tile.TileY - center_tile_y) * OSM_TILE_SIZE * map_scale_y;
+   // draw the display list
+   mPassTimer[(int)DrawPass::TILES].Begin();
+   if (!mDisplayList.Empty())
+   {
+      glm::vec2 origin((float)center_tile_pixels_x, (float)center_tile_pixels_y);
+      glm::vec2 scale((float)map_scale_x, (float)map_scale_y);
 
-      glm::mat4 model(1.0f);
+      DrawTiles(mDisplayList, origin, scale, 1.0f);
 
-      model = glm::translate(model, glm::vec3(mMapOffsetX, mMapOffsetY, 0.0f));
-      model = glm::rotate(model, (float)(-mMapRotation * DEGREES_TO_RADIANS), glm::vec3(0.0f, 0.0f, 1.0f));
-      model = glm::translate(model, glm::vec3(center_tile_pixels_x + offset_pixels_x,
-                                              center_tile_pixels_y + offset_pixels_y,
-                                              0.0f));
-      model = glm::scale(model, glm::vec3(map_scale_x, map_scale_y, 0.0f));
-
-      tile_rect.SetModelMatrix(model);
-      tile_rect.SetTexture(tile.Texture);
-      tile_rect.SetColor(glm::vec4(1.0f));
-      tile_rect.Render(mMapProjection);
-
-      // draw the subframe boundary
-      if (mDrawSubframeBoundaries)
+      // the subframe boundaries are drawn over the tiles in the debug pass,
+      // their models are only built when they are shown
+      for (size_t i = 0; mDrawSubframeBoundaries && i < mDisplayList.Size(); i++)
       {
-         CGlLineStrip           linestrip = CGlLineStrip(mShaderLine, 0.0f, 0.0f, 0.0f, 0.0f);
-         CGlRect                rect = CGlRect(mShaderRect, 0.0f, 0.0f, (float)OSM_TILE_SIZE, (float)OSM_TILE_SIZE);
-         float                  half_size = (float)OSM_TILE_SIZE * 0.5f;
-         std::vector<glm::vec3> points;
-
-         points.push_back(glm::vec3(-half_size, -half_size, 0.0f));
-         points.push_back(glm::vec3(-half_size,  half_size, 0.0f));
-         points.push_back(glm::vec3( half_size,  half_size, 0.0f));
-         points.push_back(glm::vec3( half_size, -half_size, 0.0f));
-         points.push_back(glm::vec3(-half_size, -half_size, 0.0f));
-
-         linestrip.SetLineWidth(3.0f);
-         linestrip.SetColor(glm::vec4(1.0f, 0.0f, 0.0f, 1.0f));
-         linestrip.SetVertices(&points);
-         linestrip.SetModelMatrix(model);
-         linestrip.Render(mMapProjection);
+         glm::vec2 offset = mDisplayList.Offsets[i] * scale * (float)OSM_TILE_SIZE;
+         glm::mat4 model(1.0f);
 
-         rect.SetColor(glm::vec4(1.0f, 0.0f, 0.0f, 0.2f));
-         rect.SetModelMatrix(model);
-         rect.Render(mMapProjection);
+         model = glm::translate(model, glm::vec3(mMapOffsetX, mMapOffsetY, 0.0f));
+         model = glm::rotate(model, (float)(-mMapRotation * DEGREES_TO_RADIANS), glm::vec3(0.0f, 0.0f, 1.0f));
+         model = glm::translate(model, glm::vec3(origin.x + offset.x, origin.y - offset.y, 0.0f));
+         model = glm::scale(model, glm::vec3(scale.x, scale.y, 0.0f));
+
+         mSubframeModels.push_back(model);
       }
    }
+   mPassTimer[(int)DrawPass::TILES].End();
 
+   mPassTimer[(int)DrawPass::EASING].Begin();
    if (mEasingEnabled)
    {
-      if (mDisplayListEasing.size())
+      // each level fading out is placed from its own first tile
+      for (auto& list : mDisplayListEasing)
       {
-         // calculate the image offset in pixels from the map center of rotation
-         // for the center tile
-         int    zoom_level        = mDisplayListEasing[0].ZoomLevel;
-         double meters_per_pix_ew = GetMetersPerPixelEw(mMapCenterLat, zoom_level);
-         double meters_per_pix_ns = GetMetersPerPixelNs(zoom_level);
+         double meters_per_pix_ew = GetMetersPerPixelEw(mMapCenterLat, list.Zoom);
+         double meters_per_pix_ns = GetMetersPerPixelNs(list.Zoom);
          double deg_per_pix_ew    = meters_per_pix_ew * M_TO_DEG;
          double deg_per_pix_ns    = meters_per_pix_ns * M_TO_DEG;
 
-         map_zoom             = mMapScale[zoom_level] / mMapScaleFactor;
+         map_zoom             = mMapScale[list.Zoom] / mMapScaleFactor;
          map_scale_x          = map_zoom * cos(mMapCenterLat * DEGREES_TO_RADIANS);
          map_scale_y          = map_zoom * cos(mMapCenterLat * DEGREES_TO_RADIANS);
-         center_tile_pixels_x = (mDisplayListEasing[0].Longitude - mMapCenterLon) / deg_per_pix_ew * map_zoom;
-         center_tile_pixels_y = (mDisplayListEasing[0].Latitude - mMapCenterLat) / deg_per_pix_ns * map_zoom;
-         center_tile_x        = mDisplayListEasing[0].TileX;
-         center_tile_y        = mDisplayListEasing[0].TileY;
-      }
+         center_tile_pixels_x = (list.Longitude - mMapCenterLon) / deg_per_pix_ew * map_zoom;
+         center_tile_pixels_y = (list.Latitude - mMapCenterLat) / deg_per_pix_ns * map_zoom;
 
-      // loop through the easing display list
-      for (auto& tile : mDisplayListEasing)
-      {
-         if (!tile.Texture)
-         {
-            tile.Texture = GetOrCreateTexture(tile.Filename.c_str(), true);
-         }
-
-         if (!tile.Texture)
-            continue;
+         DrawTiles(list,
+                   glm::vec2((float)center_tile_pixels_x, (float)center_tile_pixels_y),
+                   glm::vec2((float)map_scale_x, (float)map_scale_y),
+                   (float)list.Age / (float)EASE_AGE);
 
-         offset_pixels_x = (tile.TileX - center_tile_x) * OSM_TILE_SIZE * map_scale_x;
-         offset_pixels_y = -(tile.TileY - center_tile_y) * OSM_TILE_SIZE * map_scale_y;
-
-         glm::mat4 model(1.0f);
-
-         model = glm::translate(model, glm::vec3(mMapOffsetX, mMapOffsetY, 0.0f));
-         model = glm::rotate(model, (float)(-mMapRotation * DEGREES_TO_RADIANS), glm::vec3(0.0f, 0.0f, 1.0f));
-         model = glm::translate(model, glm::vec3(center_tile_pixels_x + offset_pixels_x,
-                                                 center_tile_pixels_y + offset_pixels_y,
-                                                 0.0f));
-         model = glm::scale(model, glm::vec3(map_scale_x, map_scale_y, 0.0f));
-
-         tile_rect.SetModelMatrix(model);
-         tile_rect.SetTexture(tile.Texture);
-         float alpha = (float)tile.Age / (float)EASE_AGE;
-         tile_rect.SetColor(glm::vec4(alpha));
-         tile_rect.Render(mMapProjection);
-
-         tile.Age--;
+         list.Age--;
       }
 
-      // Delete any easing tiles that have aged out
+      // Delete any easing lists that have aged out
       for (auto it = mDisplayListEasing.begin(); it != mDisplayListEasing.end();)
       {
          if (it->Age <= 0)
@@ -497,26 +489,29 @@ void COpenStreetMap::Draw()
          }
       }
    }
+   mPassTimer[(int)DrawPass::EASING].End();
 
-   // Delete any tiles that have been evicted from the cache
-   if (mDisplayListTrash.size())
-   {
-      for (const auto& tile : mDisplayListTrash)
-      {
-         DeleteTexture(tile.Filename.c_str());
-      }
-   }
-   mDisplayListTrash.clear();
+   // textures no map is drawing any more go once the pool is full, the
+   // display list references are only stable with the mutex held
+   if (mTileService)
+      mTileService->CollectTextures();
 
    // release the mutex
    mMutex.unlock();
 
+   mPassTimer[(int)DrawPass::OVERLAY].Begin();
+   for (CMapLayer* layer : mLayers)
+   {
+      layer->Draw(mMapView, mMapProjection);
+   }
+
    if (mBorderEnabled)
    {
-      std::vector<glm::vec3> points;
-      CGlLineStrip           border = CGlLineStrip(mShaderLine, 0.0f, 0.0f, 0.0f, 0.0f);
-      glm::mat4              model(1.0f);
+      TArenaVector<glm::vec3> points{TArenaAllocator<glm::vec3>(mFrameArena)};
+      CGlLineStrip            border = CGlLineStrip(mShaderLine, 0.0f, 0.0f, 0.0f, 0.0f);
+      glm::mat4               model(1.0f);
 
+      points.reserve(5);
       points.push_back(glm::vec3(-(float)(mMapWidthPix - 3) * 0.5f, -(float)(mMapHeightPix - 3) * 0.5f, 0.0f));
       points.push_back(glm::vec3(-(float)(mMapWidthPix - 3) * 0.5f,  (float)(mMapHeightPix - 3) * 0.5f, 0.0f));
       points.push_back(glm::vec3( (float)(mMapWidthPix - 3) * 0.5f,  (float)(mMapHeightPix - 3) * 0.5f, 0.0f));
@@ -531,15 +526,45 @@ void COpenStreetMap::Draw()
       border.SetModelMatrix(model);
       border.Render(mMapProjection);
    }
+   mPassTimer[(int)DrawPass::OVERLAY].End();
 
+   mPassTimer[(int)DrawPass::DEBUG].Begin();
    if (mDrawSubframeBoundaries)
    {
+      // draw the subframe boundaries
+      CGlLineStrip            linestrip = CGlLineStrip(mShaderLine, 0.0f, 0.0f, 0.0f, 0.0f);
+      CGlRect                 tile_boundary = CGlRect(mShaderRect, 0.0f, 0.0f, (float)OSM_TILE_SIZE, (float)OSM_TILE_SIZE);
+      float                   half_size = (float)OSM_TILE_SIZE * 0.5f;
+      TArenaVector<glm::vec3> tile_points{TArenaAllocator<glm::vec3>(mFrameArena)};
+
+      tile_points.reserve(5);
+      tile_points.push_back(glm::vec3(-half_size, -half_size, 0.0f));
+      tile_points.push_back(glm::vec3(-half_size,  half_size, 0.0f));
+      tile_points.push_back(glm::vec3( half_size,  half_size, 0.0f));
+      tile_points.push_back(glm::vec3( half_size, -half_size, 0.0f));
+      tile_points.push_back(glm::vec3(-half_size, -half_size, 0.0f));
+
+      linestrip.SetLineWidth(3.0f);
+      linestrip.SetColor(glm::vec4(1.0f, 0.0f, 0.0f, 1.0f));
+      linestrip.SetVertices(&tile_points);
+      tile_boundary.SetColor(glm::vec4(1.0f, 0.0f, 0.0f, 0.2f));
+
+      for (const auto& tile_model : mSubframeModels)
+      {
+         linestrip.SetModelMatrix(tile_model);
+         linestrip.Render(mMapProjection);
+
+         tile_boundary.SetModelMatrix(tile_model);
+         tile_boundary.Render(mMapProjection);
+      }
+
       // draw viewport
-      std::vector<glm::vec3> points;
-      CGlLineStrip           viewport = CGlLineStrip(mShaderLine, 0.0f, 0.0f, 0.0f, 0.0f);
-      CGlRect                rect = CGlRect(mShaderRect, 0.0f, 0.0f, mMapWidthPix, mMapHeightPix);
-      glm::mat4              model(1.0f);
+      TArenaVector<glm::vec3> points{TArenaAllocator<glm::vec3>(mFrameArena)};
+      CGlLineStrip            viewport = CGlLineStrip(mShaderLine, 0.0f, 0.0f, 0.0f, 0.0f);
+      CGlRect                 rect = CGlRect(mShaderRect, 0.0f, 0.0f, mMapWidthPix, mMapHeightPix);
+      glm::mat4               model(1.0f);
 
+      points.reserve(5);
       points.push_back(glm::vec3(-(float)mMapWidthPix * 0.5f, -(float)mMapHeightPix * 0.5f, 0.0f));
       points.push_back(glm::vec3(-(float)mMapWidthPix * 0.5f,  (float)mMapHeightPix * 0.5f, 0.0f));
       points.push_back(glm::vec3( (float)mMapWidthPix * 0.5f,  (float)mMapHeightPix * 0.5f, 0.0f));
@@ -588,6 +613,10 @@ void COpenStreetMap::Draw()
       coverage.SetModelMatrix(model);
       coverage.Render(mMapProjection);
    }
+   mPassTimer[(int)DrawPass::DEBUG].End();
+
+   // the outlines are drawn, their memory goes back for the next frame
+   mFrameArena.Reset();
 
    if (mClipEnabled)
    {
@@ -595,36 +624,53 @@ void COpenStreetMap::Draw()
    }
 }
 
-void COpenStreetMap::EnableCache(bool Enable, const char* CachePath)
+void COpenStreetMap::DrawTiles(TDisplayList& List, const glm::vec2& Origin, const glm::vec2& Scale, float Alpha)
 {
-   if (!CachePath || strlen(CachePath) == 0)
+   if (!mShaderTile)
    {
-      mCacheEnabled = false;
-      mCachePath = "";
+      ExecApiLogWarning("OpenStreetMap: No tile shader");
       return;
    }
 
-   mCacheEnabled = Enable;
-   mCachePath    = CachePath;
+   // the map offset and rotation are the same for every tile, the tile
+   // placement is left to the shader
+   glm::mat4 transform = mMapProjection;
 
-   // append '/' to the path if not already there
-   if (mCachePath[mCachePath.length() - 1] != '/') {
-      mCachePath += '/';
-   }
-}
+   transform = glm::translate(transform, glm::vec3(mMapOffsetX, mMapOffsetY, 0.0f));
+   transform = glm::rotate(transform, (float)(-mMapRotation * DEGREES_TO_RADIANS), glm::vec3(0.0f, 0.0f, 1.0f));
 
-void COpenStreetMap::EnableWmtsServer(bool Enable, const char* WmtsUrl)
-{
-   if (Enable && WmtsUrl)
-   {
-      mWmtsEnabled = Enable;
-      mWmtsUrl  = WmtsUrl;
-   }
-   else
+   if (!mTileVAO)
+      glGenVertexArrays(1, &mTileVAO);
+
+   mShaderTile->Use();
+   mShaderTile->SetUniform("transform", transform);
+   mShaderTile->SetUniform("uOrigin", Origin);
+   mShaderTile->SetUniform("uTileSize", Scale * (float)OSM_TILE_SIZE);
+   mShaderTile->SetUniform("uAlpha", Alpha);
+   mShaderTile->SetUniform("uTexture", 0);
+
+   glActiveTexture(GL_TEXTURE0);
+   glBindVertexArray(mTileVAO);
+
+   for (size_t i = 0; i < List.Size(); i++)
    {
-      mWmtsEnabled = false;
-      mWmtsUrl  = "";
+      if (!List.Textures[i])
+      {
+         List.Textures[i] = GetTexture(List, i);
+         RecordTextureLoad(List.Textures[i]);
+      }
+
+      if (!List.Textures[i])
+         continue;
+
+      // no array is enabled, every vertex of the draw reads this offset
+      glVertexAttrib2f(0, List.Offsets[i].x, List.Offsets[i].y);
+      glBindTexture(GL_TEXTURE_2D, List.Textures[i]->GetTexture());
+      glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
    }
+
+   glBindVertexArray(0);
+   glBindTexture(GL_TEXTURE_2D, 0);
 }
 
 void COpenStreetMap::EnableEasing(bool Enable)
@@ -639,10 +685,29 @@ void COpenStreetMap::EnableSubframeBoundaries(bool Enable)
    mDrawSubframeBoundaries = Enable;
 }
 
+void COpenStreetMap::RemoveLayer(CMapLayer* Layer)
+{
+   mLayers.erase(std::remove(mLayers.begin(), mLayers.end(), Layer), mLayers.end());
+}
+
+void COpenStreetMap::ResetPassTimers()
+{
+   for (CGlTimerQuery& timer : mPassTimer)
+      timer.Reset();
+}
+
+std::shared_ptr<CTexture> COpenStreetMap::GetTexture(const TDisplayList& List, size_t Index)
+{
+   // the no data png is one named texture for every tile without data
+   if (!List.HasData[Index])
+      return GetOrCreateTexture(NO_DATA_FILENAME, true);
+
+   return mTileService->AcquireTexture(List.Keys[Index]);
+}
+
 double COpenStreetMap::GetLatitudeFromTileY(int Y, int Zoom) 
 {
-   double n = M_PI - 2.0 * M_PI * (double)Y / (double)(1 << Zoom);
-   return atan(0.5 * (exp(n) - exp(-n))) * RADIANS_TO_DEGREES;
+   return CMercator::GetTileEdgeLatitude(Y, Zoom);
 }
 
 double COpenStreetMap::GetLongitudeFromTileX(int X, int Zoom) 
@@ -660,23 +725,30 @@ double COpenStreetMap::GetMetersPerPixelNs(int Zoom)
    return EQUATOR_CIRCUMFERENCE_M / (double)(1 << (Zoom + 8));
 }
 
+const char* COpenStreetMap::GetPassName(DrawPass Pass)
+{
+   switch (Pass)
+   {
+      case DrawPass::TILES:   return "Tiles";
+      case DrawPass::EASING:  return "Easing";
+      case DrawPass::OVERLAY: return "Overlay";
+      case DrawPass::DEBUG:   return "Debug";
+      default:                return "Unknown";
+   }
+}
+
 void COpenStreetMap::GetTileList(TTileList& TileList, double MapCenterLat, double MapCenterLon, int ZoomLevel, double ScaleX, double CoverageRadiusPixels)
 {
-   TCacheTag tile;
-   int       max_tiles = (1 << ZoomLevel);
-   int       x = GetTileX(MapCenterLon, ZoomLevel);
-   int       y = GetTileY(MapCenterLat, ZoomLevel);
-   int       level = 0; // 0=1x1, 1=3x3, 2=5x5...
-   bool      complete = false;
+   int  max_tiles = (1 << ZoomLevel);
+   int  x = GetTileX(MapCenterLon, ZoomLevel);
+   int  y = GetTileY(MapCenterLat, ZoomLevel);
+   int  level = 0; // 0=1x1, 1=3x3, 2=5x5...
+   bool complete = false;
 
    if (ZoomLevel < 2)
    {
       // just add the center tile to the coverage list
-      tile.Zoom = ZoomLevel;
-      tile.X = x;
-      tile.Y = y;
-
-      TileList.push_back(tile);
+      TileList.push_back(TTileKey::Make(ZoomLevel, x, y));
       return;
    }
    else
@@ -686,11 +758,7 @@ void COpenStreetMap::GetTileList(TTileList& TileList, double MapCenterLat, doubl
          if (level == 0)
          {
             // add the center tile to the coverage list
-            tile.Zoom = ZoomLevel;
-            tile.X = x;
-            tile.Y = y;
-
-            TileList.push_back(tile);
+            TileList.push_back(TTileKey::Make(ZoomLevel, x, y));
 
             level++;
          }
@@ -714,9 +782,7 @@ void COpenStreetMap::GetTileList(TTileList& TileList, double MapCenterLat, doubl
                }
 
                // add tile to the coverage list
-               tile.X = x;
-               tile.Y = y;
-               TileList.push_back(tile);
+               TileList.push_back(TTileKey::Make(ZoomLevel, x, y));
             }
 
             if (complete)
@@ -734,9 +800,7 @@ void COpenStreetMap::GetTileList(TTileList& TileList, double MapCenterLat, doubl
                }
 
                // add tile to the coverage list
-               tile.X = x;
-               tile.Y = y;
-               TileList.push_back(tile);
+               TileList.push_back(TTileKey::Make(ZoomLevel, x, y));
             }
 
             if (complete)
@@ -754,9 +818,7 @@ void COpenStreetMap::GetTileList(TTileList& TileList, double MapCenterLat, doubl
                }
 
                // add tile to the coverage list
-               tile.X = x;
-               tile.Y = y;
-               TileList.push_back(tile);
+               TileList.push_back(TTileKey::Make(ZoomLevel, x, y));
             }
 
             if (complete)
@@ -774,9 +836,7 @@ void COpenStreetMap::GetTileList(TTileList& TileList, double MapCenterLat, doubl
                }
 
                // add tile to the coverage list
-               tile.X = x;
-               tile.Y = y;
-               TileList.push_back(tile);
+               TileList.push_back(TTileKey::Make(ZoomLevel, x, y));
             }
 
             if (complete)
@@ -806,150 +866,264 @@ int COpenStreetMap::GetTileY(double Latitude, int Zoom)
 
 void COpenStreetMap::GetZoom()
 {
-   if (mMapScaleFactor >= 500000000.0)
-   {
-      mZoomLevel = 0;
-   }
-   else if (mMapScaleFactor >= 250000000.0)
-   {
-      mZoomLevel = 1;
-   }
-   else if (mMapScaleFactor >= 150000000.0)
-   {
-      mZoomLevel = 2;
-   }
-   else if (mMapScaleFactor >= 70000000.0)
-   {
-      mZoomLevel = 3;
-   }
-   else if (mMapScaleFactor >= 35000000.0)
-   {
-      mZoomLevel = 4;
-   }
-   else if (mMapScaleFactor >= 15000000.0)
-   {
-      mZoomLevel = 5;
-   }
-   else if (mMapScaleFactor >= 10000000.0)
-   {
-      mZoomLevel = 6;
-   }
-   else if (mMapScaleFactor >= 4000000.0)
-   {
-      mZoomLevel = 7;
-   }
-   else if (mMapScaleFactor >= 2000000.0)
-   {
-      mZoomLevel = 8;
-   }
-   else if (mMapScaleFactor >= 1000000.0)
-   {
-      mZoomLevel = 9;
-   }
-   else if (mMapScaleFactor >= 500000.0)
-   {
-      mZoomLevel = 10;
-   }
-   else if (mMapScaleFactor >= 250000.0)
-   {
-      mZoomLevel = 11;
-   }
-   else if (mMapScaleFactor >= 150000.0)
-   {
-      mZoomLevel = 12;
-   }
-   else if (mMapScaleFactor >= 70000.0)
-   {
-      mZoomLevel = 13;
-   }
-   else if (mMapScaleFactor >= 35000.0)
-   {
-      mZoomLevel = 14;
-   }
-   else if (mMapScaleFactor >= 15000.0)
+   int zoom_level = GetZoomForScale(mMapScaleFactor);
+
+   // a coarser level holds until the scale is below its threshold by the
+   // hysteresis, so a scale resting near one doesn't flip between two
+   // levels. Zooming out changes level at the threshold, a finer level than
+   // the scale needs would take four times the tiles.
+   if (zoom_level > mZoomLevel)
    {
-      mZoomLevel = 15;
+      double lower = mMapScale[mZoomLevel] * (1.0 - mZoomHysteresis);
+
+      if (mMapScaleFactor >= lower)
+         zoom_level = mZoomLevel;
    }
-   else if (mMapScaleFactor >= 8000.0)
+
+   if (zoom_level != mZoomLevel)
    {
-      mZoomLevel = 16;
+      mStats.AddZoomChange();
+      mZoomLevel = zoom_level;
    }
-   else if (mMapScaleFactor >= 4000.0)
+
+   mMapZoom = mMapScale[mZoomLevel] / mMapScaleFactor;
+   mMapScaleX = mMapZoom * cos(mMapCenterLat * DEGREES_TO_RADIANS);
+   mMapScaleY = mMapZoom * cos(mMapCenterLat * DEGREES_TO_RADIANS);
+}
+
+int COpenStreetMap::GetZoomForScale(double ScaleFactor)
+{
+   // the first level whose scale the factor reaches, the last two levels
+   // share a scale and the deepest is only used below it
+   for (int zoom_level = 0; zoom_level < MAX_ZOOM_LEVELS - 1; zoom_level++)
    {
-      mZoomLevel = 17;
+      if (ScaleFactor >= mMapScale[zoom_level])
+         return zoom_level;
    }
-   else if (mMapScaleFactor >= 2000.0)
+
+   return MAX_ZOOM_LEVELS - 1;
+}
+
+bool COpenStreetMap::GetSession(TMapSession& Session) const
+{
+   if (!mSessionLoaded)
+      return false;
+
+   Session = mSession;
+
+   return true;
+}
+
+bool COpenStreetMap::IsViewportComplete()
+{
+   bool complete;
+
+   mMutex.lock();
+
+   // the display list has to be for the current zoom level and centered
+   // on the current center tile
+   complete = !mDisplayList.Empty() &&
+              (mDisplayList.Keys[0] == TTileKey::Make(mZoomLevel,
+                                                      GetTileX(mMapCenterLon, mZoomLevel),
+                                                      GetTileY(mMapCenterLat, mZoomLevel)));
+
+   for (size_t i = 0; complete && i < mDisplayList.Size(); i++)
    {
-      mZoomLevel = 18;
+      if (!mDisplayList.HasData[i])
+         complete = false;
    }
-   else if (mMapScaleFactor >= 1000.0)
+
+   mMutex.unlock();
+
+   return complete;
+}
+
+bool COpenStreetMap::LoadSession()
+{
+   std::ifstream session_file(mSessionFilename, std::ios::in | std::ios::binary);
+   uint32_t      header[3] = { 0, 0, 0 };
+   TMapSession   session = {};
+   TTileList     keys;
+
+   if (!session_file)
+      return false;
+
+   session_file.read((char*)header, sizeof(header));
+   session_file.read((char*)&session.Latitude, sizeof(session.Latitude));
+   session_file.read((char*)&session.Longitude, sizeof(session.Longitude));
+   session_file.read((char*)&session.RotationDeg, sizeof(session.RotationDeg));
+   session_file.read((char*)&session.ScaleFactor, sizeof(session.ScaleFactor));
+   session_file.read((char*)&session.ZoomLevel, sizeof(session.ZoomLevel));
+
+   if (!session_file || header[0] != SESSION_MAGIC || header[1] != SESSION_VERSION ||
+       header[2] > TILE_SERVICE_RECORDS || session.ZoomLevel < 0 || session.ZoomLevel >= MAX_ZOOM_LEVELS ||
+       !(session.ScaleFactor > 0.0f))
    {
-      mZoomLevel = 19;
+      ExecApiLogWarning("OpenStreetMap: ignoring %s, unknown format", mSessionFilename.c_str());
+      return false;
    }
-   else
+
+   keys.resize(header[2]);
+   session_file.read((char*)keys.data(), keys.size() * sizeof(TTileKey));
+
+   if (!session_file)
+      keys.clear();
+
+   mSession = session;
+   mSessionLoaded = true;
+
+   mMapCenterLat = session.Latitude;
+   mMapCenterLon = session.Longitude;
+   mMapRotation = -session.RotationDeg;
+   mMapScaleFactor = session.ScaleFactor;
+   mSettleScaleFactor = session.ScaleFactor;
+   mZoomLevel = session.ZoomLevel;
+
+   Update();
+
+   // the tiles of one level, placed from the first the way the coverage
+   // thread does. It replaces the list once its first pass is done.
+   for (TTileKey key : keys)
    {
-      mZoomLevel = 20;
+      int tiles;
+
+      if (key.GetZoom() != keys[0].GetZoom() || key.GetZoom() >= MAX_ZOOM_LEVELS)
+         continue;
+
+      // a damaged file could name tiles outside the level
+      tiles = 1 << key.GetZoom();
+
+      if (key.GetX() < 0 || key.GetX() >= tiles || key.GetY() < 0 || key.GetY() >= tiles)
+         continue;
+
+      if (mDisplayList.Empty())
+      {
+         int zoom = key.GetZoom();
+
+         mDisplayList.Latitude  = (GetLatitudeFromTileY(key.GetY(), zoom) + GetLatitudeFromTileY(key.GetY() + 1, zoom)) / 2.0;
+         mDisplayList.Longitude = (GetLongitudeFromTileX(key.GetX(), zoom) + GetLongitudeFromTileX(key.GetX() + 1, zoom)) / 2.0;
+         mDisplayList.Zoom      = zoom;
+      }
+
+      mDisplayList.Keys.push_back(key);
+      mDisplayList.Textures.push_back(nullptr);
+      mDisplayList.Offsets.push_back(glm::vec2((float)(key.GetX() - mDisplayList.Keys[0].GetX()),
+                                               (float)(key.GetY() - mDisplayList.Keys[0].GetY())));
+      mDisplayList.HasData.push_back(1);
    }
 
-   mMapZoom = mMapScale[mZoomLevel] / mMapScaleFactor;
-   mMapScaleX = mMapZoom * cos(mMapCenterLat * DEGREES_TO_RADIANS);
-   mMapScaleY = mMapZoom * cos(mMapCenterLat * DEGREES_TO_RADIANS);
+   mTileService->Preload(mDisplayList.Keys);
+
+   return true;
 }
 
 bool COpenStreetMap::Open(bool        WmtsEnabled,
                           const char* WmtsUrl,
                           bool        CacheEnabled,
-                          const char* CachePath)
+                          const char* CachePath,
+                          const char* SessionName)
 {
+   using usec = std::chrono::microseconds;
+
    if (mCoverageThread.joinable())
    {
       return false;
    }
 
-   EnableWmtsServer(WmtsEnabled, WmtsUrl);
-   EnableCache(CacheEnabled, CachePath);
-
-   // Open the WMTS interface
-   if (mWmtsEnabled)
-   {
-      std::string    capabilities_filename;
-      unsigned char* buffer;
-      int            size;
-      bool           got_capabilities = false;
+   mOpenTime = TClock::now();
 
-      // Get the wmts capabilities
-      if (mWmtsIf.Open(mWmtsUrl.c_str(), 10))
-         got_capabilities = mWmtsIf.GetWmtsCapabilitiesXml(&buffer, size);
+   // maps on the same server and cache path share one tile service, the
+   // server is discovered in the background
+   mTileService = CTileService::Acquire(WmtsEnabled ? WmtsUrl : nullptr,
+                                        CacheEnabled ? CachePath : nullptr);
 
-      // write the wms capabilities to the file
-      if (CachePath && got_capabilities && size)
-      {
-         capabilities_filename = CachePath;
-         capabilities_filename += "/osm_wmts_capabilities.xml";
+   mStateCallbackId = mTileService->AddStateCallback([this](ServerState State)
+   {
+      if (State == ServerState::ONLINE)
+         mStats.RecordStartup(StartupEvent::SERVER_ONLINE, std::chrono::duration_cast<usec>(TClock::now() - mOpenTime).count());
 
-         std::ofstream wmts_capabilities_file(
-               capabilities_filename,
-               std::ios::out | std::ios::binary | std::ios::trunc);
+      std::lock_guard<std::mutex> lock(mStateCallbackMutex);
 
-         wmts_capabilities_file.write((char*)buffer, size);
+      if (mStateCallback)
+         mStateCallback(State);
+   });
 
-         mWmtsOnline = true;
-      }
-      else
-      {
-         ExecApiLogWarning("Failed to connect with WMTS server");
-         mWmtsTimeout = SERVER_TIMEOUT;
-         mWmtsOnline = false;
-      }
+   // a session needs the disk cache, the tiles are restored from it
+   if (SessionName && !mTileService->GetCachePath().empty())
+   {
+      mSessionFilename = mTileService->GetCachePath() + SessionName + OSM_SESSION_SUFFIX;
+      LoadSession();
    }
 
    // kick off the coverage thread
    if (!mCoverageThread.joinable())
       mCoverageThread = std::thread(&COpenStreetMap::CoverageThread, this);
 
+   mStats.RecordStartup(StartupEvent::OPEN, std::chrono::duration_cast<usec>(TClock::now() - mOpenTime).count());
+
    return true;
 }
 
+void COpenStreetMap::RecordTextureLoad(const std::shared_ptr<CTexture>& Texture)
+{
+   TTextureLoadTimes times;
+
+   // only textures created just now report their load times
+   if (!Texture || !Texture->TakeLoadTimes(times))
+      return;
+
+   mStats.GetLatency(TileStage::DISK).Record(times.ReadUs);
+   mStats.GetLatency(TileStage::DECODE).Record(times.DecodeUs);
+   mStats.GetLatency(TileStage::UPLOAD).Record(times.UploadUs);
+   mStats.AddBytesRead(times.FileSize);
+}
+
+void COpenStreetMap::SaveSession()
+{
+   TMapSession session;
+   TTileList   keys;
+
+   session.Latitude    = mMapCenterLat;
+   session.Longitude   = mMapCenterLon;
+   session.RotationDeg = -mMapRotation;
+   session.ScaleFactor = mMapScaleFactor;
+   session.ZoomLevel   = mZoomLevel;
+
+   for (size_t i = 0; i < mDisplayList.Size(); i++)
+   {
+      if (mDisplayList.HasData[i])
+         keys.push_back(mDisplayList.Keys[i]);
+   }
+
+   // written next to the session and renamed, a crash leaves the old one
+   std::string     temp_filename = mSessionFilename + ".tmp";
+   std::error_code err;
+
+   {
+      std::ofstream session_file(temp_filename, std::ios::out | std::ios::binary | std::ios::trunc);
+      uint32_t      header[3] = { SESSION_MAGIC, SESSION_VERSION, (uint32_t)keys.size() };
+
+      session_file.write((const char*)header, sizeof(header));
+      session_file.write((const char*)&session.Latitude, sizeof(session.Latitude));
+      session_file.write((const char*)&session.Longitude, sizeof(session.Longitude));
+      session_file.write((const char*)&session.RotationDeg, sizeof(session.RotationDeg));
+      session_file.write((const char*)&session.ScaleFactor, sizeof(session.ScaleFactor));
+      session_file.write((const char*)&session.ZoomLevel, sizeof(session.ZoomLevel));
+      session_file.write((const char*)keys.data(), keys.size() * sizeof(TTileKey));
+
+      if (!session_file.good())
+      {
+         ExecApiLogWarning("OpenStreetMap: unable to write %s", temp_filename.c_str());
+         return;
+      }
+   }
+
+   std::filesystem::rename(temp_filename, mSessionFilename, err);
+
+   if (err)
+      ExecApiLogWarning("OpenStreetMap: unable to rename %s, %s", temp_filename.c_str(), err.message().c_str());
+}
+
 void COpenStreetMap::SetMapCenter(double MapCenterLat, double MapCenterLon)
 {
    mMutex.lock();
@@ -972,6 +1146,15 @@ void COpenStreetMap::SetMapRotation(double RotationClockwiseDeg)
 void COpenStreetMap::SetMapScaleFactor(float ScaleFactor)
 {
    mMutex.lock();
+
+   // the tail of an eased zoom creeps for a long time, only moves past the
+   // threshold restart the settle time
+   if (fabs(ScaleFactor - mSettleScaleFactor) > mSettleScaleFactor * ZOOM_SETTLE_CHANGE)
+   {
+      mScaleChangeTime = TClock::now();
+      mSettleScaleFactor = ScaleFactor;
+   }
+
    mMapScaleFactor = ScaleFactor;
    mMutex.unlock();
 }
@@ -984,12 +1167,39 @@ void COpenStreetMap::SetMapSize(int MapWidthPix, int MapHeightPix)
    mMutex.unlock();
 }
 
+void COpenStreetMap::SetServerStateCallback(CTileService::TStateCallback Callback)
+{
+   {
+      std::lock_guard<std::mutex> lock(mStateCallbackMutex);
+      mStateCallback = Callback;
+   }
+
+   // the service calls it with the state once registered, a map already
+   // open does the same
+   if (Callback && mTileService)
+      Callback(mTileService->GetServerState());
+}
+
 void COpenStreetMap::SetWindowSize(int WinWidthPix, int WinHeightPix)
 {
    mWinWidthPix  = WinWidthPix;
    mWinHeightPix = WinHeightPix;
 }
 
+void COpenStreetMap::SetZoomHysteresis(double Hysteresis)
+{
+   mMutex.lock();
+   mZoomHysteresis = std::max(Hysteresis, 0.0);
+   mMutex.unlock();
+}
+
+void COpenStreetMap::SetZoomSettleMs(int SettleMs)
+{
+   mMutex.lock();
+   mZoomSettleMs = std::max(SettleMs, 0);
+   mMutex.unlock();
+}
+
 void COpenStreetMap::Update()
 {
    mMutex.lock();
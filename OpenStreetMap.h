@@ -1,30 +1,100 @@
 
 #pragma once
 
+#include <chrono>
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <thread>
 #include <mutex>
 #include <memory>
 #include <glm/glm.hpp>
-#include "WmtsIf.h"
 #include "Shader.h"
-#include "Cache.h"
+#include "FrameArena.h"
+#include "GlTimerQuery.h"
+#include "MapLayer.h"
+#include "MapStats.h"
 #include "Texture.h"
+#include "TileFormat.h"
+#include "TileKey.h"
+#include "TileService.h"
 
 #define OSM_IMAGE_CACHE_SIZE 1024
 #define OSM_TILE_SIZE        256
-#define SERVER_TIMEOUT       200 // cycles before trying server again
 #define MAX_ZOOM_LEVELS      21
+#define ZOOM_HYSTERESIS      0.15 // share of a threshold the scale has to drop below it by to zoom in a level
+#define ZOOM_SETTLE_MS       300  // time the scale has to hold still before missing tiles are fetched
+#define ZOOM_SETTLE_CHANGE   0.02 // share the scale has to move by to count as changing
+#define OSM_SESSION_SUFFIX   ".session" // after the session name given to Open, in the cache path
+
+// Render passes in Draw, each is timed on the gpu and the cpu
+enum class DrawPass
+{
+   TILES,   // current display list, includes texture uploads
+   EASING,  // tiles fading out after a zoom change
+   OVERLAY, // map border
+   DEBUG,   // subframe boundaries, viewport and coverage area
+   NUM_PASSES
+};
+
+// The view a map was closed at, restored with its tiles by Open
+struct TMapSession
+{
+   double Latitude;
+   double Longitude;
+   double RotationDeg;  // clockwise, as SetMapRotation takes it
+   float  ScaleFactor;
+   int    ZoomLevel;
+};
 
 class COpenStreetMap
 {
 public:
+   // One zoom level of tiles as parallel arrays. The coverage thread fills
+   // in the keys and placements, the render thread the textures, and every
+   // tile is placed by the tile shader from its offset and one set of view
+   // uniforms.
+   struct TDisplayList
+   {
+      std::vector<TTileKey>                  Keys;
+      std::vector<std::shared_ptr<CTexture>> Textures;        // null until the tile is first drawn
+      std::vector<glm::vec2>                 Offsets;         // tiles east and south of the first tile
+      std::vector<uint8_t>                   HasData;         // the no data png is drawn without
+      double                                 Latitude = 0.0;  // center of the first tile
+      double                                 Longitude = 0.0;
+      int                                    Zoom = 0;
+      int                                    Age = 0;         // frames left to fade out, easing lists only
+
+      void Clear();
+      bool Empty() const { return Keys.empty(); }
+      size_t Size() const { return Keys.size(); }
+   };
+
+   using TTileList = std::vector<TTileKey>;
+   using TClock = std::chrono::steady_clock;
+
    COpenStreetMap();
    ~COpenStreetMap();
 
+   // drawn in order in the overlay pass, the map does not own the layers
+   void AddLayer(CMapLayer* Layer);
+
    void Close();
 
+   // disk cache layout, CachePath ends in '/'
+   static std::string ConstructFilename(const std::string& CachePath, int Zoom, int X, int Y,
+                                        TileFormat Format = TileFormat::PNG);
+
+   static std::string ConstructFilename(const std::string& CachePath, TTileKey Key,
+                                        TileFormat Format = TileFormat::PNG)
+   {
+      return ConstructFilename(CachePath, Key.GetZoom(), Key.GetX(), Key.GetY(), Format);
+   }
+
+   // the same name into a buffer, without allocating, false if it doesn't fit
+   static bool ConstructFilename(char* Filename, size_t Size, const std::string& CachePath, TTileKey Key,
+                                 TileFormat Format = TileFormat::PNG);
+
    void Draw();
 
    void EnableBorder(bool Enable) { mBorderEnabled = Enable; }
@@ -34,13 +104,55 @@ public:
 
    int GetCenterTileX() const { return mCenterTileX; }
    int GetCenterTileY() const { return mCenterTileY; }
+   // where the last Draw put the map, only read from the render thread
+   const TMapView& GetMapView() const { return mMapView; }
    double GetMapZoom() const { return mMapZoom; }
+   static const char* GetPassName(DrawPass Pass);
+   // rolling gpu and cpu submission times, only read from the render thread
+   const CGlTimerQuery& GetPassTimer(DrawPass Pass) const { return mPassTimer[(int)Pass]; }
+   // the view restored by Open, false without a session file. The map
+   // starts at it, an application keeping its own view state takes it
+   // from here.
+   bool GetSession(TMapSession& Session) const;
+   // per stage latencies and cache tier hit rates, safe to read from any thread
+   CMapStats& GetStats() { return mStats; }
+   // fetches, disk cache and textures shared with the other maps on the
+   // same server and cache path, null until opened
+   const std::shared_ptr<CTileService>& GetTileService() const { return mTileService; }
    int GetZoomLevel() const { return mZoomLevel; }
 
+   // tile coverage and mercator helpers, these don't depend on the map state
+   static double GetLatitudeFromTileY(int Y, int Zoom);
+
+   static double GetLongitudeFromTileX(int X, int Zoom);
+
+   static double GetMetersPerPixelEw(double Latitude, int Zoom);
+
+   static double GetMetersPerPixelNs(int Zoom);
+
+   static void GetTileList(TTileList& TileList, double MapCenterLat, double MapCenterLon, int ZoomLevel, double ScaleX, double CoverageRadiusPixels);
+
+   static int GetTileX(double Longitude, int Zoom);
+
+   static int GetTileY(double Latitude, int Zoom);
+
+   // true once every tile covering the current view is drawn with map data
+   bool IsViewportComplete();
+
+   // With a SessionName the view and the tiles on screen are saved to the
+   // cache path by Close and restored here, the tiles decoded in parallel,
+   // so the first frames show the previous view instead of an empty map.
+   // Maps sharing a cache path need different names.
    bool Open(bool        WmtsEnabled,
              const char* WmtsUrl,
              bool        CacheEnabled,
-             const char* CachePath);
+             const char* CachePath,
+             const char* SessionName = nullptr);
+
+   void RemoveLayer(CMapLayer* Layer);
+
+   // starts the rolling pass times over, only from the render thread
+   void ResetPassTimers();
 
    void SetBorderColor(const glm::vec4& Color) { mBorderColor = Color; }
 
@@ -58,120 +170,125 @@ public:
 
    void SetProjection(const glm::mat4& Projection) { mMapProjection = Projection; }
 
-   void SetShaders(std::shared_ptr<CShader> ShaderRect, std::shared_ptr<CShader> ShaderLine)
+   // Told the tile server state, before or after Open. Open doesn't wait
+   // for the server, the map starts from the disk cache and fetches once
+   // the server answers. Called right away with the current state, then
+   // on the thread that found it changed.
+   void SetServerStateCallback(CTileService::TStateCallback Callback);
+
+   // the tiles are drawn with ShaderTile, data/shaders/tile.vert
+   void SetShaders(std::shared_ptr<CShader> ShaderRect,
+                   std::shared_ptr<CShader> ShaderLine,
+                   std::shared_ptr<CShader> ShaderTile)
    {
       mShaderRect = ShaderRect;
       mShaderLine = ShaderLine;
+      mShaderTile = ShaderTile;
    }
 
    void SetWindowSize(int WinWidthPix, int WinHeightPix);
 
-   void Update();
+   // 0 switches levels exactly at the thresholds
+   void SetZoomHysteresis(double Hysteresis);
 
-private:
+   // while the scale is changing tiles come from the caches only, 0 fetches
+   // every level the scale passes through
+   void SetZoomSettleMs(int SettleMs);
 
-   static const double mMapScale[MAX_ZOOM_LEVELS];
-
-   struct TTile
-   {
-      std::shared_ptr<CTexture> Texture;
-      std::string               Filename;
-      double                    Latitude;
-      double                    Longitude;
-      int                       ZoomLevel;
-      int                       TileX;
-      int                       TileY;
-      int                       Age;
-   };
+   void Update();
 
-   struct TCacheTag
-   {
-      int Zoom;
-      int X;
-      int Y;
-
-      bool operator==(const TCacheTag& That)
-      {
-         return (this->Zoom == That.Zoom) &&
-                (this->X == That.X) &&
-                (this->Y == That.Y);
-      }
-   };
+private:
 
-   using TTileList = std::vector<TCacheTag>;
-   using TImageCache = Cache<TTile, TCacheTag, OSM_IMAGE_CACHE_SIZE>;
+   // the benchmark drives UpdateCache directly with a fake tile source
+   friend class COsmBenchmark;
 
-   std::string ConstructFilename(int Zoom, int X, int Y);
+   static const double mMapScale[MAX_ZOOM_LEVELS];
 
    void CoverageThread();
 
-   void UpdateCache(TTileList&          TileList,
-                    std::vector<TTile>& DisplayListScratchpad,
-                    std::vector<TTile>& DisplayListTrashScratchpad,
-                    TImageCache&        ImageCache);
-
-   void EnableCache(bool Enable, const char* CachePath = nullptr);
-
-   void EnableWmtsServer(bool Enable, const char* WmtsUrl = nullptr);
-
-   double GetLatitudeFromTileY(int Y, int Zoom);
-
-   double GetLongitudeFromTileX(int X, int Zoom);
-
-   double GetMetersPerPixelEw(double Latitude, int Zoom);
-
-   double GetMetersPerPixelNs(int Zoom);
-
-   void GetTileList(TTileList& TileList, double MapCenterLat, double MapCenterLon, int ZoomLevel, double ScaleX, double CoverageRadiusPixels);
+   // with CacheOnly tiles missing from the memory and disk caches are left
+   // off the display list instead of fetched
+   void UpdateCache(TTileList&    TileList,
+                    TDisplayList& DisplayListScratchpad,
+                    bool          CacheOnly = false);
 
-   int GetTileX(double Longitude, int Zoom);
+   // render thread, one draw per tile with only its offset and texture
+   // changing between draws. Origin is the first tile center in pixels from
+   // the map center and Scale the map scale of the list's zoom level.
+   void DrawTiles(TDisplayList& List, const glm::vec2& Origin, const glm::vec2& Scale, float Alpha);
 
-   int GetTileY(double Latitude, int Zoom);
+   // the texture for a display list tile, render thread
+   std::shared_ptr<CTexture> GetTexture(const TDisplayList& List, size_t Index);
 
    void GetZoom();
 
-   CWmtsIf                  mWmtsIf;
-   std::thread              mCoverageThread;
-   std::mutex               mMutex;
-   std::vector<TTile>       mDisplayList;
-   std::vector<TTile>       mDisplayListEasing;
-   std::vector<TTile>       mDisplayListTrash;
-   std::string              mCachePath;
-   std::string              mWmtsUrl;
-   glm::mat4                mMapProjection;
-   glm::vec4                mBorderColor;
-   std::shared_ptr<CShader> mShaderRect;
-   std::shared_ptr<CShader> mShaderLine;
-   TTile                    mNoDataTile;
-   double                   mMapCenterLat;
-   double                   mMapCenterLon;
-   double                   mMapZoom;
-   double                   mMapScaleX;
-   double                   mMapScaleY;
-   double                   mMapBrightness;
-   double                   mMapRotation;
-   double                   mDegPerPixNs;
-   double                   mDegPerPixEw;
-   double                   mMetersPerPixNs;
-   double                   mMetersPerPixEw;
-   float                    mMapScaleFactor;
-   float                    mCoverageRadiusScaleFactor;
-   int                      mCenterTileX;
-   int                      mCenterTileY;
-   int                      mMapOffsetX;
-   int                      mMapOffsetY;
-   int                      mMapWidthPix;
-   int                      mMapHeightPix;
-   int                      mWinWidthPix;
-   int                      mWinHeightPix;
-   int                      mZoomLevel;
-   int                      mWmtsTimeout;
-   bool                     mTerminateCoverageThread;
-   bool                     mDrawSubframeBoundaries;
-   bool                     mEasingEnabled;
-   bool                     mCacheEnabled;
-   bool                     mWmtsEnabled;
-   bool                     mWmtsOnline;
-   bool                     mBorderEnabled;
-   bool                     mClipEnabled;
+   // level for a scale factor with no hysteresis
+   static int GetZoomForScale(double ScaleFactor);
+
+   // before the coverage thread starts, the display list is rebuilt from
+   // the saved tile keys
+   bool LoadSession();
+
+   void RecordTextureLoad(const std::shared_ptr<CTexture>& Texture);
+
+   // after the coverage thread stops, the tiles with data in display order,
+   // so the center is preloaded first
+   void SaveSession();
+
+   CMapStats                     mStats;
+   CGlTimerQuery                 mPassTimer[(int)DrawPass::NUM_PASSES];
+   std::thread                   mCoverageThread;
+   std::mutex                    mMutex;
+   std::mutex                    mStateCallbackMutex;
+   CTileService::TStateCallback  mStateCallback;
+   TDisplayList                  mDisplayList;
+   std::vector<TDisplayList>     mDisplayListEasing; // levels fading out, oldest first
+   std::vector<glm::mat4>        mSubframeModels;
+   CFrameArena                   mFrameArena;        // Draw's outlines, reset at the end of every Draw
+   std::vector<CMapLayer*>       mLayers;
+   glm::mat4                     mMapProjection;
+   glm::vec4                     mBorderColor;
+   std::shared_ptr<CShader>      mShaderRect;
+   std::shared_ptr<CShader>      mShaderLine;
+   std::shared_ptr<CShader>      mShaderTile;
+   std::shared_ptr<CTileService> mTileService;
+   std::string                   mSessionFilename;   // empty without a session
+   TMapSession                   mSession;
+   TMapView                      mMapView;
+   TClock::time_point            mOpenTime;          // startup times are from here
+   TClock::time_point            mScaleChangeTime;
+   double                        mMapCenterLat;
+   double                        mMapCenterLon;
+   double                        mMapZoom;
+   double                        mMapScaleX;
+   double                        mMapScaleY;
+   double                        mMapBrightness;
+   double                        mMapRotation;
+   double                        mDegPerPixNs;
+   double                        mDegPerPixEw;
+   double                        mMetersPerPixNs;
+   double                        mMetersPerPixEw;
+   double                        mZoomHysteresis;
+   double                        mSettleScaleFactor; // where the scale last counted as changing
+   float                         mMapScaleFactor;
+   float                         mCoverageRadiusScaleFactor;
+   int                           mCenterTileX;
+   int                           mCenterTileY;
+   int                           mMapOffsetX;
+   int                           mMapOffsetY;
+   int                           mMapWidthPix;
+   int                           mMapHeightPix;
+   int                           mWinWidthPix;
+   int                           mWinHeightPix;
+   int                           mZoomLevel;
+   int                           mZoomSettleMs;
+   int                           mStateCallbackId;   // 0 when not registered with the service
+   bool                          mTerminateCoverageThread;
+   bool                          mDrawSubframeBoundaries;
+   bool                          mEasingEnabled;
+   bool                          mBorderEnabled;
+   bool                          mClipEnabled;
+   bool                          mSessionLoaded;
+
+   static unsigned int           mTileVAO;           // no buffers, the tile shader builds the quad
 };
@@ -0,0 +1,630 @@
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <cmath>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include "json/json.h"
+#include "stb_image.h"
+#include "Cache.h"
+#include "Mercator.h"
+#include "OpenStreetMap.h"
+
+#define BENCH_MIN_TIME_SEC   0.25
+#define BENCH_MAX_ITERATIONS 1000000000L
+#define BENCH_CENTER_LAT     38.93916666
+#define BENCH_CENTER_LON     -77.46
+#define BENCH_PROJECTION_POINTS    4096
+#define BENCH_PROJECTION_ZOOM      20
+#define BENCH_PROJECTION_MAX_PIXEL 1.0e-6 // batch against scalar, in pixels at BENCH_PROJECTION_ZOOM
+#define BENCH_PROJECTION_MAX_DEG   1.0e-12
+
+// keeps the optimizer from discarding a benchmarked result
+template<typename T>
+inline void DoNotOptimize(const T& Value)
+{
+   asm volatile("" : : "r,m"(Value) : "memory");
+}
+
+class COsmBenchmark
+{
+public:
+   COsmBenchmark(const char* Filter);
+
+   void Run();
+
+   bool IsFailed() const { return mFailed; }
+
+   bool Write(const char* Filename);
+
+private:
+
+   template<typename TFunc>
+   void Measure(const std::string& Name, const Json::Value& Params, TFunc Func);
+
+   template<int CAPACITY>
+   void BenchCache();
+
+   void BenchConstructFilename();
+
+   void BenchGetTileList();
+
+   void BenchMercator();
+
+   void BenchPngDecode();
+
+   void BenchProjection();
+
+   void BenchTileKey();
+
+   void BenchUpdateCache();
+
+   bool Selected(const std::string& Name) const;
+
+   Json::Value mResults;
+   std::string mFilter;
+   bool        mFailed;
+};
+
+COsmBenchmark::COsmBenchmark(const char* Filter)
+   : mResults(Json::arrayValue),
+     mFilter(Filter ? Filter : ""),
+     mFailed(false)
+{
+}
+
+template<typename TFunc>
+void COsmBenchmark::Measure(const std::string& Name, const Json::Value& Params, TFunc Func)
+{
+   using clock = std::chrono::steady_clock;
+
+   long   iterations = 1;
+   double elapsed_sec = 0.0;
+
+   if (!Selected(Name)) return;
+
+   // grow the iteration count until the run is long enough to be stable
+   while (true)
+   {
+      auto start = clock::now();
+      Func(iterations);
+      elapsed_sec = std::chrono::duration<double>(clock::now() - start).count();
+
+      if (elapsed_sec >= BENCH_MIN_TIME_SEC || iterations >= BENCH_MAX_ITERATIONS)
+         break;
+
+      if (elapsed_sec <= 0.0)
+         iterations *= 10;
+      else
+         iterations = std::min(BENCH_MAX_ITERATIONS, (long)(iterations * std::min(10.0, 1.5 * BENCH_MIN_TIME_SEC / elapsed_sec)) + 1);
+   }
+
+   Json::Value result;
+   double      ns_per_op = elapsed_sec * 1.0e9 / (double)iterations;
+
+   result["name"]        = Name;
+   result["params"]      = Params;
+   result["iterations"]  = (Json::Int64)iterations;
+   result["ns_per_op"]   = ns_per_op;
+   result["ops_per_sec"] = 1.0e9 / ns_per_op;
+   mResults.append(result);
+
+   fprintf(stderr, "%-48s %12ld iterations %14.1f ns/op\n", Name.c_str(), iterations, ns_per_op);
+}
+
+template<int CAPACITY>
+void COsmBenchmark::BenchCache()
+{
+   using TCache = Cache<TTileKey, TTileKey, CAPACITY>;
+
+   TTileKey    tile{};
+   TCache      cache;
+   Json::Value params;
+   std::string suffix = "/capacity:" + std::to_string(CAPACITY);
+
+   params["capacity"] = CAPACITY;
+
+   // fill the cache with realistic tiles, the front holds the most recent
+   for (int i = 0; i < CAPACITY; i++)
+   {
+      tile = TTileKey::Make(14, 4600 + i, 6200);
+      cache.PutFront(tile, tile);
+   }
+
+   Measure("Cache/LookupHitFront" + suffix, params, [&](long Iterations)
+   {
+      TTileKey item;
+      TTileKey front = TTileKey::Make(14, 4600 + CAPACITY - 1, 6200);
+
+      for (long i = 0; i < Iterations; i++)
+      {
+         DoNotOptimize(cache.Get(item, front));
+      }
+   });
+
+   Measure("Cache/LookupHitBack" + suffix, params, [&](long Iterations)
+   {
+      TTileKey item;
+      TTileKey back;
+
+      // every hit moves the back to the front, the tag to look up is read
+      // off the back each time so every call, calibration included, hits it
+      for (long i = 0; i < Iterations; i++)
+      {
+         cache.Peek(back, CAPACITY - 1);
+         DoNotOptimize(cache.Get(item, back));
+      }
+   });
+
+   Measure("Cache/LookupMiss" + suffix, params, [&](long Iterations)
+   {
+      TTileKey item;
+      TTileKey missing = TTileKey::Make(15, 0, 0);
+
+      for (long i = 0; i < Iterations; i++)
+      {
+         DoNotOptimize(cache.Get(item, missing));
+      }
+   });
+
+   Measure("Cache/Insert" + suffix, params, [&](long Iterations)
+   {
+      TCache empty_cache;
+
+      for (long i = 0; i < Iterations; i++)
+      {
+         if (empty_cache.IsFull())
+            empty_cache.Clear();
+
+         empty_cache.PutFront(tile, TTileKey::Make(14, (int)(i & 0xffff), 6200));
+      }
+   });
+
+   Measure("Cache/EvictInsert" + suffix, params, [&](long Iterations)
+   {
+      TTileKey trash;
+
+      // the same sequence UpdateCache runs when the cache is full
+      for (long i = 0; i < Iterations; i++)
+      {
+         if (cache.IsFull())
+            cache.GetBack(trash);
+
+         cache.PutFront(tile, TTileKey::Make(16, (int)(i & 0xffff), 6200));
+      }
+   });
+}
+
+void COsmBenchmark::BenchConstructFilename()
+{
+   std::string cache_path = "data/map/";
+
+   Measure("ConstructFilename", Json::Value(Json::objectValue), [&](long Iterations)
+   {
+      for (long i = 0; i < Iterations; i++)
+      {
+         std::string filename = COpenStreetMap::ConstructFilename(cache_path, 14, 4600 + (int)(i & 0xff), 6200);
+         DoNotOptimize(filename.data());
+      }
+   });
+}
+
+void COsmBenchmark::BenchGetTileList()
+{
+   const int window_sizes[][2] = { { 640, 480 }, { 1920, 1080 }, { 3840, 2160 } };
+
+   for (const auto& size : window_sizes)
+   {
+      for (int zoom = 0; zoom < MAX_ZOOM_LEVELS; zoom++)
+      {
+         COpenStreetMap::TTileList tile_list;
+         Json::Value               params;
+         double                    scale_x = cos(BENCH_CENTER_LAT * M_PI / 180.0);
+         double                    radius = sqrt((size[0] * 0.5) * (size[0] * 0.5) +
+                                                 (size[1] * 0.5) * (size[1] * 0.5));
+
+         COpenStreetMap::GetTileList(tile_list, BENCH_CENTER_LAT, BENCH_CENTER_LON, zoom, scale_x, radius);
+
+         params["zoom"]   = zoom;
+         params["width"]  = size[0];
+         params["height"] = size[1];
+         params["tiles"]  = (int)tile_list.size();
+
+         Measure("GetTileList/zoom:" + std::to_string(zoom) + "/size:" +
+                 std::to_string(size[0]) + "x" + std::to_string(size[1]), params,
+                 [&](long Iterations)
+         {
+            for (long i = 0; i < Iterations; i++)
+            {
+               tile_list.clear();
+               COpenStreetMap::GetTileList(tile_list, BENCH_CENTER_LAT, BENCH_CENTER_LON, zoom, scale_x, radius);
+               DoNotOptimize(tile_list.data());
+            }
+         });
+      }
+   }
+}
+
+void COsmBenchmark::BenchMercator()
+{
+   Json::Value params(Json::objectValue);
+
+   Measure("Mercator/GetTileX", params, [&](long Iterations)
+   {
+      for (long i = 0; i < Iterations; i++)
+      {
+         double lon = -180.0 + (double)(i & 0xffff) * (360.0 / 65536.0);
+         DoNotOptimize(COpenStreetMap::GetTileX(lon, (int)(i % MAX_ZOOM_LEVELS)));
+      }
+   });
+
+   Measure("Mercator/GetTileY", params, [&](long Iterations)
+   {
+      for (long i = 0; i < Iterations; i++)
+      {
+         double lat = -85.0 + (double)(i & 0xffff) * (170.0 / 65536.0);
+         DoNotOptimize(COpenStreetMap::GetTileY(lat, (int)(i % MAX_ZOOM_LEVELS)));
+      }
+   });
+
+   Measure("Mercator/GetLatitudeFromTileY", params, [&](long Iterations)
+   {
+      for (long i = 0; i < Iterations; i++)
+      {
+         int zoom = (int)(i % MAX_ZOOM_LEVELS);
+         DoNotOptimize(COpenStreetMap::GetLatitudeFromTileY((int)(i & ((1 << zoom) - 1)), zoom));
+      }
+   });
+}
+
+void COsmBenchmark::BenchProjection()
+{
+   std::vector<double> latitude(BENCH_PROJECTION_POINTS);
+   std::vector<double> longitude(BENCH_PROJECTION_POINTS);
+   std::vector<double> x(BENCH_PROJECTION_POINTS);
+   std::vector<double> y(BENCH_PROJECTION_POINTS);
+   std::vector<double> x_reference(BENCH_PROJECTION_POINTS);
+   std::vector<double> y_reference(BENCH_PROJECTION_POINTS);
+   Json::Value         params;
+   double              scale = CMercator::GetPixelScale(BENCH_PROJECTION_ZOOM);
+
+   params["points"] = BENCH_PROJECTION_POINTS;
+   params["zoom"]   = BENCH_PROJECTION_ZOOM;
+
+   // covers the whole map with the poles and the equator included
+   for (int i = 0; i < BENCH_PROJECTION_POINTS; i++)
+   {
+      latitude[i]  = -85.0511 + 2.0 * 85.0511 * (double)i / (double)(BENCH_PROJECTION_POINTS - 1);
+      longitude[i] = -180.0 + fmod((double)i * 137.50776405, 360.0);
+   }
+
+   Measure("Projection/Project/batch", params, [&](long Iterations)
+   {
+      for (long i = 0; i < Iterations; i++)
+      {
+         CMercator::Project(latitude.data(), longitude.data(), x.data(), y.data(), BENCH_PROJECTION_POINTS, scale);
+         DoNotOptimize(y.data());
+      }
+   });
+
+   Measure("Projection/Project/scalar", params, [&](long Iterations)
+   {
+      for (long i = 0; i < Iterations; i++)
+      {
+         CMercator::ProjectScalar(latitude.data(), longitude.data(), x.data(), y.data(), BENCH_PROJECTION_POINTS, scale);
+         DoNotOptimize(y.data());
+      }
+   });
+
+   CMercator::ProjectScalar(latitude.data(), longitude.data(), x_reference.data(), y_reference.data(), BENCH_PROJECTION_POINTS, scale);
+
+   Measure("Projection/Unproject/batch", params, [&](long Iterations)
+   {
+      for (long i = 0; i < Iterations; i++)
+      {
+         CMercator::Unproject(x_reference.data(), y_reference.data(), latitude.data(), longitude.data(), BENCH_PROJECTION_POINTS, scale);
+         DoNotOptimize(latitude.data());
+      }
+   });
+
+   Measure("Projection/Unproject/scalar", params, [&](long Iterations)
+   {
+      for (long i = 0; i < Iterations; i++)
+      {
+         CMercator::UnprojectScalar(x_reference.data(), y_reference.data(), latitude.data(), longitude.data(), BENCH_PROJECTION_POINTS, scale);
+         DoNotOptimize(latitude.data());
+      }
+   });
+
+   if (!Selected("Projection/Accuracy")) return;
+
+   // the batch kernels against the libm reference, odd counts included so
+   // the tail handling is covered
+   std::vector<double> latitude_reference(BENCH_PROJECTION_POINTS);
+   std::vector<double> longitude_reference(BENCH_PROJECTION_POINTS);
+   std::vector<double> x_check(BENCH_PROJECTION_POINTS);
+   std::vector<double> y_check(BENCH_PROJECTION_POINTS);
+   double              max_pixel_error = 0.0;
+   double              max_degree_error = 0.0;
+   size_t              counts[] = { BENCH_PROJECTION_POINTS, BENCH_PROJECTION_POINTS - 1, 1 };
+
+   CMercator::UnprojectScalar(x_reference.data(), y_reference.data(), latitude_reference.data(), longitude_reference.data(), BENCH_PROJECTION_POINTS, scale);
+   CMercator::ProjectScalar(latitude_reference.data(), longitude_reference.data(), x_check.data(), y_check.data(), BENCH_PROJECTION_POINTS, scale);
+
+   for (size_t count : counts)
+   {
+      size_t first = BENCH_PROJECTION_POINTS - count;
+
+      CMercator::Project(&latitude_reference[first], &longitude_reference[first], &x[first], &y[first], count, scale);
+      CMercator::Unproject(&x_reference[first], &y_reference[first], &latitude[first], &longitude[first], count, scale);
+
+      for (size_t i = first; i < BENCH_PROJECTION_POINTS; i++)
+      {
+         max_pixel_error  = std::max(max_pixel_error, std::max(fabs(x[i] - x_check[i]), fabs(y[i] - y_check[i])));
+         max_degree_error = std::max(max_degree_error, std::max(fabs(latitude[i] - latitude_reference[i]),
+                                                                fabs(longitude[i] - longitude_reference[i])));
+      }
+   }
+
+   // tile edges are the scalar formula verbatim
+   for (int zoom = 0; zoom <= MERCATOR_TABLE_MAX_ZOOM; zoom += 4)
+   {
+      for (int row = 0; row <= (1 << zoom); row += std::max(1, (1 << zoom) / 64))
+      {
+         double n = M_PI - 2.0 * M_PI * (double)row / (double)(1 << zoom);
+
+         if (CMercator::GetTileEdgeLatitude(row, zoom) != atan(0.5 * (exp(n) - exp(-n))) * (180.0 / M_PI))
+            max_degree_error = std::max(max_degree_error, 1.0);
+      }
+   }
+
+   Json::Value result;
+   bool        passed = max_pixel_error <= BENCH_PROJECTION_MAX_PIXEL && max_degree_error <= BENCH_PROJECTION_MAX_DEG;
+
+   result["name"]             = "Projection/Accuracy";
+   result["params"]           = params;
+   result["max_pixel_error"]  = max_pixel_error;
+   result["max_degree_error"] = max_degree_error;
+   result["passed"]           = passed;
+   mResults.append(result);
+
+   if (!passed)
+      mFailed = true;
+
+   fprintf(stderr, "%-48s %12s %.3g px, %.3g deg\n", "Projection/Accuracy", passed ? "passed" : "FAILED",
+           max_pixel_error, max_degree_error);
+}
+
+void COsmBenchmark::BenchPngDecode()
+{
+   const char* images[] = { "no_data.png", "logo_icon.png" };
+
+   for (const char* image : images)
+   {
+      std::ifstream              png_file(image, std::ios::in | std::ios::binary);
+      std::vector<unsigned char> buffer((std::istreambuf_iterator<char>(png_file)),
+                                        std::istreambuf_iterator<char>());
+      Json::Value                params;
+      int                        width = 0;
+      int                        height = 0;
+      int                        channels = 0;
+
+      if (buffer.empty())
+      {
+         fprintf(stderr, "Skipping png decode, unable to read %s\n", image);
+         continue;
+      }
+
+      stbi_info_from_memory(buffer.data(), buffer.size(), &width, &height, &channels);
+
+      params["file"]     = image;
+      params["bytes"]    = (int)buffer.size();
+      params["width"]    = width;
+      params["height"]   = height;
+      params["channels"] = channels;
+
+      // decode the same way CTexture does
+      Measure(std::string("PngDecode/") + image, params, [&](long Iterations)
+      {
+         stbi_set_flip_vertically_on_load(1);
+
+         for (long i = 0; i < Iterations; i++)
+         {
+            int w, h, c;
+            unsigned char* data = stbi_load_from_memory(buffer.data(), buffer.size(), &w, &h, &c, 0);
+            DoNotOptimize(data);
+            stbi_image_free(data);
+         }
+      });
+   }
+}
+
+void COsmBenchmark::BenchTileKey()
+{
+   COpenStreetMap::TTileList    tile_list;
+   std::unordered_set<TTileKey> tile_set;
+   double                       scale_x = cos(BENCH_CENTER_LAT * M_PI / 180.0);
+
+   // the 1080p coverage, the keys a frame hashes and compares
+   COpenStreetMap::GetTileList(tile_list, BENCH_CENTER_LAT, BENCH_CENTER_LON, 14, scale_x, sqrt(960.0 * 960.0 + 540.0 * 540.0));
+   tile_set.insert(tile_list.begin(), tile_list.end());
+
+   Measure("TileKey/Make", Json::Value(Json::objectValue), [&](long Iterations)
+   {
+      for (long i = 0; i < Iterations; i++)
+      {
+         DoNotOptimize(TTileKey::Make(14, 4600 + (int)(i & 0xff), 6200 + (int)((i >> 8) & 0xff)));
+      }
+   });
+
+   Measure("TileKey/Decode", Json::Value(Json::objectValue), [&](long Iterations)
+   {
+      for (long i = 0; i < Iterations; i++)
+      {
+         const TTileKey& key = tile_list[i % tile_list.size()];
+         DoNotOptimize(key.GetX() + key.GetY());
+      }
+   });
+
+   Measure("TileKey/GetParent", Json::Value(Json::objectValue), [&](long Iterations)
+   {
+      TTileKey parent;
+
+      for (long i = 0; i < Iterations; i++)
+      {
+         tile_list[i % tile_list.size()].GetParent(parent);
+         DoNotOptimize(parent);
+      }
+   });
+
+   Measure("TileKey/HashLookup", Json::Value(Json::objectValue), [&](long Iterations)
+   {
+      for (long i = 0; i < Iterations; i++)
+      {
+         DoNotOptimize(tile_set.count(tile_list[i % tile_list.size()]));
+      }
+   });
+}
+
+void COsmBenchmark::BenchUpdateCache()
+{
+   std::error_code           err;
+   std::filesystem::path     tile_dir = std::filesystem::temp_directory_path(err) / "osm_bench_tiles";
+   COpenStreetMap::TTileList tile_list;
+   const int                 zoom = 14;
+   double                    scale_x = cos(BENCH_CENTER_LAT * M_PI / 180.0);
+
+   if (err)
+   {
+      fprintf(stderr, "Skipping UpdateCache, no temp directory\n");
+      return;
+   }
+
+   // 1080p worth of coverage at a mid zoom level
+   COpenStreetMap::GetTileList(tile_list, BENCH_CENTER_LAT, BENCH_CENTER_LON, zoom, scale_x, sqrt(960.0 * 960.0 + 540.0 * 540.0));
+
+   // the fake tile source is a disk cache pre-populated with a copy of the
+   // no data tile for every tile in the coverage list
+   std::filesystem::create_directories(tile_dir, err);
+
+   COpenStreetMap disk_map;
+   disk_map.mTileService = CTileService::Acquire(nullptr, tile_dir.c_str());
+
+   for (const auto& tag : tile_list)
+   {
+      std::filesystem::copy_file("no_data.png",
+                                 COpenStreetMap::ConstructFilename(disk_map.mTileService->GetCachePath(), tag),
+                                 std::filesystem::copy_options::overwrite_existing, err);
+   }
+
+   Json::Value params;
+   params["zoom"]  = zoom;
+   params["tiles"] = (int)tile_list.size();
+
+   // every tile misses the tile service records and is found on disk
+   Measure("UpdateCache/Cold", params, [&](long Iterations)
+   {
+      COpenStreetMap::TDisplayList display_list;
+
+      for (long i = 0; i < Iterations; i++)
+      {
+         disk_map.mTileService->Clear();
+         display_list.Clear();
+         disk_map.UpdateCache(tile_list, display_list);
+         DoNotOptimize(display_list.Keys.data());
+      }
+   });
+
+   // steady state, every tile is already in the tile service records
+   Measure("UpdateCache/Warm", params, [&](long Iterations)
+   {
+      COpenStreetMap::TDisplayList display_list;
+
+      disk_map.UpdateCache(tile_list, display_list);
+
+      for (long i = 0; i < Iterations; i++)
+      {
+         display_list.Clear();
+         disk_map.UpdateCache(tile_list, display_list);
+         DoNotOptimize(display_list.Keys.data());
+      }
+   });
+
+   disk_map.Close();
+   std::filesystem::remove_all(tile_dir, err);
+}
+
+void COsmBenchmark::Run()
+{
+   BenchGetTileList();
+   BenchCache<64>();
+   BenchCache<256>();
+   BenchCache<OSM_IMAGE_CACHE_SIZE>();
+   BenchCache<4096>();
+   BenchConstructFilename();
+   BenchMercator();
+   BenchProjection();
+   BenchPngDecode();
+   BenchTileKey();
+   BenchUpdateCache();
+}
+
+bool COsmBenchmark::Selected(const std::string& Name) const
+{
+   return mFilter.empty() || Name.find(mFilter) != std::string::npos;
+}
+
+bool COsmBenchmark::Write(const char* Filename)
+{
+   Json::Value               root;
+   Json::StyledStreamWriter  writer("   ");
+   char                      date[64];
+   time_t                    now = time(nullptr);
+
+   strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+
+   root["context"]["date"]         = date;
+   root["context"]["compiler"]     = __VERSION__;
+   root["context"]["min_time_sec"] = BENCH_MIN_TIME_SEC;
+   root["benchmarks"]              = mResults;
+
+   if (!Filename)
+   {
+      writer.write(std::cout, root);
+      return true;
+   }
+
+   std::ofstream json_file(Filename, std::ios::out | std::ios::trunc);
+
+   if (!json_file.is_open())
+   {
+      fprintf(stderr, "Unable to open %s\n", Filename);
+      return false;
+   }
+
+   writer.write(json_file, root);
+
+   return true;
+}
+
+// usage: osm_bench [output.json] [name filter]
+int main(int argc, char* argv[])
+{
+   const char* output = (argc > 1 && strcmp(argv[1], "-") != 0) ? argv[1] : nullptr;
+   const char* filter = (argc > 2) ? argv[2] : nullptr;
+
+   COsmBenchmark bench(filter);
+
+   bench.Run();
+
+   if (!bench.Write(output))
+      return 1;
+
+   return bench.IsFailed() ? 2 : 0;
+}
@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "json/json.h"
+#include "MapCompositor.h"
+#include "OpenStreetMap.h"
+#include "PngWriter.h"
+#include "TestTileServer.h"
+
+#define BENCH_SIZE  16384 // output pixels on a side
+#define BENCH_ZOOM  13
+
+// Stitches a bounding box of map tiles into one image on the cpu. Without
+// --url the tiles come from the local test tile server, which is also what
+// the --bench numbers are measured against.
+
+static void Usage()
+{
+   fprintf(stderr,
+      "usage: osm_composite [options]\n"
+      "   --bbox S,W,N,E     latitude and longitude bounds (default around 38.8977, -77.0365)\n"
+      "   --rotation DEG     clockwise map rotation (default 0)\n"
+      "   --width PIX        image width (default 4096)\n"
+      "   --height PIX       image height (default 4096)\n"
+      "   --zoom Z           tile zoom level, picked from the output size if not given\n"
+      "   --threads N        worker threads, every core if not given\n"
+      "   --output FILE      png (default composite.png)\n"
+      "   --url HOST:PORT    tile server, the local test server is used if not given\n"
+      "   --cache DIR        disk cache, a temporary one is used if not given\n"
+      "   --bench            time %d x %d exports from a cold and a warm cache\n", BENCH_SIZE, BENCH_SIZE);
+}
+
+static void AddBenchResult(Json::Value& Root, const char* Name, const CMapCompositor& Compositor, const TCompositeRequest& Request)
+{
+   const TCompositeStats& stats = Compositor.GetStats();
+   Json::Value&           result = Root[Name];
+
+   result["rotation_deg"]   = Request.RotationDeg;
+   result["copy_path"]      = stats.CopyPath;
+   result["elapsed_sec"]    = stats.ElapsedSec;
+   result["mpx_per_sec"]    = (double)Request.Width * Request.Height / 1e6 / stats.ElapsedSec;
+   result["tiles_decoded"]  = stats.TilesDecoded;
+   result["tiles_fetched"]  = stats.TilesFetched;
+   result["tiles_missing"]  = stats.TilesMissing;
+}
+
+int main(int argc, char* argv[])
+{
+   CTestTileServer            server;
+   CMapCompositor             compositor;
+   std::vector<unsigned char> rgba;
+   TCompositeRequest          request = { 38.85, -77.10, 38.95, -76.97, 0.0, 4096, 4096, -1 };
+   const char*                output = "composite.png";
+   const char*                url = nullptr;
+   const char*                cache = nullptr;
+   int                        threads = 0;
+   bool                       bench = false;
+
+   for (int i = 1; i < argc; i++)
+   {
+      bool has_value = (i + 1 < argc);
+
+      if (strcmp(argv[i], "--bbox") == 0 && has_value)
+      {
+         if (sscanf(argv[++i], "%lf,%lf,%lf,%lf", &request.MinLatitude, &request.MinLongitude,
+                                                  &request.MaxLatitude, &request.MaxLongitude) != 4)
+         {
+            Usage();
+            return 1;
+         }
+      }
+      else if (strcmp(argv[i], "--rotation") == 0 && has_value)
+         request.RotationDeg = atof(argv[++i]);
+      else if (strcmp(argv[i], "--width") == 0 && has_value)
+         request.Width = atoi(argv[++i]);
+      else if (strcmp(argv[i], "--height") == 0 && has_value)
+         request.Height = atoi(argv[++i]);
+      else if (strcmp(argv[i], "--zoom") == 0 && has_value)
+         request.ZoomLevel = atoi(argv[++i]);
+      else if (strcmp(argv[i], "--threads") == 0 && has_value)
+         threads = atoi(argv[++i]);
+      else if (strcmp(argv[i], "--output") == 0 && has_value)
+         output = argv[++i];
+      else if (strcmp(argv[i], "--url") == 0 && has_value)
+         url = argv[++i];
+      else if (strcmp(argv[i], "--cache") == 0 && has_value)
+         cache = argv[++i];
+      else if (strcmp(argv[i], "--bench") == 0)
+         bench = true;
+      else
+      {
+         Usage();
+         return 1;
+      }
+   }
+
+   std::string server_url;
+
+   if (!url)
+   {
+      TTestTileServerConfig config = CTestTileServer::DefaultConfig();
+
+      config.Port = 0;
+
+      if (!server.Open(config))
+         return 1;
+
+      server_url = server.GetUrl();
+      url = server_url.c_str();
+   }
+
+   std::error_code       err;
+   std::filesystem::path cache_dir = std::filesystem::temp_directory_path(err) /
+                                     ("osm_composite_" + std::to_string(getpid()));
+
+   if (!cache)
+   {
+      std::filesystem::create_directories(cache_dir, err);
+      cache = cache_dir.c_str();
+   }
+
+   int result = 0;
+
+   if (!compositor.Open(url, cache, threads))
+      return 1;
+
+   if (bench)
+   {
+      // a whole block of tiles exported 1:1, so the unrotated pass takes the
+      // copy path and the rotated one resamples every pixel
+      int         tiles = BENCH_SIZE / OSM_TILE_SIZE;
+      int         x = COpenStreetMap::GetTileX(-77.0365, BENCH_ZOOM) - tiles / 2;
+      int         y = COpenStreetMap::GetTileY(38.8977, BENCH_ZOOM) - tiles / 2;
+      Json::Value root;
+
+      request.MinLatitude  = COpenStreetMap::GetLatitudeFromTileY(y + tiles, BENCH_ZOOM);
+      request.MaxLatitude  = COpenStreetMap::GetLatitudeFromTileY(y, BENCH_ZOOM);
+      request.MinLongitude = COpenStreetMap::GetLongitudeFromTileX(x, BENCH_ZOOM);
+      request.MaxLongitude = COpenStreetMap::GetLongitudeFromTileX(x + tiles, BENCH_ZOOM);
+      request.Width        = BENCH_SIZE;
+      request.Height       = BENCH_SIZE;
+      request.ZoomLevel    = BENCH_ZOOM;
+      request.RotationDeg  = 0.0;
+
+      root["width"]   = request.Width;
+      root["height"]  = request.Height;
+      root["zoom"]    = request.ZoomLevel;
+      root["threads"] = threads > 0 ? threads : (int)std::max(1u, std::thread::hardware_concurrency());
+
+      // cold fetches every tile from the server into the disk cache, warm
+      // starts from the disk cache with nothing decoded
+      const char* passes[] = { "cold", "warm", "warm_rotated" };
+
+      for (const char* pass : passes)
+      {
+         request.RotationDeg = (strcmp(pass, "warm_rotated") == 0) ? 30.0 : 0.0;
+
+         if (strcmp(pass, "cold") != 0)
+            compositor.Open(nullptr, cache, threads);
+
+         if (!compositor.Render(request, rgba))
+         {
+            fprintf(stderr, "Failed the %s export\n", pass);
+            result = 2;
+            break;
+         }
+
+         fprintf(stderr, "%s: %.2f s\n", pass, compositor.GetStats().ElapsedSec);
+         AddBenchResult(root, pass, compositor, request);
+      }
+
+      Json::StyledStreamWriter writer("   ");
+      writer.write(std::cout, root);
+   }
+   else
+   {
+      if (!compositor.Render(request, rgba) || !WritePngFile(output, rgba.data(), request.Width, request.Height, 4))
+      {
+         fprintf(stderr, "Failed to export %s\n", output);
+         result = 1;
+      }
+      else
+      {
+         const TCompositeStats& stats = compositor.GetStats();
+
+         fprintf(stderr, "Wrote %s (%d x %d) at zoom %d, %d tiles, %d missing, in %.2f s\n",
+                 output, request.Width, request.Height, stats.ZoomLevel,
+                 stats.TilesDecoded, stats.TilesMissing, stats.ElapsedSec);
+      }
+   }
+
+   compositor.Close();
+   server.Close();
+
+   if (cache == cache_dir.c_str())
+      std::filesystem::remove_all(cache_dir, err);
+
+   return result;
+}
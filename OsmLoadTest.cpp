@@ -0,0 +1,383 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "json/json.h"
+#include "Histogram.h"
+#include "OpenStreetMap.h"
+#include "TestTileServer.h"
+#include "Trace.h"
+
+// Drives COpenStreetMap headless (no Draw) through a scripted sequence of pans
+// and zooms against the local test tile server, and reports throughput, time
+// to complete the viewport and tile fetch latency. At the end a disk budget
+// below the cache's size is set, the collection has to leave the tiles on
+// screen alone.
+
+#define FRAME_RATE     60
+#define MAP_WIDTH      1280
+#define MAP_HEIGHT     720
+#define EVICT_MIN_AGE  2     // seconds, the disk cache's min age during the eviction check
+#define EVICT_WAIT_SEC 5     // for the collection and for the refetches after it
+
+struct TScriptStep
+{
+   double Latitude;
+   double Longitude;
+   double ScaleFactor;
+   int    Frames;      // frames to animate from the previous step
+};
+
+struct TStepResult
+{
+   int    ZoomLevel;
+   double TimeToCompleteMs;
+   bool   Complete;
+};
+
+// Washington DC out to Dulles and back, zooming in and out on the way
+static const TScriptStep default_script[] =
+{
+   { 38.8977, -77.0365, 72000.0,   0  },
+   { 38.8977, -77.0365, 35000.0,   30 },
+   { 38.9100, -77.1500, 35000.0,   120 },
+   { 38.9392, -77.4600, 72000.0,   180 },
+   { 38.9392, -77.4600, 300000.0,  60 },
+   { 38.9392, -77.4600, 1200000.0, 60 },
+   { 38.8977, -77.0365, 1200000.0, 120 },
+   { 38.8977, -77.0365, 72000.0,   90 },
+};
+
+static bool LoadScript(const char* Filename, std::vector<TScriptStep>& Script)
+{
+   std::ifstream script_file(Filename);
+   Json::Reader  reader;
+   Json::Value   root;
+
+   if (!script_file.is_open() || !reader.parse(script_file, root) || !root.isArray())
+   {
+      fprintf(stderr, "Unable to parse script %s\n", Filename);
+      return false;
+   }
+
+   // [ { "lat": 38.9, "lon": -77.4, "scale": 72000, "frames": 60 }, ... ]
+   for (const auto& step : root)
+   {
+      TScriptStep script_step;
+
+      script_step.Latitude    = step.get("lat", 0.0).asDouble();
+      script_step.Longitude   = step.get("lon", 0.0).asDouble();
+      script_step.ScaleFactor = step.get("scale", 72000.0).asDouble();
+      script_step.Frames      = step.get("frames", 0).asInt();
+      Script.push_back(script_step);
+   }
+
+   return !Script.empty();
+}
+
+static void Usage()
+{
+   fprintf(stderr,
+      "usage: osm_loadtest [options]\n"
+      "   --latency MS       added to every tile response (default 20)\n"
+      "   --jitter MS        +/- uniform jitter on the latency (default 10)\n"
+      "   --error-rate R     fraction of tile requests that fail, 0 to 1 (default 0)\n"
+      "   --bandwidth KBPS   per connection bandwidth cap, 0 is unlimited (default 0)\n"
+      "   --connections N    server connection limit, 0 is unlimited (default 4)\n"
+      "   --format EXT       tile encoding the server lists, png, jpg or webp (default png)\n"
+      "   --timeout SEC      time allowed for each viewport to complete (default 30)\n"
+      "   --script FILE      json list of { lat, lon, scale, frames } steps\n"
+      "   --output FILE      write the json report to a file instead of stdout\n"
+      "   --trace FILE       write a chrome trace-event timeline of the run\n");
+}
+
+int main(int argc, char* argv[])
+{
+   using clock = std::chrono::steady_clock;
+   using framerate = std::chrono::duration<double, std::ratio<1, FRAME_RATE>>;
+
+   TTestTileServerConfig    config = CTestTileServer::DefaultConfig();
+   CTestTileServer          server;
+   COpenStreetMap           map;
+   std::vector<TScriptStep> script;
+   std::vector<TStepResult> results;
+   CLatencyHistogram        complete_time;
+   const char*              output = nullptr;
+   const char*              trace = nullptr;
+   double                   timeout_sec = 30.0;
+
+   config.LatencyMs      = 20;
+   config.JitterMs       = 10;
+   config.MaxConnections = 4;
+
+   for (int i = 1; i < argc; i++)
+   {
+      bool has_value = (i + 1 < argc);
+
+      if (strcmp(argv[i], "--latency") == 0 && has_value)
+         config.LatencyMs = atoi(argv[++i]);
+      else if (strcmp(argv[i], "--jitter") == 0 && has_value)
+         config.JitterMs = atoi(argv[++i]);
+      else if (strcmp(argv[i], "--error-rate") == 0 && has_value)
+         config.ErrorRate = atof(argv[++i]);
+      else if (strcmp(argv[i], "--bandwidth") == 0 && has_value)
+         config.BandwidthKbps = atoi(argv[++i]);
+      else if (strcmp(argv[i], "--connections") == 0 && has_value)
+         config.MaxConnections = atoi(argv[++i]);
+      else if (strcmp(argv[i], "--format") == 0 && has_value)
+      {
+         if (!GetTileFormatFromExtension(argv[++i], config.Format))
+         {
+            Usage();
+            return 1;
+         }
+      }
+      else if (strcmp(argv[i], "--timeout") == 0 && has_value)
+         timeout_sec = atof(argv[++i]);
+      else if (strcmp(argv[i], "--script") == 0 && has_value)
+      {
+         if (!LoadScript(argv[++i], script))
+            return 1;
+      }
+      else if (strcmp(argv[i], "--output") == 0 && has_value)
+         output = argv[++i];
+      else if (strcmp(argv[i], "--trace") == 0 && has_value)
+         trace = argv[++i];
+      else
+      {
+         Usage();
+         return 1;
+      }
+   }
+
+   if (script.empty())
+      script.assign(std::begin(default_script), std::end(default_script));
+
+   if (!server.Open(config))
+      return 1;
+
+   if (trace)
+   {
+      CTrace::SetThreadName("Main");
+      CTrace::Enable(true);
+   }
+
+   // start from an empty disk cache so every tile goes to the server
+   std::error_code       err;
+   std::filesystem::path cache_dir = std::filesystem::temp_directory_path(err) /
+                                     ("osm_loadtest_" + std::to_string(getpid()));
+
+   std::filesystem::remove_all(cache_dir, err);
+   std::filesystem::create_directories(cache_dir, err);
+
+   map.SetMapSize(MAP_WIDTH, MAP_HEIGHT);
+   map.SetWindowSize(MAP_WIDTH, MAP_HEIGHT);
+   map.SetCoverageRadiusScaleFactor(1.0f);
+   map.SetMapCenter(script[0].Latitude, script[0].Longitude);
+   map.SetMapScaleFactor(script[0].ScaleFactor);
+   map.Update();
+
+   auto start_time = clock::now();
+
+   if (!map.Open(true, server.GetUrl().c_str(), true, cache_dir.c_str()))
+   {
+      fprintf(stderr, "Failed to open the map\n");
+      return 1;
+   }
+
+   TScriptStep previous = script[0];
+
+   for (size_t s = 0; s < script.size(); s++)
+   {
+      const TScriptStep& step = script[s];
+      auto               frame_time = clock::now() + framerate{1};
+      TStepResult        result;
+
+      // animate to the step target one frame at a time, the same inputs
+      // main.cpp feeds the map every frame
+      for (int frame = 1; frame <= step.Frames; frame++)
+      {
+         double t = (double)frame / (double)step.Frames;
+
+         map.SetMapCenter(previous.Latitude + (step.Latitude - previous.Latitude) * t,
+                          previous.Longitude + (step.Longitude - previous.Longitude) * t);
+         map.SetMapScaleFactor(previous.ScaleFactor * pow(step.ScaleFactor / previous.ScaleFactor, t));
+         map.Update();
+
+         std::this_thread::sleep_until(frame_time);
+         frame_time += framerate{1};
+      }
+
+      map.SetMapCenter(step.Latitude, step.Longitude);
+      map.SetMapScaleFactor(step.ScaleFactor);
+      map.Update();
+
+      // then hold the view until every tile is on the display list, timed
+      // from the view settling, not from the start of the animation
+      auto step_start = clock::now();
+
+      result.Complete = false;
+      while (std::chrono::duration<double>(clock::now() - step_start).count() < timeout_sec)
+      {
+         if (map.IsViewportComplete())
+         {
+            result.Complete = true;
+            break;
+         }
+
+         std::this_thread::sleep_until(frame_time);
+         frame_time += framerate{1};
+         map.Update();
+      }
+
+      result.ZoomLevel        = map.GetZoomLevel();
+      result.TimeToCompleteMs = std::chrono::duration<double, std::milli>(clock::now() - step_start).count();
+      results.push_back(result);
+
+      if (result.Complete)
+         complete_time.Record((uint64_t)(result.TimeToCompleteMs * 1000.0));
+
+      fprintf(stderr, "step %zu zoom %d %s in %.1f ms\n", s, result.ZoomLevel,
+              result.Complete ? "complete" : "INCOMPLETE", result.TimeToCompleteMs);
+
+      previous = step;
+   }
+
+   double elapsed_sec = std::chrono::duration<double>(clock::now() - start_time).count();
+
+   // every tile but the ones on screen is left to age past the min age, then
+   // half the cache is over budget. With the records forgotten the coverage
+   // thread looks the tiles on screen up on disk again, any it has to fetch
+   // were evicted while in use.
+   CDiskCache&     disk_cache = map.GetTileService()->GetDiskCache();
+   TDiskCacheStats disk_before;
+   TDiskCacheStats disk_after;
+   uint64_t        refetched;
+   bool            evict_ok;
+
+   disk_cache.SetMinAge(EVICT_MIN_AGE);
+   std::this_thread::sleep_for(std::chrono::seconds(EVICT_MIN_AGE + 1));
+
+   disk_before = disk_cache.GetStats();
+   disk_cache.SetBudget(disk_before.Bytes / 2);
+
+   auto evict_start = clock::now();
+
+   do
+   {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      disk_after = disk_cache.GetStats();
+   } while (disk_after.Collections == disk_before.Collections &&
+            clock::now() - evict_start < std::chrono::seconds(EVICT_WAIT_SEC));
+
+   uint64_t requests_before = server.GetRequestCount();
+
+   map.GetTileService()->Clear();
+
+   // a few coverage passes, and the time a refetch would take
+   std::this_thread::sleep_for(std::chrono::milliseconds(config.LatencyMs + config.JitterMs + 500));
+
+   refetched = server.GetRequestCount() - requests_before;
+   evict_ok  = disk_after.Collections > disk_before.Collections &&
+               disk_after.EvictedTiles > disk_before.EvictedTiles && refetched == 0;
+
+   fprintf(stderr, "eviction %s, %lu of %lu tiles evicted, %lu on screen fetched again\n",
+           evict_ok ? "ok" : "FAILED",
+           (unsigned long)(disk_after.EvictedTiles - disk_before.EvictedTiles),
+           (unsigned long)disk_before.Tiles,
+           (unsigned long)refetched);
+
+   // the capabilities document picked the tiles' format, a map that missed
+   // it fetched png from the default path
+   TileFormat map_format = map.GetTileService()->GetTileFormat();
+   bool       format_ok = map_format == config.Format;
+
+   if (!format_ok)
+      fprintf(stderr, "format FAILED, %s tiles fetched for %s\n", GetTileFormatExtension(map_format),
+              GetTileFormatExtension(config.Format));
+
+   map.Close();
+   server.Close();
+
+   if (trace)
+      CTrace::Dump(trace);
+   std::filesystem::remove_all(cache_dir, err);
+
+   // report
+   const CLatencyHistogram& latency = map.GetStats().GetLatency(TileStage::NETWORK);
+   Json::Value              root;
+   Json::Value              steps(Json::arrayValue);
+   int                      incomplete = 0;
+
+   for (const auto& result : results)
+   {
+      Json::Value step;
+
+      step["zoom"]                = result.ZoomLevel;
+      step["complete"]            = result.Complete;
+      step["time_to_complete_ms"] = result.TimeToCompleteMs;
+      steps.append(step);
+
+      if (!result.Complete)
+         incomplete++;
+   }
+
+   root["config"]["latency_ms"]      = config.LatencyMs;
+   root["config"]["jitter_ms"]       = config.JitterMs;
+   root["config"]["error_rate"]      = config.ErrorRate;
+   root["config"]["bandwidth_kbps"]  = config.BandwidthKbps;
+   root["config"]["max_connections"] = config.MaxConnections;
+   root["config"]["format"]          = GetTileFormatExtension(config.Format);
+   root["config"]["map_width"]       = MAP_WIDTH;
+   root["config"]["map_height"]      = MAP_HEIGHT;
+   root["steps"]                     = steps;
+   root["elapsed_sec"]               = elapsed_sec;
+   root["tiles_fetched"]             = (Json::UInt64)latency.GetCount();
+   root["fetch_failures"]            = (Json::UInt64)map.GetStats().GetMisses(CacheTier::WMTS);
+   root["zoom_changes"]              = (Json::UInt64)map.GetStats().GetZoomChanges();
+   root["tiles_per_sec"]             = latency.GetCount() / elapsed_sec;
+   root["server_requests"]           = (Json::UInt64)server.GetRequestCount();
+   root["server_bytes_sent"]         = (Json::UInt64)server.GetBytesSent();
+   root["tile_latency_ms"]["p50"]    = latency.GetPercentile(50.0) / 1000.0;
+   root["tile_latency_ms"]["p99"]    = latency.GetPercentile(99.0) / 1000.0;
+   root["tile_latency_ms"]["mean"]   = latency.GetMean() / 1000.0;
+   root["tile_latency_ms"]["max"]    = latency.GetMax() / 1000.0;
+   root["time_to_complete_viewport_ms"]["p50"]  = complete_time.GetPercentile(50.0) / 1000.0;
+   root["time_to_complete_viewport_ms"]["p99"]  = complete_time.GetPercentile(99.0) / 1000.0;
+   root["time_to_complete_viewport_ms"]["mean"] = complete_time.GetMean() / 1000.0;
+   root["time_to_complete_viewport_ms"]["max"]  = complete_time.GetMax() / 1000.0;
+   root["incomplete_viewports"]      = incomplete;
+   root["eviction"]["budget_bytes"]  = (Json::UInt64)(disk_before.Bytes / 2);
+   root["eviction"]["evicted_tiles"] = (Json::UInt64)(disk_after.EvictedTiles - disk_before.EvictedTiles);
+   root["eviction"]["refetched"]     = (Json::UInt64)refetched;
+   root["eviction"]["ok"]            = evict_ok;
+   root["startup_ms"]["open"]          = map.GetStats().GetStartupUs(StartupEvent::OPEN) / 1000.0;
+   root["startup_ms"]["first_tiles"]   = map.GetStats().GetStartupUs(StartupEvent::FIRST_TILES) / 1000.0;
+   root["startup_ms"]["server_online"] = map.GetStats().GetStartupUs(StartupEvent::SERVER_ONLINE) / 1000.0;
+
+   Json::StyledStreamWriter writer("   ");
+
+   if (output)
+   {
+      std::ofstream json_file(output, std::ios::out | std::ios::trunc);
+      writer.write(json_file, root);
+   }
+   else
+   {
+      writer.write(std::cout, root);
+   }
+
+   fprintf(stderr, "%lu tiles in %.1f s (%.1f tiles/s), latency p50 %.1f ms p99 %.1f ms\n",
+           (unsigned long)latency.GetCount(), elapsed_sec, latency.GetCount() / elapsed_sec,
+           latency.GetPercentile(50.0) / 1000.0, latency.GetPercentile(99.0) / 1000.0);
+
+   return (incomplete || !evict_ok || !format_ok) ? 2 : 0;
+}
@@ -0,0 +1,299 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include <glad/glad.h>
+#include <glm/gtc/matrix_transform.hpp>
+#include "json/json.h"
+#include "GlDebug.h"
+#include "HeadlessContext.h"
+#include "Histogram.h"
+#include "MarkerLayer.h"
+#include "Mercator.h"
+#include "PngWriter.h"
+
+// Frame times of the marker layer with a tenth of the markers moving every
+// frame, 100k and 1M markers spread around a city. Each count is drawn at
+// city zoom where the quadtree culls most of them, region zoom where all of
+// them are in view and world zoom where the visible list is skipped. Only
+// the markers are drawn, no tiles.
+
+#define BENCH_LATITUDE  38.8977
+#define BENCH_LONGITUDE -77.0365
+#define BENCH_SPREAD    1.0    // degrees around the center markers start in
+#define BENCH_MOVING    0.1    // share of markers moved each frame
+
+struct TBenchView
+{
+   const char* Name;
+   int         ZoomLevel;
+};
+
+static void Usage()
+{
+   fprintf(stderr,
+      "usage: osm_markerbench [options]\n"
+      "   --frames N         frames per marker count and view (default 60)\n"
+      "   --width PIX        image width (default 1280)\n"
+      "   --height PIX       image height (default 720)\n"
+      "   --json FILE        results, stdout if not given\n"
+      "   --output FILE      png of the last frame at city zoom\n");
+}
+
+static TMapView MakeView(int ZoomLevel, int Width, int Height)
+{
+   TMapView view = {};
+   double   latitude = BENCH_LATITUDE;
+   double   longitude = BENCH_LONGITUDE;
+
+   CMercator::Project(&latitude, &longitude, &view.CenterX, &view.CenterY, 1, 1.0);
+
+   view.PixelsPerWorldX = (double)CMercator::GetPixelScale(ZoomLevel);
+   view.PixelsPerWorldY = view.PixelsPerWorldX;
+   view.RotationDeg     = 0.0;
+   view.WidthPix        = Width;
+   view.HeightPix       = Height;
+   view.ZoomLevel       = ZoomLevel;
+
+   return view;
+}
+
+// the last frame, rows flipped from gl order
+static bool WriteFrame(const char* Filename, int Width, int Height)
+{
+   size_t                     row_size = (size_t)Width * 4;
+   std::vector<unsigned char> rgba(row_size * Height);
+   std::vector<unsigned char> flipped(rgba.size());
+
+   GLCALL(glPixelStorei(GL_PACK_ALIGNMENT, 1));
+   GLCALL(glReadPixels(0, 0, Width, Height, GL_RGBA, GL_UNSIGNED_BYTE, rgba.data()));
+
+   for (int y = 0; y < Height; y++)
+      memcpy(flipped.data() + y * row_size, rgba.data() + (Height - 1 - y) * row_size, row_size);
+
+   return WritePngFile(Filename, flipped.data(), Width, Height, 4);
+}
+
+int main(int argc, char* argv[])
+{
+   using clock = std::chrono::steady_clock;
+
+   CHeadlessContext context;
+   const char*      output = nullptr;
+   const char*      json = nullptr;
+   int              frames = 60;
+   int              width = 1280;
+   int              height = 720;
+
+   for (int i = 1; i < argc; i++)
+   {
+      bool has_value = (i + 1 < argc);
+
+      if (strcmp(argv[i], "--frames") == 0 && has_value)
+         frames = atoi(argv[++i]);
+      else if (strcmp(argv[i], "--width") == 0 && has_value)
+         width = atoi(argv[++i]);
+      else if (strcmp(argv[i], "--height") == 0 && has_value)
+         height = atoi(argv[++i]);
+      else if (strcmp(argv[i], "--json") == 0 && has_value)
+         json = argv[++i];
+      else if (strcmp(argv[i], "--output") == 0 && has_value)
+         output = argv[++i];
+      else
+      {
+         Usage();
+         return 1;
+      }
+   }
+
+   if (frames <= 0 || width <= 0 || height <= 0)
+   {
+      Usage();
+      return 1;
+   }
+
+   if (!context.Open())
+      return 1;
+
+   fprintf(stderr, "Rendering with %s\n", context.GetRenderer().c_str());
+
+   unsigned int framebuffer;
+   unsigned int color_buffer;
+
+   GLCALL(glGenFramebuffers(1, &framebuffer));
+   GLCALL(glGenRenderbuffers(1, &color_buffer));
+   GLCALL(glBindRenderbuffer(GL_RENDERBUFFER, color_buffer));
+   GLCALL(glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height));
+   GLCALL(glBindFramebuffer(GL_FRAMEBUFFER, framebuffer));
+   GLCALL(glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color_buffer));
+   GLCALL(glViewport(0, 0, width, height));
+   GLCALL(glEnable(GL_BLEND));
+   GLCALL(glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA));
+
+   const TBenchView views[] = { { "city", 14 }, { "region", 8 }, { "world", 1 } };
+   const int        counts[] = { 100000, 1000000 };
+   glm::mat4        projection = glm::ortho(-(float)width * 0.5f, (float)width * 0.5f,
+                                            -(float)height * 0.5f, (float)height * 0.5f, -1.0f, 1.0f);
+   auto             shader = std::make_shared<CShader>("data/shaders/marker.vert", "data/shaders/marker.frag");
+   Json::Value      root;
+   int              result = 0;
+
+   root["renderer"] = context.GetRenderer();
+   root["width"]    = width;
+   root["height"]   = height;
+   root["frames"]   = frames;
+   root["moving"]   = BENCH_MOVING;
+
+   for (int count : counts)
+   {
+      std::mt19937                     random(1);
+      std::uniform_real_distribution<> spread(-BENCH_SPREAD, BENCH_SPREAD);
+      std::uniform_real_distribution<> unit(0.0, 1.0);
+      std::vector<double>              latitude(count);
+      std::vector<double>              longitude(count);
+      std::vector<double>              heading(count);
+      std::vector<int>                 ids(count);
+      CMarkerLayer                     markers;
+      auto                             add_start = clock::now();
+
+      if (!markers.Open(shader))
+         return 1;
+
+      for (int i = 0; i < count; i++)
+      {
+         float hue = (float)unit(random);
+
+         latitude[i] = BENCH_LATITUDE + spread(random);
+         longitude[i] = BENCH_LONGITUDE + spread(random);
+         heading[i] = unit(random) * 2.0 * M_PI;
+         ids[i] = markers.Add(latitude[i], longitude[i],
+                              glm::vec4(0.5f + 0.5f * cosf(hue * 6.2832f), 0.5f + 0.5f * cosf((hue - 0.333f) * 6.2832f),
+                                        0.5f + 0.5f * cosf((hue + 0.333f) * 6.2832f), 0.9f),
+                              8.0f + 8.0f * (float)unit(random));
+      }
+
+      double       add_ms = std::chrono::duration<double, std::milli>(clock::now() - add_start).count();
+      Json::Value& count_json = root["markers"][std::to_string(count)];
+      size_t       moving = (size_t)(count * BENCH_MOVING);
+      size_t       window = 0;
+
+      count_json["add_ms"] = add_ms;
+
+      for (const TBenchView& bench_view : views)
+      {
+         TMapView          view = MakeView(bench_view.ZoomLevel, width, height);
+         CLatencyHistogram update_time;
+         CLatencyHistogram draw_time;
+         CLatencyHistogram frame_time;
+         CLatencyHistogram query_time;
+         uint64_t          uploaded = 0;
+         uint64_t          visible = 0;
+
+         // a first frame puts everything on the gpu
+         markers.Draw(view, projection);
+         GLCALL(glFinish());
+
+         for (int frame = 0; frame < frames; frame++)
+         {
+            auto frame_start = clock::now();
+
+            // a window of a tenth of the markers takes a step of about 10 m,
+            // the window moves on every frame
+            for (size_t i = 0; i < moving; i++)
+            {
+               size_t index = (window + i) % count;
+
+               heading[index] += 0.1;
+               latitude[index] += 0.0001 * cos(heading[index]);
+               longitude[index] += 0.0001 * sin(heading[index]);
+            }
+
+            if (window + moving <= (size_t)count)
+               markers.Move(&ids[window], &latitude[window], &longitude[window], moving);
+            else
+            {
+               size_t first = count - window;
+
+               markers.Move(&ids[window], &latitude[window], &longitude[window], first);
+               markers.Move(&ids[0], &latitude[0], &longitude[0], moving - first);
+            }
+
+            window = (window + moving) % count;
+
+            auto draw_start = clock::now();
+
+            GLCALL(glClearColor(0.9f, 0.9f, 0.85f, 1.0f));
+            GLCALL(glClear(GL_COLOR_BUFFER_BIT));
+            markers.Draw(view, projection);
+            GLCALL(glFinish());
+
+            auto         frame_end = clock::now();
+            TMarkerStats stats = markers.GetStats();
+
+            update_time.Record(std::chrono::duration_cast<std::chrono::microseconds>(draw_start - frame_start).count());
+            draw_time.Record(std::chrono::duration_cast<std::chrono::microseconds>(frame_end - draw_start).count());
+            frame_time.Record(std::chrono::duration_cast<std::chrono::microseconds>(frame_end - frame_start).count());
+            query_time.Record((uint64_t)(stats.QueryMs * 1000.0));
+            uploaded += stats.UploadedBytes;
+            visible = stats.Visible;
+         }
+
+         if (output && strcmp(bench_view.Name, "city") == 0 && count == counts[0] && !WriteFrame(output, width, height))
+         {
+            fprintf(stderr, "Failed to write %s\n", output);
+            result = 1;
+         }
+
+         Json::Value& view_json = count_json[bench_view.Name];
+
+         view_json["zoom"]             = bench_view.ZoomLevel;
+         view_json["visible"]          = (Json::UInt64)visible;
+         view_json["nodes"]            = (Json::UInt64)markers.GetStats().Nodes;
+         view_json["upload_mb_frame"]  = uploaded / (1024.0 * 1024.0) / frames;
+         view_json["update_ms"]["p50"] = update_time.GetPercentile(50.0) / 1000.0;
+         view_json["update_ms"]["p99"] = update_time.GetPercentile(99.0) / 1000.0;
+         view_json["query_ms"]["p50"]  = query_time.GetPercentile(50.0) / 1000.0;
+         view_json["query_ms"]["p99"]  = query_time.GetPercentile(99.0) / 1000.0;
+         view_json["draw_ms"]["p50"]   = draw_time.GetPercentile(50.0) / 1000.0;
+         view_json["draw_ms"]["p99"]   = draw_time.GetPercentile(99.0) / 1000.0;
+         view_json["frame_ms"]["p50"]  = frame_time.GetPercentile(50.0) / 1000.0;
+         view_json["frame_ms"]["p99"]  = frame_time.GetPercentile(99.0) / 1000.0;
+         view_json["frame_ms"]["mean"] = frame_time.GetMean() / 1000.0;
+
+         fprintf(stderr, "%d markers %s: %.2f ms a frame\n", count, bench_view.Name, frame_time.GetMean() / 1000.0);
+      }
+
+      markers.Close();
+   }
+
+   Json::StyledStreamWriter writer("   ");
+
+   if (json)
+   {
+      std::ofstream json_file(json, std::ios::out | std::ios::trunc);
+
+      if (json_file.is_open())
+         writer.write(json_file, root);
+      else
+      {
+         fprintf(stderr, "Unable to open %s\n", json);
+         result = 1;
+      }
+   }
+   else
+      writer.write(std::cout, root);
+
+   GLCALL(glBindFramebuffer(GL_FRAMEBUFFER, 0));
+   GLCALL(glDeleteRenderbuffers(1, &color_buffer));
+   GLCALL(glDeleteFramebuffers(1, &framebuffer));
+   shader.reset();
+   context.Close();
+
+   return result;
+}
@@ -0,0 +1,255 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "SharedTilePool.h"
+
+// Kills processes attached to a CSharedTilePool and checks the pool recovers:
+// the references and claims of a crashed client are dropped, a client killed
+// while it holds the mutex leaves an index that still works and loses no
+// blocks, and a segment whose creator died before finishing it is replaced.
+
+#define CHECK_BLOCKS     8     // pool budget in blocks
+#define CHECK_KEYS       32    // tiles the load rounds use
+#define CHECK_ROUNDS     50    // clients killed under load
+#define CHECK_TILE_SIZE  16    // pixels on a side of the published tiles
+#define CHECK_TIMEOUT    60    // seconds before a hung check is killed
+
+static TTileKey MakeKey(int Index)
+{
+   return TTileKey::Make(12, 1000 + Index, 2000);
+}
+
+// every pixel byte is the key's index, a tile read back is checked against it
+static bool PublishTile(CSharedTilePool& Pool, int Index)
+{
+   std::vector<unsigned char> pixels(CHECK_TILE_SIZE * CHECK_TILE_SIZE * 4, (unsigned char)Index);
+
+   return Pool.Publish(MakeKey(Index), pixels.data(), CHECK_TILE_SIZE, CHECK_TILE_SIZE, 4);
+}
+
+static bool IsTileIntact(const TSharedTile& Tile, int Index)
+{
+   size_t bytes = (size_t)Tile.Width * Tile.Height * Tile.Channels;
+
+   if (Tile.Width != CHECK_TILE_SIZE || Tile.Height != CHECK_TILE_SIZE || Tile.Channels != 4)
+      return false;
+
+   for (size_t i = 0; i < bytes; i++)
+   {
+      if (Tile.Pixels[i] != (unsigned char)Index)
+         return false;
+   }
+
+   return true;
+}
+
+static bool Report(const char* Check, bool Ok, const char* Detail = "")
+{
+   fprintf(stderr, "%-16s %s %s\n", Check, Ok ? "ok" : "FAILED", Detail);
+   return Ok;
+}
+
+// a client that publishes tile 0, keeps a reference to it and claims tile 1,
+// then is killed
+static bool CheckCrashedClient(const char* Name)
+{
+   CSharedTilePool pool;
+   TSharedTile     tile;
+   int             ready[2];
+   char            byte = 0;
+
+   if (!pool.Open(Name, CHECK_BLOCKS * SHARED_POOL_BLOCK_BYTES) || pipe(ready) != 0)
+      return Report("crashed client", false, "unable to open the pool");
+
+   pid_t child = fork();
+
+   if (child == 0)
+   {
+      CSharedTilePool child_pool;
+      TSharedTile     child_tile;
+
+      if (child_pool.Open(Name, 0) &&
+          child_pool.Lookup(MakeKey(0), child_tile) == SharedTileStatus::CLAIMED && PublishTile(child_pool, 0) &&
+          child_pool.Lookup(MakeKey(0), child_tile) == SharedTileStatus::READY &&
+          child_pool.Lookup(MakeKey(1), child_tile) == SharedTileStatus::CLAIMED)
+         byte = 1;
+
+      if (write(ready[1], &byte, 1) != 1)
+         _exit(1);
+
+      pause();
+      _exit(0);
+   }
+
+   bool ok = read(ready[0], &byte, 1) == 1 && byte == 1;
+
+   close(ready[0]);
+   close(ready[1]);
+
+   // the claim holds while the client lives
+   ok = ok && pool.Lookup(MakeKey(1), tile) == SharedTileStatus::BUSY;
+   ok = ok && pool.GetStats().Clients == 2;
+
+   kill(child, SIGKILL);
+   waitpid(child, nullptr, 0);
+
+   // its claim is taken over
+   ok = ok && pool.Lookup(MakeKey(1), tile) == SharedTileStatus::CLAIMED && PublishTile(pool, 1);
+   ok = ok && pool.GetStats().ReapedClients == 1 && pool.GetStats().Clients == 1;
+
+   // tile 0 is the oldest, once its reference is dropped it is the one the
+   // full pool evicts, tile 1 stays
+   for (int i = 2; ok && i < CHECK_BLOCKS + 1; i++)
+      ok = pool.Lookup(MakeKey(i), tile) == SharedTileStatus::CLAIMED && PublishTile(pool, i);
+
+   SharedTileStatus evicted = pool.Lookup(MakeKey(0), tile);
+
+   if (evicted == SharedTileStatus::READY)
+      pool.Release(tile);
+   else if (evicted == SharedTileStatus::CLAIMED)
+      pool.Abandon(MakeKey(0));
+
+   ok = ok && evicted == SharedTileStatus::CLAIMED;
+   ok = ok && pool.Lookup(MakeKey(1), tile) == SharedTileStatus::READY && IsTileIntact(tile, 1);
+
+   if (ok)
+      pool.Release(tile);
+
+   pool.Close();
+
+   return Report("crashed client", ok);
+}
+
+// clients looking up, publishing and referencing tiles as fast as they can
+// are killed at random points, some of them holding the mutex
+static bool CheckKilledUnderLoad(const char* Name)
+{
+   CSharedTilePool pool;
+   TSharedTile     tile;
+   std::mt19937    random(1);
+   bool            ok = true;
+   char            detail[128];
+
+   if (!pool.Open(Name, CHECK_BLOCKS * SHARED_POOL_BLOCK_BYTES))
+      return Report("killed under load", false, "unable to open the pool");
+
+   for (int round = 0; round < CHECK_ROUNDS; round++)
+   {
+      pid_t child = fork();
+
+      if (child == 0)
+      {
+         CSharedTilePool child_pool;
+         TSharedTile     child_tile;
+         std::mt19937    child_random(round);
+
+         if (!child_pool.Open(Name, 0))
+            _exit(1);
+
+         while (true)
+         {
+            int index = child_random() % CHECK_KEYS;
+
+            switch (child_pool.Lookup(MakeKey(index), child_tile))
+            {
+               case SharedTileStatus::CLAIMED:
+                  // some claims are left behind for the reaper
+                  if (child_random() % 4)
+                     PublishTile(child_pool, index);
+                  break;
+               case SharedTileStatus::READY:
+                  // and some references
+                  if (child_random() % 4)
+                     child_pool.Release(child_tile);
+                  break;
+               default:
+                  break;
+            }
+         }
+      }
+
+      std::this_thread::sleep_for(std::chrono::microseconds(500 + random() % 5000));
+      kill(child, SIGKILL);
+      waitpid(child, nullptr, 0);
+
+      // whatever the client left, every tile is readable and intact
+      for (int i = 0; ok && i < CHECK_KEYS; i++)
+      {
+         SharedTileStatus status = pool.Lookup(MakeKey(i), tile);
+
+         if (status == SharedTileStatus::READY)
+         {
+            ok = IsTileIntact(tile, i);
+            pool.Release(tile);
+         }
+         else if (status == SharedTileStatus::CLAIMED)
+            ok = PublishTile(pool, i);
+         else
+            ok = false;
+      }
+
+      if (!ok)
+      {
+         snprintf(detail, sizeof(detail), "in round %d", round);
+         return Report("killed under load", false, detail);
+      }
+   }
+
+   // no block was lost, the pool fills up to its budget
+   TSharedTilePoolStats stats = pool.GetStats();
+
+   ok = stats.Tiles == CHECK_BLOCKS && stats.Clients == 1 && stats.ReapedClients == CHECK_ROUNDS;
+   snprintf(detail, sizeof(detail), "%d rounds, %lu tiles of %d blocks, %lu reaped", CHECK_ROUNDS,
+            (unsigned long)stats.Tiles, CHECK_BLOCKS, (unsigned long)stats.ReapedClients);
+
+   pool.Close();
+
+   return Report("killed under load", ok, detail);
+}
+
+// a creator that died after sizing the segment, or before
+static bool CheckHalfCreated(const char* Name, size_t Bytes)
+{
+   CSharedTilePool pool;
+   TSharedTile     tile;
+   int             fd = shm_open(Name, O_RDWR | O_CREAT | O_EXCL, 0600);
+
+   if (fd < 0 || ftruncate(fd, Bytes) != 0)
+      return Report("half created", false, "unable to create the segment");
+
+   close(fd);
+
+   bool ok = pool.Open(Name, CHECK_BLOCKS * SHARED_POOL_BLOCK_BYTES) &&
+             pool.Lookup(MakeKey(0), tile) == SharedTileStatus::CLAIMED && PublishTile(pool, 0);
+
+   pool.Close();
+
+   return Report(Bytes ? "half created" : "never sized", ok);
+}
+
+int main()
+{
+   std::string name = "/osm_poolcheck_" + std::to_string(getpid());
+   bool        ok = true;
+
+   alarm(CHECK_TIMEOUT);
+
+   ok &= CheckCrashedClient(name.c_str());
+   ok &= CheckKilledUnderLoad(name.c_str());
+   ok &= CheckHalfCreated(name.c_str(), 1 << 20);
+   ok &= CheckHalfCreated(name.c_str(), 0);
+
+   shm_unlink(name.c_str());
+
+   return ok ? 0 : 2;
+}
@@ -0,0 +1,396 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "json/json.h"
+#include "Histogram.h"
+#include "TestTileServer.h"
+#include "TileProxy.h"
+
+// Concurrency benchmark of the caching tile proxy in front of the local test
+// tile server. Many clients ask for the same block of tiles at once, cold,
+// then from the proxy's memory at rising client counts, then from its disk
+// cache after a restart. Upstream requests should equal the tiles in the
+// block, however many clients there are.
+
+#define BENCH_ZOOM        12
+#define BENCH_TILE_X      1171  // Washington DC
+#define BENCH_TILE_Y      1566
+#define BENCH_BLOCK       16    // tiles on a side
+#define BENCH_MAX_CLIENTS 1024
+
+// A blocking http client, one connection kept alive across requests the way a
+// browser would, or a new one per request the way CWmtsIf does
+class CBenchClient
+{
+public:
+   CBenchClient(int Port) : mPort(Port), mSocket(-1) {}
+   ~CBenchClient() { Disconnect(); }
+
+   // the status, -1 if the connection failed
+   int Get(const std::string& Path, bool KeepAlive, size_t& BodySize)
+   {
+      // a kept connection the proxy closed since gets one retry
+      for (int attempt = 0; attempt < 2; attempt++)
+      {
+         if (mSocket < 0 && !Connect())
+            return -1;
+
+         int status = Request(Path, KeepAlive, BodySize);
+
+         if (!KeepAlive || status < 0)
+            Disconnect();
+
+         if (status >= 0)
+            return status;
+      }
+
+      return -1;
+   }
+
+private:
+
+   bool Connect()
+   {
+      struct sockaddr_in address;
+      int                enable = 1;
+
+      mSocket = socket(AF_INET, SOCK_STREAM, 0);
+
+      if (mSocket < 0)
+         return false;
+
+      setsockopt(mSocket, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+      memset(&address, 0, sizeof(address));
+      address.sin_family      = AF_INET;
+      address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      address.sin_port        = htons(mPort);
+
+      if (connect(mSocket, (struct sockaddr*)&address, sizeof(address)) < 0)
+      {
+         Disconnect();
+         return false;
+      }
+
+      mBuffer.clear();
+
+      return true;
+   }
+
+   void Disconnect()
+   {
+      if (mSocket >= 0)
+         close(mSocket);
+
+      mSocket = -1;
+   }
+
+   bool Fill()
+   {
+      char    buffer[16384];
+      ssize_t size = recv(mSocket, buffer, sizeof(buffer), 0);
+
+      if (size <= 0)
+         return false;
+
+      mBuffer.append(buffer, size);
+
+      return true;
+   }
+
+   int Request(const std::string& Path, bool KeepAlive, size_t& BodySize)
+   {
+      std::string request = "GET " + Path + " HTTP/1.1\r\nHost: 127.0.0.1:" + std::to_string(mPort) +
+                            (KeepAlive ? "\r\n\r\n" : "\r\nConnection: close\r\n\r\n");
+      size_t      end;
+      int         status;
+
+      if (send(mSocket, request.data(), request.size(), MSG_NOSIGNAL) != (ssize_t)request.size())
+         return -1;
+
+      while ((end = mBuffer.find("\r\n\r\n")) == std::string::npos)
+      {
+         if (!Fill())
+            return -1;
+      }
+
+      const char* length = strcasestr(mBuffer.c_str(), "Content-Length:");
+
+      if (sscanf(mBuffer.c_str(), "HTTP/1.1 %d", &status) != 1 || !length || length > mBuffer.c_str() + end)
+         return -1;
+
+      BodySize = strtoul(length + 15, nullptr, 10);
+
+      while (mBuffer.size() < end + 4 + BodySize)
+      {
+         if (!Fill())
+            return -1;
+      }
+
+      mBuffer.erase(0, end + 4 + BodySize);
+
+      return status;
+   }
+
+   int         mPort;
+   int         mSocket;
+   std::string mBuffer;
+};
+
+struct TPhaseResult
+{
+   std::string       Name;
+   int               Clients;
+   bool              KeepAlive;
+   uint64_t          Requests;
+   uint64_t          Failures;
+   uint64_t          Bytes;
+   double            ElapsedSec;
+   CLatencyHistogram Latency;
+};
+
+// Client threads each walk the tiles Passes times in an order of their own
+// and time every request
+static void RunPhase(TPhaseResult& Result, int Port, const std::vector<std::string>& Paths, int Clients, int Passes, bool KeepAlive)
+{
+   std::vector<std::thread> threads;
+   std::atomic<uint64_t>    failures(0);
+   std::atomic<uint64_t>    bytes(0);
+   auto                     start = std::chrono::steady_clock::now();
+
+   Result.Clients   = Clients;
+   Result.KeepAlive = KeepAlive;
+   Result.Requests  = (uint64_t)Clients * Passes * Paths.size();
+
+   for (int c = 0; c < Clients; c++)
+   {
+      threads.emplace_back([&, c]()
+      {
+         CBenchClient             client(Port);
+         std::vector<std::string> order = Paths;
+         std::mt19937             random(c + 1);
+
+         for (int pass = 0; pass < Passes; pass++)
+         {
+            std::shuffle(order.begin(), order.end(), random);
+
+            for (const auto& path : order)
+            {
+               auto   request_start = std::chrono::steady_clock::now();
+               size_t size = 0;
+
+               if (client.Get(path, KeepAlive, size) != 200)
+                  failures++;
+
+               bytes += size;
+               Result.Latency.Record(std::chrono::duration_cast<std::chrono::microseconds>(
+                     std::chrono::steady_clock::now() - request_start).count());
+            }
+         }
+      });
+   }
+
+   for (auto& thread : threads)
+      thread.join();
+
+   Result.ElapsedSec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+   Result.Failures = failures;
+   Result.Bytes = bytes;
+
+   fprintf(stderr, "%-8s %4d clients %-10s %7lu requests %9.0f req/s p50 %7.2f ms p99 %7.2f ms %lu failed\n",
+           Result.Name.c_str(), Clients, KeepAlive ? "keep-alive" : "close",
+           (unsigned long)Result.Requests, Result.Requests / Result.ElapsedSec,
+           Result.Latency.GetPercentile(50.0) / 1000.0, Result.Latency.GetPercentile(99.0) / 1000.0,
+           (unsigned long)Result.Failures);
+}
+
+static Json::Value GetPhaseJson(const TPhaseResult& Result, const TTileProxyStats& Stats, uint64_t ServerRequests)
+{
+   Json::Value phase;
+
+   phase["name"]                = Result.Name;
+   phase["clients"]             = Result.Clients;
+   phase["keep_alive"]          = Result.KeepAlive;
+   phase["requests"]            = (Json::UInt64)Result.Requests;
+   phase["failures"]            = (Json::UInt64)Result.Failures;
+   phase["bytes"]               = (Json::UInt64)Result.Bytes;
+   phase["elapsed_sec"]         = Result.ElapsedSec;
+   phase["requests_per_sec"]    = Result.Requests / Result.ElapsedSec;
+   phase["latency_ms"]["p50"]   = Result.Latency.GetPercentile(50.0) / 1000.0;
+   phase["latency_ms"]["p99"]   = Result.Latency.GetPercentile(99.0) / 1000.0;
+   phase["latency_ms"]["mean"]  = Result.Latency.GetMean() / 1000.0;
+   phase["latency_ms"]["max"]   = Result.Latency.GetMax() / 1000.0;
+   phase["memory_hits"]         = (Json::UInt64)Stats.MemoryHits;
+   phase["disk_hits"]           = (Json::UInt64)Stats.DiskHits;
+   phase["upstream_fetches"]    = (Json::UInt64)Stats.UpstreamFetches;
+   phase["coalesced"]           = (Json::UInt64)Stats.Coalesced;
+   phase["peak_connections"]    = (Json::UInt64)Stats.PeakConnections;
+   phase["server_requests"]     = (Json::UInt64)ServerRequests;
+
+   return phase;
+}
+
+static void Usage()
+{
+   fprintf(stderr, "usage: osm_proxybench [--clients N] [--latency MS] [--upstream N] [--passes N] [--output FILE]\n");
+}
+
+int main(int argc, char* argv[])
+{
+   TTestTileServerConfig     server_config = CTestTileServer::DefaultConfig();
+   TTileProxyConfig          proxy_config = CTileProxy::DefaultConfig();
+   CTestTileServer           server;
+   std::vector<std::string>  paths;
+   std::deque<TPhaseResult>  results;   // the histograms don't move
+   Json::Value               phases(Json::arrayValue);
+   const char*               output = nullptr;
+   int                       clients = 64;
+   int                       passes = 4;
+   int                       failed = 0;
+
+   server_config.LatencyMs = 20;
+   server_config.JitterMs  = 5;
+
+   for (int i = 1; i < argc; i++)
+   {
+      bool has_value = (i + 1 < argc);
+
+      if (strcmp(argv[i], "--clients") == 0 && has_value)
+         clients = std::max(1, std::min(atoi(argv[++i]), BENCH_MAX_CLIENTS));
+      else if (strcmp(argv[i], "--latency") == 0 && has_value)
+         server_config.LatencyMs = atoi(argv[++i]);
+      else if (strcmp(argv[i], "--upstream") == 0 && has_value)
+         proxy_config.UpstreamConnections = atoi(argv[++i]);
+      else if (strcmp(argv[i], "--passes") == 0 && has_value)
+         passes = std::max(1, atoi(argv[++i]));
+      else if (strcmp(argv[i], "--output") == 0 && has_value)
+         output = argv[++i];
+      else
+      {
+         Usage();
+         return 1;
+      }
+   }
+
+   for (int y = 0; y < BENCH_BLOCK; y++)
+   {
+      for (int x = 0; x < BENCH_BLOCK; x++)
+      {
+         paths.push_back("/styles/basic-preview/256/" + std::to_string(BENCH_ZOOM) + "/" +
+                         std::to_string(BENCH_TILE_X + x) + "/" + std::to_string(BENCH_TILE_Y + y) + ".png");
+      }
+   }
+
+   if (!server.Open(server_config))
+      return 1;
+
+   // start from an empty disk cache so the cold phase goes upstream
+   std::error_code       err;
+   std::filesystem::path cache_dir = std::filesystem::temp_directory_path(err) /
+                                     ("osm_proxybench_" + std::to_string(getpid()));
+
+   std::filesystem::remove_all(cache_dir, err);
+   proxy_config.UpstreamUrl = server.GetUrl();
+   proxy_config.CachePath   = cache_dir.string() + "/";
+
+   {
+      CTileProxy proxy;
+
+      if (!proxy.Open(proxy_config))
+         return 1;
+
+      uint64_t server_start = server.GetRequestCount();
+
+      // every client wants every tile at once, the upstream sees each once
+      results.emplace_back();
+      results.back().Name = "cold";
+      RunPhase(results.back(), proxy.GetPort(), paths, clients, 1, true);
+      phases.append(GetPhaseJson(results.back(), proxy.GetStats(), server.GetRequestCount() - server_start));
+
+      if (server.GetRequestCount() - server_start != paths.size())
+      {
+         fprintf(stderr, "cold phase: %lu upstream requests for %zu tiles\n",
+                 (unsigned long)(server.GetRequestCount() - server_start), paths.size());
+         failed++;
+      }
+
+      // from memory, the event loop is all there is
+      for (int memory_clients : { 1, 16, 64, 256 })
+      {
+         for (bool keep_alive : { true, false })
+         {
+            results.emplace_back();
+            results.back().Name = "memory";
+            RunPhase(results.back(), proxy.GetPort(), paths, memory_clients, passes, keep_alive);
+            phases.append(GetPhaseJson(results.back(), proxy.GetStats(), server.GetRequestCount() - server_start));
+         }
+      }
+   }
+
+   {
+      CTileProxy proxy;
+
+      if (!proxy.Open(proxy_config))
+         return 1;
+
+      uint64_t server_start = server.GetRequestCount();
+
+      // a restarted proxy serves the tiles from its disk cache
+      results.emplace_back();
+      results.back().Name = "disk";
+      RunPhase(results.back(), proxy.GetPort(), paths, clients, 1, true);
+      phases.append(GetPhaseJson(results.back(), proxy.GetStats(), server.GetRequestCount() - server_start));
+
+      if (server.GetRequestCount() - server_start > 0)
+      {
+         fprintf(stderr, "disk phase: %lu upstream requests\n", (unsigned long)(server.GetRequestCount() - server_start));
+         failed++;
+      }
+   }
+
+   server.Close();
+   std::filesystem::remove_all(cache_dir, err);
+
+   for (const auto& result : results)
+      failed += result.Failures ? 1 : 0;
+
+   Json::Value root;
+
+   root["config"]["latency_ms"]           = server_config.LatencyMs;
+   root["config"]["jitter_ms"]            = server_config.JitterMs;
+   root["config"]["upstream_connections"] = proxy_config.UpstreamConnections;
+   root["config"]["tiles"]                = (Json::UInt64)paths.size();
+   root["config"]["clients"]              = clients;
+   root["config"]["passes"]               = passes;
+   root["phases"]                         = phases;
+
+   Json::StyledStreamWriter writer("   ");
+
+   if (output)
+   {
+      std::ofstream json_file(output, std::ios::out | std::ios::trunc);
+      writer.write(json_file, root);
+   }
+   else
+   {
+      writer.write(std::cout, root);
+   }
+
+   return failed ? 2 : 0;
+}
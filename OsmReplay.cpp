@@ -0,0 +1,448 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <glad/glad.h>
+#include <glm/gtc/matrix_transform.hpp>
+#include "json/json.h"
+#include "GlDebug.h"
+#include "HeadlessContext.h"
+#include "HeapCounter.h"
+#include "Histogram.h"
+#include "OpenStreetMap.h"
+#include "TestTileServer.h"
+#include "ViewRecorder.h"
+
+// Replays a view recording from main --record FILE frame for frame against
+// the local test tile server, drawing into a framebuffer object of a headless
+// context, and reports frame times, tiles fetched, cache hit rates and the
+// time to complete the viewport each time the view comes to rest. Every run
+// starts from an empty disk cache and a server with a fixed seed, so two
+// builds replaying the same file see the same inputs and the same tiles.
+
+#define REPLAY_FRAME_RATE 60
+#define REPLAY_WIDTH      1280
+#define REPLAY_HEIGHT     720
+
+struct TTrajectoryStep
+{
+   double Latitude;
+   double Longitude;
+   double ScaleFactor;
+   double RotationDeg;
+   int    Frames;      // frames to animate from the previous step
+   int    HoldFrames;  // frames to stay at the step
+};
+
+// the load test's run from Washington DC out to Dulles and back, with a
+// turn on the way and a rest after each move
+static const TTrajectoryStep default_trajectory[] =
+{
+   { 38.8977, -77.0365, 72000.0,   0.0,  0,   180 },
+   { 38.8977, -77.0365, 35000.0,   0.0,  30,  180 },
+   { 38.9100, -77.1500, 35000.0,   30.0, 120, 180 },
+   { 38.9392, -77.4600, 72000.0,   30.0, 180, 180 },
+   { 38.9392, -77.4600, 300000.0,  0.0,  60,  180 },
+   { 38.9392, -77.4600, 1200000.0, 0.0,  60,  180 },
+   { 38.8977, -77.0365, 1200000.0, 0.0,  120, 180 },
+   { 38.8977, -77.0365, 72000.0,   0.0,  90,  180 },
+};
+
+static void MakeDefaultTrajectory(std::vector<TRecordedView>& Views)
+{
+   TRecordedView view = {};
+
+   view.MapWidth     = REPLAY_WIDTH;
+   view.MapHeight    = REPLAY_HEIGHT;
+   view.WindowWidth  = REPLAY_WIDTH;
+   view.WindowHeight = REPLAY_HEIGHT;
+
+   const TTrajectoryStep* previous = &default_trajectory[0];
+
+   for (const TTrajectoryStep& step : default_trajectory)
+   {
+      for (int frame = 1; frame <= step.Frames; frame++)
+      {
+         double t = (double)frame / (double)step.Frames;
+
+         view.Latitude    = previous->Latitude + (step.Latitude - previous->Latitude) * t;
+         view.Longitude   = previous->Longitude + (step.Longitude - previous->Longitude) * t;
+         view.ScaleFactor = (float)(previous->ScaleFactor * pow(step.ScaleFactor / previous->ScaleFactor, t));
+         view.RotationDeg = (float)(previous->RotationDeg + (step.RotationDeg - previous->RotationDeg) * t);
+         Views.push_back(view);
+      }
+
+      view.Latitude    = step.Latitude;
+      view.Longitude   = step.Longitude;
+      view.ScaleFactor = (float)step.ScaleFactor;
+      view.RotationDeg = (float)step.RotationDeg;
+
+      for (int frame = 0; frame < step.HoldFrames; frame++)
+         Views.push_back(view);
+
+      previous = &step;
+   }
+}
+
+// FNV-1a of the records, two reports with the same hash replayed the same frames
+static std::string HashViews(const std::vector<TRecordedView>& Views)
+{
+   const unsigned char* bytes = (const unsigned char*)Views.data();
+   uint64_t             hash = 0xcbf29ce484222325ull;
+
+   for (size_t i = 0; i < Views.size() * sizeof(TRecordedView); i++)
+   {
+      hash ^= bytes[i];
+      hash *= 0x100000001b3ull;
+   }
+
+   char hex[17];
+
+   snprintf(hex, sizeof(hex), "%016lx", (unsigned long)hash);
+
+   return hex;
+}
+
+static void Usage()
+{
+   fprintf(stderr,
+      "usage: osm_replay [options]\n"
+      "   --input FILE       view recording from main --record, a built in one if not given\n"
+      "   --generate FILE    write the built in recording to a file and exit\n"
+      "   --rate FPS         replay rate, 0 is unthrottled (default the recording's)\n"
+      "   --latency MS       added to every tile response (default 20)\n"
+      "   --jitter MS        +/- uniform jitter on the latency (default 10)\n"
+      "   --connections N    server connection limit, 0 is unlimited (default 4)\n"
+      "   --timeout SEC      time allowed for the last view to complete (default 30)\n"
+      "   --output FILE      write the json report to a file instead of stdout\n");
+}
+
+int main(int argc, char* argv[])
+{
+   using clock = std::chrono::steady_clock;
+
+   TTestTileServerConfig      config = CTestTileServer::DefaultConfig();
+   CTestTileServer            server;
+   CHeadlessContext           context;
+   std::vector<TRecordedView> views;
+   CLatencyHistogram          frame_time;
+   CLatencyHistogram          frame_allocations;
+   CLatencyHistogram          steady_allocations;
+   CLatencyHistogram          complete_time;
+   const char*                input = nullptr;
+   const char*                generate = nullptr;
+   const char*                output = nullptr;
+   double                     timeout_sec = 30.0;
+   int                        recorded_rate = REPLAY_FRAME_RATE;
+   int                        rate = -1;
+   bool                       last_complete = false;
+
+   config.LatencyMs      = 20;
+   config.JitterMs       = 10;
+   config.MaxConnections = 4;
+
+   for (int i = 1; i < argc; i++)
+   {
+      bool has_value = (i + 1 < argc);
+
+      if (strcmp(argv[i], "--input") == 0 && has_value)
+         input = argv[++i];
+      else if (strcmp(argv[i], "--generate") == 0 && has_value)
+         generate = argv[++i];
+      else if (strcmp(argv[i], "--rate") == 0 && has_value)
+         rate = atoi(argv[++i]);
+      else if (strcmp(argv[i], "--latency") == 0 && has_value)
+         config.LatencyMs = atoi(argv[++i]);
+      else if (strcmp(argv[i], "--jitter") == 0 && has_value)
+         config.JitterMs = atoi(argv[++i]);
+      else if (strcmp(argv[i], "--connections") == 0 && has_value)
+         config.MaxConnections = atoi(argv[++i]);
+      else if (strcmp(argv[i], "--timeout") == 0 && has_value)
+         timeout_sec = atof(argv[++i]);
+      else if (strcmp(argv[i], "--output") == 0 && has_value)
+         output = argv[++i];
+      else
+      {
+         Usage();
+         return 1;
+      }
+   }
+
+   if (input)
+   {
+      if (!CViewRecorder::Load(input, views, recorded_rate))
+      {
+         fprintf(stderr, "Unable to load %s\n", input);
+         return 1;
+      }
+   }
+   else
+      MakeDefaultTrajectory(views);
+
+   if (generate)
+   {
+      if (!CViewRecorder::Save(generate, views, recorded_rate))
+      {
+         fprintf(stderr, "Unable to write %s\n", generate);
+         return 1;
+      }
+
+      return 0;
+   }
+
+   if (rate < 0)
+      rate = recorded_rate;
+
+   // the framebuffer is as large as the largest window of the recording,
+   // each frame draws into the corner its window covers
+   int max_width = 1;
+   int max_height = 1;
+
+   for (const auto& view : views)
+   {
+      max_width = std::max(max_width, (int)view.WindowWidth);
+      max_height = std::max(max_height, (int)view.WindowHeight);
+   }
+
+   if (!server.Open(config))
+      return 1;
+
+   if (!context.Open())
+      return 1;
+
+   fprintf(stderr, "Replaying %zu frames at %d fps with %s\n", views.size(), rate, context.GetRenderer().c_str());
+
+   unsigned int framebuffer;
+   unsigned int color_buffer;
+
+   GLCALL(glGenFramebuffers(1, &framebuffer));
+   GLCALL(glGenRenderbuffers(1, &color_buffer));
+   GLCALL(glBindRenderbuffer(GL_RENDERBUFFER, color_buffer));
+   GLCALL(glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, max_width, max_height));
+   GLCALL(glBindFramebuffer(GL_FRAMEBUFFER, framebuffer));
+   GLCALL(glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color_buffer));
+   GLCALL(glEnable(GL_BLEND));
+   GLCALL(glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA));
+
+   // start from an empty disk cache so every run fetches the same tiles
+   std::error_code       err;
+   std::filesystem::path cache_dir = std::filesystem::temp_directory_path(err) /
+                                     ("osm_replay_" + std::to_string(getpid()));
+
+   std::filesystem::remove_all(cache_dir, err);
+   std::filesystem::create_directories(cache_dir, err);
+
+   Json::Value root;
+   int         result = 0;
+   int         settled = 0;
+   int         incomplete = 0;
+   uint64_t    complete_frames = 0;
+   double      elapsed_sec = 0.0;
+
+   {
+      COpenStreetMap map;
+
+      map.SetShaders(std::make_shared<CShader>("data/shaders/rect.vert", "data/shaders/rect.frag"),
+                     std::make_shared<CShader>("data/shaders/line.vert", "data/shaders/line.frag"),
+                     std::make_shared<CShader>("data/shaders/tile.vert", "data/shaders/tile.frag"));
+      map.SetBorderColor(glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+      map.SetCoverageRadiusScaleFactor(1.0f);
+      map.SetMapCenter(views[0].Latitude, views[0].Longitude);
+      map.SetMapScaleFactor(views[0].ScaleFactor);
+      map.Update();
+
+      if (!map.Open(true, server.GetUrl().c_str(), true, cache_dir.c_str()))
+      {
+         fprintf(stderr, "Failed to open the map\n");
+         return 1;
+      }
+
+      auto start_time = clock::now();
+      auto frame_period = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(rate > 0 ? 1.0 / rate : 0.0));
+      auto next_frame = start_time;
+      auto change_time = start_time;     // the view last moved
+      bool waiting = true;               // for the view since then to complete
+      bool resting = false;              // the view hasn't moved for a frame
+
+      // the frames of the recording, then the last view held until it
+      // completes or the timeout runs out
+      for (size_t f = 0; ; f++)
+      {
+         bool                 holding = (f >= views.size());
+         const TRecordedView& view = views[holding ? views.size() - 1 : f];
+
+         if (holding && (!waiting || std::chrono::duration<double>(clock::now() - change_time).count() > timeout_sec))
+            break;
+
+         if (rate > 0)
+         {
+            std::this_thread::sleep_until(next_frame);
+            next_frame += frame_period;
+         }
+
+         auto frame_start = clock::now();
+
+         if (f > 0 && !holding && memcmp(&view, &views[f - 1], sizeof(view)) != 0)
+         {
+            // a view that rested and moved on before it was complete
+            if (waiting && resting)
+               incomplete++;
+
+            change_time = frame_start;
+            waiting = true;
+            resting = false;
+         }
+         else if (f > 0)
+            resting = true;
+
+         map.SetProjection(glm::ortho(-(float)view.WindowWidth * 0.5f,
+                                       (float)view.WindowWidth * 0.5f,
+                                      -(float)view.WindowHeight * 0.5f,
+                                       (float)view.WindowHeight * 0.5f, -1.0f, 1.0f));
+         map.SetMapCenter(view.Latitude, view.Longitude);
+         map.SetMapRotation(view.RotationDeg);
+         map.SetMapScaleFactor(view.ScaleFactor);
+         map.EnableEasing((view.Flags & VIEW_FLAG_EASING) != 0);
+         map.EnableSubframeBoundaries((view.Flags & VIEW_FLAG_BOUNDARIES) != 0);
+         map.EnableBorder((view.Flags & VIEW_FLAG_BORDER) != 0);
+         map.EnableClip((view.Flags & VIEW_FLAG_CLIP) != 0);
+         map.SetMapSize(view.MapWidth, view.MapHeight);
+         map.SetWindowSize(view.WindowWidth, view.WindowHeight);
+         map.SetMapOffset(view.OffsetX, view.OffsetY);
+
+         GLCALL(glViewport(0, 0, view.WindowWidth, view.WindowHeight));
+         GLCALL(glClearColor(0.5f, 0.5f, 0.5f, 1.0f));
+         GLCALL(glClear(GL_COLOR_BUFFER_BIT));
+
+         uint64_t allocations = GetThreadAllocations();
+
+         map.Update();
+         map.Draw();
+         GLCALL(glFinish());
+
+         auto frame_end = clock::now();
+
+         allocations = GetThreadAllocations() - allocations;
+
+         if (!holding)
+         {
+            frame_time.Record(std::chrono::duration_cast<std::chrono::microseconds>(frame_end - frame_start).count());
+            frame_allocations.Record(allocations);
+         }
+
+         if (map.IsViewportComplete())
+         {
+            if (!holding)
+               complete_frames++;
+
+            // a complete view at rest is the steady state
+            if (resting)
+               steady_allocations.Record(allocations);
+
+            // only a view at rest counts, one in motion completes by chance
+            if (waiting && resting)
+            {
+               complete_time.Record(std::chrono::duration_cast<std::chrono::microseconds>(frame_end - change_time).count());
+               settled++;
+               waiting = false;
+            }
+         }
+      }
+
+      if (waiting)
+         incomplete++;
+
+      last_complete = !waiting;
+
+      elapsed_sec = std::chrono::duration<double>(clock::now() - start_time).count();
+
+      map.Close();
+
+      // report
+      const CMapStats&         stats = map.GetStats();
+      const CLatencyHistogram& latency = stats.GetLatency(TileStage::NETWORK);
+
+      root["renderer"]                  = context.GetRenderer();
+      root["recording"]["file"]         = input ? input : "built in";
+      root["recording"]["frames"]       = (Json::UInt64)views.size();
+      root["recording"]["frame_rate"]   = recorded_rate;
+      root["recording"]["hash"]         = HashViews(views);
+      root["config"]["rate"]            = rate;
+      root["config"]["latency_ms"]      = config.LatencyMs;
+      root["config"]["jitter_ms"]       = config.JitterMs;
+      root["config"]["max_connections"] = config.MaxConnections;
+      root["config"]["seed"]            = config.Seed;
+      root["elapsed_sec"]               = elapsed_sec;
+      root["frame_ms"]["p50"]           = frame_time.GetPercentile(50.0) / 1000.0;
+      root["frame_ms"]["p90"]           = frame_time.GetPercentile(90.0) / 1000.0;
+      root["frame_ms"]["p99"]           = frame_time.GetPercentile(99.0) / 1000.0;
+      root["frame_ms"]["mean"]          = frame_time.GetMean() / 1000.0;
+      root["frame_ms"]["max"]           = frame_time.GetMax() / 1000.0;
+      root["complete_frames"]           = (Json::UInt64)complete_frames;
+      root["allocations_per_frame"]["mean"]   = frame_allocations.GetMean();
+      root["allocations_per_frame"]["p99"]    = (Json::UInt64)frame_allocations.GetPercentile(99.0);
+      root["allocations_per_frame"]["max"]    = (Json::UInt64)frame_allocations.GetMax();
+      root["allocations_per_frame"]["steady"] = (Json::UInt64)steady_allocations.GetPercentile(50.0);
+      root["allocations_per_coverage_pass"]["mean"] = stats.GetAllocations(AllocPass::COVERAGE).GetMean();
+      root["allocations_per_coverage_pass"]["max"]  = (Json::UInt64)stats.GetAllocations(AllocPass::COVERAGE).GetMax();
+      root["tiles_fetched"]             = (Json::UInt64)latency.GetCount();
+      root["fetch_failures"]            = (Json::UInt64)stats.GetMisses(CacheTier::WMTS);
+      root["server_requests"]           = (Json::UInt64)server.GetRequestCount();
+      root["hit_rate"]["memory"]        = stats.GetHitRate(CacheTier::MEMORY);
+      root["hit_rate"]["disk"]          = stats.GetHitRate(CacheTier::DISK);
+      root["hit_rate"]["wmts"]          = stats.GetHitRate(CacheTier::WMTS);
+      root["zoom_changes"]              = (Json::UInt64)stats.GetZoomChanges();
+      root["settled_views"]             = settled;
+      root["incomplete_views"]          = incomplete;
+      root["time_to_complete_viewport_ms"]["p50"]  = complete_time.GetPercentile(50.0) / 1000.0;
+      root["time_to_complete_viewport_ms"]["p99"]  = complete_time.GetPercentile(99.0) / 1000.0;
+      root["time_to_complete_viewport_ms"]["mean"] = complete_time.GetMean() / 1000.0;
+      root["time_to_complete_viewport_ms"]["max"]  = complete_time.GetMax() / 1000.0;
+
+      fprintf(stderr, "%zu frames in %.1f s, frame p50 %.2f ms p99 %.2f ms, %lu tiles, %d of %d views complete\n",
+              views.size(), elapsed_sec, frame_time.GetPercentile(50.0) / 1000.0, frame_time.GetPercentile(99.0) / 1000.0,
+              (unsigned long)latency.GetCount(), settled, settled + incomplete);
+   }
+
+   server.Close();
+   CTileService::DeleteTextures();
+   std::filesystem::remove_all(cache_dir, err);
+
+   Json::StyledStreamWriter writer("   ");
+
+   if (output)
+   {
+      std::ofstream json_file(output, std::ios::out | std::ios::trunc);
+
+      if (json_file.is_open())
+         writer.write(json_file, root);
+      else
+      {
+         fprintf(stderr, "Unable to open %s\n", output);
+         result = 1;
+      }
+   }
+   else
+      writer.write(std::cout, root);
+
+   GLCALL(glBindFramebuffer(GL_FRAMEBUFFER, 0));
+   GLCALL(glDeleteRenderbuffers(1, &color_buffer));
+   GLCALL(glDeleteFramebuffers(1, &framebuffer));
+   context.Close();
+
+   // views that moved on before they completed are part of the result, a
+   // last view that never completes is a broken pipeline
+   if (result == 0 && !last_complete)
+      result = 2;
+
+   return result;
+}
@@ -0,0 +1,175 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "CacheSeeder.h"
+
+// Downloads the tiles of an area into the disk cache for offline use. Stop
+// it with ctrl-c at any time, running it again picks up where it left off.
+
+static volatile sig_atomic_t terminate = 0;
+
+static void SignalHandler(int)
+{
+   terminate = 1;
+}
+
+static void Usage()
+{
+   fprintf(stderr,
+      "usage: osm_seed --url HOST:PORT (--bbox S,W,N,E | --polygon LAT,LON;LAT,LON;...) --zoom MIN[-MAX] [options]\n"
+      "   --cache DIR        disk cache the map reads (default data/map)\n"
+      "   --connections N    parallel downloads (default 4, at most %d)\n"
+      "   --rate R           requests per second over all connections, 0 is unlimited (default 20)\n"
+      "   --retries N        attempts per tile after the first (default 3)\n"
+      "   --count            only print how many tiles the area has\n", SEED_MAX_CONNECTIONS);
+}
+
+static bool ParsePolygon(const char* Text, std::vector<TSeedPoint>& Polygon)
+{
+   const char* cursor = Text;
+
+   Polygon.clear();
+
+   while (*cursor)
+   {
+      TSeedPoint point;
+      int        length = 0;
+
+      if (sscanf(cursor, "%lf,%lf%n", &point.Latitude, &point.Longitude, &length) != 2)
+         return false;
+
+      Polygon.push_back(point);
+      cursor += length;
+
+      if (*cursor == ';')
+         cursor++;
+   }
+
+   return Polygon.size() >= 3;
+}
+
+static void PrintProgress(const TSeedProgress& Progress)
+{
+   uint64_t done = Progress.Cached + Progress.Downloaded + Progress.Failed;
+
+   fprintf(stderr, "zoom %2d: %llu/%llu tiles (%.1f%%), %llu cached, %llu downloaded, %llu failed, %.1f tiles/s, %.1f MB\n",
+           Progress.Zoom,
+           (unsigned long long)done,
+           (unsigned long long)Progress.Total,
+           Progress.Total ? 100.0 * done / Progress.Total : 100.0,
+           (unsigned long long)Progress.Cached,
+           (unsigned long long)Progress.Downloaded,
+           (unsigned long long)Progress.Failed,
+           Progress.ElapsedSec > 0.0 ? Progress.Downloaded / Progress.ElapsedSec : 0.0,
+           Progress.Bytes / 1e6);
+}
+
+int main(int argc, char* argv[])
+{
+   CCacheSeeder seeder;
+   TSeedRequest request;
+   const char*  url = nullptr;
+   const char*  cache = "data/map";
+   bool         count_only = false;
+
+   request.MinZoom        = -1;
+   request.MaxZoom        = -1;
+   request.Connections    = 4;
+   request.RequestsPerSec = 20.0;
+   request.Retries        = 3;
+
+   for (int i = 1; i < argc; i++)
+   {
+      bool has_value = (i + 1 < argc);
+
+      if (strcmp(argv[i], "--bbox") == 0 && has_value)
+      {
+         double south, west, north, east;
+
+         if (sscanf(argv[++i], "%lf,%lf,%lf,%lf", &south, &west, &north, &east) != 4)
+         {
+            Usage();
+            return 1;
+         }
+
+         request.Polygon = CCacheSeeder::MakeBoundingBox(south, west, north, east);
+      }
+      else if (strcmp(argv[i], "--polygon") == 0 && has_value)
+      {
+         if (!ParsePolygon(argv[++i], request.Polygon))
+         {
+            Usage();
+            return 1;
+         }
+      }
+      else if (strcmp(argv[i], "--zoom") == 0 && has_value)
+      {
+         int fields = sscanf(argv[++i], "%d-%d", &request.MinZoom, &request.MaxZoom);
+
+         if (fields == 1)
+            request.MaxZoom = request.MinZoom;
+      }
+      else if (strcmp(argv[i], "--url") == 0 && has_value)
+         url = argv[++i];
+      else if (strcmp(argv[i], "--cache") == 0 && has_value)
+         cache = argv[++i];
+      else if (strcmp(argv[i], "--connections") == 0 && has_value)
+         request.Connections = atoi(argv[++i]);
+      else if (strcmp(argv[i], "--rate") == 0 && has_value)
+         request.RequestsPerSec = atof(argv[++i]);
+      else if (strcmp(argv[i], "--retries") == 0 && has_value)
+         request.Retries = atoi(argv[++i]);
+      else if (strcmp(argv[i], "--count") == 0)
+         count_only = true;
+      else
+      {
+         Usage();
+         return 1;
+      }
+   }
+
+   if (request.Polygon.empty() || request.MinZoom < 0 || (!url && !count_only))
+   {
+      Usage();
+      return 1;
+   }
+
+   if (count_only)
+   {
+      printf("%llu\n", (unsigned long long)CCacheSeeder::CountTiles(request));
+      return 0;
+   }
+
+   signal(SIGINT, SignalHandler);
+   signal(SIGTERM, SignalHandler);
+
+   if (!seeder.Open(url, cache) || !seeder.Start(request))
+      return 1;
+
+   while (seeder.IsRunning() && !terminate)
+   {
+      sleep(1);
+
+      if (seeder.IsRunning())
+         PrintProgress(seeder.GetProgress());
+   }
+
+   seeder.Stop();
+
+   TSeedProgress progress = seeder.GetProgress();
+
+   PrintProgress(progress);
+   seeder.Close();
+
+   if (terminate)
+   {
+      fprintf(stderr, "Interrupted, run again with the same area to resume\n");
+      return 3;
+   }
+
+   return progress.Failed ? 2 : 0;
+}
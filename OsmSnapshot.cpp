@@ -0,0 +1,294 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "json/json.h"
+#include "HeadlessContext.h"
+#include "Histogram.h"
+#include "MapSnapshot.h"
+#include "PngWriter.h"
+#include "PolylineLayer.h"
+#include "TestTileServer.h"
+
+// Renders map snapshots without a window, for build servers. Without --url
+// the tiles come from the local test tile server, which is also what the
+// --bench throughput numbers are measured against.
+
+static void Usage()
+{
+   fprintf(stderr,
+      "usage: osm_snapshot [options]\n"
+      "   --lat DEG          map center latitude (default 38.8977)\n"
+      "   --lon DEG          map center longitude (default -77.0365)\n"
+      "   --scale S          map scale factor (default 72000)\n"
+      "   --rotation DEG     clockwise map rotation (default 0)\n"
+      "   --width PIX        image width (default 1280)\n"
+      "   --height PIX       image height (default 720)\n"
+      "   --output FILE      png, or raw rgba if the name ends in .rgba (default snapshot.png)\n"
+      "   --url HOST:PORT    tile server, the local test server is used if not given\n"
+      "   --cache DIR        disk cache, a temporary one is used if not given\n"
+      "   --timeout SEC      time allowed for the tiles of each map (default 30)\n"
+      "   --bench N          render N maps panning east and report maps per second\n"
+      "   --tracks N         draw N points of random tracks around the center over the map\n");
+}
+
+// random walks of up to 100000 points starting near the map center, a few
+// meters a step with a slowly turning heading like a gps track
+static void AddTracks(CPolylineLayer& Layer, const TSnapshotView& View, int Points)
+{
+   std::mt19937                     random(1);
+   std::uniform_real_distribution<> start(-0.05, 0.05);
+   std::normal_distribution<>       turn(0.0, 0.1);
+   std::vector<double>              latitude;
+   std::vector<double>              longitude;
+
+   for (int track = 0; Points > 1; track++)
+   {
+      int    count = std::min(Points, 100000);
+      double lat = View.Latitude + start(random);
+      double lon = View.Longitude + start(random);
+      double heading = start(random) * 100.0;
+      float  hue = (float)(track % 6) / 6.0f;
+
+      latitude.resize(count);
+      longitude.resize(count);
+
+      for (int i = 0; i < count; i++)
+      {
+         heading += turn(random);
+         lat += 0.00005 * cos(heading);
+         lon += 0.00005 * sin(heading) / cos(lat * M_PI / 180.0);
+         latitude[i] = lat;
+         longitude[i] = lon;
+      }
+
+      Layer.Add(latitude.data(), longitude.data(), count,
+                glm::vec4(0.5f + 0.5f * cosf(hue * 6.2832f), 0.5f + 0.5f * cosf((hue - 0.333f) * 6.2832f),
+                          0.5f + 0.5f * cosf((hue + 0.333f) * 6.2832f), 0.8f), 3.0f);
+      Points -= count;
+   }
+}
+
+static bool WriteSnapshot(const char* Filename, const std::vector<unsigned char>& Rgba, int Width, int Height)
+{
+   size_t length = strlen(Filename);
+
+   if (length > 5 && strcmp(Filename + length - 5, ".rgba") == 0)
+   {
+      std::ofstream rgba_file(Filename, std::ios::out | std::ios::binary | std::ios::trunc);
+
+      rgba_file.write((const char*)Rgba.data(), Rgba.size());
+      return rgba_file.good();
+   }
+
+   return WritePngFile(Filename, Rgba.data(), Width, Height, 4);
+}
+
+int main(int argc, char* argv[])
+{
+   using clock = std::chrono::steady_clock;
+
+   CHeadlessContext           context;
+   CTestTileServer            server;
+   std::vector<unsigned char> rgba;
+   TSnapshotView              view = { 38.8977, -77.0365, 72000.0, 0.0, 1280, 720 };
+   const char*                output = "snapshot.png";
+   const char*                url = nullptr;
+   const char*                cache = nullptr;
+   double                     timeout_sec = 30.0;
+   int                        bench_maps = 0;
+   int                        track_points = 0;
+
+   for (int i = 1; i < argc; i++)
+   {
+      bool has_value = (i + 1 < argc);
+
+      if (strcmp(argv[i], "--lat") == 0 && has_value)
+         view.Latitude = atof(argv[++i]);
+      else if (strcmp(argv[i], "--lon") == 0 && has_value)
+         view.Longitude = atof(argv[++i]);
+      else if (strcmp(argv[i], "--scale") == 0 && has_value)
+         view.ScaleFactor = atof(argv[++i]);
+      else if (strcmp(argv[i], "--rotation") == 0 && has_value)
+         view.RotationDeg = atof(argv[++i]);
+      else if (strcmp(argv[i], "--width") == 0 && has_value)
+         view.Width = atoi(argv[++i]);
+      else if (strcmp(argv[i], "--height") == 0 && has_value)
+         view.Height = atoi(argv[++i]);
+      else if (strcmp(argv[i], "--output") == 0 && has_value)
+         output = argv[++i];
+      else if (strcmp(argv[i], "--url") == 0 && has_value)
+         url = argv[++i];
+      else if (strcmp(argv[i], "--cache") == 0 && has_value)
+         cache = argv[++i];
+      else if (strcmp(argv[i], "--timeout") == 0 && has_value)
+         timeout_sec = atof(argv[++i]);
+      else if (strcmp(argv[i], "--bench") == 0 && has_value)
+         bench_maps = atoi(argv[++i]);
+      else if (strcmp(argv[i], "--tracks") == 0 && has_value)
+         track_points = atoi(argv[++i]);
+      else
+      {
+         Usage();
+         return 1;
+      }
+   }
+
+   std::string server_url;
+
+   if (!url)
+   {
+      TTestTileServerConfig config = CTestTileServer::DefaultConfig();
+
+      config.Port = 0;
+
+      if (!server.Open(config))
+         return 1;
+
+      server_url = server.GetUrl();
+      url = server_url.c_str();
+   }
+
+   // the map only reads tiles through its disk cache directory
+   std::error_code       err;
+   std::filesystem::path cache_dir = std::filesystem::temp_directory_path(err) /
+                                     ("osm_snapshot_" + std::to_string(getpid()));
+
+   if (!cache)
+   {
+      std::filesystem::create_directories(cache_dir, err);
+      cache = cache_dir.c_str();
+   }
+
+   if (!context.Open())
+      return 1;
+
+   fprintf(stderr, "Rendering with %s\n", context.GetRenderer().c_str());
+
+   int result = 0;
+
+   {
+      CMapSnapshot   snapshot;
+      CPolylineLayer tracks;
+
+      if (!snapshot.Open(url, cache))
+      {
+         fprintf(stderr, "Failed to open the map\n");
+         return 1;
+      }
+
+      if (track_points > 0)
+      {
+         auto tracks_start = clock::now();
+
+         tracks.Open(std::make_shared<CShader>("data/shaders/polyline.vert", "data/shaders/polyline.frag"));
+         AddTracks(tracks, view, track_points);
+
+         while (tracks.IsBuilding())
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+         snapshot.GetMap().AddLayer(&tracks);
+
+         fprintf(stderr, "Built %d track points in %.1f ms\n", track_points,
+                 std::chrono::duration<double, std::milli>(clock::now() - tracks_start).count());
+      }
+
+      auto first_start = clock::now();
+
+      if (!snapshot.Render(view, rgba, timeout_sec) || !WriteSnapshot(output, rgba, view.Width, view.Height))
+      {
+         fprintf(stderr, "Failed to render %s\n", output);
+         result = 1;
+      }
+
+      double first_ms = std::chrono::duration<double, std::milli>(clock::now() - first_start).count();
+
+      fprintf(stderr, "Wrote %s (%d x %d) in %.1f ms\n", output, view.Width, view.Height, first_ms);
+
+      if (bench_maps > 0 && result == 0)
+      {
+         CLatencyHistogram map_time;
+         int               rendered = 0;
+         int               zoom = snapshot.GetMap().GetZoomLevel();
+         double            map_zoom = snapshot.GetMap().GetMapZoom();
+
+         // pan east by half a map each time so every map needs some new tiles,
+         // degrees per screen pixel follow the scaling in COpenStreetMap::Draw
+         double deg_per_pixel = 360.0 / (OSM_TILE_SIZE * (double)(1 << zoom) *
+                                         map_zoom * cos(view.Latitude * M_PI / 180.0));
+         auto   bench_start = clock::now();
+
+         for (int i = 0; i < bench_maps; i++)
+         {
+            auto map_start = clock::now();
+
+            view.Longitude += deg_per_pixel * view.Width * 0.5;
+
+            if (!snapshot.Render(view, rgba, timeout_sec))
+               break;
+
+            map_time.Record(std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - map_start).count());
+            rendered++;
+         }
+
+         double      elapsed_sec = std::chrono::duration<double>(clock::now() - bench_start).count();
+         Json::Value root;
+
+         root["renderer"]       = context.GetRenderer();
+         root["width"]          = view.Width;
+         root["height"]         = view.Height;
+         root["zoom"]           = zoom;
+         root["maps"]           = rendered;
+         root["elapsed_sec"]    = elapsed_sec;
+         root["maps_per_sec"]   = rendered / elapsed_sec;
+         root["first_map_ms"]   = first_ms;
+         root["map_ms"]["p50"]  = map_time.GetPercentile(50.0) / 1000.0;
+         root["map_ms"]["p99"]  = map_time.GetPercentile(99.0) / 1000.0;
+         root["map_ms"]["mean"] = map_time.GetMean() / 1000.0;
+         root["map_ms"]["max"]  = map_time.GetMax() / 1000.0;
+
+         if (track_points > 0)
+         {
+            TPolylineStats       track_stats = tracks.GetStats();
+            const CGlTimerQuery& overlay = snapshot.GetMap().GetPassTimer(DrawPass::OVERLAY);
+
+            root["tracks"]["points"]         = (Json::UInt64)track_stats.Points;
+            root["tracks"]["build_ms"]       = track_stats.LastBuildMs;
+            root["tracks"]["gpu_bytes"]      = (Json::UInt64)track_stats.GpuBytes;
+            root["tracks"]["lod"]            = track_stats.Lod;
+            root["tracks"]["lod_segments"]   = (Json::UInt64)track_stats.LodSegments;
+            root["tracks"]["drawn_segments"] = (Json::UInt64)track_stats.DrawnSegments;
+            root["tracks"]["overlay_gpu_ms"] = overlay.GetGpuMs();
+            root["tracks"]["overlay_cpu_ms"] = overlay.GetCpuMs();
+         }
+
+         Json::StyledStreamWriter writer("   ");
+         writer.write(std::cout, root);
+
+         if (rendered < bench_maps)
+            result = 2;
+      }
+
+      snapshot.GetMap().RemoveLayer(&tracks);
+      tracks.Close();
+      snapshot.Close();
+      CTexture::DeleteTextures();
+   }
+
+   context.Close();
+   server.Close();
+
+   if (cache == cache_dir.c_str())
+      std::filesystem::remove_all(cache_dir, err);
+
+   return result;
+}
@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include "TileProxy.h"
+
+// Caching tile proxy, e.g.
+// ./osm_tileproxy --upstream 192.168.1.151:8080 --cache ./cache/ --port 8081
+// then point the maps at it with map.Open(true, "<proxy host>:8081", ...)
+
+static volatile sig_atomic_t terminate = 0;
+
+static void SignalHandler(int)
+{
+   terminate = 1;
+}
+
+int main(int argc, char* argv[])
+{
+   TTileProxyConfig config = CTileProxy::DefaultConfig();
+   CTileProxy       proxy;
+
+   config.Port = 8081;
+
+   for (int i = 1; i < argc; i++)
+   {
+      bool has_value = (i + 1 < argc);
+
+      if (strcmp(argv[i], "--port") == 0 && has_value)
+         config.Port = atoi(argv[++i]);
+      else if (strcmp(argv[i], "--upstream") == 0 && has_value)
+         config.UpstreamUrl = argv[++i];
+      else if (strcmp(argv[i], "--cache") == 0 && has_value)
+         config.CachePath = argv[++i];
+      else if (strcmp(argv[i], "--connections") == 0 && has_value)
+         config.UpstreamConnections = atoi(argv[++i]);
+      else if (strcmp(argv[i], "--memory") == 0 && has_value)
+         config.MemoryBytes = (uint64_t)atoi(argv[++i]) << 20;
+      else if (strcmp(argv[i], "--budget") == 0 && has_value)
+         config.CacheBudgetBytes = (uint64_t)atoi(argv[++i]) << 20;
+      else
+      {
+         fprintf(stderr, "usage: osm_tileproxy --upstream HOST:PORT --cache PATH [--port N] "
+                         "[--connections N] [--memory MB] [--budget MB]\n");
+         return 1;
+      }
+   }
+
+   if (config.UpstreamUrl.empty() || config.CachePath.empty())
+   {
+      fprintf(stderr, "osm_tileproxy: --upstream and --cache are required\n");
+      return 1;
+   }
+
+   signal(SIGINT, SignalHandler);
+   signal(SIGTERM, SignalHandler);
+
+   if (!proxy.Open(config))
+      return 1;
+
+   printf("Proxying %s on port %d, cache %s\n", config.UpstreamUrl.c_str(), proxy.GetPort(), config.CachePath.c_str());
+
+   while (!terminate)
+      sleep(1);
+
+   TTileProxyStats stats = proxy.GetStats();
+
+   proxy.Close();
+
+   printf("%lu requests, %lu memory hits, %lu disk hits, %lu upstream fetches (%lu failed), "
+          "%lu coalesced, %lu bytes, %lu peak connections\n",
+          (unsigned long)stats.Requests,
+          (unsigned long)stats.MemoryHits,
+          (unsigned long)stats.DiskHits,
+          (unsigned long)stats.UpstreamFetches,
+          (unsigned long)stats.UpstreamErrors,
+          (unsigned long)stats.Coalesced,
+          (unsigned long)stats.BytesSent,
+          (unsigned long)stats.PeakConnections);
+
+   return 0;
+}
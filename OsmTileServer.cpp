@@ -0,0 +1,70 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include "TestTileServer.h"
+
+// Standalone test tile server, point the demo at it with
+// map.Open(true, "127.0.0.1:<port>", ...)
+
+static volatile sig_atomic_t terminate = 0;
+
+static void SignalHandler(int)
+{
+   terminate = 1;
+}
+
+int main(int argc, char* argv[])
+{
+   TTestTileServerConfig config = CTestTileServer::DefaultConfig();
+   CTestTileServer       server;
+
+   config.Port = 8080;
+
+   for (int i = 1; i < argc; i++)
+   {
+      bool has_value = (i + 1 < argc);
+
+      if (strcmp(argv[i], "--port") == 0 && has_value)
+         config.Port = atoi(argv[++i]);
+      else if (strcmp(argv[i], "--latency") == 0 && has_value)
+         config.LatencyMs = atoi(argv[++i]);
+      else if (strcmp(argv[i], "--jitter") == 0 && has_value)
+         config.JitterMs = atoi(argv[++i]);
+      else if (strcmp(argv[i], "--error-rate") == 0 && has_value)
+         config.ErrorRate = atof(argv[++i]);
+      else if (strcmp(argv[i], "--bandwidth") == 0 && has_value)
+         config.BandwidthKbps = atoi(argv[++i]);
+      else if (strcmp(argv[i], "--connections") == 0 && has_value)
+         config.MaxConnections = atoi(argv[++i]);
+      else if (strcmp(argv[i], "--format") == 0 && has_value && GetTileFormatFromExtension(argv[i + 1], config.Format))
+         i++;
+      else
+      {
+         fprintf(stderr, "usage: osm_tileserver [--port N] [--latency MS] [--jitter MS] "
+                         "[--error-rate R] [--bandwidth KBPS] [--connections N] [--format png|jpg|webp]\n");
+         return 1;
+      }
+   }
+
+   signal(SIGINT, SignalHandler);
+   signal(SIGTERM, SignalHandler);
+
+   if (!server.Open(config))
+      return 1;
+
+   printf("Serving test tiles on %s\n", server.GetUrl().c_str());
+
+   while (!terminate)
+      sleep(1);
+
+   server.Close();
+
+   printf("%lu requests, %lu errors, %lu bytes\n",
+          (unsigned long)server.GetRequestCount(),
+          (unsigned long)server.GetErrorCount(),
+          (unsigned long)server.GetBytesSent());
+
+   return 0;
+}
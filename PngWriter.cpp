@@ -0,0 +1,102 @@
+#include <string.h>
+#include <cstdint>
+#include <fstream>
+#include <zlib.h>
+#include "PngWriter.h"
+
+static void PutUint32(std::vector<unsigned char>& Buffer, uint32_t Value)
+{
+   Buffer.push_back((Value >> 24) & 0xff);
+   Buffer.push_back((Value >> 16) & 0xff);
+   Buffer.push_back((Value >> 8) & 0xff);
+   Buffer.push_back(Value & 0xff);
+}
+
+static void PutChunk(std::vector<unsigned char>& Buffer, const char* Type, const unsigned char* Data, size_t Size)
+{
+   size_t type_offset;
+
+   PutUint32(Buffer, (uint32_t)Size);
+
+   // the crc covers the chunk type and the data
+   type_offset = Buffer.size();
+   Buffer.insert(Buffer.end(), Type, Type + 4);
+   if (Size)
+      Buffer.insert(Buffer.end(), Data, Data + Size);
+
+   PutUint32(Buffer, (uint32_t)crc32(0L, &Buffer[type_offset], (uInt)(Size + 4)));
+}
+
+bool WritePngBuffer(std::vector<unsigned char>& PngBuffer,
+                    const unsigned char*        Pixels,
+                    int                         Width,
+                    int                         Height,
+                    int                         Channels,
+                    int                         CompressionLevel)
+{
+   const unsigned char        signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+   const unsigned char        color_type[5] = { 0, 0, 4, 2, 6 };
+   std::vector<unsigned char> header;
+   std::vector<unsigned char> raw;
+   std::vector<unsigned char> compressed;
+   size_t                     row_size;
+   uLongf                     compressed_size;
+
+   if (!Pixels || Width <= 0 || Height <= 0 || Channels < 1 || Channels > 4)
+      return false;
+
+   row_size = (size_t)Width * Channels;
+
+   // each row is prefixed with filter type 0 (none)
+   raw.resize((row_size + 1) * Height);
+   for (int y = 0; y < Height; y++)
+   {
+      raw[y * (row_size + 1)] = 0;
+      memcpy(&raw[y * (row_size + 1) + 1], &Pixels[y * row_size], row_size);
+   }
+
+   compressed_size = compressBound((uLong)raw.size());
+   compressed.resize(compressed_size);
+
+   if (compress2(compressed.data(), &compressed_size, raw.data(), (uLong)raw.size(), CompressionLevel) != Z_OK)
+      return false;
+
+   PutUint32(header, (uint32_t)Width);
+   PutUint32(header, (uint32_t)Height);
+   header.push_back(8);                     // bit depth
+   header.push_back(color_type[Channels]);  // color type
+   header.push_back(0);                     // compression
+   header.push_back(0);                     // filter
+   header.push_back(0);                     // interlace
+
+   PngBuffer.clear();
+   PngBuffer.reserve(compressed_size + 64);
+   PngBuffer.insert(PngBuffer.end(), signature, signature + sizeof(signature));
+   PutChunk(PngBuffer, "IHDR", header.data(), header.size());
+   PutChunk(PngBuffer, "IDAT", compressed.data(), compressed_size);
+   PutChunk(PngBuffer, "IEND", nullptr, 0);
+
+   return true;
+}
+
+bool WritePngFile(const char*          Filename,
+                  const unsigned char* Pixels,
+                  int                  Width,
+                  int                  Height,
+                  int                  Channels,
+                  int                  CompressionLevel)
+{
+   std::vector<unsigned char> png_buffer;
+
+   if (!WritePngBuffer(png_buffer, Pixels, Width, Height, Channels, CompressionLevel))
+      return false;
+
+   std::ofstream png_file(Filename, std::ios::out | std::ios::binary | std::ios::trunc);
+
+   if (!png_file.is_open())
+      return false;
+
+   png_file.write((char*)png_buffer.data(), png_buffer.size());
+
+   return png_file.good();
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <vector>
+
+// Encodes 8 bit gray, RGB or RGBA pixels as a png file. Rows are top to
+// bottom, which is the order the tile server expects.
+bool WritePngBuffer(std::vector<unsigned char>& PngBuffer,
+                    const unsigned char*        Pixels,
+                    int                         Width,
+                    int                         Height,
+                    int                         Channels,
+                    int                         CompressionLevel = 6);
+
+bool WritePngFile(const char*          Filename,
+                  const unsigned char* Pixels,
+                  int                  Width,
+                  int                  Height,
+                  int                  Channels,
+                  int                  CompressionLevel = 6);
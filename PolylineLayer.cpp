@@ -0,0 +1,578 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <glad/glad.h>
+#include "PolylineLayer.h"
+#include "GlDebug.h"
+#include "Mercator.h"
+#include "ExecApi.h"
+#include "Trace.h"
+
+CPolylineLayer::CPolylineLayer()
+   : mStats{},
+     mMaxWidthPix(0.0f),
+     mVAO(0),
+     mBuffers{},
+     mTextures{},
+     mMaxTexels(0),
+     mNextId(0),
+     mDirty(false),
+     mBuilding(false),
+     mTerminate(false)
+{
+}
+
+CPolylineLayer::~CPolylineLayer()
+{
+   Close();
+}
+
+int CPolylineLayer::Add(const double* Latitude, const double* Longitude, size_t Count, const glm::vec4& Color, float WidthPix)
+{
+   if (Count < 2)
+   {
+      ExecApiLogWarning("PolylineLayer: a polyline needs at least 2 points");
+      return -1;
+   }
+
+   std::shared_ptr<TPolyline> polyline = std::make_shared<TPolyline>();
+
+   polyline->Latitude.assign(Latitude, Latitude + Count);
+   polyline->Longitude.assign(Longitude, Longitude + Count);
+   polyline->Color    = Color;
+   polyline->WidthPix = std::max(WidthPix, 1.0f);
+   polyline->Prepared = false;
+
+   std::lock_guard<std::mutex> lock(mMutex);
+
+   polyline->Id = mNextId++;
+   mPolylines.push_back(polyline);
+   mDirty    = true;
+   mBuilding = true;
+   mCondition.notify_one();
+
+   return polyline->Id;
+}
+
+void CPolylineLayer::AddEntries(TGeometry& Geometry, const std::vector<std::shared_ptr<TPolyline>>& Polylines, int Zoom, bool All)
+{
+   TLod&    lod = Geometry.Lods[Zoom];
+   uint32_t base = 0;
+   uint32_t style = 0;
+
+   lod.First = (uint32_t)(Geometry.Entries.size() / 2);
+
+   for (const auto& polyline : Polylines)
+   {
+      for (size_t i = 0; i < polyline->Level.size(); i++)
+      {
+         if (All || polyline->Level[i] <= Zoom)
+         {
+            Geometry.Entries.push_back(base + (uint32_t)i);
+            Geometry.Entries.push_back(style);
+         }
+      }
+
+      Geometry.Entries.push_back(POLYLINE_BREAK);
+      Geometry.Entries.push_back(0);
+
+      base += (uint32_t)polyline->Level.size();
+      style++;
+   }
+
+   uint32_t entries = (uint32_t)(Geometry.Entries.size() / 2) - lod.First;
+
+   lod.Segments = (entries > 0) ? entries - 1 : 0;
+   lod.Blocks.clear();
+
+   // bounds from the hi parts are close enough for culling
+   for (uint32_t first = 0; first < lod.Segments; first += POLYLINE_BLOCK_SEGMENTS)
+   {
+      TBlock block;
+
+      block.First    = lod.First + first;
+      block.Segments = std::min((uint32_t)POLYLINE_BLOCK_SEGMENTS, lod.Segments - first);
+      block.MinX     = std::numeric_limits<float>::max();
+      block.MinY     = std::numeric_limits<float>::max();
+      block.MaxX     = -std::numeric_limits<float>::max();
+      block.MaxY     = -std::numeric_limits<float>::max();
+
+      for (uint32_t entry = block.First; entry <= block.First + block.Segments; entry++)
+      {
+         uint32_t point = Geometry.Entries[entry * 2];
+
+         if (point == POLYLINE_BREAK)
+            continue;
+
+         block.MinX = std::min(block.MinX, Geometry.Points[point * 4]);
+         block.MinY = std::min(block.MinY, Geometry.Points[point * 4 + 1]);
+         block.MaxX = std::max(block.MaxX, Geometry.Points[point * 4]);
+         block.MaxY = std::max(block.MaxY, Geometry.Points[point * 4 + 1]);
+      }
+
+      lod.Blocks.push_back(block);
+   }
+}
+
+void CPolylineLayer::Build(const std::vector<std::shared_ptr<TPolyline>>& Polylines, TGeometry& Geometry)
+{
+   auto     start = std::chrono::steady_clock::now();
+   uint64_t level_counts[MAX_ZOOM_LEVELS] = {};
+   uint64_t points = 0;
+   size_t   style = 0;
+
+   for (const auto& polyline : Polylines)
+   {
+      if (!polyline->Prepared)
+         Prepare(*polyline);
+
+      points += polyline->X.size();
+   }
+
+   Geometry.Points.resize(points * 4);
+   Geometry.Styles.resize(Polylines.size() * 8);
+   Geometry.MaxWidthPix = 0.0f;
+   Geometry.Polylines   = Polylines.size();
+   points = 0;
+
+   for (const auto& polyline : Polylines)
+   {
+      float* styles = &Geometry.Styles[style++ * 8];
+
+      for (size_t i = 0; i < polyline->X.size(); i++)
+      {
+         float* point = &Geometry.Points[points++ * 4];
+
+         point[0] = (float)polyline->X[i];
+         point[1] = (float)polyline->Y[i];
+         point[2] = (float)(polyline->X[i] - (double)point[0]);
+         point[3] = (float)(polyline->Y[i] - (double)point[1]);
+
+         level_counts[polyline->Level[i]]++;
+      }
+
+      styles[0] = polyline->Color.r;
+      styles[1] = polyline->Color.g;
+      styles[2] = polyline->Color.b;
+      styles[3] = polyline->Color.a;
+      styles[4] = polyline->WidthPix;
+      styles[5] = 0.0f;
+      styles[6] = 0.0f;
+      styles[7] = 0.0f;
+
+      Geometry.MaxWidthPix = std::max(Geometry.MaxWidthPix, polyline->WidthPix);
+   }
+
+   // the levels nest, each keeps the points of the ones before it. Past
+   // POLYLINE_FULL_LOD_SHARE of the points a level draws all of them, one
+   // more nearly full copy would cost more memory than it saves drawing.
+   uint64_t kept = 0;
+   int      full_zoom = MAX_ZOOM_LEVELS - 1;
+
+   for (int zoom = 0; zoom < MAX_ZOOM_LEVELS; zoom++)
+   {
+      kept += level_counts[zoom];
+
+      if (kept >= POLYLINE_FULL_LOD_SHARE * points)
+      {
+         full_zoom = zoom;
+         break;
+      }
+
+      if (zoom > 0 && level_counts[zoom] == 0)
+         Geometry.Lods[zoom] = Geometry.Lods[zoom - 1];
+      else
+         AddEntries(Geometry, Polylines, zoom, false);
+   }
+
+   AddEntries(Geometry, Polylines, full_zoom, true);
+
+   for (int zoom = full_zoom + 1; zoom < MAX_ZOOM_LEVELS; zoom++)
+      Geometry.Lods[zoom] = Geometry.Lods[full_zoom];
+
+   Geometry.BuildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void CPolylineLayer::BuilderThread()
+{
+   CTrace::SetThreadName("Polyline Builder");
+
+   std::unique_lock<std::mutex> lock(mMutex);
+
+   while (!mTerminate)
+   {
+      if (!mDirty)
+      {
+         mCondition.wait(lock);
+         continue;
+      }
+
+      // changes made while building are picked up by the next pass
+      std::vector<std::shared_ptr<TPolyline>> polylines = mPolylines;
+      std::unique_ptr<TGeometry>              geometry(new TGeometry());
+
+      mDirty = false;
+      lock.unlock();
+
+      {
+         TRACE_SCOPE("PolylineBuild", "overlay");
+         Build(polylines, *geometry);
+      }
+
+      lock.lock();
+
+      mStats.Polylines   = geometry->Polylines;
+      mStats.Points      = geometry->Points.size() / 4;
+      mStats.LastBuildMs = geometry->BuildMs;
+      mStats.Builds++;
+      mPending  = std::move(geometry);
+      mBuilding = mDirty;
+   }
+}
+
+void CPolylineLayer::Clear()
+{
+   std::lock_guard<std::mutex> lock(mMutex);
+
+   mPolylines.clear();
+   mDirty    = true;
+   mBuilding = true;
+   mCondition.notify_one();
+}
+
+void CPolylineLayer::Close()
+{
+   if (mBuilderThread.joinable())
+   {
+      mMutex.lock();
+      mTerminate = true;
+      mCondition.notify_one();
+      mMutex.unlock();
+
+      mBuilderThread.join();
+   }
+
+   if (mVAO)
+   {
+      GLCALL(glDeleteTextures(3, mTextures));
+      GLCALL(glDeleteBuffers(3, mBuffers));
+      GLCALL(glDeleteVertexArrays(1, &mVAO));
+      mVAO = 0;
+   }
+
+   for (TLod& lod : mLods)
+      lod = TLod{};
+
+   mPending  = nullptr;
+   mShader   = nullptr;
+   mBuilding = false;
+}
+
+void CPolylineLayer::Draw(const TMapView& View, const glm::mat4& Projection)
+{
+   std::unique_ptr<TGeometry> geometry;
+
+   if (!mShader)
+      return;
+
+   mMutex.lock();
+   geometry = std::move(mPending);
+   mMutex.unlock();
+
+   if (geometry)
+   {
+      TRACE_SCOPE("PolylineUpload", "texture");
+      Upload(*geometry);
+   }
+
+   // the level whose tolerance is POLYLINE_TOLERANCE_PIX at this scale
+   double pixels_per_world = std::max(View.PixelsPerWorldX, View.PixelsPerWorldY);
+   int    zoom = (int)ceil(log2(pixels_per_world / OSM_TILE_SIZE));
+
+   zoom = std::min(std::max(zoom, 0), MAX_ZOOM_LEVELS - 1);
+
+   const TLod& lod = mLods[zoom];
+   uint64_t    drawn_segments = 0;
+   uint64_t    draw_calls = 0;
+
+   if (lod.Segments > 0)
+   {
+      TRACE_SCOPE("PolylineDraw", "render");
+
+      double min_x, min_y, max_x, max_y;
+      float  center_x = (float)View.CenterX;
+      float  center_y = (float)View.CenterY;
+
+      GetVisibleWorldRect(View, mMaxWidthPix, min_x, min_y, max_x, max_y);
+
+      mShader->Use();
+      mShader->SetUniform("transform", GetScreenTransform(View, Projection));
+      mShader->SetUniform("uCenter", glm::vec4(center_x, center_y,
+                                               (float)(View.CenterX - (double)center_x),
+                                               (float)(View.CenterY - (double)center_y)));
+      mShader->SetUniform("uPixelsPerWorld", glm::vec2((float)View.PixelsPerWorldX, (float)View.PixelsPerWorldY));
+      mShader->SetUniform("uPoints", 0);
+      mShader->SetUniform("uEntries", 1);
+      mShader->SetUniform("uStyles", 2);
+
+      for (int i = 0; i < 3; i++)
+      {
+         GLCALL(glActiveTexture(GL_TEXTURE0 + i));
+         GLCALL(glBindTexture(GL_TEXTURE_BUFFER, mTextures[i]));
+      }
+
+      // the vertex shader reads everything from the texture buffers
+      GLCALL(glBindVertexArray(mVAO));
+
+      // neighbouring visible blocks go out in one call
+      uint32_t first = 0;
+      uint32_t segments = 0;
+
+      for (const TBlock& block : lod.Blocks)
+      {
+         bool visible = block.MaxX >= min_x && block.MinX <= max_x &&
+                        block.MaxY >= min_y && block.MinY <= max_y;
+
+         if (visible && segments > 0 && first + segments == block.First)
+         {
+            segments += block.Segments;
+            continue;
+         }
+
+         if (segments > 0)
+         {
+            GLCALL(glDrawArrays(GL_TRIANGLES, first * 6, segments * 6));
+            drawn_segments += segments;
+            draw_calls++;
+            segments = 0;
+         }
+
+         if (visible)
+         {
+            first    = block.First;
+            segments = block.Segments;
+         }
+      }
+
+      if (segments > 0)
+      {
+         GLCALL(glDrawArrays(GL_TRIANGLES, first * 6, segments * 6));
+         drawn_segments += segments;
+         draw_calls++;
+      }
+
+      for (int i = 2; i >= 0; i--)
+      {
+         GLCALL(glActiveTexture(GL_TEXTURE0 + i));
+         GLCALL(glBindTexture(GL_TEXTURE_BUFFER, 0));
+      }
+
+      GLCALL(glBindVertexArray(0));
+   }
+
+   std::lock_guard<std::mutex> lock(mMutex);
+
+   mStats.Lod           = zoom;
+   mStats.LodSegments   = lod.Segments;
+   mStats.DrawnSegments = drawn_segments;
+   mStats.DrawCalls     = draw_calls;
+}
+
+TPolylineStats CPolylineLayer::GetStats() const
+{
+   std::lock_guard<std::mutex> lock(mMutex);
+
+   return mStats;
+}
+
+bool CPolylineLayer::IsBuilding() const
+{
+   std::lock_guard<std::mutex> lock(mMutex);
+
+   return mBuilding;
+}
+
+bool CPolylineLayer::Open(std::shared_ptr<CShader> Shader)
+{
+   if (!Shader)
+   {
+      ExecApiLogWarning("PolylineLayer: no shader");
+      return false;
+   }
+
+   mShader = Shader;
+
+   if (!mBuilderThread.joinable())
+   {
+      mTerminate = false;
+      mBuilderThread = std::thread(&CPolylineLayer::BuilderThread, this);
+   }
+
+   return true;
+}
+
+void CPolylineLayer::Prepare(TPolyline& Polyline)
+{
+   size_t             count = Polyline.Latitude.size();
+   std::vector<float> significance(count);
+   std::vector<float> tolerance(MAX_ZOOM_LEVELS);
+
+   struct TSpan
+   {
+      size_t First;
+      size_t Last;
+      float  Significance;
+   };
+
+   std::vector<TSpan> stack;
+
+   Polyline.X.resize(count);
+   Polyline.Y.resize(count);
+   CMercator::Project(Polyline.Latitude.data(), Polyline.Longitude.data(), Polyline.X.data(), Polyline.Y.data(), count, 1.0);
+
+   // the projected points are all that is needed from here on
+   Polyline.Latitude  = std::vector<double>();
+   Polyline.Longitude = std::vector<double>();
+
+   // Douglas-Peucker to a tolerance of 0, each point gets the distance it
+   // was split at, capped by the split above it. Keeping the points over a
+   // tolerance is then the same as running Douglas-Peucker with it.
+   for (size_t first = 0; first + 1 < count; first += POLYLINE_SIMPLIFY_POINTS - 1)
+   {
+      size_t last = std::min(first + POLYLINE_SIMPLIFY_POINTS - 1, count - 1);
+
+      significance[first] = std::numeric_limits<float>::max();
+      significance[last]  = std::numeric_limits<float>::max();
+      stack.push_back({ first, last, std::numeric_limits<float>::max() });
+
+      while (!stack.empty())
+      {
+         TSpan  span = stack.back();
+         double ax = Polyline.X[span.First];
+         double ay = Polyline.Y[span.First];
+         double dx = Polyline.X[span.Last] - ax;
+         double dy = Polyline.Y[span.Last] - ay;
+         double length2 = dx * dx + dy * dy;
+         double max_distance2 = -1.0;
+         size_t split = span.First;
+
+         stack.pop_back();
+
+         if (span.Last - span.First < 2)
+            continue;
+
+         // distance to the segment, not the line, so spikes past the ends count
+         for (size_t i = span.First + 1; i < span.Last; i++)
+         {
+            double px = Polyline.X[i] - ax;
+            double py = Polyline.Y[i] - ay;
+            double t = (length2 > 0.0) ? std::min(std::max((px * dx + py * dy) / length2, 0.0), 1.0) : 0.0;
+            double ex = px - t * dx;
+            double ey = py - t * dy;
+            double distance2 = ex * ex + ey * ey;
+
+            if (distance2 > max_distance2)
+            {
+               max_distance2 = distance2;
+               split = i;
+            }
+         }
+
+         float value = std::min((float)sqrt(max_distance2), span.Significance);
+
+         significance[split] = value;
+         stack.push_back({ span.First, split, value });
+         stack.push_back({ split, span.Last, value });
+      }
+   }
+
+   for (int zoom = 0; zoom < MAX_ZOOM_LEVELS; zoom++)
+      tolerance[zoom] = (float)(POLYLINE_TOLERANCE_PIX / (double)(OSM_TILE_SIZE << zoom));
+
+   Polyline.Level.resize(count);
+
+   for (size_t i = 0; i < count; i++)
+   {
+      int level = 0;
+
+      while (level < MAX_ZOOM_LEVELS - 1 && significance[i] <= tolerance[level])
+         level++;
+
+      Polyline.Level[i] = (uint8_t)level;
+   }
+
+   Polyline.Prepared = true;
+}
+
+bool CPolylineLayer::Remove(int Id)
+{
+   std::lock_guard<std::mutex> lock(mMutex);
+
+   for (auto it = mPolylines.begin(); it != mPolylines.end(); it++)
+   {
+      if ((*it)->Id == Id)
+      {
+         mPolylines.erase(it);
+         mDirty    = true;
+         mBuilding = true;
+         mCondition.notify_one();
+         return true;
+      }
+   }
+
+   return false;
+}
+
+bool CPolylineLayer::Upload(TGeometry& Geometry)
+{
+   const GLenum formats[3] = { GL_RGBA32F, GL_RG32UI, GL_RGBA32F };
+   const void*  data[3] = { Geometry.Points.data(), Geometry.Entries.data(), Geometry.Styles.data() };
+   size_t       bytes[3] = { Geometry.Points.size() * sizeof(float),
+                             Geometry.Entries.size() * sizeof(uint32_t),
+                             Geometry.Styles.size() * sizeof(float) };
+   size_t       texels[3] = { Geometry.Points.size() / 4, Geometry.Entries.size() / 2, Geometry.Styles.size() / 4 };
+
+   if (!mVAO)
+   {
+      GLCALL(glGenVertexArrays(1, &mVAO));
+      GLCALL(glGenBuffers(3, mBuffers));
+      GLCALL(glGenTextures(3, mTextures));
+      GLCALL(glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &mMaxTexels));
+   }
+
+   for (TLod& lod : mLods)
+      lod = TLod{};
+
+   for (int i = 0; i < 3; i++)
+   {
+      if (texels[i] > (size_t)mMaxTexels)
+      {
+         ExecApiLogWarning("PolylineLayer: %zu texels is over the texture buffer limit of %d", texels[i], mMaxTexels);
+         return false;
+      }
+   }
+
+   for (int i = 0; i < 3; i++)
+   {
+      GLCALL(glBindBuffer(GL_TEXTURE_BUFFER, mBuffers[i]));
+      GLCALL(glBufferData(GL_TEXTURE_BUFFER, bytes[i], data[i], GL_STATIC_DRAW));
+      GLCALL(glBindTexture(GL_TEXTURE_BUFFER, mTextures[i]));
+      GLCALL(glTexBuffer(GL_TEXTURE_BUFFER, formats[i], mBuffers[i]));
+   }
+
+   GLCALL(glBindTexture(GL_TEXTURE_BUFFER, 0));
+   GLCALL(glBindBuffer(GL_TEXTURE_BUFFER, 0));
+
+   for (int zoom = 0; zoom < MAX_ZOOM_LEVELS; zoom++)
+      mLods[zoom] = std::move(Geometry.Lods[zoom]);
+
+   mMaxWidthPix = Geometry.MaxWidthPix;
+
+   std::lock_guard<std::mutex> lock(mMutex);
+
+   mStats.GpuBytes = bytes[0] + bytes[1] + bytes[2];
+   mStats.Uploads++;
+
+   return true;
+}
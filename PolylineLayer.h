@@ -0,0 +1,142 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <glm/glm.hpp>
+#include "MapLayer.h"
+#include "OpenStreetMap.h"
+#include "Shader.h"
+
+#define POLYLINE_TOLERANCE_PIX   0.5    // simplification error allowed at each zoom level
+#define POLYLINE_BLOCK_SEGMENTS  4096   // segments culled together
+#define POLYLINE_SIMPLIFY_POINTS 65536  // longer lines are simplified in pieces, bounds the worst case
+#define POLYLINE_FULL_LOD_SHARE  0.8    // levels keeping more of the points than this draw all of them
+#define POLYLINE_BREAK           0xffffffffu
+
+struct TPolylineStats
+{
+   uint64_t Polylines;
+   uint64_t Points;
+   uint64_t GpuBytes;
+   uint64_t Builds;
+   uint64_t Uploads;
+   double   LastBuildMs;
+   int      Lod;            // the rest are from the last Draw
+   uint64_t LodSegments;
+   uint64_t DrawnSegments;
+   uint64_t DrawCalls;
+};
+
+// Tracks and other polylines drawn over the map, sized for millions of
+// points.
+//
+// The points live in static texture buffers as normalized mercator split
+// into float hi and lo parts, so they are exact at any zoom and only sent
+// to the gpu again when the lines change. A builder thread ranks every
+// point with Douglas-Peucker once and keeps one list of points per zoom
+// level, the ones that matter at POLYLINE_TOLERANCE_PIX. Draw picks the
+// list for the current scale, skips blocks of segments that are off the
+// map and expands each segment into a quad of its width in the vertex
+// shader, which avoids glLineWidth and its 1 pixel limit in core profiles.
+class CPolylineLayer : public CMapLayer
+{
+public:
+   CPolylineLayer();
+   ~CPolylineLayer();
+
+   // the points are copied, returns the id for Remove or -1
+   int Add(const double* Latitude, const double* Longitude, size_t Count, const glm::vec4& Color, float WidthPix);
+
+   void Clear();
+
+   // stops the builder and deletes the gpu buffers, render thread
+   void Close();
+
+   void Draw(const TMapView& View, const glm::mat4& Projection) override;
+
+   TPolylineStats GetStats() const;
+
+   // true until the last change is ready to draw
+   bool IsBuilding() const;
+
+   // the buffers are created by the first Draw that has lines
+   bool Open(std::shared_ptr<CShader> Shader);
+
+   bool Remove(int Id);
+
+private:
+
+   struct TPolyline
+   {
+      std::vector<double>  Latitude;
+      std::vector<double>  Longitude;
+      std::vector<double>  X;         // world, filled in by the builder
+      std::vector<double>  Y;
+      std::vector<uint8_t> Level;     // first zoom level each point is drawn at
+      glm::vec4            Color;
+      float                WidthPix;
+      int                  Id;
+      bool                 Prepared;
+   };
+
+   // a run of segments, one segment joins an entry to the next
+   struct TBlock
+   {
+      uint32_t First;
+      uint32_t Segments;
+      float    MinX;
+      float    MinY;
+      float    MaxX;
+      float    MaxY;
+   };
+
+   struct TLod
+   {
+      uint32_t            First;
+      uint32_t            Segments;
+      std::vector<TBlock> Blocks;
+   };
+
+   struct TGeometry
+   {
+      std::vector<float>    Points;   // hi x, hi y, lo x, lo y
+      std::vector<uint32_t> Entries;  // point, style, the point is POLYLINE_BREAK between lines
+      std::vector<float>    Styles;   // color, then width
+      TLod                  Lods[MAX_ZOOM_LEVELS];
+      float                 MaxWidthPix;
+      uint64_t              Polylines;
+      double                BuildMs;
+   };
+
+   static void AddEntries(TGeometry& Geometry, const std::vector<std::shared_ptr<TPolyline>>& Polylines, int Zoom, bool All);
+
+   static void Build(const std::vector<std::shared_ptr<TPolyline>>& Polylines, TGeometry& Geometry);
+
+   void BuilderThread();
+
+   static void Prepare(TPolyline& Polyline);
+
+   bool Upload(TGeometry& Geometry);
+
+   std::vector<std::shared_ptr<TPolyline>> mPolylines;
+   std::unique_ptr<TGeometry>              mPending;
+   std::shared_ptr<CShader>                mShader;
+   mutable std::mutex                      mMutex;
+   std::condition_variable                 mCondition;
+   std::thread                             mBuilderThread;
+   TLod                                    mLods[MAX_ZOOM_LEVELS];
+   TPolylineStats                          mStats;
+   float                                   mMaxWidthPix;
+   unsigned int                            mVAO;
+   unsigned int                            mBuffers[3];
+   unsigned int                            mTextures[3];
+   int                                     mMaxTexels;
+   int                                     mNextId;
+   bool                                    mDirty;
+   bool                                    mBuilding;
+   bool                                    mTerminate;
+};
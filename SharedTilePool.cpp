@@ -0,0 +1,774 @@
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "SharedTilePool.h"
+#include "ExecApi.h"
+
+#define POOL_MAGIC   0x4c505453 // "STPL"
+#define POOL_VERSION 2 // blockless claims
+#define NO_BLOCK     0xffffffffu
+
+enum SlotState : uint8_t
+{
+   SLOT_EMPTY,
+   SLOT_PENDING, // claimed, the owner is decoding it
+   SLOT_READY
+};
+
+struct TPoolClient
+{
+   int32_t  Pid;
+   uint32_t Active;
+   uint64_t StartTime; // from /proc, a reused pid doesn't pass for the dead process
+};
+
+struct CSharedTilePool::THeader
+{
+   std::atomic<uint32_t> Magic;      // stored last by the creator
+   uint32_t              Version;
+   int32_t               CreatorPid; // stored first, a creator that died leaves the magic unset
+   pthread_mutex_t       Mutex;      // robust and process shared
+   uint64_t              MappedBytes;
+   uint32_t              SlotBits;   // the index has 1 << SlotBits slots
+   uint32_t              BlockCount;
+   uint32_t              FreeBlock;  // free blocks are linked through their first word
+   uint32_t              Tiles;
+   uint32_t              Entries;    // slots in use, tiles and claims
+   uint64_t              Clock;      // bumped on every hit, the lru order
+   uint64_t              Hits;
+   uint64_t              Decodes;
+   uint64_t              Evictions;
+   uint64_t              ReapedClients;
+   TPoolClient           Clients[SHARED_POOL_CLIENTS];
+};
+
+struct CSharedTilePool::TSlot
+{
+   uint64_t Key;
+   uint64_t Refs;     // a bit per client
+   uint64_t LastUse;
+   uint32_t Block;    // NO_BLOCK until the pixels are published
+   uint16_t Width;
+   uint16_t Height;
+   uint8_t  State;
+   uint8_t  Channels;
+   int8_t   Owner;    // the client a pending tile is claimed by
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "the magic is read by other processes");
+
+static size_t AlignUp(size_t Bytes, size_t Alignment)
+{
+   return (Bytes + Alignment - 1) / Alignment * Alignment;
+}
+
+// where the probe for a key starts
+static uint32_t GetHomeSlot(uint64_t Key, uint32_t SlotBits)
+{
+   return (Key * 0x9e3779b97f4a7c15ull) >> (64 - SlotBits);
+}
+
+// unlinks Name if it is still the segment that was opened, one another
+// process created in its place meanwhile stays
+static void UnlinkSegment(const char* Name, ino_t Inode)
+{
+   struct stat st;
+   int         fd = shm_open(Name, O_RDONLY, 0);
+
+   if (fd < 0)
+      return;
+
+   if (fstat(fd, &st) == 0 && st.st_ino == Inode)
+      shm_unlink(Name);
+
+   close(fd);
+}
+
+// field 22 of /proc/<pid>/stat, 0 if it can't be read
+static uint64_t GetProcessStartTime(pid_t Pid)
+{
+   std::ifstream stat_file("/proc/" + std::to_string(Pid) + "/stat");
+   std::string   stat;
+
+   std::getline(stat_file, stat);
+
+   // the command name is in parentheses and may hold spaces, the space
+   // after it starts field 3
+   size_t      close = stat.rfind(')');
+   const char* field = (close == std::string::npos) ? nullptr : stat.c_str() + close + 1;
+
+   for (int i = 3; field && i < 22; i++)
+   {
+      field = strchr(field + 1, ' ');
+   }
+
+   return field ? strtoull(field, nullptr, 10) : 0;
+}
+
+CSharedTilePool::CSharedTilePool()
+   : mHeader(nullptr),
+     mSlots(nullptr),
+     mBlocks(nullptr),
+     mMappedBytes(0),
+     mClient(-1)
+{
+}
+
+CSharedTilePool::~CSharedTilePool()
+{
+   Close();
+}
+
+void CSharedTilePool::Abandon(TTileKey Key)
+{
+   if (!mHeader)
+      return;
+
+   Lock();
+
+   int slot = FindSlot(Key);
+
+   if (slot >= 0 && mSlots[slot].State == SLOT_PENDING && mSlots[slot].Owner == mClient)
+      RemoveSlot(slot);
+
+   Unlock();
+}
+
+int64_t CSharedTilePool::AllocateBlock()
+{
+   if (mHeader->FreeBlock == NO_BLOCK)
+   {
+      uint32_t slot_count = 1u << mHeader->SlotBits;
+      int      victim = -1;
+
+      for (uint32_t i = 0; i < slot_count; i++)
+      {
+         const TSlot& slot = mSlots[i];
+
+         if (slot.State == SLOT_READY && slot.Refs == 0 && (victim < 0 || slot.LastUse < mSlots[victim].LastUse))
+            victim = i;
+      }
+
+      if (victim < 0)
+         return -1;
+
+      RemoveSlot(victim);
+      mHeader->Evictions++;
+   }
+
+   uint32_t block = mHeader->FreeBlock;
+
+   memcpy(&mHeader->FreeBlock, GetBlock(block), sizeof(uint32_t));
+
+   return block;
+}
+
+void CSharedTilePool::Close()
+{
+   if (!mHeader)
+      return;
+
+   bool last = true;
+
+   Lock();
+
+   // the references and claims of this process go with it, a process that
+   // died attached doesn't keep the pool around
+   DropClient(mClient);
+   ReapClients();
+
+   for (int i = 0; i < SHARED_POOL_CLIENTS; i++)
+      last &= !mHeader->Clients[i].Active;
+
+   Unlock();
+
+   munmap(mHeader, mMappedBytes);
+
+   // a process opening it from now on creates a new one
+   if (last)
+      shm_unlink(mName.c_str());
+
+   mHeader = nullptr;
+   mSlots = nullptr;
+   mBlocks = nullptr;
+   mMappedBytes = 0;
+   mClient = -1;
+   mLocalRefs.clear();
+}
+
+void CSharedTilePool::DropClient(int Client)
+{
+   uint32_t              slot_count = 1u << mHeader->SlotBits;
+   uint64_t              bit = 1ull << Client;
+   std::vector<uint64_t> claims;
+
+   // removing shifts entries around, the claims are removed by key after
+   // the pass
+   for (uint32_t i = 0; i < slot_count; i++)
+   {
+      TSlot& slot = mSlots[i];
+
+      slot.Refs &= ~bit;
+
+      if (slot.State == SLOT_PENDING && slot.Owner == Client)
+         claims.push_back(slot.Key);
+   }
+
+   for (uint64_t key : claims)
+      RemoveSlot(FindSlot({ key }));
+
+   mHeader->Clients[Client].Active = 0;
+}
+
+int CSharedTilePool::FindSlot(TTileKey Key) const
+{
+   uint32_t mask = (1u << mHeader->SlotBits) - 1;
+
+   for (uint32_t i = GetHomeSlot(Key.Value, mHeader->SlotBits);; i = (i + 1) & mask)
+   {
+      if (mSlots[i].State == SLOT_EMPTY)
+         return -1;
+
+      if (mSlots[i].Key == Key.Value)
+         return i;
+   }
+}
+
+uint8_t* CSharedTilePool::GetBlock(uint32_t Block) const
+{
+   return mBlocks + (size_t)Block * SHARED_POOL_BLOCK_BYTES;
+}
+
+TSharedTilePoolStats CSharedTilePool::GetStats()
+{
+   TSharedTilePoolStats stats = {};
+
+   if (!mHeader)
+      return stats;
+
+   Lock();
+
+   stats.BudgetBytes = (uint64_t)mHeader->BlockCount * SHARED_POOL_BLOCK_BYTES;
+   stats.Tiles = mHeader->Tiles;
+   stats.Hits = mHeader->Hits;
+   stats.Decodes = mHeader->Decodes;
+   stats.Evictions = mHeader->Evictions;
+   stats.ReapedClients = mHeader->ReapedClients;
+
+   for (int i = 0; i < SHARED_POOL_CLIENTS; i++)
+      stats.Clients += mHeader->Clients[i].Active;
+
+   Unlock();
+
+   return stats;
+}
+
+bool CSharedTilePool::IsClientAlive(int Client) const
+{
+   const TPoolClient& client = mHeader->Clients[Client];
+
+   if (!client.Active)
+      return false;
+
+   // EPERM is a process of another user, alive
+   if (kill(client.Pid, 0) != 0 && errno == ESRCH)
+      return false;
+
+   return client.StartTime == 0 || GetProcessStartTime(client.Pid) == client.StartTime;
+}
+
+void CSharedTilePool::Lock()
+{
+   // the last holder died part way through a change, a shift of the index
+   // or a push to the free list may be half done. Both are rebuilt from the
+   // slots before anything reads them.
+   if (pthread_mutex_lock(&mHeader->Mutex) == EOWNERDEAD)
+   {
+      RebuildIndex();
+      ReapClients();
+      pthread_mutex_consistent(&mHeader->Mutex);
+   }
+}
+
+SharedTileStatus CSharedTilePool::Lookup(TTileKey Key, TSharedTile& Tile)
+{
+   if (!mHeader)
+      return SharedTileStatus::UNAVAILABLE;
+
+   Lock();
+
+   int slot = FindSlot(Key);
+
+   if (slot >= 0 && mSlots[slot].State == SLOT_READY)
+   {
+      TSlot& ready = mSlots[slot];
+
+      if (mLocalRefs[Key.Value]++ == 0)
+         ready.Refs |= 1ull << mClient;
+
+      ready.LastUse = ++mHeader->Clock;
+      mHeader->Hits++;
+
+      Tile.Key = Key;
+      Tile.Pixels = GetBlock(ready.Block);
+      Tile.Width = ready.Width;
+      Tile.Height = ready.Height;
+      Tile.Channels = ready.Channels;
+
+      Unlock();
+      return SharedTileStatus::READY;
+   }
+
+   if (slot >= 0 && (mSlots[slot].Owner == mClient || IsClientAlive(mSlots[slot].Owner)))
+   {
+      Unlock();
+      return SharedTileStatus::BUSY;
+   }
+
+   // the claim of a process that died goes with everything else it held,
+   // and the tile is claimed again below
+   if (slot >= 0)
+   {
+      ReapClients();
+
+      if ((slot = FindSlot(Key)) >= 0)
+         RemoveSlot(slot);
+   }
+
+   // a claim holds no block until it is published, one empty slot is left
+   // so probes end
+   uint32_t mask = (1u << mHeader->SlotBits) - 1;
+
+   if (mHeader->Entries >= mask)
+   {
+      Unlock();
+      return SharedTileStatus::UNAVAILABLE;
+   }
+
+   uint32_t i = GetHomeSlot(Key.Value, mHeader->SlotBits);
+
+   while (mSlots[i].State != SLOT_EMPTY)
+      i = (i + 1) & mask;
+
+   TSlot& claimed = mSlots[i];
+
+   claimed = {};
+   claimed.Key = Key.Value;
+   claimed.Block = NO_BLOCK;
+   claimed.Owner = mClient;
+   claimed.State = SLOT_PENDING;
+   mHeader->Entries++;
+
+   Unlock();
+   return SharedTileStatus::CLAIMED;
+}
+
+bool CSharedTilePool::Attach(const char* Name, uint64_t BudgetBytes, bool RemoveStale)
+{
+   struct stat st;
+   ino_t       inode = 0;
+   bool        created = true;
+   uint32_t    blocks = (uint32_t)std::max<uint64_t>(1, BudgetBytes / SHARED_POOL_BLOCK_BYTES);
+   uint32_t    slot_bits = 1;
+
+   // at most half full with every tile and a claim for every client, the
+   // probes stay short
+   while ((1u << slot_bits) < (blocks + SHARED_POOL_CLIENTS) * 2)
+      slot_bits++;
+
+   mName = Name;
+
+   int fd = shm_open(Name, O_RDWR | O_CREAT | O_EXCL, 0600);
+
+   if (fd < 0 && errno == EEXIST)
+   {
+      created = false;
+      fd = shm_open(Name, O_RDWR, 0600);
+   }
+
+   if (fd < 0)
+   {
+      ExecApiLogWarning("SharedTilePool: unable to open %s, %s", Name, strerror(errno));
+      return false;
+   }
+
+   if (created)
+   {
+      size_t slots_offset = AlignUp(sizeof(THeader), 64);
+      size_t blocks_offset = AlignUp(slots_offset + sizeof(TSlot) * ((size_t)1 << slot_bits), 4096);
+
+      mMappedBytes = blocks_offset + (size_t)blocks * SHARED_POOL_BLOCK_BYTES;
+
+      if (ftruncate(fd, mMappedBytes) != 0)
+      {
+         ExecApiLogWarning("SharedTilePool: unable to size %s, %s", Name, strerror(errno));
+         close(fd);
+         shm_unlink(Name);
+         return false;
+      }
+   }
+   else
+   {
+      // the creator sizes it first, then fills in the header
+      auto timeout = std::chrono::steady_clock::now() + std::chrono::milliseconds(SHARED_POOL_OPEN_MS);
+
+      while ((fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(THeader)) && std::chrono::steady_clock::now() < timeout)
+         std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+      mMappedBytes = (fstat(fd, &st) == 0) ? st.st_size : 0;
+      inode = (mMappedBytes > 0) ? st.st_ino : 0;
+   }
+
+   void* mapped = (mMappedBytes >= sizeof(THeader)) ?
+                  mmap(nullptr, mMappedBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+
+   // a creator that died before sizing it left nothing to wait for
+   if (mapped == MAP_FAILED && !created && RemoveStale && fstat(fd, &st) == 0 && (size_t)st.st_size < sizeof(THeader))
+   {
+      ExecApiLogWarning("SharedTilePool: %s was never sized, creating it again", Name);
+      UnlinkSegment(Name, st.st_ino);
+      close(fd);
+      mMappedBytes = 0;
+
+      return Attach(Name, BudgetBytes, false);
+   }
+
+   close(fd);
+
+   if (mapped == MAP_FAILED)
+   {
+      ExecApiLogWarning("SharedTilePool: unable to map %s", Name);
+      mMappedBytes = 0;
+      return false;
+   }
+
+   mHeader = (THeader*)mapped;
+
+   if (created)
+   {
+      pthread_mutexattr_t attributes;
+
+      mHeader->CreatorPid = getpid();
+
+      pthread_mutexattr_init(&attributes);
+      pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+      pthread_mutexattr_setrobust(&attributes, PTHREAD_MUTEX_ROBUST);
+      pthread_mutex_init(&mHeader->Mutex, &attributes);
+      pthread_mutexattr_destroy(&attributes);
+
+      // the rest of the segment is zero, every slot is empty
+      mHeader->Version = POOL_VERSION;
+      mHeader->MappedBytes = mMappedBytes;
+      mHeader->SlotBits = slot_bits;
+      mHeader->BlockCount = blocks;
+   }
+   else
+   {
+      auto timeout = std::chrono::steady_clock::now() + std::chrono::milliseconds(SHARED_POOL_OPEN_MS);
+
+      while (mHeader->Magic.load(std::memory_order_acquire) != POOL_MAGIC && std::chrono::steady_clock::now() < timeout)
+         std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+      // nobody attaches before the magic is stored, a segment still
+      // without it whose creator is gone has no clients and never will
+      pid_t creator = mHeader->CreatorPid;
+      bool  stale = mHeader->Magic.load(std::memory_order_acquire) != POOL_MAGIC &&
+                    (creator <= 0 || (kill(creator, 0) != 0 && errno == ESRCH));
+
+      if (mHeader->Magic.load(std::memory_order_acquire) != POOL_MAGIC || mHeader->Version != POOL_VERSION ||
+          mHeader->MappedBytes != mMappedBytes)
+      {
+         munmap(mHeader, mMappedBytes);
+         mHeader = nullptr;
+         mMappedBytes = 0;
+
+         if (stale && RemoveStale)
+         {
+            ExecApiLogWarning("SharedTilePool: %s was left half created, creating it again", Name);
+            UnlinkSegment(Name, inode);
+
+            return Attach(Name, BudgetBytes, false);
+         }
+
+         ExecApiLogWarning("SharedTilePool: ignoring %s, unknown format", Name);
+         return false;
+      }
+   }
+
+   mSlots = (TSlot*)((uint8_t*)mHeader + AlignUp(sizeof(THeader), 64));
+   mBlocks = (uint8_t*)mHeader + AlignUp(AlignUp(sizeof(THeader), 64) + sizeof(TSlot) * ((size_t)1 << mHeader->SlotBits), 4096);
+
+   if (created)
+   {
+      for (uint32_t i = 0; i < mHeader->BlockCount; i++)
+      {
+         uint32_t next = (i + 1 < mHeader->BlockCount) ? i + 1 : NO_BLOCK;
+
+         memcpy(GetBlock(i), &next, sizeof(next));
+      }
+
+      mHeader->FreeBlock = 0;
+      mHeader->Magic.store(POOL_MAGIC, std::memory_order_release);
+   }
+
+   // a seat in the client table, from the ones dead processes left
+   Lock();
+   ReapClients();
+
+   for (int i = 0; i < SHARED_POOL_CLIENTS && mClient < 0; i++)
+   {
+      TPoolClient& client = mHeader->Clients[i];
+
+      if (client.Active)
+         continue;
+
+      client.Pid = getpid();
+      client.StartTime = GetProcessStartTime(client.Pid);
+      client.Active = 1;
+      mClient = i;
+   }
+
+   Unlock();
+
+   if (mClient < 0)
+   {
+      ExecApiLogWarning("SharedTilePool: %s has %d processes attached already", Name, SHARED_POOL_CLIENTS);
+      munmap(mHeader, mMappedBytes);
+      mHeader = nullptr;
+      mMappedBytes = 0;
+      return false;
+   }
+
+   return true;
+}
+
+bool CSharedTilePool::Open(const char* Name, uint64_t BudgetBytes)
+{
+   if (mHeader)
+      return false;
+
+   return Attach(Name, BudgetBytes, true);
+}
+
+bool CSharedTilePool::Publish(TTileKey Key, const unsigned char* Pixels, int Width, int Height, int Channels)
+{
+   if (!mHeader)
+      return false;
+
+   size_t   bytes = (size_t)Width * Height * Channels;
+   uint8_t* block = nullptr;
+
+   Lock();
+
+   int slot = FindSlot(Key);
+
+   if (slot >= 0 && mSlots[slot].State == SLOT_PENDING && mSlots[slot].Owner == mClient)
+   {
+      int64_t allocated = -1;
+
+      if (Pixels && Width > 0 && Height > 0 && Channels > 0 && bytes <= SHARED_POOL_BLOCK_BYTES)
+      {
+         allocated = AllocateBlock();
+
+         if (allocated < 0 && ReapClients())
+            allocated = AllocateBlock();
+
+         // the eviction may have moved the claim
+         slot = FindSlot(Key);
+      }
+
+      if (allocated >= 0)
+      {
+         mSlots[slot].Block = (uint32_t)allocated;
+         block = GetBlock((uint32_t)allocated);
+      }
+      else
+         RemoveSlot(slot);
+   }
+
+   Unlock();
+
+   if (!block)
+      return false;
+
+   // nobody else touches a pending tile's block, the copy is left out of
+   // the lock
+   memcpy(block, Pixels, bytes);
+
+   Lock();
+
+   slot = FindSlot(Key);
+
+   // a process that thought this one dead could have taken it over
+   bool published = slot >= 0 && mSlots[slot].State == SLOT_PENDING && mSlots[slot].Owner == mClient;
+
+   if (published)
+   {
+      TSlot& ready = mSlots[slot];
+
+      ready.Width = (uint16_t)Width;
+      ready.Height = (uint16_t)Height;
+      ready.Channels = (uint8_t)Channels;
+      ready.Owner = -1;
+      ready.LastUse = ++mHeader->Clock;
+      ready.State = SLOT_READY;
+      mHeader->Tiles++;
+      mHeader->Decodes++;
+   }
+
+   Unlock();
+
+   return published;
+}
+
+bool CSharedTilePool::ReapClients()
+{
+   bool reaped = false;
+
+   for (int c = 0; c < SHARED_POOL_CLIENTS; c++)
+   {
+      if (!mHeader->Clients[c].Active || c == mClient || IsClientAlive(c))
+         continue;
+
+      DropClient(c);
+      mHeader->ReapedClients++;
+      reaped = true;
+   }
+
+   return reaped;
+}
+
+void CSharedTilePool::RebuildIndex()
+{
+   uint32_t                     slot_count = 1u << mHeader->SlotBits;
+   uint32_t                     mask = slot_count - 1;
+   std::vector<TSlot>           entries;
+   std::vector<uint8_t>         used(mHeader->BlockCount, 0);
+   std::unordered_set<uint64_t> keys;
+
+   // a shift that stopped half way leaves an entry in two slots, the
+   // second copy is dropped. A block no entry holds goes back on the free
+   // list whether or not the list had it.
+   for (uint32_t i = 0; i < slot_count; i++)
+   {
+      const TSlot& slot = mSlots[i];
+
+      if (slot.State == SLOT_EMPTY || keys.count(slot.Key))
+         continue;
+
+      if (slot.Block != NO_BLOCK && (slot.Block >= mHeader->BlockCount || used[slot.Block]))
+         continue;
+
+      if (slot.State == SLOT_READY && slot.Block == NO_BLOCK)
+         continue;
+
+      if (slot.Block != NO_BLOCK)
+         used[slot.Block] = 1;
+
+      keys.insert(slot.Key);
+      entries.push_back(slot);
+   }
+
+   for (uint32_t i = 0; i < slot_count; i++)
+      mSlots[i].State = SLOT_EMPTY;
+
+   mHeader->Tiles = 0;
+   mHeader->Entries = 0;
+
+   for (const TSlot& entry : entries)
+   {
+      uint32_t i = GetHomeSlot(entry.Key, mHeader->SlotBits);
+
+      while (mSlots[i].State != SLOT_EMPTY)
+         i = (i + 1) & mask;
+
+      mSlots[i] = entry;
+      mHeader->Entries++;
+
+      if (entry.State == SLOT_READY)
+         mHeader->Tiles++;
+   }
+
+   mHeader->FreeBlock = NO_BLOCK;
+
+   for (uint32_t block = mHeader->BlockCount; block-- > 0;)
+   {
+      if (used[block])
+         continue;
+
+      memcpy(GetBlock(block), &mHeader->FreeBlock, sizeof(uint32_t));
+      mHeader->FreeBlock = block;
+   }
+}
+
+void CSharedTilePool::Release(const TSharedTile& Tile)
+{
+   if (!mHeader)
+      return;
+
+   Lock();
+
+   auto it = mLocalRefs.find(Tile.Key.Value);
+
+   if (it != mLocalRefs.end() && --it->second == 0)
+   {
+      int slot = FindSlot(Tile.Key);
+
+      if (slot >= 0)
+         mSlots[slot].Refs &= ~(1ull << mClient);
+
+      mLocalRefs.erase(it);
+   }
+
+   Unlock();
+}
+
+void CSharedTilePool::RemoveSlot(int Slot)
+{
+   uint32_t mask = (1u << mHeader->SlotBits) - 1;
+   uint32_t hole = Slot;
+
+   if (mSlots[hole].State == SLOT_READY)
+      mHeader->Tiles--;
+
+   if (mSlots[hole].Block != NO_BLOCK)
+   {
+      memcpy(GetBlock(mSlots[hole].Block), &mHeader->FreeBlock, sizeof(uint32_t));
+      mHeader->FreeBlock = mSlots[hole].Block;
+   }
+
+   mSlots[hole].State = SLOT_EMPTY;
+   mHeader->Entries--;
+
+   // an entry after the hole moves into it unless its home slot lies
+   // between the two, the probe sequence from its home stays unbroken
+   for (uint32_t i = (hole + 1) & mask; mSlots[i].State != SLOT_EMPTY; i = (i + 1) & mask)
+   {
+      uint32_t home = GetHomeSlot(mSlots[i].Key, mHeader->SlotBits);
+
+      if (((i - home) & mask) >= ((i - hole) & mask))
+      {
+         mSlots[hole] = mSlots[i];
+         mSlots[i].State = SLOT_EMPTY;
+         hole = i;
+      }
+   }
+}
+
+void CSharedTilePool::Unlock()
+{
+   pthread_mutex_unlock(&mHeader->Mutex);
+}
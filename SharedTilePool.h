@@ -0,0 +1,138 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include "TileKey.h"
+
+#define SHARED_POOL_CLIENTS     64     // processes attached at once, one reference bit each
+#define SHARED_POOL_BLOCK_BYTES (256 * 256 * 4) // one decoded tile of up to 4 channels
+#define SHARED_POOL_OPEN_MS     2000   // wait for another process to finish creating the pool
+
+// What Lookup found for a tile
+enum class SharedTileStatus
+{
+   READY,       // decoded, the pixels are referenced until Release
+   CLAIMED,     // not in the pool, the caller produces it and calls Publish or Abandon
+   BUSY,        // another process is producing it
+   UNAVAILABLE  // no pool, or its index is full of claims
+};
+
+// A decoded tile in the pool, the pixels are shared memory and read only
+struct TSharedTile
+{
+   TTileKey             Key;
+   const unsigned char* Pixels;
+   int                  Width;
+   int                  Height;
+   int                  Channels;
+};
+
+struct TSharedTilePoolStats
+{
+   uint64_t BudgetBytes;
+   uint64_t Tiles;          // decoded, in the pool
+   uint64_t Clients;        // processes attached
+   uint64_t Hits;           // lookups that found the tile decoded, every process
+   uint64_t Decodes;        // tiles published by the process that decoded them
+   uint64_t Evictions;
+   uint64_t ReapedClients;  // processes that died attached, their references dropped
+};
+
+// Decoded tiles shared by every process on the host that opens the same
+// name, so displays showing the same area decode each tile once.
+//
+// The pool is one POSIX shared memory segment: a header with a robust,
+// process shared mutex, an open addressed index by tile key and fixed size
+// pixel blocks under the byte budget. Every process attached holds a slot in
+// a client table and a tile's references are a bit per client, so the
+// references of a process that crashed are dropped when its death is
+// noticed, by the robust mutex or by a liveness check before eviction. A
+// tile claimed by a dead process is taken over by the next lookup, and a
+// process that died holding the mutex has the index rebuilt behind it.
+//
+// The segment is created by the first process, sized by its budget, and
+// unlinked by the last one to close it.
+class CSharedTilePool
+{
+public:
+   CSharedTilePool();
+   ~CSharedTilePool();
+
+   // a tile nobody produced after all, the next lookup claims it again
+   void Abandon(TTileKey Key);
+
+   void Close();
+
+   TSharedTilePoolStats GetStats();
+
+   bool IsOpen() const { return mHeader != nullptr; }
+
+   // Finds a decoded tile and references it, or claims it for the caller.
+   // A claim holds no block until Publish, so claiming a tile only to keep
+   // other processes from fetching it evicts nothing. Claims of one process
+   // aren't told apart, a thread looking up a tile another thread of the
+   // same process claimed gets BUSY.
+   SharedTileStatus Lookup(TTileKey Key, TSharedTile& Tile);
+
+   // Name is a shared memory object name, "/name". The budget only counts
+   // when the pool is created, later processes use the creator's. A pool
+   // whose creator died before finishing it is removed and created again.
+   bool Open(const char* Name, uint64_t BudgetBytes);
+
+   // copies the pixels of a claimed tile into a block, the least recently
+   // used unreferenced tile's when none is free. False if they don't fit a
+   // block or every block is referenced, which abandons the claim.
+   bool Publish(TTileKey Key, const unsigned char* Pixels, int Width, int Height, int Channels);
+
+   // drops a reference Lookup took
+   void Release(const TSharedTile& Tile);
+
+private:
+
+   struct THeader;
+   struct TSlot;
+
+   // mutex held, a block from the free list or the least recently used
+   // unreferenced tile, -1 if every block is referenced
+   int64_t AllocateBlock();
+
+   // Open, RemoveStale unlinks a segment left half created and tries once more
+   bool Attach(const char* Name, uint64_t BudgetBytes, bool RemoveStale);
+
+   // mutex held, clears the client's reference bit, removes its claims and
+   // frees its seat
+   void DropClient(int Client);
+
+   // mutex held, the slot holding Key or -1
+   int FindSlot(TTileKey Key) const;
+
+   uint8_t* GetBlock(uint32_t Block) const;
+
+   // mutex held, true if the client's process still runs
+   bool IsClientAlive(int Client) const;
+
+   void Lock();
+
+   // mutex held, drops the references and claims of clients whose process
+   // is gone, true if any were
+   bool ReapClients();
+
+   // mutex held, after a holder died, the index and free list again from
+   // the entries in the slots
+   void RebuildIndex();
+
+   // mutex held, empties a slot and shifts the entries after it back, so
+   // lookups never need tombstones
+   void RemoveSlot(int Slot);
+
+   void Unlock();
+
+   std::string                            mName;
+   THeader*                               mHeader;
+   TSlot*                                 mSlots;
+   uint8_t*                               mBlocks;
+   size_t                                 mMappedBytes;
+   std::unordered_map<uint64_t, uint32_t> mLocalRefs;  // by tile key, this process's share of its reference bit
+   int                                    mClient;     // index in the client table, -1 when closed
+};
@@ -0,0 +1,375 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <chrono>
+#include <random>
+#include <webp/encode.h>
+#include "TestTileServer.h"
+#include "JpegWriter.h"
+#include "PngWriter.h"
+#include "ExecApi.h"
+
+#define TILE_SIZE          256
+#define MAX_REQUEST_SIZE   8192
+#define MAX_CACHED_TILES   4096
+#define BANDWIDTH_SLICE_MS 10
+#define LOSSY_QUALITY      85   // of the jpeg and webp tiles
+
+CTestTileServer::CTestTileServer()
+   : mConfig(DefaultConfig()),
+     mRequestCount(0),
+     mErrorCount(0),
+     mBytesSent(0),
+     mTerminate(false),
+     mActiveConnections(0),
+     mListenSocket(-1),
+     mPort(0)
+{
+}
+
+CTestTileServer::~CTestTileServer()
+{
+   Close();
+}
+
+void CTestTileServer::AcceptThread()
+{
+   uint32_t connection_count = 0;
+
+   while (!mTerminate)
+   {
+      struct pollfd poll_fd = { mListenSocket, POLLIN, 0 };
+
+      // hold connections in the listen backlog while at the connection limit,
+      // the same way a server with a fixed worker pool queues them
+      if (mConfig.MaxConnections > 0)
+      {
+         std::unique_lock<std::mutex> lock(mConnectionMutex);
+         mConnectionCondition.wait_for(lock, std::chrono::milliseconds(100), [this]()
+         {
+            return mTerminate || mActiveConnections < mConfig.MaxConnections;
+         });
+
+         if (mActiveConnections >= mConfig.MaxConnections)
+            continue;
+      }
+
+      if (poll(&poll_fd, 1, 100) <= 0)
+         continue;
+
+      int socket = accept(mListenSocket, nullptr, nullptr);
+
+      if (socket < 0)
+         continue;
+
+      mConnectionMutex.lock();
+      mActiveConnections++;
+      mConnectionMutex.unlock();
+
+      std::thread(&CTestTileServer::ConnectionThread, this, socket, mConfig.Seed + connection_count++).detach();
+   }
+}
+
+void CTestTileServer::Close()
+{
+   if (mAcceptThread.joinable())
+   {
+      mTerminate = true;
+      mConnectionCondition.notify_all();
+      mAcceptThread.join();
+   }
+
+   // wait for the connection threads to drain
+   std::unique_lock<std::mutex> lock(mConnectionMutex);
+   mConnectionCondition.wait(lock, [this]() { return mActiveConnections == 0; });
+   lock.unlock();
+
+   if (mListenSocket >= 0)
+   {
+      close(mListenSocket);
+      mListenSocket = -1;
+   }
+}
+
+void CTestTileServer::ConnectionThread(int Socket, uint32_t Seed)
+{
+   std::mt19937                          random(Seed);
+   std::uniform_real_distribution<double> uniform(0.0, 1.0);
+   std::vector<unsigned char>            image;
+   std::string                           xml;
+   char                                  request[MAX_REQUEST_SIZE];
+   char                                  path[1024];
+   char                                  extension[8];
+   int                                   request_size = 0;
+   int                                   zoom;
+   int                                   x;
+   int                                   y;
+
+   // read the request header, nothing we serve has a request body
+   while (request_size < MAX_REQUEST_SIZE - 1)
+   {
+      int size = recv(Socket, &request[request_size], MAX_REQUEST_SIZE - 1 - request_size, 0);
+
+      if (size <= 0)
+         break;
+
+      request_size += size;
+      request[request_size] = 0;
+
+      if (strstr(request, "\r\n\r\n"))
+         break;
+   }
+   request[request_size] = 0;
+
+   mRequestCount++;
+
+   // injected latency
+   if (mConfig.LatencyMs > 0 || mConfig.JitterMs > 0)
+   {
+      double delay_ms = mConfig.LatencyMs + (uniform(random) * 2.0 - 1.0) * mConfig.JitterMs;
+
+      if (delay_ms > 0.0)
+         std::this_thread::sleep_for(std::chrono::microseconds((int64_t)(delay_ms * 1000.0)));
+   }
+
+   if (sscanf(request, "GET %1023s", path) != 1)
+   {
+      SendResponse(Socket, 400, "text/plain", (const unsigned char*)"Bad Request", 11);
+   }
+   else if (strcmp(path, "/styles/basic-preview/wmts.xml") == 0)
+   {
+      GetCapabilitiesXml(xml);
+      SendResponse(Socket, 200, "application/xml", (const unsigned char*)xml.data(), xml.size());
+   }
+   else if (sscanf(path, "/styles/basic-preview/256/%d/%d/%d.%7s", &zoom, &x, &y, extension) == 4 &&
+            strcmp(extension, GetTileFormatExtension(mConfig.Format)) == 0)
+   {
+      if (uniform(random) < mConfig.ErrorRate)
+      {
+         mErrorCount++;
+         SendResponse(Socket, 500, "text/plain", (const unsigned char*)"Internal Server Error", 21);
+      }
+      else if (zoom < 0 || zoom > 30 || x < 0 || y < 0 || x >= (1 << zoom) || y >= (1 << zoom))
+      {
+         SendResponse(Socket, 404, "text/plain", (const unsigned char*)"Not Found", 9);
+      }
+      else
+      {
+         GetTileImage(zoom, x, y, image);
+         SendResponse(Socket, 200, GetTileFormatMimeType(mConfig.Format), image.data(), image.size());
+      }
+   }
+   else
+   {
+      SendResponse(Socket, 404, "text/plain", (const unsigned char*)"Not Found", 9);
+   }
+
+   close(Socket);
+
+   mConnectionMutex.lock();
+   mActiveConnections--;
+   mConnectionMutex.unlock();
+   mConnectionCondition.notify_all();
+}
+
+TTestTileServerConfig CTestTileServer::DefaultConfig()
+{
+   TTestTileServerConfig config;
+
+   config.Port           = 0;
+   config.LatencyMs      = 0;
+   config.JitterMs       = 0;
+   config.ErrorRate      = 0.0;
+   config.BandwidthKbps  = 0;
+   config.MaxConnections = 0;
+   config.Format         = TileFormat::PNG;
+   config.Seed           = 1;
+
+   return config;
+}
+
+void CTestTileServer::GetCapabilitiesXml(std::string& Xml)
+{
+   std::string mime_type = GetTileFormatMimeType(mConfig.Format);
+   std::string url = "http://" + GetUrl() + "/styles/basic-preview/256/{TileMatrix}/{TileCol}/{TileRow}." +
+                     GetTileFormatExtension(mConfig.Format);
+
+   Xml  = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n";
+   Xml += "<Capabilities xmlns=\"http://www.opengis.net/wmts/1.0\" xmlns:ows=\"http://www.opengis.net/ows/1.1\" version=\"1.0.0\">\n";
+   Xml += "  <Contents>\n";
+   Xml += "    <Layer>\n";
+   Xml += "      <ows:Title>basic-preview</ows:Title>\n";
+   Xml += "      <ows:Identifier>basic-preview</ows:Identifier>\n";
+   Xml += "      <Style isDefault=\"true\"><ows:Identifier>default</ows:Identifier></Style>\n";
+   Xml += "      <Format>" + mime_type + "</Format>\n";
+   Xml += "      <TileMatrixSetLink><TileMatrixSet>GoogleMapsCompatible</TileMatrixSet></TileMatrixSetLink>\n";
+   Xml += "      <ResourceURL format=\"" + mime_type + "\" resourceType=\"tile\" template=\"" + url + "\"/>\n";
+   Xml += "    </Layer>\n";
+   Xml += "    <TileMatrixSet>\n";
+   Xml += "      <ows:Identifier>GoogleMapsCompatible</ows:Identifier>\n";
+   Xml += "      <ows:SupportedCRS>urn:ogc:def:crs:EPSG::3857</ows:SupportedCRS>\n";
+
+   for (int zoom = 0; zoom <= 20; zoom++)
+   {
+      std::string n = std::to_string(1 << zoom);
+
+      Xml += "      <TileMatrix><ows:Identifier>" + std::to_string(zoom) + "</ows:Identifier>";
+      Xml += "<TileWidth>256</TileWidth><TileHeight>256</TileHeight>";
+      Xml += "<MatrixWidth>" + n + "</MatrixWidth><MatrixHeight>" + n + "</MatrixHeight></TileMatrix>\n";
+   }
+
+   Xml += "    </TileMatrixSet>\n";
+   Xml += "  </Contents>\n";
+   Xml += "</Capabilities>\n";
+}
+
+void CTestTileServer::GetTileImage(int Zoom, int X, int Y, std::vector<unsigned char>& Image)
+{
+   TTileKey key(Zoom, X, Y);
+
+   mTileMutex.lock();
+   auto it = mTiles.find(key);
+   if (it != mTiles.end())
+   {
+      Image = it->second;
+      mTileMutex.unlock();
+      return;
+   }
+   mTileMutex.unlock();
+
+   // generate a tile with a color unique to its coordinates and a dark
+   // border, so seams and misplaced tiles stand out on the map
+   std::vector<unsigned char> pixels(TILE_SIZE * TILE_SIZE * 3);
+   uint32_t                   hash = (uint32_t)(Zoom * 73856093) ^ (uint32_t)(X * 19349663) ^ (uint32_t)(Y * 83492791);
+   unsigned char              r = 128 + (hash & 0x7f);
+   unsigned char              g = 128 + ((hash >> 8) & 0x7f);
+   unsigned char              b = 128 + ((hash >> 16) & 0x7f);
+
+   for (int y = 0; y < TILE_SIZE; y++)
+   {
+      for (int x = 0; x < TILE_SIZE; x++)
+      {
+         unsigned char* pixel = &pixels[(y * TILE_SIZE + x) * 3];
+         bool           edge = (x < 2 || y < 2 || x >= TILE_SIZE - 2 || y >= TILE_SIZE - 2);
+         bool           grid = ((x % 32) == 0 || (y % 32) == 0);
+
+         pixel[0] = edge ? 32 : (grid ? r - 48 : r);
+         pixel[1] = edge ? 32 : (grid ? g - 48 : g);
+         pixel[2] = edge ? 32 : (grid ? b - 48 : b);
+      }
+   }
+
+   if (mConfig.Format == TileFormat::JPEG)
+      WriteJpegBuffer(Image, pixels.data(), TILE_SIZE, TILE_SIZE, 3, LOSSY_QUALITY);
+   else if (mConfig.Format == TileFormat::WEBP)
+   {
+      unsigned char* webp = nullptr;
+      size_t         size = WebPEncodeRGB(pixels.data(), TILE_SIZE, TILE_SIZE, TILE_SIZE * 3, LOSSY_QUALITY, &webp);
+
+      Image.assign(webp, webp + size);
+      WebPFree(webp);
+   }
+   else
+      WritePngBuffer(Image, pixels.data(), TILE_SIZE, TILE_SIZE, 3);
+
+   mTileMutex.lock();
+   if (mTiles.size() >= MAX_CACHED_TILES)
+      mTiles.clear();
+   mTiles[key] = Image;
+   mTileMutex.unlock();
+}
+
+std::string CTestTileServer::GetUrl() const
+{
+   return "127.0.0.1:" + std::to_string(mPort);
+}
+
+bool CTestTileServer::Open(const TTestTileServerConfig& Config)
+{
+   struct sockaddr_in address;
+   socklen_t          address_size = sizeof(address);
+   int                enable = 1;
+
+   if (mAcceptThread.joinable())
+      return false;
+
+   mConfig = Config;
+   mTerminate = false;
+
+   mListenSocket = socket(AF_INET, SOCK_STREAM, 0);
+
+   if (mListenSocket < 0)
+   {
+      ExecApiLogWarning("Test tile server failed to create socket");
+      return false;
+   }
+
+   setsockopt(mListenSocket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+   memset(&address, 0, sizeof(address));
+   address.sin_family      = AF_INET;
+   address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+   address.sin_port        = htons(mConfig.Port);
+
+   if (bind(mListenSocket, (struct sockaddr*)&address, sizeof(address)) < 0 ||
+       listen(mListenSocket, 128) < 0)
+   {
+      ExecApiLogWarning("Test tile server failed to listen on port %d", mConfig.Port);
+      close(mListenSocket);
+      mListenSocket = -1;
+      return false;
+   }
+
+   getsockname(mListenSocket, (struct sockaddr*)&address, &address_size);
+   mPort = ntohs(address.sin_port);
+
+   mAcceptThread = std::thread(&CTestTileServer::AcceptThread, this);
+
+   return true;
+}
+
+bool CTestTileServer::SendResponse(int                  Socket,
+                                   int                  Status,
+                                   const char*          ContentType,
+                                   const unsigned char* Body,
+                                   size_t               Size)
+{
+   char   header[256];
+   size_t sent = 0;
+   size_t slice_size = (size_t)-1;
+
+   snprintf(header, sizeof(header),
+            "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+            Status, (Status == 200) ? "OK" : "Error", ContentType, Size);
+
+   if (send(Socket, header, strlen(header), MSG_NOSIGNAL) < 0)
+      return false;
+
+   // the bandwidth cap sends the body in time slices
+   if (mConfig.BandwidthKbps > 0)
+   {
+      slice_size = (size_t)mConfig.BandwidthKbps * 1000 / 8 * BANDWIDTH_SLICE_MS / 1000;
+      if (slice_size == 0) slice_size = 1;
+   }
+
+   while (sent < Size)
+   {
+      size_t  size = std::min(slice_size, Size - sent);
+      ssize_t result = send(Socket, &Body[sent], size, MSG_NOSIGNAL);
+
+      if (result <= 0)
+         return false;
+
+      sent += result;
+      mBytesSent += result;
+
+      if (mConfig.BandwidthKbps > 0 && sent < Size)
+         std::this_thread::sleep_for(std::chrono::milliseconds(BANDWIDTH_SLICE_MS));
+   }
+
+   return true;
+}
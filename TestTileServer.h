@@ -0,0 +1,85 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+#include "TileFormat.h"
+
+// Stand-in for the WMTS tile server used by the load test. It answers the same
+// /styles/basic-preview/... routes CWmtsIf requests with generated png, jpeg
+// or webp tiles and a generated capabilities document, and can inject
+// latency, jitter, errors, a bandwidth cap and a connection limit.
+
+struct TTestTileServerConfig
+{
+   int        Port;           // 0 picks a free port
+   int        LatencyMs;      // added before every response
+   int        JitterMs;       // uniform +/- on top of the latency
+   double     ErrorRate;      // 0.0 to 1.0, fraction of tile requests that fail
+   int        BandwidthKbps;  // per connection, 0 is unlimited
+   int        MaxConnections; // connections served at once, 0 is unlimited
+   TileFormat Format;         // of the tiles, the capabilities document lists it
+   uint32_t   Seed;
+};
+
+class CTestTileServer
+{
+public:
+   CTestTileServer();
+   ~CTestTileServer();
+
+   void Close();
+
+   uint64_t GetBytesSent() const { return mBytesSent; }
+
+   uint64_t GetErrorCount() const { return mErrorCount; }
+
+   int GetPort() const { return mPort; }
+
+   uint64_t GetRequestCount() const { return mRequestCount; }
+
+   // host:port the way COpenStreetMap::Open expects the WMTS url
+   std::string GetUrl() const;
+
+   bool Open(const TTestTileServerConfig& Config);
+
+   static TTestTileServerConfig DefaultConfig();
+
+private:
+
+   using TTileKey = std::tuple<int, int, int>;
+
+   void AcceptThread();
+
+   void ConnectionThread(int Socket, uint32_t Seed);
+
+   void GetCapabilitiesXml(std::string& Xml);
+
+   void GetTileImage(int Zoom, int X, int Y, std::vector<unsigned char>& Image);
+
+   bool SendResponse(int                  Socket,
+                     int                  Status,
+                     const char*          ContentType,
+                     const unsigned char* Body,
+                     size_t               Size);
+
+   TTestTileServerConfig                          mConfig;
+   std::thread                                    mAcceptThread;
+   std::mutex                                     mConnectionMutex;
+   std::condition_variable                        mConnectionCondition;
+   std::mutex                                     mTileMutex;
+   std::map<TTileKey, std::vector<unsigned char>> mTiles;
+   std::atomic<uint64_t>                          mRequestCount;
+   std::atomic<uint64_t>                          mErrorCount;
+   std::atomic<uint64_t>                          mBytesSent;
+   std::atomic<bool>                              mTerminate;
+   int                                            mActiveConnections;
+   int                                            mListenSocket;
+   int                                            mPort;
+};
@@ -1,26 +1,55 @@
 
 #include <iostream>
 #include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iterator>
 #include <glad/glad.h>
 #include "Texture.h"
+#include "TextureRegistry.h"
+#include "TileFormat.h"
+#include "Trace.h"
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
-std::unordered_map<std::string, std::shared_ptr<CTexture>> CTexture::TextureMap;
-std::vector<std::string> CTexture::AvailableTextures;
-
 CTexture::CTexture(const char* Filename, bool DisableOutput)
    : mFilename(Filename),
+     mLoadTimes{},
      mTextureId(0),
      mWidth(0),
      mHeight(0),
-     mChannels(0)
+     mChannels(0),
+     mLoadTimesTaken(false)
 {
+   using clock = std::chrono::steady_clock;
+   using usec = std::chrono::microseconds;
+
    if (strlen(Filename) == 0)
       return;
 
-   stbi_set_flip_vertically_on_load(1);
-   unsigned char* data = stbi_load(mFilename.c_str(), &mWidth, &mHeight, &mChannels, 0);
+   // read and decode separately so each can be timed
+   auto start = clock::now();
+
+   std::ifstream              image_file(mFilename, std::ios::in | std::ios::binary);
+   std::vector<unsigned char> buffer((std::istreambuf_iterator<char>(image_file)),
+                                     std::istreambuf_iterator<char>());
+
+   auto read_done = clock::now();
+
+   // png, jpeg or webp, whatever the file holds
+   unsigned char* data = nullptr;
+
+   if (buffer.size())
+      data = DecodeTileImage(buffer.data(), buffer.size(), 0, true, mWidth, mHeight, mChannels);
+
+   auto decode_done = clock::now();
+
+   CTrace::Record("ReadFile", "decode", start, read_done);
+   CTrace::Record("Decode", "decode", read_done, decode_done);
+
+   mLoadTimes.ReadUs   = std::chrono::duration_cast<usec>(read_done - start).count();
+   mLoadTimes.DecodeUs = std::chrono::duration_cast<usec>(decode_done - read_done).count();
+   mLoadTimes.FileSize = buffer.size();
 
    if (!data)
    {
@@ -28,6 +57,42 @@ CTexture::CTexture(const char* Filename, bool DisableOutput)
       return;
    }
 
+   Upload(data, DisableOutput);
+
+   FreeTileImage(data);
+}
+
+CTexture::CTexture(const char* Filename, const TTextureImage& Image, bool DisableOutput)
+   : mFilename(Filename),
+     mLoadTimes(Image.LoadTimes),
+     mTextureId(0),
+     mWidth(Image.Width),
+     mHeight(Image.Height),
+     mChannels(Image.Channels),
+     mLoadTimesTaken(false)
+{
+   if (Image.Pixels.empty())
+      return;
+
+   Upload(Image.Pixels.data(), DisableOutput);
+}
+
+CTexture::~CTexture()
+{
+   // the last handle can go on any thread, the gl texture is deleted on the
+   // render thread
+   if (mTextureId)
+      CTextureRegistry::ReleaseGlTexture(mTextureId);
+}
+
+void CTexture::Upload(const unsigned char* Data, bool DisableOutput)
+{
+   using clock = std::chrono::steady_clock;
+   using usec = std::chrono::microseconds;
+
+   auto start = clock::now();
+
+   CTextureRegistry::SetGlThread();
    glGenTextures(1, &mTextureId);
    glBindTexture(GL_TEXTURE_2D, mTextureId);
 
@@ -43,34 +108,30 @@ CTexture::CTexture(const char* Filename, bool DisableOutput)
 
    if (mChannels == 4)
    {
-      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, mWidth, mHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, mWidth, mHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, Data);
       glGenerateMipmap(GL_TEXTURE_2D);
    }
    else if (mChannels == 3)
    {
-      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, mWidth, mHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, mWidth, mHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, Data);
       glGenerateMipmap(GL_TEXTURE_2D);
    }
    else
    {
       glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // Disable byte-alignment restriction
-      glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, mWidth, mHeight, 0, GL_RED, GL_UNSIGNED_BYTE, data);
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, mWidth, mHeight, 0, GL_RED, GL_UNSIGNED_BYTE, Data);
    }
 
-   stbi_image_free(data);
-
    glBindTexture(GL_TEXTURE_2D, 0);
-}
 
-CTexture::~CTexture()
-{
-   DeleteTexture();
+   mLoadTimes.UploadUs = std::chrono::duration_cast<usec>(clock::now() - start).count();
+
+   CTrace::Record("Upload", "render", start);
 }
 
 void CTexture::DeleteTextures()
 {
-   for (auto& texture : TextureMap)
-      texture.second->DeleteTexture();
+   CTextureRegistry::GetGlobal().DeleteTextures();
 }
 
 void CTexture::DeleteTexture()
@@ -82,53 +143,25 @@ void CTexture::DeleteTexture()
    }
 }
 
-bool DeleteTexture(const char* Filename)
+bool CTexture::TakeLoadTimes(TTextureLoadTimes& Times)
 {
-   if (!CTexture::TextureMap.erase(Filename))
+   if (mLoadTimesTaken)
       return false;
 
-   for (size_t i = 0; i < CTexture::AvailableTextures.size(); i++)
-   {
-      if (CTexture::AvailableTextures[i] == Filename)
-      {
-         CTexture::AvailableTextures.erase(CTexture::AvailableTextures.begin() + i);
-         return true;
-      }
-   }
+   Times = mLoadTimes;
+   mLoadTimesTaken = true;
 
-   return false;
+   return true;
 }
 
-std::shared_ptr<CTexture> GetOrCreateTexture(const char* Filename, bool DisableOutput)
+bool DeleteTexture(const char* Filename)
 {
-   std::shared_ptr<CTexture> texture_ptr = nullptr;
+   return CTextureRegistry::GetGlobal().Remove(CTextureRegistry::GetNameId(Filename));
+}
 
-   if (CTexture::TextureMap.find(Filename) != CTexture::TextureMap.end())
-   {
-      texture_ptr = CTexture::TextureMap[Filename];
-   }
-   else
-   {
-      // Try loading the texture
-      texture_ptr = std::make_shared<CTexture>(Filename, DisableOutput);
-      if (texture_ptr->GetTexture())
-      {
-         CTexture::TextureMap[Filename] = texture_ptr;
-
-         CTexture::AvailableTextures.push_back(Filename);
-
-         // Sort alphabetically
-         std::sort(CTexture::AvailableTextures.begin(), CTexture::AvailableTextures.end(),
-            [](const std::string& a, const std::string& b)
-            {
-               return a < b;
-            });
-      }
-      else
-      {
-         texture_ptr = nullptr;
-      }
-   }
+std::shared_ptr<CTexture> GetOrCreateTexture(const char* Filename, bool DisableOutput)
+{
+   CTextureRegistry::CollectReleased();
 
-   return texture_ptr;
+   return CTextureRegistry::GetGlobal().GetOrCreate(CTextureRegistry::GetNameId(Filename), Filename, DisableOutput);
 }
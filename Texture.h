@@ -1,21 +1,39 @@
 #pragma once
 
 #include <string>
-#include <unordered_map>
 #include <vector>
 #include <memory>
+#include <cstdint>
+
+// Time spent creating a texture, in microseconds
+struct TTextureLoadTimes
+{
+   uint64_t ReadUs;
+   uint64_t DecodeUs;
+   uint64_t UploadUs;
+   size_t   FileSize;
+};
+
+// A file decoded off the render thread, uploaded by the CTexture made from it
+struct TTextureImage
+{
+   std::vector<unsigned char> Pixels;
+   int                        Width;
+   int                        Height;
+   int                        Channels;
+   TTextureLoadTimes          LoadTimes; // read and decode, the upload is timed by CTexture
+};
 
 class CTexture
 {
 public:
 
-   // Hash map to hold textures
-   static std::unordered_map<std::string, std::shared_ptr<CTexture>> TextureMap;
-   static std::vector<std::string> AvailableTextures;
-
    CTexture(const char* Filename, bool DisableOutput);
+   // render thread, only uploads, Filename is just the name
+   CTexture(const char* Filename, const TTextureImage& Image, bool DisableOutput);
    ~CTexture();
 
+   // render thread, the textures loaded by name
    static void DeleteTextures();
 
    void DeleteTexture();
@@ -28,14 +46,24 @@ public:
    //! \details Returns the texture identifier
    unsigned int GetTexture() const { return mTextureId; };
 
+   //! \fn bool TakeLoadTimes(TTextureLoadTimes& Times)
+   //! \details Returns the load times the first time it is called, so shared
+   //! textures are only counted once
+   bool TakeLoadTimes(TTextureLoadTimes& Times);
+
 private:
 
-   std::string  mFilename;
-   unsigned int mTextureId;
-   int          mWidth;
-   int          mHeight;
-   int          mChannels;
+   void Upload(const unsigned char* Data, bool DisableOutput);
+
+   std::string       mFilename;
+   TTextureLoadTimes mLoadTimes;
+   unsigned int      mTextureId;
+   int               mWidth;
+   int               mHeight;
+   int               mChannels;
+   bool              mLoadTimesTaken;
 };
 
+// textures by name in CTextureRegistry::GetGlobal
 std::shared_ptr<CTexture> GetOrCreateTexture(const char* Filename, bool DisableOutput = false);
 bool DeleteTexture(const char* Filename);
@@ -0,0 +1,234 @@
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <glad/glad.h>
+#include "TextureRegistry.h"
+
+// the thread textures are created on, gl calls are only made there
+static std::atomic<std::thread::id> gl_thread{ std::thread::id() };
+
+// gl textures let go of on other threads
+static std::mutex                release_mutex;
+static std::vector<unsigned int> released;
+
+// ids given out to names, names are few and live as long as the process
+static std::mutex                                  name_mutex;
+static std::unordered_map<std::string, TTextureId> name_ids;
+
+CTextureRegistry::CTextureRegistry()
+   : mClock(0),
+     mEvictedTextures(0)
+{
+}
+
+CTextureRegistry::~CTextureRegistry()
+{
+}
+
+void CTextureRegistry::CollectReleased()
+{
+   std::vector<unsigned int> texture_ids;
+
+   {
+      std::lock_guard<std::mutex> lock(release_mutex);
+      texture_ids.swap(released);
+   }
+
+   if (texture_ids.size())
+      glDeleteTextures(texture_ids.size(), texture_ids.data());
+}
+
+void CTextureRegistry::DeleteTextures()
+{
+   std::lock_guard<std::mutex> lock(mMutex);
+
+   for (auto& entry : mEntries)
+      entry.second.Texture->DeleteTexture();
+
+   mEntries.clear();
+}
+
+std::shared_ptr<CTexture> CTextureRegistry::Find(TTextureId Id)
+{
+   std::lock_guard<std::mutex> lock(mMutex);
+
+   auto it = mEntries.find(Id);
+
+   if (it == mEntries.end())
+      return nullptr;
+
+   it->second.LastUsed = ++mClock;
+
+   return it->second.Texture;
+}
+
+CTextureRegistry& CTextureRegistry::GetGlobal()
+{
+   static CTextureRegistry registry;
+
+   return registry;
+}
+
+std::shared_ptr<CTexture> CTextureRegistry::GetOrCreate(TTextureId Id, const char* Filename, bool DisableOutput)
+{
+   std::shared_ptr<CTexture> texture = Find(Id);
+
+   if (texture)
+      return texture;
+
+   // the load is left outside the lock, only the render thread creates
+   texture = std::make_shared<CTexture>(Filename, DisableOutput);
+
+   if (!texture->GetTexture())
+      return nullptr;
+
+   std::lock_guard<std::mutex> lock(mMutex);
+
+   mEntries[Id] = { texture, ++mClock };
+
+   return texture;
+}
+
+TTextureId CTextureRegistry::GetNameId(const std::string& Name)
+{
+   std::lock_guard<std::mutex> lock(name_mutex);
+
+   auto it = name_ids.find(Name);
+
+   if (it != name_ids.end())
+      return it->second;
+
+   TTextureId id = TEXTURE_NAME_ID_BIT | name_ids.size();
+
+   name_ids[Name] = id;
+
+   return id;
+}
+
+std::vector<std::string> CTextureRegistry::GetNames()
+{
+   std::vector<std::string> names;
+
+   {
+      std::lock_guard<std::mutex> lock(mMutex);
+
+      names.reserve(mEntries.size());
+
+      for (const auto& entry : mEntries)
+         names.push_back(entry.second.Texture->GetTextureFilename());
+   }
+
+   std::sort(names.begin(), names.end());
+
+   return names;
+}
+
+TTextureRegistryStats CTextureRegistry::GetStats()
+{
+   TTextureRegistryStats stats = {};
+
+   {
+      std::lock_guard<std::mutex> lock(mMutex);
+
+      stats.Textures = mEntries.size();
+      stats.EvictedTextures = mEvictedTextures;
+
+      for (const auto& entry : mEntries)
+      {
+         if (entry.second.Texture.use_count() > 1)
+            stats.ReferencedTextures++;
+      }
+   }
+
+   std::lock_guard<std::mutex> lock(release_mutex);
+
+   stats.PendingDeletes = released.size();
+
+   return stats;
+}
+
+void CTextureRegistry::Insert(TTextureId Id, const std::shared_ptr<CTexture>& Texture)
+{
+   if (!Texture || !Texture->GetTexture())
+      return;
+
+   std::lock_guard<std::mutex> lock(mMutex);
+
+   mEntries[Id] = { Texture, ++mClock };
+}
+
+void CTextureRegistry::ReleaseGlTexture(unsigned int TextureId)
+{
+   if (std::this_thread::get_id() == gl_thread.load())
+   {
+      glDeleteTextures(1, &TextureId);
+      return;
+   }
+
+   std::lock_guard<std::mutex> lock(release_mutex);
+
+   released.push_back(TextureId);
+}
+
+bool CTextureRegistry::Remove(TTextureId Id)
+{
+   std::shared_ptr<CTexture> texture;
+
+   {
+      std::lock_guard<std::mutex> lock(mMutex);
+
+      auto it = mEntries.find(Id);
+
+      if (it == mEntries.end())
+         return false;
+
+      // the last reference goes after the lock is released
+      texture = std::move(it->second.Texture);
+      mEntries.erase(it);
+   }
+
+   return true;
+}
+
+void CTextureRegistry::SetGlThread()
+{
+   gl_thread.store(std::this_thread::get_id());
+}
+
+size_t CTextureRegistry::Trim(size_t MaxTextures)
+{
+   std::vector<std::pair<uint64_t, TTextureId>> unreferenced;
+   std::vector<std::shared_ptr<CTexture>>       evicted;
+   size_t                                       excess;
+
+   {
+      std::lock_guard<std::mutex> lock(mMutex);
+
+      if (mEntries.size() <= MaxTextures)
+         return 0;
+
+      // a count of one is the registry's own reference
+      for (const auto& entry : mEntries)
+      {
+         if (entry.second.Texture.use_count() == 1)
+            unreferenced.push_back({ entry.second.LastUsed, entry.first });
+      }
+
+      excess = std::min(mEntries.size() - MaxTextures, unreferenced.size());
+
+      std::nth_element(unreferenced.begin(), unreferenced.begin() + excess, unreferenced.end());
+
+      for (size_t i = 0; i < excess; i++)
+      {
+         auto it = mEntries.find(unreferenced[i].second);
+
+         evicted.push_back(std::move(it->second.Texture));
+         mEntries.erase(it);
+      }
+
+      mEvictedTextures += excess;
+   }
+
+   return excess;
+}
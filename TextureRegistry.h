@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Texture.h"
+
+// Texture ids, map tiles use their 64-bit tile key and other textures an id
+// from GetNameId, which has the top bit set so the two never collide
+using TTextureId = uint64_t;
+
+#define TEXTURE_NAME_ID_BIT (1ull << 63)
+
+struct TTextureRegistryStats
+{
+   uint64_t Textures;
+   uint64_t ReferencedTextures; // held by a handle outside the registry
+   uint64_t EvictedTextures;
+   uint64_t PendingDeletes;     // released off the render thread, waiting for CollectReleased
+};
+
+// Textures by integer id.
+//
+// Lookups, inserts and removes are hash map operations on the id under a
+// mutex, so any thread can find or let go of a texture. Handles are
+// shared_ptrs and the registry holds one reference; a texture leaves the
+// gpu when the last handle goes. A handle dropped on another thread only
+// queues its gl texture, which the render thread deletes in
+// CollectReleased.
+class CTextureRegistry
+{
+public:
+   CTextureRegistry();
+   ~CTextureRegistry();
+
+   // render thread, deletes the gl textures released on other threads
+   static void CollectReleased();
+
+   // render thread, deletes every gl texture while the context is still
+   // current and empties the registry
+   void DeleteTextures();
+
+   // any thread, the texture if it is registered
+   std::shared_ptr<CTexture> Find(TTextureId Id);
+
+   // textures loaded by name, GetOrCreateTexture
+   static CTextureRegistry& GetGlobal();
+
+   // render thread, the texture for Id, loaded from Filename the first time
+   std::shared_ptr<CTexture> GetOrCreate(TTextureId Id, const char* Filename, bool DisableOutput = false);
+
+   // id for a texture name, the same name always gets the same id
+   static TTextureId GetNameId(const std::string& Name);
+
+   // the filenames of the registered textures sorted for display, built on
+   // every call
+   std::vector<std::string> GetNames();
+
+   TTextureRegistryStats GetStats();
+
+   // render thread, registers a texture made elsewhere, e.g. from pixels
+   // decoded ahead of time, replacing any under the same id
+   void Insert(TTextureId Id, const std::shared_ptr<CTexture>& Texture);
+
+   // the gl texture of a CTexture going away, deleted now on the render
+   // thread and queued on any other
+   static void ReleaseGlTexture(unsigned int TextureId);
+
+   // any thread, drops the registry's reference
+   bool Remove(TTextureId Id);
+
+   // called when a texture is created, textures are only created on the
+   // render thread
+   static void SetGlThread();
+
+   // render thread, deletes the least recently used textures no handle
+   // holds until at most MaxTextures are left, returns the number deleted
+   size_t Trim(size_t MaxTextures);
+
+private:
+   struct TEntry
+   {
+      std::shared_ptr<CTexture> Texture;
+      uint64_t                  LastUsed;
+   };
+
+   std::mutex                             mMutex;
+   std::unordered_map<TTextureId, TEntry> mEntries;
+   uint64_t                               mClock;
+   uint64_t                               mEvictedTextures;
+};
@@ -0,0 +1,170 @@
+
+#include <cstdlib>
+#include <cstring>
+#include <webp/decode.h>
+#include "TileFormat.h"
+#include "stb_image.h"
+
+static const char* extensions[(int)TileFormat::NUM_FORMATS] = { "webp", "jpg", "png" };
+static const char* mime_types[(int)TileFormat::NUM_FORMATS] = { "image/webp", "image/jpeg", "image/png" };
+
+const char* GetTileFormatExtension(TileFormat Format)
+{
+   return (Format < TileFormat::NUM_FORMATS) ? extensions[(int)Format] : "";
+}
+
+const char* GetTileFormatMimeType(TileFormat Format)
+{
+   return (Format < TileFormat::NUM_FORMATS) ? mime_types[(int)Format] : "";
+}
+
+bool GetTileFormatFromExtension(const std::string& Extension, TileFormat& Format)
+{
+   for (int i = 0; i < (int)TileFormat::NUM_FORMATS; i++)
+   {
+      if (Extension == extensions[i])
+      {
+         Format = (TileFormat)i;
+         return true;
+      }
+   }
+
+   // other spellings only come from servers, the cache uses the ones above
+   if (Extension == "jpeg")
+   {
+      Format = TileFormat::JPEG;
+      return true;
+   }
+
+   return false;
+}
+
+bool GetTileFormatFromMimeType(const std::string& MimeType, TileFormat& Format)
+{
+   // parameters such as "; mode=8bit" are ignored
+   std::string type = MimeType.substr(0, MimeType.find(';'));
+
+   while (!type.empty() && type.back() == ' ')
+      type.pop_back();
+
+   for (int i = 0; i < (int)TileFormat::NUM_FORMATS; i++)
+   {
+      if (strcasecmp(type.c_str(), mime_types[i]) == 0)
+      {
+         Format = (TileFormat)i;
+         return true;
+      }
+   }
+
+   if (strcasecmp(type.c_str(), "image/jpg") == 0)
+   {
+      Format = TileFormat::JPEG;
+      return true;
+   }
+
+   return false;
+}
+
+bool GetTileFormatFromData(const unsigned char* Data, size_t Size, TileFormat& Format)
+{
+   if (Size >= 8 && memcmp(Data, "\x89PNG\r\n\x1a\n", 8) == 0)
+      Format = TileFormat::PNG;
+   else if (Size >= 3 && Data[0] == 0xff && Data[1] == 0xd8 && Data[2] == 0xff)
+      Format = TileFormat::JPEG;
+   else if (Size >= 12 && memcmp(Data, "RIFF", 4) == 0 && memcmp(Data + 8, "WEBP", 4) == 0)
+      Format = TileFormat::WEBP;
+   else
+      return false;
+
+   return true;
+}
+
+// stb_image has no webp, libwebp decodes straight into a buffer that is
+// freed the same way as stb_image's
+static unsigned char* DecodeWebp(const unsigned char* Data,
+                                 size_t               Size,
+                                 int                  DesiredChannels,
+                                 bool                 FlipVertically,
+                                 int&                 Width,
+                                 int&                 Height,
+                                 int&                 Channels)
+{
+   WebPBitstreamFeatures features;
+
+   if (WebPGetFeatures(Data, Size, &features) != VP8_STATUS_OK)
+      return nullptr;
+
+   int    channels = (DesiredChannels == 3 || (DesiredChannels == 0 && !features.has_alpha)) ? 3 : 4;
+   size_t stride = (size_t)features.width * channels;
+   size_t bytes = stride * features.height;
+   auto*  pixels = (unsigned char*)malloc(bytes);
+
+   if (!pixels)
+      return nullptr;
+
+   bool decoded = (channels == 3) ? WebPDecodeRGBInto(Data, Size, pixels, bytes, (int)stride) != nullptr
+                                  : WebPDecodeRGBAInto(Data, Size, pixels, bytes, (int)stride) != nullptr;
+
+   if (!decoded)
+   {
+      free(pixels);
+      return nullptr;
+   }
+
+   if (FlipVertically)
+   {
+      unsigned char* row = (unsigned char*)malloc(stride);
+
+      for (int y = 0; row && y < features.height / 2; y++)
+      {
+         unsigned char* top = pixels + y * stride;
+         unsigned char* bottom = pixels + (features.height - 1 - y) * stride;
+
+         memcpy(row, top, stride);
+         memcpy(top, bottom, stride);
+         memcpy(bottom, row, stride);
+      }
+
+      free(row);
+   }
+
+   Width = features.width;
+   Height = features.height;
+   Channels = channels;
+
+   return pixels;
+}
+
+unsigned char* DecodeTileImage(const unsigned char* Data,
+                               size_t               Size,
+                               int                  DesiredChannels,
+                               bool                 FlipVertically,
+                               int&                 Width,
+                               int&                 Height,
+                               int&                 Channels)
+{
+   TileFormat format;
+
+   if (!Data || !GetTileFormatFromData(Data, Size, format))
+      return nullptr;
+
+   if (format == TileFormat::WEBP)
+      return DecodeWebp(Data, Size, DesiredChannels, FlipVertically, Width, Height, Channels);
+
+   // the flag is per thread, the compositor decodes on a pool of workers
+   stbi_set_flip_vertically_on_load_thread(FlipVertically ? 1 : 0);
+
+   unsigned char* pixels = stbi_load_from_memory(Data, (int)Size, &Width, &Height, &Channels, DesiredChannels);
+
+   // stb_image reports the file's channels, the pixels have the ones asked for
+   if (pixels && DesiredChannels)
+      Channels = DesiredChannels;
+
+   return pixels;
+}
+
+void FreeTileImage(unsigned char* Pixels)
+{
+   // stb_image allocates with malloc as well
+   free(Pixels);
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Tile image encodings, in the order a server's formats are preferred.
+// Lossy WebP and JPEG tiles are a fraction of the size of PNG tiles for
+// imagery and decode faster, PNG is the fallback every server has.
+enum class TileFormat : uint8_t
+{
+   WEBP,
+   JPEG,
+   PNG,
+   NUM_FORMATS
+};
+
+// "png", "jpg" or "webp", the cache file extension
+const char* GetTileFormatExtension(TileFormat Format);
+
+// "image/png", "image/jpeg" or "image/webp"
+const char* GetTileFormatMimeType(TileFormat Format);
+
+bool GetTileFormatFromExtension(const std::string& Extension, TileFormat& Format);
+
+// false for types no decoder here handles, e.g. vector tiles
+bool GetTileFormatFromMimeType(const std::string& MimeType, TileFormat& Format);
+
+// from the file signature
+bool GetTileFormatFromData(const unsigned char* Data, size_t Size, TileFormat& Format);
+
+// Decodes a png, jpeg or webp file to 8 bit pixels, the encoding is taken
+// from the signature. DesiredChannels 0 keeps the image's own channels.
+// Returns null if the data isn't an image, free the pixels with
+// FreeTileImage.
+unsigned char* DecodeTileImage(const unsigned char* Data,
+                               size_t               Size,
+                               int                  DesiredChannels,
+                               bool                 FlipVertically,
+                               int&                 Width,
+                               int&                 Height,
+                               int&                 Channels);
+
+void FreeTileImage(unsigned char* Pixels);
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+#define TILE_KEY_MAX_ZOOM   29           // 29 bits each of x and y fill the 58 bit morton code
+#define TILE_KEY_ZOOM_SHIFT 58
+#define TILE_KEY_INVALID    (~0ull)
+
+// A map tile packed into 64 bits, the zoom level above a morton code of the
+// tile x and y.
+//
+//    bits 58-62  zoom
+//    bits 0-57   x in the even bits, y in the odd bits
+//
+// The morton code of a tile is its quadkey read as a base 4 number, so keys
+// of one zoom level sort in z-order and a parent is a shift away. Bit 63 is
+// never set, CTextureRegistry name ids use it. Filenames and urls are only
+// built from a key where a tile is read, written or requested.
+struct TTileKey
+{
+   uint64_t Value;
+
+   static TTileKey Make(int Zoom, int X, int Y)
+   {
+      return { ((uint64_t)Zoom << TILE_KEY_ZOOM_SHIFT) | SpreadBits((uint32_t)X) | (SpreadBits((uint32_t)Y) << 1) };
+   }
+
+   int GetZoom() const { return (int)(Value >> TILE_KEY_ZOOM_SHIFT); }
+
+   int GetX() const { return (int)CompactBits(Value); }
+
+   int GetY() const { return (int)CompactBits(Value >> 1); }
+
+   bool IsValid() const { return GetZoom() <= TILE_KEY_MAX_ZOOM; }
+
+   // the tile one level up covering this one, zoom 0 has none
+   bool GetParent(TTileKey& Parent) const
+   {
+      int zoom = GetZoom();
+
+      if (zoom == 0)
+         return false;
+
+      Parent.Value = ((uint64_t)(zoom - 1) << TILE_KEY_ZOOM_SHIFT) | ((Value & GetMortonMask()) >> 2);
+      return true;
+   }
+
+   // one of the four tiles one level down, Index is the quadkey digit,
+   // bit 0 east and bit 1 south
+   bool GetChild(int Index, TTileKey& Child) const
+   {
+      int zoom = GetZoom();
+
+      if (zoom >= TILE_KEY_MAX_ZOOM)
+         return false;
+
+      Child.Value = ((uint64_t)(zoom + 1) << TILE_KEY_ZOOM_SHIFT) | ((Value & GetMortonMask()) << 2) | (uint64_t)(Index & 3);
+      return true;
+   }
+
+   // the tile Dx east and Dy south, wrapped around the antimeridian. There
+   // is no neighbor past the top or bottom of the map.
+   bool GetNeighbor(int Dx, int Dy, TTileKey& Neighbor) const
+   {
+      int     zoom = GetZoom();
+      int64_t tiles = 1ll << zoom;
+      int64_t x = ((GetX() + (int64_t)Dx) % tiles + tiles) % tiles;
+      int64_t y = GetY() + (int64_t)Dy;
+
+      if (y < 0 || y >= tiles)
+         return false;
+
+      Neighbor = Make(zoom, (int)x, (int)y);
+      return true;
+   }
+
+   bool operator==(const TTileKey& That) const { return Value == That.Value; }
+
+   bool operator!=(const TTileKey& That) const { return Value != That.Value; }
+
+   bool operator<(const TTileKey& That) const { return Value < That.Value; }
+
+   static uint64_t GetMortonMask() { return (1ull << TILE_KEY_ZOOM_SHIFT) - 1; }
+
+   // the bits of V moved to the even bit positions
+   static uint64_t SpreadBits(uint32_t V)
+   {
+      uint64_t bits = V;
+
+      bits = (bits | (bits << 16)) & 0x0000ffff0000ffffull;
+      bits = (bits | (bits << 8))  & 0x00ff00ff00ff00ffull;
+      bits = (bits | (bits << 4))  & 0x0f0f0f0f0f0f0f0full;
+      bits = (bits | (bits << 2))  & 0x3333333333333333ull;
+      bits = (bits | (bits << 1))  & 0x5555555555555555ull;
+
+      return bits;
+   }
+
+   // the even bits of V packed together, below the zoom bits
+   static uint32_t CompactBits(uint64_t V)
+   {
+      uint64_t bits = V & 0x0155555555555555ull;
+
+      bits = (bits | (bits >> 1))  & 0x3333333333333333ull;
+      bits = (bits | (bits >> 2))  & 0x0f0f0f0f0f0f0f0full;
+      bits = (bits | (bits >> 4))  & 0x00ff00ff00ff00ffull;
+      bits = (bits | (bits >> 8))  & 0x0000ffff0000ffffull;
+      bits = (bits | (bits >> 16)) & 0x00000000ffffffffull;
+
+      return (uint32_t)bits;
+   }
+};
+
+namespace std
+{
+   template<> struct hash<TTileKey>
+   {
+      // neighbors differ in the low bits only, the multiply spreads them
+      size_t operator()(const TTileKey& Key) const
+      {
+         return (size_t)(Key.Value * 0x9e3779b97f4a7c15ull);
+      }
+   };
+}
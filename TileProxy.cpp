@@ -0,0 +1,889 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include "TileProxy.h"
+#include "OpenStreetMap.h"
+#include "Trace.h"
+#include "ExecApi.h"
+
+// epoll ids that aren't connections, connections count up from FIRST_ID
+#define LISTEN_ID 0
+#define EVENT_ID  1
+#define FIRST_ID  2
+
+// a header's value, lowercase, empty if the request doesn't have it
+static std::string GetHeader(const std::string& Head, const char* Name)
+{
+   size_t length = strlen(Name);
+
+   for (size_t line = Head.find("\r\n"); line != std::string::npos; line = Head.find("\r\n", line + 2))
+   {
+      const char* text = Head.c_str() + line + 2;
+
+      if (strncasecmp(text, Name, length) != 0 || text[length] != ':')
+         continue;
+
+      size_t begin = Head.find_first_not_of(" \t", line + 2 + length + 1);
+      size_t end = Head.find("\r\n", line + 2);
+
+      if (begin == std::string::npos || (end != std::string::npos && begin >= end))
+         return std::string();
+
+      std::string value = Head.substr(begin, (end == std::string::npos) ? std::string::npos : end - begin);
+
+      while (!value.empty() && (value.back() == ' ' || value.back() == '\t'))
+         value.pop_back();
+
+      std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+
+      return value;
+   }
+
+   return std::string();
+}
+
+CTileProxy::CTileProxy()
+   : mConfig(DefaultConfig()),
+     mTileFormat(TileFormat::PNG),
+     mTileMatrices(MAX_ZOOM_LEVELS),
+     mListenSocket(-1),
+     mEpoll(-1),
+     mEvent(-1),
+     mPort(0),
+     mNextId(FIRST_ID),
+     mRequests(0),
+     mMemoryHits(0),
+     mDiskHits(0),
+     mUpstreamFetches(0),
+     mUpstreamErrors(0),
+     mCoalesced(0),
+     mBytesSent(0),
+     mOpenConnections(0),
+     mPeakConnections(0),
+     mMemoryTiles(0),
+     mMemoryBytes(0),
+     mTerminate(false)
+{
+}
+
+CTileProxy::~CTileProxy()
+{
+   Close();
+}
+
+void CTileProxy::Accept()
+{
+   while (true)
+   {
+      int socket = accept4(mListenSocket, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+      if (socket < 0)
+      {
+         if (errno == EINTR)
+            continue;
+
+         // out of descriptors, the backlog holds the rest until one closes
+         if (errno != EAGAIN && errno != EWOULDBLOCK)
+            ExecApiLogWarning("Tile proxy: accept failed, %s", strerror(errno));
+
+         return;
+      }
+
+      // responses are written whole, don't hold back the last segment
+      int                enable = 1;
+      struct epoll_event event = {};
+      uint64_t           id = mNextId++;
+
+      setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+      event.events = EPOLLIN;
+      event.data.u64 = id;
+
+      if (epoll_ctl(mEpoll, EPOLL_CTL_ADD, socket, &event) < 0)
+      {
+         close(socket);
+         continue;
+      }
+
+      TConnection& connection = mConnections[id];
+
+      connection.Socket     = socket;
+      connection.Sent       = 0;
+      connection.KeepAlive  = false;
+      connection.Waiting    = false;
+      connection.Writable   = false;
+      connection.ReadClosed = false;
+
+      uint64_t open = ++mOpenConnections;
+      uint64_t peak = mPeakConnections;
+
+      while (open > peak && !mPeakConnections.compare_exchange_weak(peak, open));
+   }
+}
+
+void CTileProxy::Close()
+{
+   {
+      std::lock_guard<std::mutex> lock(mQueueMutex);
+      mTerminate = true;
+   }
+
+   mQueueCondition.notify_all();
+
+   if (mLoopThread.joinable())
+   {
+      uint64_t wake = 1;
+
+      if (write(mEvent, &wake, sizeof(wake)) < 0)
+         ExecApiLogWarning("Tile proxy: unable to wake the event loop");
+
+      mLoopThread.join();
+   }
+
+   // a worker waiting on a slow server gives up the fetch
+   for (auto& wmts_if : mWmtsIf)
+      wmts_if.Abort();
+
+   for (auto& worker : mWorkers)
+      worker.join();
+
+   mWorkers.clear();
+
+   for (auto& connection : mConnections)
+      close(connection.second.Socket);
+
+   mConnections.clear();
+   mWaiting.clear();
+   mMemoryLru.clear();
+   mMemory.clear();
+   mQueue.clear();
+   mCompletions.clear();
+   mOpenConnections = 0;
+   mMemoryTiles = 0;
+   mMemoryBytes = 0;
+
+   if (mListenSocket >= 0) close(mListenSocket);
+   if (mEpoll >= 0)        close(mEpoll);
+   if (mEvent >= 0)        close(mEvent);
+
+   mListenSocket = -1;
+   mEpoll = -1;
+   mEvent = -1;
+
+   for (auto& wmts_if : mWmtsIf)
+      wmts_if.Close();
+
+   mDiskCache.Close();
+}
+
+void CTileProxy::CloseConnection(uint64_t Id)
+{
+   auto it = mConnections.find(Id);
+
+   if (it == mConnections.end())
+      return;
+
+   // a connection still waiting on a lookup is skipped when it completes
+   epoll_ctl(mEpoll, EPOLL_CTL_DEL, it->second.Socket, nullptr);
+   close(it->second.Socket);
+   mConnections.erase(it);
+   mOpenConnections--;
+}
+
+void CTileProxy::Complete(const TCompletion& Completion)
+{
+   auto it = mWaiting.find(Completion.Key);
+
+   if (it == mWaiting.end())
+      return;
+
+   std::vector<uint64_t> waiting = std::move(it->second);
+
+   mWaiting.erase(it);
+
+   if (Completion.Data)
+      PutMemory(Completion.Key, Completion.Data);
+
+   for (uint64_t id : waiting)
+   {
+      if (Completion.Data)
+         Respond(id, 200, GetTileFormatMimeType(mTileFormat), std::string(), Completion.Data);
+      else
+         Respond(id, 502, "text/plain", "Bad Gateway", nullptr);
+
+      Serve(id);
+   }
+}
+
+TTileProxyConfig CTileProxy::DefaultConfig()
+{
+   TTileProxyConfig config;
+
+   config.Port                = 0;
+   config.UpstreamConnections = 8;
+   config.MemoryBytes         = 64ull << 20;
+   config.CacheBudgetBytes    = 0;
+
+   return config;
+}
+
+void CTileProxy::GetCapabilitiesXml(std::string& Xml, const std::string& Host) const
+{
+   // the upstream's format under the proxy's own routes, so the tile urls a
+   // client builds from the template come back here
+   std::string url = "http://" + Host + "/styles/basic-preview/256/{TileMatrix}/{TileCol}/{TileRow}." +
+                     GetTileFormatExtension(mTileFormat);
+   std::string mime_type = GetTileFormatMimeType(mTileFormat);
+
+   Xml  = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n";
+   Xml += "<Capabilities xmlns=\"http://www.opengis.net/wmts/1.0\" xmlns:ows=\"http://www.opengis.net/ows/1.1\" version=\"1.0.0\">\n";
+   Xml += "  <Contents>\n";
+   Xml += "    <Layer>\n";
+   Xml += "      <ows:Title>basic-preview</ows:Title>\n";
+   Xml += "      <ows:Identifier>basic-preview</ows:Identifier>\n";
+   Xml += "      <Style isDefault=\"true\"><ows:Identifier>default</ows:Identifier></Style>\n";
+   Xml += "      <Format>" + mime_type + "</Format>\n";
+   Xml += "      <TileMatrixSetLink><TileMatrixSet>GoogleMapsCompatible</TileMatrixSet></TileMatrixSetLink>\n";
+   Xml += "      <ResourceURL format=\"" + mime_type + "\" resourceType=\"tile\" template=\"" + url + "\"/>\n";
+   Xml += "    </Layer>\n";
+   Xml += "    <TileMatrixSet>\n";
+   Xml += "      <ows:Identifier>GoogleMapsCompatible</ows:Identifier>\n";
+   Xml += "      <ows:SupportedCRS>urn:ogc:def:crs:EPSG::3857</ows:SupportedCRS>\n";
+
+   for (int zoom = 0; zoom < mTileMatrices; zoom++)
+   {
+      std::string n = std::to_string(1 << zoom);
+
+      Xml += "      <TileMatrix><ows:Identifier>" + std::to_string(zoom) + "</ows:Identifier>";
+      Xml += "<TileWidth>256</TileWidth><TileHeight>256</TileHeight>";
+      Xml += "<MatrixWidth>" + n + "</MatrixWidth><MatrixHeight>" + n + "</MatrixHeight></TileMatrix>\n";
+   }
+
+   Xml += "    </TileMatrixSet>\n";
+   Xml += "  </Contents>\n";
+   Xml += "</Capabilities>\n";
+}
+
+TTileProxyStats CTileProxy::GetStats() const
+{
+   TTileProxyStats stats;
+
+   stats.Requests        = mRequests;
+   stats.MemoryHits      = mMemoryHits;
+   stats.DiskHits        = mDiskHits;
+   stats.UpstreamFetches = mUpstreamFetches;
+   stats.UpstreamErrors  = mUpstreamErrors;
+   stats.Coalesced       = mCoalesced;
+   stats.BytesSent       = mBytesSent;
+   stats.Connections     = mOpenConnections;
+   stats.PeakConnections = mPeakConnections;
+   stats.MemoryTiles     = mMemoryTiles;
+   stats.MemoryBytes     = mMemoryBytes;
+
+   return stats;
+}
+
+std::string CTileProxy::GetUrl() const
+{
+   return "127.0.0.1:" + std::to_string(mPort);
+}
+
+bool CTileProxy::HandleRequest(uint64_t Id, TConnection& Connection)
+{
+   size_t end = Connection.Request.find("\r\n\r\n");
+
+   // the rest of the header is still on its way
+   if (end == std::string::npos)
+      return false;
+
+   std::string head = Connection.Request.substr(0, end + 2);
+   std::string connection_header = GetHeader(head, "Connection");
+   char        method[16];
+   char        path[1024];
+   char        version[16];
+   int         zoom;
+   int         x;
+   int         y;
+
+   Connection.Request.erase(0, end + 4);
+   Connection.Waiting = true;
+   mRequests++;
+
+   if (sscanf(head.c_str(), "%15s %1023s %15s", method, path, version) != 3)
+   {
+      Connection.KeepAlive = false;
+      Respond(Id, 400, "text/plain", "Bad Request", nullptr);
+      return true;
+   }
+
+   // http/1.1 keeps the connection unless told otherwise, http/1.0 the other way around.
+   // The last request of a client that shut down its side ends it.
+   Connection.KeepAlive = (strcmp(version, "HTTP/1.1") == 0) ? (connection_header != "close")
+                                                              : (connection_header == "keep-alive");
+
+   if (Connection.ReadClosed && Connection.Request.find("\r\n\r\n") == std::string::npos)
+      Connection.KeepAlive = false;
+
+   if (strcmp(method, "GET") != 0)
+   {
+      Respond(Id, 405, "text/plain", "Method Not Allowed", nullptr);
+   }
+   else if (strcmp(path, "/styles/basic-preview/wmts.xml") == 0)
+   {
+      std::string host = GetHeader(head, "Host");
+      std::string xml;
+
+      GetCapabilitiesXml(xml, host.empty() ? GetUrl() : host);
+      Respond(Id, 200, "application/xml", xml, nullptr);
+   }
+   else if (sscanf(path, "/styles/basic-preview/256/%d/%d/%d.", &zoom, &x, &y) == 3)
+   {
+      if (zoom < 0 || zoom >= mTileMatrices || zoom > TILE_KEY_MAX_ZOOM || x < 0 || y < 0 || x >= (1 << zoom) || y >= (1 << zoom))
+      {
+         Respond(Id, 404, "text/plain", "Not Found", nullptr);
+         return true;
+      }
+
+      TTileKey key = TTileKey::Make(zoom, x, y);
+      auto     memory = mMemory.find(key);
+
+      if (memory != mMemory.end())
+      {
+         mMemoryHits++;
+         mMemoryLru.splice(mMemoryLru.begin(), mMemoryLru, memory->second);
+         Respond(Id, 200, GetTileFormatMimeType(mTileFormat), std::string(), memory->second->second);
+         return true;
+      }
+
+      // one lookup per tile, every request for it while it runs waits on it
+      auto waiting = mWaiting.find(key);
+
+      if (waiting != mWaiting.end())
+      {
+         mCoalesced++;
+         waiting->second.push_back(Id);
+         return true;
+      }
+
+      mWaiting[key].push_back(Id);
+
+      {
+         std::lock_guard<std::mutex> lock(mQueueMutex);
+         mQueue.push_back(key);
+      }
+
+      mQueueCondition.notify_one();
+   }
+   else
+   {
+      Respond(Id, 404, "text/plain", "Not Found", nullptr);
+   }
+
+   return true;
+}
+
+void CTileProxy::LoopThread()
+{
+   struct epoll_event events[TILE_PROXY_MAX_EVENTS];
+
+   CTrace::SetThreadName("Proxy");
+
+   while (!mTerminate)
+   {
+      int count = epoll_wait(mEpoll, events, TILE_PROXY_MAX_EVENTS, -1);
+
+      if (count < 0)
+      {
+         if (errno == EINTR)
+            continue;
+
+         ExecApiLogWarning("Tile proxy: epoll_wait failed, %s", strerror(errno));
+         break;
+      }
+
+      for (int i = 0; i < count && !mTerminate; i++)
+      {
+         uint64_t id = events[i].data.u64;
+
+         if (id == LISTEN_ID)
+         {
+            Accept();
+         }
+         else if (id == EVENT_ID)
+         {
+            std::vector<TCompletion> completions;
+            uint64_t                 value;
+
+            if (read(mEvent, &value, sizeof(value)) < 0 && errno != EAGAIN)
+               ExecApiLogWarning("Tile proxy: eventfd read failed, %s", strerror(errno));
+
+            {
+               std::lock_guard<std::mutex> lock(mQueueMutex);
+               completions.swap(mCompletions);
+            }
+
+            for (const auto& completion : completions)
+               Complete(completion);
+         }
+         else if (events[i].events & (EPOLLERR | EPOLLHUP))
+         {
+            CloseConnection(id);
+         }
+         else
+         {
+            if (events[i].events & EPOLLIN)
+               Read(id);
+
+            if (events[i].events & EPOLLOUT)
+               Serve(id);
+         }
+      }
+   }
+}
+
+bool CTileProxy::Open(const TTileProxyConfig& Config)
+{
+   struct sockaddr_in address;
+   socklen_t          address_size = sizeof(address);
+   struct epoll_event event = {};
+   int                enable = 1;
+   int                connections = std::max(1, std::min(Config.UpstreamConnections, TILE_PROXY_MAX_UPSTREAM));
+   std::error_code    err;
+
+   if (IsOpen())
+      return false;
+
+   mConfig = Config;
+   mTerminate = false;
+
+   if (mConfig.CachePath.empty() || mConfig.UpstreamUrl.empty())
+   {
+      ExecApiLogWarning("Tile proxy: needs an upstream url and a cache path");
+      return false;
+   }
+
+   if (mConfig.CachePath.back() != '/')
+      mConfig.CachePath += '/';
+
+   std::filesystem::create_directories(mConfig.CachePath, err);
+
+   // curl is initialized here, not on the workers
+   for (int i = 0; i < connections; i++)
+   {
+      if (!mWmtsIf[i].Open(mConfig.UpstreamUrl.c_str(), 10))
+      {
+         ExecApiLogWarning("Tile proxy: unable to open the tile server %s", mConfig.UpstreamUrl.c_str());
+         return false;
+      }
+   }
+
+   // the upstream's capabilities pick the format, saved where the map and the
+   // next start look for them, or the last saved ones if it's offline
+   unsigned char* buffer;
+   int            size;
+
+   if (mWmtsIf[0].GetWmtsCapabilitiesXml(&buffer, size) && mWmtsIf[0].LoadCapabilities(buffer, size))
+   {
+      std::ofstream capabilities_file(mConfig.CachePath + WMTS_CAPABILITIES_FILENAME,
+                                      std::ios::out | std::ios::binary | std::ios::trunc);
+
+      capabilities_file.write((const char*)buffer, size);
+   }
+   else if (!mWmtsIf[0].LoadCapabilitiesFile(mConfig.CachePath + WMTS_CAPABILITIES_FILENAME))
+   {
+      ExecApiLogWarning("Tile proxy: no capabilities from %s, serving png", mConfig.UpstreamUrl.c_str());
+   }
+
+   for (int i = 1; i < connections; i++)
+      mWmtsIf[i].SetTileSource(mWmtsIf[0].GetTileSource());
+
+   mTileFormat = mWmtsIf[0].GetTileSource().Format;
+   mTileMatrices = mWmtsIf[0].GetTileSource().TileMatrices.empty() ? MAX_ZOOM_LEVELS
+                 : (int)mWmtsIf[0].GetTileSource().TileMatrices.size();
+
+   mDiskCache.SetBudget(mConfig.CacheBudgetBytes);
+   mDiskCache.Open(mConfig.CachePath.c_str());
+
+   // clients on other hosts are the point, listen on every interface
+   mListenSocket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+   mEpoll = epoll_create1(EPOLL_CLOEXEC);
+   mEvent = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+   if (mListenSocket < 0 || mEpoll < 0 || mEvent < 0)
+   {
+      ExecApiLogWarning("Tile proxy: failed to create the sockets, %s", strerror(errno));
+      Close();
+      return false;
+   }
+
+   setsockopt(mListenSocket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+   memset(&address, 0, sizeof(address));
+   address.sin_family      = AF_INET;
+   address.sin_addr.s_addr = htonl(INADDR_ANY);
+   address.sin_port        = htons(mConfig.Port);
+
+   if (bind(mListenSocket, (struct sockaddr*)&address, sizeof(address)) < 0 ||
+       listen(mListenSocket, SOMAXCONN) < 0)
+   {
+      ExecApiLogWarning("Tile proxy: failed to listen on port %d", mConfig.Port);
+      Close();
+      return false;
+   }
+
+   getsockname(mListenSocket, (struct sockaddr*)&address, &address_size);
+   mPort = ntohs(address.sin_port);
+
+   event.events = EPOLLIN;
+   event.data.u64 = LISTEN_ID;
+   epoll_ctl(mEpoll, EPOLL_CTL_ADD, mListenSocket, &event);
+
+   event.data.u64 = EVENT_ID;
+   epoll_ctl(mEpoll, EPOLL_CTL_ADD, mEvent, &event);
+
+   for (int i = 0; i < connections; i++)
+      mWorkers.emplace_back(&CTileProxy::WorkerThread, this, i);
+
+   mLoopThread = std::thread(&CTileProxy::LoopThread, this);
+
+   return true;
+}
+
+void CTileProxy::PutMemory(TTileKey Key, const TTileData& Data)
+{
+   if (Data->size() > mConfig.MemoryBytes || mMemory.count(Key))
+      return;
+
+   mMemoryLru.emplace_front(Key, Data);
+   mMemory[Key] = mMemoryLru.begin();
+   mMemoryBytes += Data->size();
+
+   // the connections still sending an evicted tile hold their own reference
+   while (mMemoryBytes > mConfig.MemoryBytes)
+   {
+      mMemoryBytes -= mMemoryLru.back().second->size();
+      mMemory.erase(mMemoryLru.back().first);
+      mMemoryLru.pop_back();
+   }
+
+   mMemoryTiles = mMemory.size();
+}
+
+void CTileProxy::Read(uint64_t Id)
+{
+   auto it = mConnections.find(Id);
+
+   if (it == mConnections.end())
+      return;
+
+   TConnection& connection = it->second;
+   char         buffer[4096];
+
+   while (true)
+   {
+      ssize_t size = recv(connection.Socket, buffer, sizeof(buffer), 0);
+
+      if (size > 0)
+      {
+         connection.Request.append(buffer, size);
+      }
+      else if (size < 0 && errno == EINTR)
+      {
+         continue;
+      }
+      else if (size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      {
+         break;
+      }
+      else if (size == 0)
+      {
+         // the client is done sending, what it sent is answered first
+         connection.ReadClosed = true;
+         UpdateEvents(Id, connection);
+         break;
+      }
+      else
+      {
+         // a lookup it was waiting on goes on for the others
+         CloseConnection(Id);
+         return;
+      }
+   }
+
+   // only the request still coming in is held to the header limit, the
+   // ones complete behind a lookup to the pipeline's
+   size_t last_end = connection.Request.rfind("\r\n\r\n");
+   size_t unparsed = connection.Request.size() - ((last_end == std::string::npos) ? 0 : last_end + 4);
+
+   if (unparsed > TILE_PROXY_MAX_REQUEST_SIZE || connection.Request.size() > TILE_PROXY_MAX_PIPELINED)
+   {
+      ExecApiLogWarning("Tile proxy: request header too long, closing the connection");
+      CloseConnection(Id);
+      return;
+   }
+
+   Serve(Id);
+}
+
+void CTileProxy::Respond(uint64_t Id, int Status, const char* ContentType, const std::string& Body, const TTileData& Data)
+{
+   auto it = mConnections.find(Id);
+
+   if (it == mConnections.end())
+      return;
+
+   TConnection& connection = it->second;
+   size_t       size = Data ? Data->size() : Body.size();
+   char         header[256];
+
+   snprintf(header, sizeof(header),
+            "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: %s\r\n\r\n",
+            Status, (Status == 200) ? "OK" : "Error", ContentType, size,
+            connection.KeepAlive ? "keep-alive" : "close");
+
+   connection.Head = header;
+   connection.Body = Data;
+   connection.Sent = 0;
+
+   if (!Data)
+      connection.Head += Body;
+}
+
+void CTileProxy::Serve(uint64_t Id)
+{
+   while (true)
+   {
+      auto it = mConnections.find(Id);
+
+      if (it == mConnections.end())
+         return;
+
+      TConnection& connection = it->second;
+
+      // requests pipelined behind one in progress wait their turn
+      if (!connection.Waiting && !HandleRequest(Id, connection))
+         break;
+
+      // a lookup answers it later, or the socket has to drain first
+      if (connection.Head.empty() || !Write(Id))
+         return;
+   }
+
+   // a client that shut down without a whole request left gets nothing more
+   auto it = mConnections.find(Id);
+
+   if (it->second.ReadClosed)
+      CloseConnection(Id);
+}
+
+void CTileProxy::UpdateEvents(uint64_t Id, TConnection& Connection)
+{
+   struct epoll_event event = {};
+
+   event.events = (Connection.ReadClosed ? 0u : (uint32_t)EPOLLIN) | (Connection.Writable ? (uint32_t)EPOLLOUT : 0u);
+   event.data.u64 = Id;
+   epoll_ctl(mEpoll, EPOLL_CTL_MOD, Connection.Socket, &event);
+}
+
+void CTileProxy::WorkerThread(int Connection)
+{
+   CTrace::SetThreadName("Proxy Fetch");
+
+   while (true)
+   {
+      TTileKey key;
+
+      {
+         std::unique_lock<std::mutex> lock(mQueueMutex);
+         mQueueCondition.wait(lock, [this]() { return mTerminate || !mQueue.empty(); });
+
+         if (mTerminate)
+            return;
+
+         key = mQueue.front();
+         mQueue.pop_front();
+      }
+
+      std::string     tile_filename = COpenStreetMap::ConstructFilename(mConfig.CachePath, key, mTileFormat);
+      TCompletion     completion;
+      std::error_code err;
+
+      completion.Key = key;
+
+      if (std::filesystem::exists(tile_filename, err))
+      {
+         TRACE_SCOPE("DiskRead", "disk");
+         std::ifstream tile_file(tile_filename, std::ios::in | std::ios::binary);
+         auto          data = std::make_shared<std::vector<unsigned char>>(
+                                 (std::istreambuf_iterator<char>(tile_file)), std::istreambuf_iterator<char>());
+
+         if (!data->empty())
+         {
+            mDiskHits++;
+            mDiskCache.Touch(key);
+            completion.Data = data;
+         }
+      }
+
+      // nothing on disk, or the file went away under us
+      if (!completion.Data)
+      {
+         unsigned char* buffer;
+         int            size;
+
+         mUpstreamFetches++;
+
+         if (mWmtsIf[Connection].GetMapTileBuffer(key.GetZoom(), key.GetX(), key.GetY(), &buffer, size))
+         {
+            completion.Data = std::make_shared<std::vector<unsigned char>>(buffer, buffer + size);
+            WriteTile(key, buffer, size);
+         }
+         else
+         {
+            mUpstreamErrors++;
+         }
+      }
+
+      uint64_t wake = 1;
+
+      {
+         std::lock_guard<std::mutex> lock(mQueueMutex);
+         mCompletions.push_back(completion);
+      }
+
+      if (write(mEvent, &wake, sizeof(wake)) < 0)
+         ExecApiLogWarning("Tile proxy: unable to wake the event loop");
+   }
+}
+
+bool CTileProxy::Write(uint64_t Id)
+{
+   auto it = mConnections.find(Id);
+
+   if (it == mConnections.end())
+      return false;
+
+   TConnection& connection = it->second;
+   size_t       body_size = connection.Body ? connection.Body->size() : 0;
+   size_t       total = connection.Head.size() + body_size;
+
+   while (connection.Sent < total)
+   {
+      struct iovec  vectors[2];
+      struct msghdr message = {};
+      int           count = 0;
+      size_t        head_sent = std::min(connection.Sent, connection.Head.size());
+      size_t        body_sent = connection.Sent - head_sent;
+
+      if (head_sent < connection.Head.size())
+      {
+         vectors[count].iov_base = (void*)(connection.Head.data() + head_sent);
+         vectors[count].iov_len  = connection.Head.size() - head_sent;
+         count++;
+      }
+
+      if (body_sent < body_size)
+      {
+         vectors[count].iov_base = (void*)(connection.Body->data() + body_sent);
+         vectors[count].iov_len  = body_size - body_sent;
+         count++;
+      }
+
+      message.msg_iov = vectors;
+      message.msg_iovlen = count;
+
+      ssize_t result = sendmsg(connection.Socket, &message, MSG_NOSIGNAL);
+
+      if (result < 0 && errno == EINTR)
+         continue;
+
+      if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      {
+         // the rest goes when the socket drains
+         if (!connection.Writable)
+         {
+            connection.Writable = true;
+            UpdateEvents(Id, connection);
+         }
+
+         return false;
+      }
+
+      if (result <= 0)
+      {
+         CloseConnection(Id);
+         return false;
+      }
+
+      connection.Sent += result;
+      mBytesSent += result;
+   }
+
+   if (connection.Writable)
+   {
+      connection.Writable = false;
+      UpdateEvents(Id, connection);
+   }
+
+   // a client that shut down its side is closed once its last request is
+   // answered
+   if (!connection.KeepAlive ||
+       (connection.ReadClosed && connection.Request.find("\r\n\r\n") == std::string::npos))
+   {
+      CloseConnection(Id);
+      return false;
+   }
+
+   connection.Head.clear();
+   connection.Body.reset();
+   connection.Sent = 0;
+   connection.Waiting = false;
+
+   return true;
+}
+
+bool CTileProxy::WriteTile(TTileKey Key, const unsigned char* Buffer, int Size)
+{
+   TRACE_SCOPE("DiskWrite", "disk");
+
+   // a map reading the same cache never sees a half written tile
+   std::string     tile_filename = COpenStreetMap::ConstructFilename(mConfig.CachePath, Key, mTileFormat);
+   std::string     part_filename = tile_filename + ".part";
+   std::error_code err;
+
+   {
+      std::ofstream tile_file(part_filename, std::ios::out | std::ios::binary | std::ios::trunc);
+
+      tile_file.write((const char*)Buffer, Size);
+
+      if (!tile_file.good())
+      {
+         ExecApiLogWarning("Tile proxy: unable to write %s", part_filename.c_str());
+         return false;
+      }
+   }
+
+   std::filesystem::rename(part_filename, tile_filename, err);
+
+   if (err)
+   {
+      ExecApiLogWarning("Tile proxy: unable to rename %s, %s", part_filename.c_str(), err.message().c_str());
+      std::filesystem::remove(part_filename, err);
+      return false;
+   }
+
+   mDiskCache.Add(Key, Size, mTileFormat);
+
+   return true;
+}
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "DiskCache.h"
+#include "TileKey.h"
+#include "WmtsIf.h"
+
+#define TILE_PROXY_MAX_UPSTREAM     32     // upstream connections, one fetch each
+#define TILE_PROXY_MAX_REQUEST_SIZE 8192   // request header, nothing we serve has a body
+#define TILE_PROXY_MAX_PIPELINED    (64 * TILE_PROXY_MAX_REQUEST_SIZE) // requests queued behind a lookup
+#define TILE_PROXY_MAX_EVENTS       256    // epoll events handled per wakeup
+
+struct TTileProxyConfig
+{
+   int         Port;                 // 0 picks a free port
+   std::string UpstreamUrl;          // host:port the way COpenStreetMap::Open takes it
+   std::string CachePath;            // the map's disk cache layout, ends in '/'
+   int         UpstreamConnections;  // fetches in flight at once
+   uint64_t    MemoryBytes;          // recently served tiles kept in memory
+   uint64_t    CacheBudgetBytes;     // disk cache, 0 is unlimited
+};
+
+struct TTileProxyStats
+{
+   uint64_t Requests;
+   uint64_t MemoryHits;
+   uint64_t DiskHits;
+   uint64_t UpstreamFetches;
+   uint64_t UpstreamErrors;
+   uint64_t Coalesced;         // requests that waited on another request's lookup
+   uint64_t BytesSent;
+   uint64_t Connections;       // open now
+   uint64_t PeakConnections;
+   uint64_t MemoryTiles;
+   uint64_t MemoryBytes;
+};
+
+// Caching proxy for the WMTS tile server. It answers the same
+// /styles/basic-preview/... routes CWmtsIf requests, so a map pointed at the
+// proxy instead of the server works unchanged, and serves the tiles from
+// memory, then the disk cache, then the upstream server, filling the caches
+// on the way back.
+//
+// One thread runs an epoll loop over non-blocking sockets and never touches
+// the disk or the network upstream. Lookups that miss memory go to a pool of
+// workers, one CWmtsIf each, and concurrent requests for the same tile wait
+// on the one lookup in flight. Workers hand finished tiles back through an
+// eventfd. Connections are kept alive unless the client asks otherwise.
+class CTileProxy
+{
+public:
+   CTileProxy();
+   ~CTileProxy();
+
+   void Close();
+
+   static TTileProxyConfig DefaultConfig();
+
+   int GetPort() const { return mPort; }
+
+   TTileProxyStats GetStats() const;
+
+   // host:port the way COpenStreetMap::Open expects the WMTS url
+   std::string GetUrl() const;
+
+   bool IsOpen() const { return mLoopThread.joinable(); }
+
+   bool Open(const TTileProxyConfig& Config);
+
+private:
+
+   using TTileData = std::shared_ptr<const std::vector<unsigned char>>;
+   using TMemoryLru = std::list<std::pair<TTileKey, TTileData>>;
+
+   struct TConnection
+   {
+      int         Socket;
+      std::string Request;    // bytes read and not handled yet
+      std::string Head;       // status line and headers, and the body of an error
+      TTileData   Body;
+      size_t      Sent;       // of Head, then Body
+      bool        KeepAlive;
+      bool        Waiting;    // on a lookup, or writing a response
+      bool        Writable;   // EPOLLOUT is armed
+      bool        ReadClosed; // the client shut down its side, the requests in are still answered
+   };
+
+   // a worker's lookup, Data is empty if the tile couldn't be had
+   struct TCompletion
+   {
+      TTileKey  Key;
+      TTileData Data;
+   };
+
+   void Accept();
+
+   void CloseConnection(uint64_t Id);
+
+   void Complete(const TCompletion& Completion);
+
+   void GetCapabilitiesXml(std::string& Xml, const std::string& Host) const;
+
+   // takes the first request off the buffer and answers it or starts its
+   // lookup, false if no whole request is in yet
+   bool HandleRequest(uint64_t Id, TConnection& Connection);
+
+   void LoopThread();
+
+   void PutMemory(TTileKey Key, const TTileData& Data);
+
+   void Read(uint64_t Id);
+
+   // sets up the response, Serve or Complete sends it
+   void Respond(uint64_t Id, int Status, const char* ContentType, const std::string& Body, const TTileData& Data);
+
+   // answers the buffered requests one after the other until one waits on a
+   // lookup or the socket. A loop, so a long pipeline of requests answered
+   // at once doesn't grow the stack.
+   void Serve(uint64_t Id);
+
+   // EPOLLIN until the client shuts down its side, EPOLLOUT while a
+   // response waits for the socket to drain
+   void UpdateEvents(uint64_t Id, TConnection& Connection);
+
+   void WorkerThread(int Connection);
+
+   // true once the response is written and the connection is ready for the
+   // next request, false if it waits for the socket or was closed
+   bool Write(uint64_t Id);
+
+   bool WriteTile(TTileKey Key, const unsigned char* Buffer, int Size);
+
+   TTileProxyConfig         mConfig;
+   CWmtsIf                  mWmtsIf[TILE_PROXY_MAX_UPSTREAM];
+   CDiskCache               mDiskCache;
+   TileFormat               mTileFormat;   // from the upstream capabilities
+   int                      mTileMatrices; // zoom levels the capabilities list
+   std::thread              mLoopThread;
+   std::vector<std::thread> mWorkers;
+   int                      mListenSocket;
+   int                      mEpoll;
+   int                      mEvent;        // eventfd, completions and Close
+   int                      mPort;
+
+   // loop thread only
+   std::unordered_map<uint64_t, TConnection>           mConnections;
+   std::unordered_map<TTileKey, std::vector<uint64_t>> mWaiting;  // connections waiting on a lookup
+   TMemoryLru                                          mMemoryLru;
+   std::unordered_map<TTileKey, TMemoryLru::iterator>  mMemory;
+   uint64_t                                            mNextId;
+
+   // workers and the loop
+   std::mutex                mQueueMutex;
+   std::condition_variable   mQueueCondition;
+   std::deque<TTileKey>      mQueue;
+   std::vector<TCompletion>  mCompletions;
+
+   std::atomic<uint64_t>     mRequests;
+   std::atomic<uint64_t>     mMemoryHits;
+   std::atomic<uint64_t>     mDiskHits;
+   std::atomic<uint64_t>     mUpstreamFetches;
+   std::atomic<uint64_t>     mUpstreamErrors;
+   std::atomic<uint64_t>     mCoalesced;
+   std::atomic<uint64_t>     mBytesSent;
+   std::atomic<uint64_t>     mOpenConnections;
+   std::atomic<uint64_t>     mPeakConnections;
+   std::atomic<uint64_t>     mMemoryTiles;
+   std::atomic<uint64_t>     mMemoryBytes;
+   std::atomic<bool>         mTerminate;
+};
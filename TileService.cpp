@@ -0,0 +1,725 @@
+
+#include <limits.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <vector>
+#include "TileService.h"
+#include "OpenStreetMap.h"
+#include "ExecApi.h"
+#include "Trace.h"
+
+// every open service, a map acquiring the same server and cache path as a
+// live one shares it
+static std::mutex                               service_mutex;
+static std::vector<std::weak_ptr<CTileService>> services;
+static uint64_t                                 shared_pool_budget = 0;
+
+// '/' appended if not already there, empty without a path
+static std::string GetCachePathName(const char* CachePath)
+{
+   std::string path = CachePath ? CachePath : "";
+
+   if (!path.empty() && path[path.length() - 1] != '/')
+      path += '/';
+
+   return path;
+}
+
+// the same for every process with the same server and cache path, however
+// the path was spelled
+static std::string GetSharedPoolName(const std::string& WmtsUrl, const std::string& CachePath)
+{
+   std::error_code err;
+   std::string     id = WmtsUrl + "\n" + std::filesystem::absolute(CachePath, err).lexically_normal().string();
+   uint64_t        hash = 0xcbf29ce484222325ull;
+   char            name[32];
+
+   // fnv-1a, std::hash isn't the same across builds
+   for (unsigned char c : id)
+      hash = (hash ^ c) * 0x100000001b3ull;
+
+   snprintf(name, sizeof(name), "/osm_tiles_%016llx", (unsigned long long)hash);
+
+   return name;
+}
+
+CTileService::CTileService()
+   : mOpenTime(),
+     mRetryTime(),
+     mSharedFetches(0),
+     mDiscoveryMs(0),
+     mTileFormat(TileFormat::PNG),
+     mServerState(ServerState::NONE),
+     mDiscovered(false),
+     mTerminateDiscovery(false),
+     mNextCallbackId(1),
+     mPreloadNext(0),
+     mPreloadWorkers(0),
+     mTerminatePreload(false)
+{
+}
+
+CTileService::~CTileService()
+{
+   {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mTerminateDiscovery = true;
+   }
+
+   // a probe waiting on the server ends early
+   mWmtsIf.Abort();
+   mDiscoveryWake.notify_all();
+
+   if (mDiscoveryThread.joinable())
+      mDiscoveryThread.join();
+
+   {
+      std::lock_guard<std::mutex> lock(mPreloadMutex);
+      mTerminatePreload = true;
+   }
+
+   for (auto& thread : mPreloadThreads)
+      thread.join();
+
+   mWmtsIf.Close();
+   mDiskCache.Close();
+   mSharedPool.Close();
+}
+
+std::shared_ptr<CTileService> CTileService::Acquire(const char* WmtsUrl, const char* CachePath)
+{
+   std::string                   url = WmtsUrl ? WmtsUrl : "";
+   std::string                   path = GetCachePathName(CachePath);
+   std::shared_ptr<CTileService> service;
+
+   std::lock_guard<std::mutex> lock(service_mutex);
+
+   // drop the services nobody holds any more while looking
+   for (auto it = services.begin(); it != services.end();)
+   {
+      std::shared_ptr<CTileService> live = it->lock();
+
+      if (!live)
+      {
+         it = services.erase(it);
+         continue;
+      }
+
+      if (live->mWmtsUrl == url && live->mCachePath == path)
+         service = live;
+
+      it++;
+   }
+
+   if (service)
+      return service;
+
+   service = std::shared_ptr<CTileService>(new CTileService());
+   service->Open(url.empty() ? nullptr : url.c_str(), path.empty() ? nullptr : path.c_str());
+   services.push_back(service);
+
+   return service;
+}
+
+int CTileService::AddStateCallback(TStateCallback Callback)
+{
+   std::lock_guard<std::mutex> callback_lock(mCallbackMutex);
+   int                         id = mNextCallbackId++;
+
+   // under the callback mutex a change can't slip in between the current
+   // state and the registration
+   Callback(GetServerState());
+   mCallbacks.emplace_back(id, std::move(Callback));
+
+   return id;
+}
+
+std::shared_ptr<CTexture> CTileService::AcquireTexture(TTileKey Key)
+{
+   std::shared_ptr<CTexture> texture = mTextures.Find(Key.Value);
+
+   if (texture)
+      return texture;
+
+   {
+      std::unique_lock<std::mutex> lock(mPreloadMutex);
+      auto                         it = mPreloaded.find(Key);
+
+      if (it != mPreloaded.end())
+      {
+         if (!it->second.Decoded)
+            return nullptr;
+
+         TTextureImage image = std::move(it->second.Image);
+
+         mPreloaded.erase(it);
+         lock.unlock();
+
+         // only the upload is left, a tile that failed to decode is read
+         // again below and reports its own failure
+         if (!image.Pixels.empty())
+         {
+            texture = std::make_shared<CTexture>(COpenStreetMap::ConstructFilename(mCachePath, Key, mTileFormat).c_str(), image, true);
+            mTextures.Insert(Key.Value, texture);
+
+            if (texture->GetTexture())
+               return texture;
+         }
+      }
+   }
+
+   // decoded here or by another process, the pool is left to the file load
+   // when it has no room
+   if (mSharedPool.IsOpen())
+   {
+      TTextureImage image = {};
+
+      if (!LoadTileImage(Key, image))
+         return nullptr;
+
+      if (!image.Pixels.empty())
+      {
+         texture = std::make_shared<CTexture>(COpenStreetMap::ConstructFilename(mCachePath, Key, mTileFormat).c_str(), image, true);
+         mTextures.Insert(Key.Value, texture);
+
+         if (texture->GetTexture())
+            return texture;
+      }
+   }
+
+   // the filename is only built for a texture that has to be read
+   texture = mTextures.GetOrCreate(Key.Value, COpenStreetMap::ConstructFilename(mCachePath, Key, mTileFormat).c_str(), true);
+
+   // the file is gone or bad, e.g. evicted by the disk cache, without the
+   // record the next coverage pass fetches it again
+   if (!texture)
+   {
+      std::lock_guard<std::mutex> lock(mMutex);
+      RemoveRecord(Key);
+   }
+
+   return texture;
+}
+
+void CTileService::Clear()
+{
+   std::lock_guard<std::mutex> lock(mMutex);
+
+   mRecords.clear();
+   mRecordLru.clear();
+}
+
+void CTileService::CollectTextures()
+{
+   mTextures.Trim(TILE_SERVICE_TEXTURES);
+   CTextureRegistry::CollectReleased();
+
+   // preloaded tiles of a view that was never shown
+   std::lock_guard<std::mutex> lock(mPreloadMutex);
+   TClock::time_point          expired = TClock::now() - std::chrono::milliseconds(TILE_SERVICE_PRELOAD_KEEP_MS);
+
+   for (auto it = mPreloaded.begin(); it != mPreloaded.end();)
+   {
+      if (it->second.Decoded && it->second.Done < expired)
+         it = mPreloaded.erase(it);
+      else
+         it++;
+   }
+}
+
+void CTileService::EnableSharedPool(uint64_t BudgetBytes)
+{
+   std::lock_guard<std::mutex> lock(service_mutex);
+
+   shared_pool_budget = BudgetBytes;
+}
+
+void CTileService::DeleteTextures()
+{
+   std::lock_guard<std::mutex> lock(service_mutex);
+
+   for (auto& weak_service : services)
+   {
+      std::shared_ptr<CTileService> service = weak_service.lock();
+
+      if (!service)
+         continue;
+
+      service->mTextures.DeleteTextures();
+   }
+}
+
+void CTileService::DiscoveryThread()
+{
+   std::string    capabilities_filename;
+   unsigned char* buffer;
+   int            size;
+   int            wait_ms = TILE_SERVICE_RETRY_MS;
+
+   CTrace::SetThreadName("Discovery");
+
+   if (!mCachePath.empty())
+      capabilities_filename = mCachePath + WMTS_CAPABILITIES_FILENAME;
+
+   while (true)
+   {
+      bool got_capabilities = false;
+
+      {
+         TRACE_SCOPE("Discovery", "network");
+         std::lock_guard<std::mutex> fetch_lock(mFetchMutex);
+
+         // Get the wmts capabilities
+         got_capabilities = mWmtsIf.GetWmtsCapabilitiesXml(&buffer, size) && size;
+
+         if (got_capabilities)
+         {
+            // write the wms capabilities to the file
+            if (!capabilities_filename.empty())
+            {
+               std::ofstream wmts_capabilities_file(
+                     capabilities_filename,
+                     std::ios::out | std::ios::binary | std::ios::trunc);
+
+               wmts_capabilities_file.write((char*)buffer, size);
+            }
+
+            mWmtsIf.LoadCapabilities(buffer, size);
+            mTileFormat = mWmtsIf.GetTileSource().Format;
+         }
+      }
+
+      std::unique_lock<std::mutex> lock(mMutex);
+
+      if (mTerminateDiscovery)
+         return;
+
+      if (got_capabilities)
+      {
+         mDiscovered = true;
+         mDiscoveryMs = std::chrono::duration<double, std::milli>(TClock::now() - mOpenTime).count();
+         lock.unlock();
+
+         SetServerState(ServerState::ONLINE);
+         return;
+      }
+
+      if (mServerState != ServerState::OFFLINE)
+      {
+         ExecApiLogWarning("TileService: Failed to connect with WMTS server");
+         lock.unlock();
+         SetServerState(ServerState::OFFLINE);
+         lock.lock();
+      }
+
+      // a server that is down for long is asked less often
+      mDiscoveryWake.wait_for(lock, std::chrono::milliseconds(wait_ms), [&] { return mTerminateDiscovery; });
+
+      if (mTerminateDiscovery)
+         return;
+
+      wait_ms = std::min(wait_ms * 2, TILE_SERVICE_PROBE_MAX_MS);
+   }
+}
+
+ServerState CTileService::GetServerState()
+{
+   std::lock_guard<std::mutex> lock(mMutex);
+
+   return mServerState;
+}
+
+TTileServiceStats CTileService::GetStats()
+{
+   TTileServiceStats     stats = {};
+   TTextureRegistryStats textures = mTextures.GetStats();
+
+   // the registry only holds weak references
+   stats.Views = weak_from_this().use_count();
+   stats.Textures = textures.Textures;
+   stats.ReferencedTextures = textures.ReferencedTextures;
+   stats.EvictedTextures = textures.EvictedTextures;
+   stats.PendingDeletes = textures.PendingDeletes;
+
+   mPreloadMutex.lock();
+   stats.PreloadQueue = mPreloadQueue.size() - std::min(mPreloadNext, mPreloadQueue.size());
+   mPreloadMutex.unlock();
+
+   std::lock_guard<std::mutex> lock(mMutex);
+
+   stats.Records = mRecords.size();
+   stats.PendingLookups = mPending.size();
+   stats.SharedFetches = mSharedFetches;
+   stats.State = mServerState;
+   stats.DiscoveryMs = mDiscoveryMs;
+
+   return stats;
+}
+
+TileStatus CTileService::GetTile(TTileKey Key, bool CacheOnly, CMapStats& Stats)
+{
+   char        tile_filename[PATH_MAX];
+   struct stat tile_stat;
+   bool        got_file = false;
+   bool        fetched = false;
+   bool        discovering;
+   bool        online;
+
+   std::unique_lock<std::mutex> lock(mMutex);
+
+   // another map is looking the tile up, its result is ours too
+   if (mPending.count(Key))
+   {
+      if (CacheOnly)
+         return TileStatus::DEFERRED;
+
+      mSharedFetches++;
+      mFetchDone.wait(lock, [&] { return mPending.count(Key) == 0; });
+   }
+
+   auto it = mRecords.find(Key);
+
+   if (it != mRecords.end())
+   {
+      mRecordLru.splice(mRecordLru.begin(), mRecordLru, it->second);
+      Stats.RecordHit(CacheTier::MEMORY);
+      lock.unlock();
+
+      // a tile that stays on screen is never read from disk again, the
+      // touch keeps the collector from taking its file
+      mDiskCache.Touch(Key);
+      return TileStatus::READY;
+   }
+
+   Stats.RecordMiss(CacheTier::MEMORY);
+
+   // textures are loaded from the files, without a cache path a fetched
+   // tile has nowhere to go
+   if (mCachePath.empty())
+      return CacheOnly ? TileStatus::DEFERRED : TileStatus::NO_DATA;
+
+   // every coverage pass looks up the tiles it doesn't have in memory, the
+   // name is built in place so a lookup allocates nothing, a cache path too
+   // long for it has no tiles
+   if (!COpenStreetMap::ConstructFilename(tile_filename, sizeof(tile_filename), mCachePath, Key, mTileFormat))
+      return TileStatus::NO_DATA;
+
+   // a failed server gets another try once the retry time is up, until it
+   // is discovered the tiles not on disk wait
+   discovering = mServerState == ServerState::DISCOVERING;
+   online = mDiscovered && (mServerState == ServerState::ONLINE || TClock::now() >= mRetryTime);
+
+   mPending.insert(Key);
+   lock.unlock();
+
+   {
+      TRACE_SCOPE("DiskLookup", "disk");
+      got_file = stat(tile_filename, &tile_stat) == 0;
+   }
+
+   if (got_file)
+   {
+      Stats.RecordHit(CacheTier::DISK);
+      mDiskCache.Touch(Key);
+   }
+   else
+      Stats.RecordMiss(CacheTier::DISK);
+
+   // another process fetching or decoding the tile writes it to the disk
+   // cache for this one too
+   TSharedTile      shared;
+   SharedTileStatus claim = SharedTileStatus::UNAVAILABLE;
+
+   if (!got_file && !CacheOnly && online)
+   {
+      claim = mSharedPool.Lookup(Key, shared);
+
+      if (claim == SharedTileStatus::READY)
+         mSharedPool.Release(shared);
+
+      // the process that had it claimed may have written it since the look
+      if (claim == SharedTileStatus::CLAIMED)
+         got_file = stat(tile_filename, &tile_stat) == 0;
+   }
+
+   if (!got_file && !CacheOnly && online && claim != SharedTileStatus::BUSY)
+   {
+      std::lock_guard<std::mutex> fetch_lock(mFetchMutex);
+      unsigned char*              buffer;
+      int                         size;
+
+      mWmtsIf.SetStats(&Stats);
+      got_file = mWmtsIf.GetMapTileBuffer(Key.GetZoom(), Key.GetX(), Key.GetY(), &buffer, size);
+      fetched = true;
+
+      if (got_file)
+      {
+         TRACE_SCOPE("DiskWrite", "disk");
+         std::error_code err;
+         std::filesystem::create_directory(mCachePath, err);
+
+         std::ofstream tile_file(tile_filename, std::ios::out | std::ios::binary | std::ios::trunc);
+
+         tile_file.write((char*)buffer, size);
+         mDiskCache.Add(Key, size, mTileFormat);
+      }
+
+      mWmtsIf.SetStats(nullptr);
+   }
+
+   // the texture load claims it again to decode it
+   if (claim == SharedTileStatus::CLAIMED)
+      mSharedPool.Abandon(Key);
+
+   lock.lock();
+
+   // nothing is recorded for a no data tile, so the fetch happens again
+   // once the scale settles
+   if (got_file)
+      PutRecord(Key);
+
+   // bad tile file from the tile server
+   if (fetched && !got_file)
+      mRetryTime = TClock::now() + std::chrono::milliseconds(TILE_SERVICE_RETRY_MS);
+
+   mPending.erase(Key);
+   lock.unlock();
+   mFetchDone.notify_all();
+
+   if (fetched)
+      SetServerState(got_file ? ServerState::ONLINE : ServerState::OFFLINE);
+
+   if (got_file)
+      return TileStatus::READY;
+
+   return (CacheOnly || discovering || claim == SharedTileStatus::BUSY) ? TileStatus::DEFERRED : TileStatus::NO_DATA;
+}
+
+bool CTileService::LoadTileImage(TTileKey Key, TTextureImage& Image)
+{
+   using usec = std::chrono::microseconds;
+
+   TSharedTile      shared;
+   SharedTileStatus status = mSharedPool.Lookup(Key, shared);
+   auto             start = TClock::now();
+
+   if (status == SharedTileStatus::BUSY)
+      return false;
+
+   if (status == SharedTileStatus::READY)
+   {
+      Image.Pixels.assign(shared.Pixels, shared.Pixels + (size_t)shared.Width * shared.Height * shared.Channels);
+      Image.Width = shared.Width;
+      Image.Height = shared.Height;
+      Image.Channels = shared.Channels;
+      Image.LoadTimes.ReadUs = std::chrono::duration_cast<usec>(TClock::now() - start).count();
+      mSharedPool.Release(shared);
+
+      return true;
+   }
+
+   std::ifstream              tile_file(COpenStreetMap::ConstructFilename(mCachePath, Key, mTileFormat),
+                                        std::ios::in | std::ios::binary);
+   std::vector<unsigned char> buffer((std::istreambuf_iterator<char>(tile_file)),
+                                     std::istreambuf_iterator<char>());
+   auto                       read_done = TClock::now();
+   unsigned char*             data = nullptr;
+
+   // flipped the same way CTexture loads a file
+   if (!buffer.empty())
+      data = DecodeTileImage(buffer.data(), buffer.size(), 0, true, Image.Width, Image.Height, Image.Channels);
+
+   if (data)
+   {
+      Image.Pixels.assign(data, data + (size_t)Image.Width * Image.Height * Image.Channels);
+      FreeTileImage(data);
+   }
+
+   Image.LoadTimes.ReadUs   = std::chrono::duration_cast<usec>(read_done - start).count();
+   Image.LoadTimes.DecodeUs = std::chrono::duration_cast<usec>(TClock::now() - read_done).count();
+   Image.LoadTimes.FileSize = buffer.size();
+
+   if (status == SharedTileStatus::CLAIMED)
+   {
+      if (Image.Pixels.empty() || !mSharedPool.Publish(Key, Image.Pixels.data(), Image.Width, Image.Height, Image.Channels))
+         mSharedPool.Abandon(Key);
+   }
+
+   return true;
+}
+
+void CTileService::Open(const char* WmtsUrl, const char* CachePath)
+{
+   mOpenTime = TClock::now();
+   mCachePath = GetCachePathName(CachePath);
+   mWmtsUrl = WmtsUrl ? WmtsUrl : "";
+
+   if (!mCachePath.empty())
+      mDiskCache.Open(mCachePath.c_str());
+
+   // Acquire holds the service mutex, the budget can't change under it
+   if (!mCachePath.empty() && shared_pool_budget)
+      mSharedPool.Open(GetSharedPoolName(mWmtsUrl, mCachePath).c_str(), shared_pool_budget);
+
+   if (mWmtsUrl.empty())
+      return;
+
+   // until the server answers, the last capabilities written keep the
+   // tiles already cached in the format they were fetched in
+   if (!mCachePath.empty())
+   {
+      mWmtsIf.LoadCapabilitiesFile(mCachePath + WMTS_CAPABILITIES_FILENAME);
+      mTileFormat = mWmtsIf.GetTileSource().Format;
+   }
+
+   // only curl is set up here, the server is first asked on the thread
+   mWmtsIf.Open(mWmtsUrl.c_str(), 10);
+
+   mServerState = ServerState::DISCOVERING;
+   mDiscoveryThread = std::thread(&CTileService::DiscoveryThread, this);
+}
+
+void CTileService::Preload(const std::vector<TTileKey>& Keys)
+{
+   if (mCachePath.empty() || Keys.empty())
+      return;
+
+   std::lock_guard<std::mutex> lock(mPreloadMutex);
+
+   // the workers of an earlier preload have all returned or are about to
+   if (mPreloadWorkers == 0)
+   {
+      for (auto& thread : mPreloadThreads)
+         thread.join();
+
+      mPreloadThreads.clear();
+      mPreloadQueue.clear();
+      mPreloadNext = 0;
+   }
+
+   for (TTileKey key : Keys)
+   {
+      // another map's session may have asked for it already
+      if (mPreloaded.count(key) || mTextures.Find(key.Value))
+         continue;
+
+      mPreloaded[key].Decoded = false;
+      mPreloadQueue.push_back(key);
+   }
+
+   int threads = std::min<int>(TILE_SERVICE_PRELOAD_THREADS, std::max(1u, std::thread::hardware_concurrency()));
+
+   threads = std::min<int>(threads, mPreloadQueue.size() - mPreloadNext);
+
+   for (int i = mPreloadWorkers; i < threads; i++)
+   {
+      mPreloadWorkers++;
+      mPreloadThreads.emplace_back(&CTileService::PreloadThread, this);
+   }
+}
+
+void CTileService::PreloadThread()
+{
+   CTrace::SetThreadName("Preload");
+
+   while (true)
+   {
+      TTileKey key;
+
+      {
+         std::lock_guard<std::mutex> lock(mPreloadMutex);
+
+         if (mTerminatePreload || mPreloadNext >= mPreloadQueue.size())
+         {
+            mPreloadWorkers--;
+            return;
+         }
+
+         key = mPreloadQueue[mPreloadNext++];
+      }
+
+      TRACE_SCOPE("Preload", "decode");
+
+      TTextureImage image = {};
+
+      // a tile another process is decoding is left to the render thread,
+      // which finds it in the shared pool
+      LoadTileImage(key, image);
+
+      // the coverage thread finds it on disk without looking, the file
+      // was read like any other
+      if (!image.Pixels.empty())
+      {
+         {
+            std::lock_guard<std::mutex> lock(mMutex);
+
+            if (!mRecords.count(key))
+               PutRecord(key);
+         }
+
+         mDiskCache.Touch(key);
+      }
+
+      std::lock_guard<std::mutex> lock(mPreloadMutex);
+      TPreloadedTile&             tile = mPreloaded[key];
+
+      tile.Image = std::move(image);
+      tile.Done = TClock::now();
+      tile.Decoded = true;
+   }
+}
+
+void CTileService::RemoveRecord(TTileKey Key)
+{
+   auto it = mRecords.find(Key);
+
+   if (it == mRecords.end())
+      return;
+
+   mRecordLru.erase(it->second);
+   mRecords.erase(it);
+}
+
+void CTileService::RemoveStateCallback(int Id)
+{
+   std::lock_guard<std::mutex> callback_lock(mCallbackMutex);
+
+   mCallbacks.erase(std::remove_if(mCallbacks.begin(), mCallbacks.end(),
+                                   [&](const std::pair<int, TStateCallback>& Entry) { return Entry.first == Id; }),
+                    mCallbacks.end());
+}
+
+void CTileService::SetServerState(ServerState State)
+{
+   // the callback mutex first, the callbacks see the changes in order
+   std::lock_guard<std::mutex> callback_lock(mCallbackMutex);
+
+   {
+      std::lock_guard<std::mutex> lock(mMutex);
+
+      if (mServerState == State)
+         return;
+
+      mServerState = State;
+   }
+
+   for (auto& callback : mCallbacks)
+      callback.second(State);
+}
+
+void CTileService::PutRecord(TTileKey Key)
+{
+   mRecordLru.push_front(Key);
+   mRecords[Key] = mRecordLru.begin();
+
+   if (mRecords.size() > TILE_SERVICE_RECORDS)
+   {
+      mRecords.erase(mRecordLru.back());
+      mRecordLru.pop_back();
+   }
+}
@@ -0,0 +1,215 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "DiskCache.h"
+#include "MapStats.h"
+#include "SharedTilePool.h"
+#include "TextureRegistry.h"
+#include "TileKey.h"
+#include "WmtsIf.h"
+
+#define TILE_SERVICE_RECORDS         4096  // tiles known to be on disk
+#define TILE_SERVICE_TEXTURES        1024  // resident textures before unreferenced ones are deleted
+#define TILE_SERVICE_RETRY_MS        1000  // time the server is left alone after a failed request
+#define TILE_SERVICE_PROBE_MAX_MS    30000 // longest wait between probes of a server that never answered
+#define TILE_SERVICE_PRELOAD_THREADS 4     // decoding the tiles of a restored session
+#define TILE_SERVICE_PRELOAD_KEEP_MS 5000  // decoded tiles no map asked for are dropped after
+
+// What GetTile found for a tile
+enum class TileStatus
+{
+   READY,    // the png is on disk
+   NO_DATA,  // not on disk and the server is offline or failed
+   DEFERRED  // not cached and only cached tiles were asked for, or the
+             // server hasn't answered its first probe yet
+};
+
+// The tile server as the service last found it
+enum class ServerState
+{
+   NONE,        // no server, the disk cache only
+   DISCOVERING, // the first probe hasn't answered, cached tiles only
+   ONLINE,
+   OFFLINE      // a probe or fetch failed, retried in the background
+};
+
+struct TTileServiceStats
+{
+   uint64_t    Views;              // maps sharing the service
+   uint64_t    Records;
+   uint64_t    SharedFetches;      // requests that waited on a fetch for another map
+   uint64_t    Textures;
+   uint64_t    ReferencedTextures; // held by a display list
+   uint64_t    EvictedTextures;
+   uint64_t    PendingDeletes;     // released off the render thread
+   uint64_t    PendingLookups;     // tiles being looked up or fetched
+   uint64_t    PreloadQueue;       // tiles left to preload
+   ServerState State;
+   double      DiscoveryMs;        // Open to the first probe answered, 0 until then
+};
+
+// Tiles for every map in the process using the same server and cache path.
+//
+// The fetch pipeline, the record of tiles on disk and the pool of decoded
+// tile textures are shared, so a main map and a minimap over the same area
+// fetch, decode and upload each tile once. Maps keep their own coverage and
+// display lists. Textures are registered by tile key and stay resident while
+// any display list holds them, the least recently used unreferenced ones are
+// deleted once the pool is past TILE_SERVICE_TEXTURES.
+//
+// With EnableSharedPool, decoded tiles go to a pool in shared memory named
+// after the server and cache path, so map processes on the same host decode
+// a tile once, and a tile one process is fetching isn't fetched by another.
+//
+// Opening doesn't touch the network. The capabilities are fetched on a
+// discovery thread, which probes until the server answers; until then the
+// tiles come from the disk cache in the format the last run saved.
+class CTileService : public std::enable_shared_from_this<CTileService>
+{
+public:
+   using TClock = std::chrono::steady_clock;
+   using TStateCallback = std::function<void(ServerState State)>;
+
+   ~CTileService();
+
+   // the service for a server and cache path, either may be null. It is
+   // opened by the first map and closed when the last one lets go of it.
+   static std::shared_ptr<CTileService> Acquire(const char* WmtsUrl, const char* CachePath);
+
+   // Called with the current state right away, then on the thread that
+   // changes it, the discovery or a coverage thread. Callbacks mustn't add
+   // or remove callbacks. Returns the id RemoveStateCallback takes.
+   int AddStateCallback(TStateCallback Callback);
+
+   // services opened from now on with a cache path share decoded tiles with
+   // other processes through a CSharedTilePool of BudgetBytes, 0 turns it off
+   static void EnableSharedPool(uint64_t BudgetBytes);
+
+   // render thread, the texture for a tile on disk, loaded once for every
+   // map. Null for a tile Preload is still decoding, it is drawn a frame
+   // later rather than read twice.
+   std::shared_ptr<CTexture> AcquireTexture(TTileKey Key);
+
+   // forgets the tile records, the files and textures stay
+   void Clear();
+
+   // render thread, deletes the oldest unreferenced textures past the pool size
+   void CollectTextures();
+
+   // render thread, deletes the gpu textures of every service while the
+   // context is still current
+   static void DeleteTextures();
+
+   // ends in '/', empty without a disk cache
+   const std::string& GetCachePath() const { return mCachePath; }
+
+   // budget, pins and usage of the tile files under the cache path
+   CDiskCache& GetDiskCache() { return mDiskCache; }
+
+   ServerState GetServerState();
+
+   // closed unless EnableSharedPool was called before the service opened
+   CSharedTilePool& GetSharedPool() { return mSharedPool; }
+
+   TTileServiceStats GetStats();
+
+   // the encoding the tiles are fetched and cached in, from the server's
+   // capabilities, or the ones saved in the cache path until it answers
+   TileFormat GetTileFormat() const { return mTileFormat; }
+
+   // coverage threads, finds a tile in the records, on disk or on the
+   // server. A tile another map is fetching is waited for rather than
+   // fetched again. Lookups are counted into the caller's Stats.
+   TileStatus GetTile(TTileKey Key, bool CacheOnly, CMapStats& Stats);
+
+   // reads and decodes the tile files on worker threads, in order, so
+   // AcquireTexture only has to upload them. The tiles found are recorded
+   // as on disk.
+   void Preload(const std::vector<TTileKey>& Keys);
+
+   void RemoveStateCallback(int Id);
+
+private:
+   using TRecordLru = std::list<TTileKey>;
+
+   struct TPreloadedTile
+   {
+      TTextureImage      Image;
+      TClock::time_point Done;
+      bool               Decoded;  // false while a worker has it
+   };
+
+   CTileService();
+
+   // probes the server until it answers with its capabilities, then exits
+   void DiscoveryThread();
+
+   // The decoded pixels of a tile on disk, from the shared pool if another
+   // process decoded it and published to it if this one does. False while
+   // another process is decoding it.
+   bool LoadTileImage(TTileKey Key, TTextureImage& Image);
+
+   void Open(const char* WmtsUrl, const char* CachePath);
+
+   void PreloadThread();
+
+   // mMutex held, the record goes to the front and the oldest past
+   // TILE_SERVICE_RECORDS is dropped
+   void PutRecord(TTileKey Key);
+
+   // mMutex held
+   void RemoveRecord(TTileKey Key);
+
+   // mMutex not held, the callbacks run on the calling thread
+   void SetServerState(ServerState State);
+
+   CWmtsIf                                            mWmtsIf;
+   CDiskCache                                         mDiskCache;
+   CSharedTilePool                                    mSharedPool;
+   CTextureRegistry                                   mTextures;   // by tile key
+   std::mutex                                         mMutex;      // records, pending fetches and server state
+   std::mutex                                         mFetchMutex; // the server interface
+   std::condition_variable                            mFetchDone;
+   std::unordered_map<TTileKey, TRecordLru::iterator> mRecords;    // position in mRecordLru
+   TRecordLru                                         mRecordLru;  // most recent first
+   std::unordered_set<TTileKey>                       mPending;    // being looked up or fetched
+   std::string                                        mCachePath;
+   std::string                                        mWmtsUrl;
+   TClock::time_point                                 mOpenTime;
+   TClock::time_point                                 mRetryTime;
+   uint64_t                                           mSharedFetches;
+   double                                             mDiscoveryMs;
+   std::atomic<TileFormat>                            mTileFormat;
+   ServerState                                        mServerState;
+   bool                                               mDiscovered;  // the capabilities are loaded
+
+   std::thread                                        mDiscoveryThread;
+   std::condition_variable                            mDiscoveryWake; // with mMutex, ends the wait between probes
+   bool                                               mTerminateDiscovery;
+
+   std::mutex                                         mCallbackMutex;
+   std::vector<std::pair<int, TStateCallback>>        mCallbacks;
+   int                                                mNextCallbackId;
+
+   // tiles being decoded ahead of AcquireTexture, the workers exit once the
+   // queue is empty
+   std::mutex                                         mPreloadMutex;
+   std::vector<std::thread>                           mPreloadThreads;
+   std::vector<TTileKey>                              mPreloadQueue;   // taken from the front
+   size_t                                             mPreloadNext;
+   std::unordered_map<TTileKey, TPreloadedTile>       mPreloaded;
+   int                                                mPreloadWorkers; // still running
+   bool                                               mTerminatePreload;
+};
@@ -0,0 +1,130 @@
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "json/json.h"
+#include "ExecApi.h"
+#include "Trace.h"
+
+struct TTraceEvent
+{
+   const char* Name;
+   const char* Category;
+   int64_t     StartUs;
+   int64_t     DurationUs;
+};
+
+// written only by its own thread, read by Dump
+struct TTraceBuffer
+{
+   TTraceEvent           Events[TRACE_BUFFER_SIZE];
+   std::atomic<uint64_t> Head;
+   std::string           ThreadName;
+   int                   ThreadId;
+};
+
+// buffers outlive their threads so events from finished threads still dump
+static std::mutex                                 trace_registry_mutex;
+static std::vector<std::unique_ptr<TTraceBuffer>> trace_registry;
+static const CTrace::TTimePoint                   trace_epoch = std::chrono::steady_clock::now();
+static thread_local TTraceBuffer*                 trace_buffer = nullptr;
+
+static TTraceBuffer* GetThreadBuffer()
+{
+   if (!trace_buffer)
+   {
+      std::lock_guard<std::mutex> lock(trace_registry_mutex);
+
+      trace_registry.push_back(std::make_unique<TTraceBuffer>());
+      trace_buffer             = trace_registry.back().get();
+      trace_buffer->Head       = 0;
+      trace_buffer->ThreadId   = (int)trace_registry.size();
+      trace_buffer->ThreadName = "Thread " + std::to_string(trace_buffer->ThreadId);
+   }
+
+   return trace_buffer;
+}
+
+std::atomic<bool> CTrace::mEnabled(false);
+
+bool CTrace::Dump(const char* Filename)
+{
+   std::lock_guard<std::mutex> lock(trace_registry_mutex);
+   std::ofstream               trace_file(Filename, std::ios::out | std::ios::trunc);
+   Json::Value                 root;
+   Json::Value                 events(Json::arrayValue);
+
+   if (!trace_file.is_open())
+   {
+      ExecApiLogWarning("Unable to open trace file %s", Filename);
+      return false;
+   }
+
+   for (const auto& buffer : trace_registry)
+   {
+      Json::Value thread_name;
+      uint64_t    head = buffer->Head.load(std::memory_order_acquire);
+      uint64_t    count = head < TRACE_BUFFER_SIZE ? head : TRACE_BUFFER_SIZE;
+
+      thread_name["name"]         = "thread_name";
+      thread_name["ph"]           = "M";
+      thread_name["pid"]          = 1;
+      thread_name["tid"]          = buffer->ThreadId;
+      thread_name["args"]["name"] = buffer->ThreadName;
+      events.append(thread_name);
+
+      // the oldest events can be overwritten while this runs, which at worst
+      // garbles a few events at the start of the thread's timeline
+      for (uint64_t i = head - count; i < head; i++)
+      {
+         const TTraceEvent& event = buffer->Events[i % TRACE_BUFFER_SIZE];
+         Json::Value        trace_event;
+
+         trace_event["name"] = event.Name;
+         trace_event["cat"]  = event.Category;
+         trace_event["ph"]   = "X";
+         trace_event["ts"]   = (Json::Int64)event.StartUs;
+         trace_event["dur"]  = (Json::Int64)event.DurationUs;
+         trace_event["pid"]  = 1;
+         trace_event["tid"]  = buffer->ThreadId;
+         events.append(trace_event);
+      }
+   }
+
+   root["traceEvents"]     = events;
+   root["displayTimeUnit"] = "ms";
+
+   Json::FastWriter writer;
+
+   trace_file << writer.write(root);
+
+   return trace_file.good();
+}
+
+void CTrace::Record(const char* Name, const char* Category, TTimePoint Start, TTimePoint End)
+{
+   using usec = std::chrono::microseconds;
+
+   if (!IsEnabled())
+      return;
+
+   TTraceBuffer* buffer = GetThreadBuffer();
+   uint64_t      head = buffer->Head.load(std::memory_order_relaxed);
+   TTraceEvent&  event = buffer->Events[head % TRACE_BUFFER_SIZE];
+
+   event.Name       = Name;
+   event.Category   = Category;
+   event.StartUs    = std::chrono::duration_cast<usec>(Start - trace_epoch).count();
+   event.DurationUs = std::chrono::duration_cast<usec>(End - Start).count();
+
+   // publish the event to Dump
+   buffer->Head.store(head + 1, std::memory_order_release);
+}
+
+void CTrace::SetThreadName(const char* Name)
+{
+   TTraceBuffer* buffer = GetThreadBuffer();
+
+   std::lock_guard<std::mutex> lock(trace_registry_mutex);
+   buffer->ThreadName = Name;
+}
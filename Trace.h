@@ -0,0 +1,85 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#define TRACE_BUFFER_SIZE 32768 // events kept per thread, oldest are overwritten
+
+// Scoped tracing of the map pipeline, written out as Chrome trace-event json
+// that loads in chrome://tracing or ui.perfetto.dev.
+//
+// Every thread records into its own ring buffer, so recording takes no locks.
+// Event names and categories must be string literals, only the pointers are
+// kept. Recording is off until Enable(true) and costs one atomic load when off.
+class CTrace
+{
+public:
+   using TTimePoint = std::chrono::steady_clock::time_point;
+
+   // write every thread's events, may be called while threads are recording
+   static bool Dump(const char* Filename);
+
+   static void Enable(bool Enable) { mEnabled.store(Enable, std::memory_order_relaxed); }
+
+   static bool IsEnabled() { return mEnabled.load(std::memory_order_relaxed); }
+
+   static void Record(const char* Name, const char* Category, TTimePoint Start, TTimePoint End);
+
+   static void Record(const char* Name, const char* Category, TTimePoint Start)
+   {
+      Record(Name, Category, Start, std::chrono::steady_clock::now());
+   }
+
+   // shown as the thread's name on the timeline
+   static void SetThreadName(const char* Name);
+
+private:
+
+   static std::atomic<bool> mEnabled;
+};
+
+// Records the time from construction to destruction as one event
+class CTraceScope
+{
+public:
+   CTraceScope(const char* Name, const char* Category)
+      : mName(Name),
+        mCategory(Category),
+        mStart(std::chrono::steady_clock::now())
+   {
+   }
+
+   ~CTraceScope()
+   {
+      CTrace::Record(mName, mCategory, mStart);
+   }
+
+private:
+   const char*        mName;
+   const char*        mCategory;
+   CTrace::TTimePoint mStart;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b)  TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(Name, Category) CTraceScope TRACE_CONCAT(trace_scope_, __LINE__)(Name, Category)
+
+// Locks a mutex, recording an event only if the lock had to wait
+template <typename TMutex>
+inline void TraceLock(TMutex& Mutex, const char* Name)
+{
+   if (!CTrace::IsEnabled())
+   {
+      Mutex.lock();
+      return;
+   }
+
+   if (Mutex.try_lock())
+      return;
+
+   auto start = std::chrono::steady_clock::now();
+   Mutex.lock();
+   CTrace::Record(Name, "lock", start);
+}
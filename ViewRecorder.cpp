@@ -0,0 +1,95 @@
+#include "ViewRecorder.h"
+#include "ExecApi.h"
+
+CViewRecorder::CViewRecorder()
+   : mFrames(0)
+{
+}
+
+CViewRecorder::~CViewRecorder()
+{
+   Close();
+}
+
+void CViewRecorder::Close()
+{
+   if (!mFile.is_open())
+      return;
+
+   mFile.close();
+
+   if (mFile.fail())
+      ExecApiLogWarning("ViewRecorder: unable to write %s", mFilename.c_str());
+}
+
+bool CViewRecorder::Load(const char* Filename, std::vector<TRecordedView>& Views, int& FrameRate)
+{
+   std::ifstream view_file(Filename, std::ios::in | std::ios::binary);
+   uint32_t      header[4] = { 0, 0, 0, 0 };
+   TRecordedView view;
+
+   view_file.read((char*)header, sizeof(header));
+
+   if (!view_file || header[0] != VIEW_RECORDER_MAGIC || header[1] != VIEW_RECORDER_VERSION ||
+       header[2] == 0 || header[3] != sizeof(TRecordedView))
+   {
+      ExecApiLogWarning("ViewRecorder: %s is not a view recording", Filename);
+      return false;
+   }
+
+   Views.clear();
+   FrameRate = (int)header[2];
+
+   // a partial last record is a session that was cut short, it is dropped
+   while (view_file.read((char*)&view, sizeof(view)))
+      Views.push_back(view);
+
+   return !Views.empty();
+}
+
+bool CViewRecorder::Open(const char* Filename, int FrameRate)
+{
+   uint32_t header[4] = { VIEW_RECORDER_MAGIC, VIEW_RECORDER_VERSION, (uint32_t)FrameRate, sizeof(TRecordedView) };
+
+   if (mFile.is_open() || FrameRate <= 0)
+      return false;
+
+   mFile.open(Filename, std::ios::out | std::ios::binary | std::ios::trunc);
+   mFile.write((const char*)header, sizeof(header));
+
+   if (!mFile.good())
+   {
+      ExecApiLogWarning("ViewRecorder: unable to create %s", Filename);
+      mFile.close();
+      return false;
+   }
+
+   mFilename = Filename;
+   mFrames = 0;
+
+   return true;
+}
+
+void CViewRecorder::Record(const TRecordedView& View)
+{
+   if (!mFile.is_open())
+      return;
+
+   mFile.write((const char*)&View, sizeof(View));
+   mFrames++;
+}
+
+bool CViewRecorder::Save(const char* Filename, const std::vector<TRecordedView>& Views, int FrameRate)
+{
+   CViewRecorder recorder;
+
+   if (!recorder.Open(Filename, FrameRate))
+      return false;
+
+   for (const auto& view : Views)
+      recorder.Record(view);
+
+   recorder.Close();
+
+   return !recorder.mFile.fail();
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Records the view inputs main.cpp feeds COpenStreetMap every frame, so a
+// session can be replayed frame for frame by osm_replay. The file is a short
+// header, magic, version, frame rate and record size, and then one packed
+// record per frame, written as is so the doubles come back bit for bit and
+// two replays of a file see the same inputs. A session cut short loses only
+// its last partial record.
+
+#define VIEW_RECORDER_MAGIC   0x564d534f   // "OSMV"
+#define VIEW_RECORDER_VERSION 1
+
+#define VIEW_FLAG_EASING      0x01
+#define VIEW_FLAG_BOUNDARIES  0x02
+#define VIEW_FLAG_BORDER      0x04
+#define VIEW_FLAG_CLIP        0x08
+
+#pragma pack(push, 1)
+struct TRecordedView
+{
+   double   Latitude;
+   double   Longitude;
+   float    ScaleFactor;
+   float    RotationDeg;
+   int32_t  MapWidth;
+   int32_t  MapHeight;
+   int32_t  WindowWidth;
+   int32_t  WindowHeight;
+   int32_t  OffsetX;
+   int32_t  OffsetY;
+   uint32_t Flags;          // VIEW_FLAG_...
+};
+#pragma pack(pop)
+
+class CViewRecorder
+{
+public:
+   CViewRecorder();
+   ~CViewRecorder();
+
+   void Close();
+
+   uint64_t GetFrames() const { return mFrames; }
+
+   bool IsOpen() const { return mFile.is_open(); }
+
+   // FrameRate is the rate the session ran at
+   static bool Load(const char* Filename, std::vector<TRecordedView>& Views, int& FrameRate);
+
+   bool Open(const char* Filename, int FrameRate);
+
+   void Record(const TRecordedView& View);
+
+   static bool Save(const char* Filename, const std::vector<TRecordedView>& Views, int FrameRate);
+
+private:
+
+   std::ofstream mFile;
+   std::string   mFilename;
+   uint64_t      mFrames;
+};
@@ -0,0 +1,446 @@
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include "WmtsCapabilities.h"
+#include "ExecApi.h"
+
+// whitespace around element text, the documents are indented
+static std::string Trim(const std::string& Text)
+{
+   size_t begin = Text.find_first_not_of(" \t\r\n");
+   size_t end = Text.find_last_not_of(" \t\r\n");
+
+   return (begin == std::string::npos) ? std::string() : Text.substr(begin, end - begin + 1);
+}
+
+// the local name, "ows:Identifier" is "Identifier"
+static std::string GetLocalName(const std::string& Name)
+{
+   size_t colon = Name.find(':');
+
+   return (colon == std::string::npos) ? Name : Name.substr(colon + 1);
+}
+
+static void ReplaceAll(std::string& Text, const char* Pattern, const std::string& Value)
+{
+   size_t length = strlen(Pattern);
+
+   for (size_t pos = Text.find(Pattern); pos != std::string::npos; pos = Text.find(Pattern, pos + Value.length()))
+      Text.replace(pos, length, Value);
+}
+
+CWmtsCapabilities::CWmtsCapabilities()
+{
+}
+
+CWmtsCapabilities::~CWmtsCapabilities()
+{
+}
+
+std::string CWmtsCapabilities::DecodeEntities(const char* Begin, const char* End)
+{
+   std::string text;
+
+   text.reserve(End - Begin);
+
+   for (const char* cursor = Begin; cursor < End; cursor++)
+   {
+      const char* semicolon = (*cursor == '&') ? (const char*)memchr(cursor, ';', End - cursor) : nullptr;
+
+      if (!semicolon)
+      {
+         text += *cursor;
+         continue;
+      }
+
+      std::string entity(cursor + 1, semicolon);
+      long        code = -1;
+
+      if (entity == "amp")       code = '&';
+      else if (entity == "lt")   code = '<';
+      else if (entity == "gt")   code = '>';
+      else if (entity == "quot") code = '"';
+      else if (entity == "apos") code = '\'';
+      else if (entity.size() > 1 && entity[0] == '#')
+         code = (entity[1] == 'x') ? strtol(entity.c_str() + 2, nullptr, 16) : strtol(entity.c_str() + 1, nullptr, 10);
+
+      if (code < 0 || code > 0x10ffff)
+      {
+         // not an entity, left as it is
+         text += *cursor;
+         continue;
+      }
+
+      // utf-8
+      if (code < 0x80)
+         text += (char)code;
+      else if (code < 0x800)
+      {
+         text += (char)(0xc0 | (code >> 6));
+         text += (char)(0x80 | (code & 0x3f));
+      }
+      else if (code < 0x10000)
+      {
+         text += (char)(0xe0 | (code >> 12));
+         text += (char)(0x80 | ((code >> 6) & 0x3f));
+         text += (char)(0x80 | (code & 0x3f));
+      }
+      else
+      {
+         text += (char)(0xf0 | (code >> 18));
+         text += (char)(0x80 | ((code >> 12) & 0x3f));
+         text += (char)(0x80 | ((code >> 6) & 0x3f));
+         text += (char)(0x80 | (code & 0x3f));
+      }
+
+      cursor = semicolon;
+   }
+
+   return text;
+}
+
+const TWmtsTileMatrixSet* CWmtsCapabilities::FindTileMatrixSet(const std::string& Identifier) const
+{
+   for (const auto& set : mTileMatrixSets)
+   {
+      if (set.Identifier == Identifier)
+         return &set;
+   }
+
+   return nullptr;
+}
+
+bool CWmtsCapabilities::IsWebMercator(const TWmtsTileMatrixSet& Set, int TileSize)
+{
+   if (Set.TileMatrices.empty())
+      return false;
+
+   for (size_t zoom = 0; zoom < Set.TileMatrices.size(); zoom++)
+   {
+      const TWmtsTileMatrix& matrix = Set.TileMatrices[zoom];
+      int                    tiles = (zoom < 31) ? (1 << zoom) : 0;
+
+      if (matrix.TileWidth != TileSize || matrix.TileHeight != TileSize ||
+          matrix.MatrixWidth != tiles || matrix.MatrixHeight != tiles)
+         return false;
+   }
+
+   return true;
+}
+
+bool CWmtsCapabilities::Parse(const unsigned char* Xml, int Size)
+{
+   const char* cursor = (const char*)Xml;
+   const char* end = cursor + Size;
+   TXmlNode    root;
+
+   mLayers.clear();
+   mTileMatrixSets.clear();
+
+   if (!Xml || Size <= 0)
+      return false;
+
+   // a utf-8 byte order mark
+   if (Size >= 3 && memcmp(cursor, "\xef\xbb\xbf", 3) == 0)
+      cursor += 3;
+
+   SkipMarkup(cursor, end);
+
+   if (cursor >= end || !ReadXml(cursor, end, root, 0) || root.Name != "Capabilities")
+   {
+      ExecApiLogWarning("WmtsCapabilities: not a capabilities document");
+      return false;
+   }
+
+   const TXmlNode* contents = root.FindChild("Contents");
+
+   if (!contents)
+      return true;
+
+   for (const auto& child : contents->Children)
+   {
+      if (child.Name == "Layer")
+         ParseLayer(child);
+      else if (child.Name == "TileMatrixSet")
+         ParseTileMatrixSet(child);
+   }
+
+   return true;
+}
+
+void CWmtsCapabilities::ParseLayer(const TXmlNode& Node)
+{
+   TWmtsLayer layer;
+
+   layer.Identifier = Node.GetChildText("Identifier");
+
+   for (const auto& child : Node.Children)
+   {
+      if (child.Name == "Style")
+      {
+         if (layer.Style.empty() || child.GetAttribute("isDefault") == "true")
+            layer.Style = child.GetChildText("Identifier");
+      }
+      else if (child.Name == "Format")
+      {
+         layer.Formats.push_back(Trim(child.Text));
+      }
+      else if (child.Name == "TileMatrixSetLink")
+      {
+         layer.TileMatrixSets.push_back(child.GetChildText("TileMatrixSet"));
+      }
+      else if (child.Name == "ResourceURL" && child.GetAttribute("resourceType") == "tile")
+      {
+         TWmtsResourceUrl url;
+
+         url.Template = child.GetAttribute("template");
+
+         if (!url.Template.empty() && GetTileFormatFromMimeType(child.GetAttribute("format"), url.Format))
+            layer.ResourceUrls.push_back(url);
+      }
+   }
+
+   mLayers.push_back(layer);
+}
+
+void CWmtsCapabilities::ParseTileMatrixSet(const TXmlNode& Node)
+{
+   TWmtsTileMatrixSet set;
+
+   set.Identifier = Node.GetChildText("Identifier");
+
+   for (const auto& child : Node.Children)
+   {
+      if (child.Name != "TileMatrix")
+         continue;
+
+      TWmtsTileMatrix matrix;
+
+      matrix.Identifier   = child.GetChildText("Identifier");
+      matrix.TileWidth    = atoi(child.GetChildText("TileWidth").c_str());
+      matrix.TileHeight   = atoi(child.GetChildText("TileHeight").c_str());
+      matrix.MatrixWidth  = atoi(child.GetChildText("MatrixWidth").c_str());
+      matrix.MatrixHeight = atoi(child.GetChildText("MatrixHeight").c_str());
+
+      set.TileMatrices.push_back(matrix);
+   }
+
+   mTileMatrixSets.push_back(set);
+}
+
+bool CWmtsCapabilities::ReadXml(const char*& Cursor, const char* End, TXmlNode& Node, int Depth)
+{
+   if (Depth >= WMTS_XML_MAX_DEPTH)
+      return false;
+
+   const char* name = ++Cursor;
+
+   while (Cursor < End && !strchr(" \t\r\n/>", *Cursor))
+      Cursor++;
+
+   Node.Name = GetLocalName(std::string(name, Cursor));
+
+   // attributes up to the end of the start tag
+   while (true)
+   {
+      while (Cursor < End && strchr(" \t\r\n", *Cursor))
+         Cursor++;
+
+      if (Cursor >= End)
+         return false;
+
+      if (*Cursor == '/')
+      {
+         Cursor = (const char*)memchr(Cursor, '>', End - Cursor);
+
+         if (!Cursor)
+            return false;
+
+         Cursor++;
+         return true;
+      }
+
+      if (*Cursor == '>')
+      {
+         Cursor++;
+         break;
+      }
+
+      const char* attribute = Cursor;
+
+      while (Cursor < End && !strchr(" \t\r\n=/>", *Cursor))
+         Cursor++;
+
+      std::string attribute_name = GetLocalName(std::string(attribute, Cursor));
+
+      while (Cursor < End && strchr(" \t\r\n=", *Cursor))
+         Cursor++;
+
+      if (Cursor >= End || (*Cursor != '"' && *Cursor != '\''))
+         return false;
+
+      const char* value = Cursor + 1;
+      const char* quote = (const char*)memchr(value, *Cursor, End - value);
+
+      if (!quote)
+         return false;
+
+      Node.Attributes.emplace_back(attribute_name, DecodeEntities(value, quote));
+      Cursor = quote + 1;
+   }
+
+   // content up to the end tag
+   while (Cursor < End)
+   {
+      if (*Cursor != '<')
+      {
+         const char* text = Cursor;
+
+         Cursor = (const char*)memchr(Cursor, '<', End - Cursor);
+
+         if (!Cursor)
+            return false;
+
+         Node.Text += DecodeEntities(text, Cursor);
+      }
+      else if (End - Cursor > 1 && Cursor[1] == '/')
+      {
+         Cursor = (const char*)memchr(Cursor, '>', End - Cursor);
+
+         if (!Cursor)
+            return false;
+
+         Cursor++;
+         return true;
+      }
+      else if (End - Cursor >= 9 && strncmp(Cursor, "<![CDATA[", 9) == 0)
+      {
+         const char* data = Cursor + 9;
+         const char* data_end = std::search(data, End, "]]>", "]]>" + 3);
+
+         Node.Text.append(data, data_end);
+         Cursor = std::min(data_end + 3, End);
+      }
+      else if (End - Cursor > 1 && (Cursor[1] == '!' || Cursor[1] == '?'))
+      {
+         SkipMarkup(Cursor, End);
+      }
+      else
+      {
+         Node.Children.emplace_back();
+
+         if (!ReadXml(Cursor, End, Node.Children.back(), Depth + 1))
+            return false;
+      }
+   }
+
+   return false;
+}
+
+bool CWmtsCapabilities::SelectTileSource(TWmtsTileSource& Source, int TileSize, const char* Layer) const
+{
+   for (const auto& layer : mLayers)
+   {
+      if (Layer && layer.Identifier != Layer)
+         continue;
+
+      const TWmtsTileMatrixSet* set = nullptr;
+
+      for (const auto& set_identifier : layer.TileMatrixSets)
+      {
+         const TWmtsTileMatrixSet* candidate = FindTileMatrixSet(set_identifier);
+
+         if (candidate && IsWebMercator(*candidate, TileSize))
+         {
+            set = candidate;
+            break;
+         }
+      }
+
+      // formats are listed in order of preference, the smallest first
+      const TWmtsResourceUrl* best = nullptr;
+
+      for (const auto& url : layer.ResourceUrls)
+      {
+         if (!best || url.Format < best->Format)
+            best = &url;
+      }
+
+      if (!set || !best)
+         continue;
+
+      Source.Layer = layer.Identifier;
+      Source.Template = best->Template;
+      Source.Format = best->Format;
+      Source.TileMatrices.clear();
+
+      for (const auto& matrix : set->TileMatrices)
+         Source.TileMatrices.push_back(matrix.Identifier);
+
+      // the same for every tile, only the matrix, row and column are left
+      ReplaceAll(Source.Template, "{TileMatrixSet}", set->Identifier);
+      ReplaceAll(Source.Template, "{Style}", layer.Style);
+
+      return true;
+   }
+
+   return false;
+}
+
+void CWmtsCapabilities::SkipMarkup(const char*& Cursor, const char* End)
+{
+   // the declaration, comments, doctype and whitespace before an element
+   while (Cursor < End)
+   {
+      if (strchr(" \t\r\n", *Cursor))
+      {
+         Cursor++;
+      }
+      else if (End - Cursor >= 4 && strncmp(Cursor, "<!--", 4) == 0)
+      {
+         const char* close = std::search(Cursor + 4, End, "-->", "-->" + 3);
+
+         Cursor = std::min(close + 3, End);
+      }
+      else if (End - Cursor > 1 && *Cursor == '<' && (Cursor[1] == '?' || Cursor[1] == '!'))
+      {
+         const char* close = (const char*)memchr(Cursor, '>', End - Cursor);
+
+         Cursor = close ? close + 1 : End;
+      }
+      else
+      {
+         break;
+      }
+   }
+}
+
+const CWmtsCapabilities::TXmlNode* CWmtsCapabilities::TXmlNode::FindChild(const char* ChildName) const
+{
+   for (const auto& child : Children)
+   {
+      if (child.Name == ChildName)
+         return &child;
+   }
+
+   return nullptr;
+}
+
+std::string CWmtsCapabilities::TXmlNode::GetAttribute(const char* AttributeName) const
+{
+   for (const auto& attribute : Attributes)
+   {
+      if (attribute.first == AttributeName)
+         return attribute.second;
+   }
+
+   return std::string();
+}
+
+std::string CWmtsCapabilities::TXmlNode::GetChildText(const char* ChildName) const
+{
+   const TXmlNode* child = FindChild(ChildName);
+
+   return child ? Trim(child->Text) : std::string();
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "TileFormat.h"
+
+#define WMTS_XML_MAX_DEPTH 64  // of nested elements, a capabilities document needs under 10
+
+// A tile url template from a layer's ResourceURL
+struct TWmtsResourceUrl
+{
+   TileFormat  Format;
+   std::string Template;  // {TileMatrixSet}, {TileMatrix}, {TileRow}, {TileCol} and {Style}
+};
+
+struct TWmtsLayer
+{
+   std::string                   Identifier;
+   std::string                   Style;          // the default style
+   std::vector<std::string>      Formats;        // mime types, including ones that can't be decoded
+   std::vector<std::string>      TileMatrixSets;
+   std::vector<TWmtsResourceUrl> ResourceUrls;   // decodable formats only
+};
+
+struct TWmtsTileMatrix
+{
+   std::string Identifier;
+   int         TileWidth;
+   int         TileHeight;
+   int         MatrixWidth;
+   int         MatrixHeight;
+};
+
+struct TWmtsTileMatrixSet
+{
+   std::string                  Identifier;
+   std::vector<TWmtsTileMatrix> TileMatrices;   // coarsest first
+};
+
+// What CWmtsIf fetches, picked from the capabilities. The default is the
+// png path of the basic-preview style every server so far has had.
+struct TWmtsTileSource
+{
+   std::string              Layer;
+   std::string              Template;       // empty for the default path
+   std::vector<std::string> TileMatrices;   // identifier by zoom level
+   TileFormat               Format = TileFormat::PNG;
+};
+
+// The parts of a WMTS GetCapabilities document the map uses, the layers,
+// their formats and tile url templates, and the tile matrix sets. The
+// reader handles the xml these documents are written in, elements,
+// attributes, comments and the predefined entities, and ignores namespace
+// prefixes.
+class CWmtsCapabilities
+{
+public:
+   CWmtsCapabilities();
+   ~CWmtsCapabilities();
+
+   const TWmtsTileMatrixSet* FindTileMatrixSet(const std::string& Identifier) const;
+
+   const std::vector<TWmtsLayer>& GetLayers() const { return mLayers; }
+
+   const std::vector<TWmtsTileMatrixSet>& GetTileMatrixSets() const { return mTileMatrixSets; }
+
+   // false if the document isn't a capabilities document
+   bool Parse(const unsigned char* Xml, int Size);
+
+   // The smallest format of the first layer served as square TileSize
+   // tiles in a matrix set that doubles every level from one tile, the web
+   // mercator layout of the map. Layer picks a layer by identifier, null
+   // takes the first that fits.
+   bool SelectTileSource(TWmtsTileSource& Source, int TileSize, const char* Layer = nullptr) const;
+
+private:
+
+   struct TXmlNode
+   {
+      std::string                                      Name;  // without the namespace prefix
+      std::vector<std::pair<std::string, std::string>> Attributes;
+      std::string                                      Text;
+      std::vector<TXmlNode>                            Children;
+
+      const TXmlNode* FindChild(const char* ChildName) const;
+      std::string GetAttribute(const char* AttributeName) const;
+      std::string GetChildText(const char* ChildName) const;
+   };
+
+   static std::string DecodeEntities(const char* Begin, const char* End);
+
+   static bool IsWebMercator(const TWmtsTileMatrixSet& Set, int TileSize);
+
+   void ParseLayer(const TXmlNode& Node);
+
+   void ParseTileMatrixSet(const TXmlNode& Node);
+
+   // false past WMTS_XML_MAX_DEPTH levels, the document comes from the server
+   static bool ReadXml(const char*& Cursor, const char* End, TXmlNode& Node, int Depth);
+
+   static void SkipMarkup(const char*& Cursor, const char* End);
+
+   std::vector<TWmtsLayer>         mLayers;
+   std::vector<TWmtsTileMatrixSet> mTileMatrixSets;
+};
@@ -1,16 +1,32 @@
 
 #include <string.h>
+#include <chrono>
+#include <fstream>
+#include <iterator>
 #include <curl/curl.h>
 #include "WmtsIf.h"
+#include "ExecApi.h"
+#include "OpenStreetMap.h"
+#include "Trace.h"
 
 CWmtsIf::CWmtsIf()
    : mCurlBuffer(),
      mWmtsUrl(""),
+     mTileSource(),
+     mStats(nullptr),
      mTimeoutMsec(500),
+     mAbort(false),
      mIsOpen(false)
 {
 }
 
+// a non-zero return ends the transfer, curl calls it about once a second
+// and whenever data moves
+static int CurlProgressFunction(void* Userdata, curl_off_t, curl_off_t, curl_off_t, curl_off_t)
+{
+   return ((std::atomic<bool>*)Userdata)->load() ? 1 : 0;
+}
+
 CWmtsIf::~CWmtsIf()
 {
    Close();
@@ -46,7 +62,7 @@ bool CWmtsIf::GetWmtsCapabilitiesXml(unsigned char** XmlFileBuffer, int& Size)
    std::string wmts_cmd;
 
    // check if open
-   if (!mIsOpen) return false;
+   if (!mIsOpen || mAbort) return false;
 
    // clear the curl buffer
    mCurlBuffer.clear();
@@ -65,6 +81,9 @@ bool CWmtsIf::GetWmtsCapabilitiesXml(unsigned char** XmlFileBuffer, int& Size)
    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, RunCurlWriteFunction);
    curl_easy_setopt(curl, CURLOPT_WRITEDATA, this);
    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, mTimeoutMsec);
+   curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+   curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, CurlProgressFunction);
+   curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &mAbort);
    curl_easy_setopt(curl, CURLOPT_URL, wmts_cmd.c_str());
    curl_easy_perform(curl);
    curl_easy_cleanup(curl);
@@ -75,25 +94,44 @@ bool CWmtsIf::GetWmtsCapabilitiesXml(unsigned char** XmlFileBuffer, int& Size)
    return true;
 }
 
-bool CWmtsIf::GetMapPngBuffer(int Zoom,
-                              int X,
-                              int Y,
-                              unsigned char** PngFileBuffer,
-                              int& Size)
+bool CWmtsIf::GetMapTileBuffer(int Zoom,
+                               int X,
+                               int Y,
+                               unsigned char** TileFileBuffer,
+                               int& Size)
 {
    std::string wmts_cmd;
+   TileFormat  format;
 
    // check if open
-   if (!mIsOpen) return false;
+   if (!mIsOpen || mAbort) return false;
+
+   TRACE_SCOPE("Fetch", "network");
+
+   // time the whole request, including the connection setup
+   auto start = std::chrono::steady_clock::now();
 
    // clear the curl buffer
    mCurlBuffer.clear();
 
-   // construct the wms command
-   wmts_cmd = mWmtsUrl + "/styles/basic-preview/256/" +
-              std::to_string(Zoom) + "/" +
-              std::to_string(X) + "/" +
-              std::to_string(Y) + ".png";
+   // construct the wms command, from the capabilities template if there
+   // was one
+   if (mTileSource.Template.empty())
+   {
+      wmts_cmd = mWmtsUrl + "/styles/basic-preview/256/" +
+                 std::to_string(Zoom) + "/" +
+                 std::to_string(X) + "/" +
+                 std::to_string(Y) + ".png";
+   }
+   else
+   {
+      wmts_cmd = mTileSource.Template;
+
+      ReplaceParameter(wmts_cmd, "{TileMatrix}", Zoom < (int)mTileSource.TileMatrices.size() ?
+                                                 mTileSource.TileMatrices[Zoom] : std::to_string(Zoom));
+      ReplaceParameter(wmts_cmd, "{TileCol}", std::to_string(X));
+      ReplaceParameter(wmts_cmd, "{TileRow}", std::to_string(Y));
+   }
 
    // initialize a curl connection
    CURL* curl = curl_easy_init();
@@ -106,29 +144,71 @@ bool CWmtsIf::GetMapPngBuffer(int Zoom,
    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, RunCurlWriteFunction);
    curl_easy_setopt(curl, CURLOPT_WRITEDATA, this);
    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, mTimeoutMsec);
+   curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+   curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, CurlProgressFunction);
+   curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &mAbort);
    curl_easy_setopt(curl, CURLOPT_URL, wmts_cmd.c_str());
    curl_easy_perform(curl);
    curl_easy_cleanup(curl);
 
-   // check for png file validity
-   if (mCurlBuffer.size() == 0)
+   // check the file is an image in the format asked for, error pages
+   // come back as html or json
+   if (!GetTileFormatFromData(mCurlBuffer.data(), mCurlBuffer.size(), format) ||
+       format != mTileSource.Format)
+   {
+      if (mStats) mStats->RecordMiss(CacheTier::WMTS);
       return false;
+   }
+
+   if (mStats)
+   {
+      mStats->GetLatency(TileStage::NETWORK).Record(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count());
+      mStats->AddBytesFetched(mCurlBuffer.size());
+      mStats->RecordHit(CacheTier::WMTS);
+   }
+
+   // output the curl buffer to the tile file buffer
+   *TileFileBuffer = mCurlBuffer.data();
+   Size = mCurlBuffer.size();
+
+   return true;
+}
+
+bool CWmtsIf::LoadCapabilities(const unsigned char* Xml, int Size)
+{
+   CWmtsCapabilities capabilities;
+   TWmtsTileSource   tile_source;
 
-   if ((mCurlBuffer[1] != 'P') ||
-       (mCurlBuffer[2] != 'N') ||
-       (mCurlBuffer[3] != 'G'))
+   if (!capabilities.Parse(Xml, Size))
       return false;
 
-   // output the curl buffer to the png file buffer
-   *PngFileBuffer = mCurlBuffer.data();
-   Size = mCurlBuffer.size();
+   // the layer the default path fetches if the server has it
+   if (!capabilities.SelectTileSource(tile_source, OSM_TILE_SIZE, "basic-preview") &&
+       !capabilities.SelectTileSource(tile_source, OSM_TILE_SIZE))
+   {
+      ExecApiLogWarning("WmtsIf: no %d pixel web mercator layer in a supported format", OSM_TILE_SIZE);
+      return false;
+   }
+
+   mTileSource = tile_source;
 
    return true;
 }
 
+bool CWmtsIf::LoadCapabilitiesFile(const std::string& Filename)
+{
+   std::ifstream              xml_file(Filename, std::ios::in | std::ios::binary);
+   std::vector<unsigned char> xml((std::istreambuf_iterator<char>(xml_file)),
+                                  std::istreambuf_iterator<char>());
+
+   return !xml.empty() && LoadCapabilities(xml.data(), xml.size());
+}
+
 bool CWmtsIf::Open(const char* WmtsUrl, int TimeoutSec)
 {
    mWmtsUrl = WmtsUrl;
+   mAbort = false;
 
    //  initialize curl
    if (curl_global_init(CURL_GLOBAL_ALL)) return false;
@@ -139,6 +219,13 @@ bool CWmtsIf::Open(const char* WmtsUrl, int TimeoutSec)
    return true;
 }
 
+void CWmtsIf::ReplaceParameter(std::string& Url, const char* Parameter, const std::string& Value)
+{
+   size_t pos = Url.find(Parameter);
+
+   if (pos != std::string::npos)
+      Url.replace(pos, strlen(Parameter), Value);
+}
 
 size_t CWmtsIf::RunCurlWriteFunction(void* Ptr, size_t Size, size_t Nmemb, void* Userdata)
 {
@@ -1,8 +1,13 @@
 
 #pragma once
 
+#include <atomic>
 #include <string>
 #include <vector>
+#include "MapStats.h"
+#include "WmtsCapabilities.h"
+
+#define WMTS_CAPABILITIES_FILENAME "osm_wmts_capabilities.xml" // kept in the cache directory
 
 class CWmtsIf
 {
@@ -11,27 +16,52 @@ public:
    CWmtsIf();
    ~CWmtsIf();
 
+   // any thread, ends the request in progress and fails the ones after it
+   // until Open, so a thread waiting on a slow server can be joined
+   void Abort() { mAbort = true; }
+
    void Close();
 
    bool GetWmtsCapabilitiesXml(unsigned char** XmlFileBuffer, int& Size);
 
-   bool GetMapPngBuffer(int Zoom,
-                        int X,
-                        int Y,
-                        unsigned char** PngFileBuffer,
-                        int& Size);
+   // a tile in the format of the tile source, anything else the server
+   // sends back is rejected
+   bool GetMapTileBuffer(int Zoom,
+                         int X,
+                         int Y,
+                         unsigned char** TileFileBuffer,
+                         int& Size);
+
+   const TWmtsTileSource& GetTileSource() const { return mTileSource; }
+
+   // picks the layer, format and url template tiles are fetched with,
+   // false leaves the tile source as it was
+   bool LoadCapabilities(const unsigned char* Xml, int Size);
+
+   bool LoadCapabilitiesFile(const std::string& Filename);
 
    bool Open(const char* WmtsUrl, int TimeoutSec);
 
+   // the tile source another connection to the same server picked
+   void SetTileSource(const TWmtsTileSource& TileSource) { mTileSource = TileSource; }
+
+   // tile requests are timed and counted into Stats when set
+   void SetStats(CMapStats* Stats) { mStats = Stats; }
+
 private:
 
    size_t CurlWriteFunction(void* Ptr, size_t Size, size_t Nmemb);
 
+   static void ReplaceParameter(std::string& Url, const char* Parameter, const std::string& Value);
+
    static size_t RunCurlWriteFunction(
          void* Ptr, size_t Size, size_t Nmemb, void* Userdata);
 
    std::vector<unsigned char> mCurlBuffer;
    std::string                mWmtsUrl;
+   TWmtsTileSource            mTileSource;
+   CMapStats*                 mStats;
    int                        mTimeoutMsec;
+   std::atomic<bool>          mAbort;
    bool                       mIsOpen;
 };
@@ -0,0 +1,15 @@
+#version 330 core
+in vec4 Color;
+in vec2 Local;
+flat in float Radius;
+
+void main()
+{
+   float distance = length(Local);
+   float coverage = clamp(Radius + 0.5 - distance, 0.0, 1.0);
+
+   // a darker ring separates markers from the map and from each other
+   float outline = clamp(distance - (Radius - 1.5) + 0.5, 0.0, 1.0);
+
+   gl_FragColor = vec4(mix(Color.rgb, Color.rgb * 0.4, outline), Color.a * coverage);
+}
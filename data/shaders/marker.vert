@@ -0,0 +1,34 @@
+#version 330 core
+layout (location = 0) in uint aSlot;  // visible marker, per instance
+
+uniform usamplerBuffer uMarkers;      // world hi x, hi y, lo x, lo y, then color, size
+uniform vec4 uCenter;                 // map center, hi x, hi y, lo x, lo y
+uniform vec2 uPixelsPerWorld;
+uniform int  uAllVisible;             // no visible list, the instance is the marker
+uniform mat4 transform;
+
+out vec4 Color;
+out vec2 Local;
+flat out float Radius;
+
+void main()
+{
+   int   slot = (uAllVisible != 0) ? gl_InstanceID : int(aSlot);
+   uvec4 position = texelFetch(uMarkers, slot * 2);
+   uvec4 style = texelFetch(uMarkers, slot * 2 + 1);
+   vec4  point = uintBitsToFloat(position);
+
+   // hi and lo are subtracted apart so the large parts cancel exactly
+   vec2 world = (point.xy - uCenter.xy) + (point.zw - uCenter.zw);
+   vec2 center = world * uPixelsPerWorld * vec2(1.0, -1.0);
+
+   // a strip over the square around the circle, a pixel larger for the fringe
+   vec2 corner = vec2(float(gl_VertexID & 1), float(gl_VertexID >> 1)) * 2.0 - 1.0;
+
+   Radius = uintBitsToFloat(style.y) * 0.5;
+   Local = corner * (Radius + 1.0);
+   Color = vec4(float(style.x & 0xffu), float((style.x >> 8) & 0xffu),
+                float((style.x >> 16) & 0xffu), float(style.x >> 24)) / 255.0;
+
+   gl_Position = transform * vec4(center + Local, 0.0, 1.0);
+}
@@ -0,0 +1,11 @@
+#version 330 core
+in vec4 Color;
+in float Across;
+flat in float HalfWidth;
+
+void main()
+{
+   float coverage = clamp(HalfWidth + 0.5 - abs(Across), 0.0, 1.0);
+
+   gl_FragColor = vec4(Color.rgb, Color.a * coverage);
+}
@@ -0,0 +1,63 @@
+#version 330 core
+uniform samplerBuffer  uPoints;   // world hi x, hi y, lo x, lo y
+uniform usamplerBuffer uEntries;  // point, style, the point is all ones between lines
+uniform samplerBuffer  uStyles;   // color, then width in pixels
+uniform vec4 uCenter;             // map center, hi x, hi y, lo x, lo y
+uniform vec2 uPixelsPerWorld;
+uniform mat4 transform;
+
+out vec4 Color;
+out float Across;
+flat out float HalfWidth;
+
+// two triangles per segment, which end and which side each corner is on
+const int   cEnd[6]  = int[6](0, 0, 1, 1, 0, 1);
+const float cSide[6] = float[6](-1.0, 1.0, -1.0, -1.0, 1.0, 1.0);
+
+vec2 ToScreen(vec4 Point)
+{
+   // hi and lo are subtracted apart so the large parts cancel exactly
+   vec2 world = (Point.xy - uCenter.xy) + (Point.zw - uCenter.zw);
+
+   return world * uPixelsPerWorld * vec2(1.0, -1.0);
+}
+
+void main()
+{
+   int   segment = gl_VertexID / 6;
+   int   corner = gl_VertexID - segment * 6;
+   uvec2 start = texelFetch(uEntries, segment).xy;
+   uvec2 end = texelFetch(uEntries, segment + 1).xy;
+
+   Color = vec4(0.0);
+   Across = 0.0;
+   HalfWidth = 0.0;
+
+   // the gap between two lines collapses to a point outside the clip volume
+   if (start.x == 0xffffffffu || end.x == 0xffffffffu)
+   {
+      gl_Position = vec4(0.0, 0.0, 2.0, 1.0);
+      return;
+   }
+
+   vec2  a = ToScreen(texelFetch(uPoints, int(start.x)));
+   vec2  b = ToScreen(texelFetch(uPoints, int(end.x)));
+   float width = texelFetch(uStyles, int(start.y) * 2 + 1).x;
+   vec2  direction = b - a;
+   float len = length(direction);
+
+   direction = (len > 0.0) ? direction / len : vec2(1.0, 0.0);
+
+   // square caps fill the joins, a pixel of fringe on the sides is faded
+   // out for antialiasing
+   vec2  normal = vec2(-direction.y, direction.x);
+   float extent = width * 0.5 + 1.0;
+   vec2  position = (cEnd[corner] == 0) ? a - direction * width * 0.5 : b + direction * width * 0.5;
+
+   position += normal * cSide[corner] * extent;
+
+   gl_Position = transform * vec4(position, 0.0, 1.0);
+   Color = texelFetch(uStyles, int(start.y) * 2);
+   Across = cSide[corner] * extent;
+   HalfWidth = width * 0.5;
+}
@@ -0,0 +1,10 @@
+#version 330 core
+uniform sampler2D uTexture;
+uniform float     uAlpha;               // premultiplied fade of an easing tile
+
+in vec2 TexCoords;
+
+void main()
+{
+   gl_FragColor = texture(uTexture, TexCoords) * uAlpha;
+}
@@ -0,0 +1,19 @@
+#version 330 core
+layout (location = 0) in vec2 aOffset;  // tiles east and south of the first tile, set per draw
+
+uniform vec2 uOrigin;                   // first tile center, pixels from the map center
+uniform vec2 uTileSize;                 // tile size in pixels at the current scale
+uniform mat4 transform;                 // projection, map offset and rotation, once per frame
+
+out vec2 TexCoords;
+
+void main()
+{
+   // a strip over the tile, the texture is upright with y north
+   vec2 corner = vec2(float(gl_VertexID & 1), float(gl_VertexID >> 1));
+   vec2 center = uOrigin + aOffset * uTileSize * vec2(1.0, -1.0);
+
+   TexCoords = corner;
+
+   gl_Position = transform * vec4(center + (corner - 0.5) * uTileSize, 0.0, 1.0);
+}
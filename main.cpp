@@ -1,6 +1,9 @@
 
 #include <stdio.h>
+#include <string.h>
+#include <algorithm>
 #include <chrono>
+#include <random>
 #include <thread>
 #include <vector>
 #include <string>
@@ -14,24 +17,52 @@
 #include "GlDebug.h"
 #include "GlLineStrip.h"
 #include "GlRect.h"
+#include "MapExport.h"
 #include "Shader.h"
 #include "Texture.h"
+#include "TextureRegistry.h"
 #include "OpenStreetMap.h"
+#include "MarkerLayer.h"
+#include "PolylineLayer.h"
+#include "Trace.h"
+#include "ViewRecorder.h"
+#include "FrameArena.h"
+#include "HeapCounter.h"
+#include "ExecApi.h"
 
 #define WIDTH              640
 #define HEIGHT             480
 #define FRAME_RATE         60
 #define TIME_CONSTANT      0.2
 #define DEGREES_TO_RADIANS M_PI / 180.0
+#define TRACE_FILENAME     "trace.json"
+#define DEMO_TRACK_POINTS  100000
+#define DEMO_MARKERS       10000
+#define MINIMAP_SIZE       180
+#define MINIMAP_ZOOM_OUT   16.0f
 
 std::shared_ptr<CShader> shader_rect = nullptr;
 std::shared_ptr<CShader> shader_line = nullptr;
+std::shared_ptr<CShader> shader_polyline = nullptr;
+std::shared_ptr<CShader> shader_marker = nullptr;
+std::shared_ptr<CShader> shader_tile = nullptr;
 std::shared_ptr<CTexture> texture = nullptr;
 int window_width = WIDTH;
 int window_height = HEIGHT;
 int map_width = WIDTH;
 int map_height = HEIGHT;
 COpenStreetMap map;
+COpenStreetMap minimap;
+CMapExport map_export;
+CViewRecorder view_recorder;
+CFrameArena frame_arena;
+uint64_t frame_allocations = 0;
+CPolylineLayer tracks;
+CMarkerLayer markers;
+std::vector<int> marker_ids;
+std::vector<double> marker_lat;
+std::vector<double> marker_lon;
+std::vector<double> marker_heading;
 float map_rotation = 0.0f;
 float map_scale_factor = 72000.0f;
 int map_offset_x = 0;
@@ -47,6 +78,11 @@ bool draw_boundaries = false;
 bool draw_border = false;
 bool clip_map = false;
 bool enable_easing = false;
+bool enable_trace = false;
+bool move_markers = true;
+bool show_demo = false;
+bool show_minimap = false;
+int  disk_budget_mb = 0;
 bool press_up = false;
 bool press_down = false;
 bool press_left = false;
@@ -93,17 +129,18 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
 
 void render()
 {
-   CGlLineStrip           lines = CGlLineStrip(shader_line, 0.0f, 0.0f, 0.0f, 0.0f);
-   CGlRect                rect1 = CGlRect(shader_rect, -25.0f, 25.0f, 50.0f, 50.0f);
-   CGlRect                rect2 = CGlRect(shader_rect, 25.0f, -25.0f, 50.0f, 50.0f);
-   std::vector<glm::vec3> points;
-   glm::mat4              mvp;
+   CGlLineStrip            lines = CGlLineStrip(shader_line, 0.0f, 0.0f, 0.0f, 0.0f);
+   CGlRect                 rect1 = CGlRect(shader_rect, -25.0f, 25.0f, 50.0f, 50.0f);
+   CGlRect                 rect2 = CGlRect(shader_rect, 25.0f, -25.0f, 50.0f, 50.0f);
+   TArenaVector<glm::vec3> points{TArenaAllocator<glm::vec3>(frame_arena)};
+   glm::mat4               mvp;
 
    mvp = glm::ortho(-(float)window_width * 0.5f,
                      (float)window_width * 0.5f,
                     -(float)window_height * 0.5f,
                      (float)window_height * 0.5f, -1.0f, 1.0f);
 
+   points.reserve(8);
    points.push_back(glm::vec3(-10.0f, -10.0f, 0.0f));
    points.push_back(glm::vec3( 10.0f, -10.0f, 0.0f));
    points.push_back(glm::vec3( 10.0f,  10.0f, 0.0f));
@@ -130,6 +167,42 @@ void render()
    map.Update();
    map.Draw();
 
+   if (view_recorder.IsOpen())
+   {
+      TRecordedView view;
+
+      view.Latitude     = latitude;
+      view.Longitude    = longitude;
+      view.ScaleFactor  = map_scale_factor;
+      view.RotationDeg  = map_rotation;
+      view.MapWidth     = map_width;
+      view.MapHeight    = map_height;
+      view.WindowWidth  = window_width;
+      view.WindowHeight = window_height;
+      view.OffsetX      = map_offset_x;
+      view.OffsetY      = map_offset_y;
+      view.Flags        = (enable_easing ? VIEW_FLAG_EASING : 0) |
+                          (draw_boundaries ? VIEW_FLAG_BOUNDARIES : 0) |
+                          (draw_border ? VIEW_FLAG_BORDER : 0) |
+                          (clip_map ? VIEW_FLAG_CLIP : 0);
+      view_recorder.Record(view);
+   }
+
+   // the minimap shares the main map's tile service, a tile both of them
+   // cover is fetched and uploaded once
+   if (show_minimap)
+   {
+      minimap.SetProjection(mvp);
+      minimap.SetMapCenter(latitude, longitude);
+      minimap.SetMapRotation(map_rotation);
+      minimap.SetMapScaleFactor(std::min(map_scale_factor * MINIMAP_ZOOM_OUT, 500000000.0f));
+      minimap.SetMapSize(MINIMAP_SIZE, MINIMAP_SIZE);
+      minimap.SetWindowSize(window_width, window_height);
+      minimap.SetMapOffset((window_width - MINIMAP_SIZE) / 2 - 10, -(window_height - MINIMAP_SIZE) / 2 + 10);
+      minimap.Update();
+      minimap.Draw();
+   }
+
    //rect2.SetColor(glm::vec4(0.0f, 0.0f, 1.0f, 1.0f));
    //rect2.Render(mvp);
 
@@ -180,9 +253,334 @@ void render()
       map_scale_factor = 10000000.0f;
 }
 
+// a random walk from the map center with a slowly turning heading, a few
+// meters a step like a gps track
+void add_demo_track()
+{
+   static std::mt19937              random(1);
+   std::normal_distribution<>       turn(0.0, 0.1);
+   std::uniform_real_distribution<> hue(0.0, 1.0);
+   std::vector<double>              lat(DEMO_TRACK_POINTS);
+   std::vector<double>              lon(DEMO_TRACK_POINTS);
+   double                           heading = hue(random) * 2.0 * M_PI;
+   float                            h = (float)hue(random);
+
+   lat[0] = latitude;
+   lon[0] = longitude;
+
+   for (int i = 1; i < DEMO_TRACK_POINTS; i++)
+   {
+      heading += turn(random);
+      lat[i] = lat[i - 1] + 0.00005 * cos(heading);
+      lon[i] = lon[i - 1] + 0.00005 * sin(heading) / cos(lat[i] * DEGREES_TO_RADIANS);
+   }
+
+   tracks.Add(lat.data(), lon.data(), DEMO_TRACK_POINTS,
+              glm::vec4(0.5f + 0.5f * cosf(h * 6.2832f), 0.5f + 0.5f * cosf((h - 0.333f) * 6.2832f),
+                        0.5f + 0.5f * cosf((h + 0.333f) * 6.2832f), 0.8f), 3.0f);
+}
+
+void draw_tracks_panel()
+{
+   TPolylineStats stats = tracks.GetStats();
+
+   if (!ImGui::CollapsingHeader("Tracks"))
+      return;
+
+   ImGui::Text("%lu tracks, %lu points, %.1f MB on the gpu%s",
+               (unsigned long)stats.Polylines,
+               (unsigned long)stats.Points,
+               stats.GpuBytes / 1048576.0,
+               tracks.IsBuilding() ? ", building" : "");
+   ImGui::Text("Level %d: %lu of %lu segments drawn in %lu calls, last build %.1f ms",
+               stats.Lod,
+               (unsigned long)stats.DrawnSegments,
+               (unsigned long)stats.LodSegments,
+               (unsigned long)stats.DrawCalls,
+               stats.LastBuildMs);
+
+   if (ImGui::Button("Add Track"))
+      add_demo_track();
+   ImGui::SameLine();
+   if (ImGui::Button("Clear Tracks"))
+      tracks.Clear();
+}
+
+void add_demo_markers()
+{
+   static std::mt19937              random(2);
+   std::uniform_real_distribution<> unit(0.0, 1.0);
+
+   for (int i = 0; i < DEMO_MARKERS; i++)
+   {
+      float h = (float)unit(random);
+
+      marker_lat.push_back(latitude + (unit(random) - 0.5) * 0.2);
+      marker_lon.push_back(longitude + (unit(random) - 0.5) * 0.2);
+      marker_heading.push_back(unit(random) * 2.0 * M_PI);
+      marker_ids.push_back(markers.Add(marker_lat.back(), marker_lon.back(),
+                                       glm::vec4(0.5f + 0.5f * cosf(h * 6.2832f), 0.5f + 0.5f * cosf((h - 0.333f) * 6.2832f),
+                                                 0.5f + 0.5f * cosf((h + 0.333f) * 6.2832f), 0.9f),
+                                       10.0f));
+   }
+}
+
+// every marker takes a step of a few meters a frame on a slowly turning heading
+void move_demo_markers()
+{
+   static std::mt19937        random(3);
+   std::normal_distribution<> turn(0.0, 0.05);
+
+   if (!move_markers || marker_ids.empty())
+      return;
+
+   for (size_t i = 0; i < marker_ids.size(); i++)
+   {
+      marker_heading[i] += turn(random);
+      marker_lat[i] += 0.00002 * cos(marker_heading[i]);
+      marker_lon[i] += 0.00002 * sin(marker_heading[i]) / cos(marker_lat[i] * DEGREES_TO_RADIANS);
+   }
+
+   markers.Move(marker_ids.data(), marker_lat.data(), marker_lon.data(), marker_ids.size());
+}
+
+void draw_markers_panel()
+{
+   TMarkerStats stats = markers.GetStats();
+
+   if (!ImGui::CollapsingHeader("Markers"))
+      return;
+
+   ImGui::Text("%lu markers, %lu visible, %lu quadtree nodes",
+               (unsigned long)stats.Markers,
+               (unsigned long)stats.Visible,
+               (unsigned long)stats.Nodes);
+   ImGui::Text("Uploaded %.1f KB in %lu calls, query %.3f ms",
+               stats.UploadedBytes / 1024.0,
+               (unsigned long)stats.UploadCalls,
+               stats.QueryMs);
+
+   if (ImGui::Button("Add Markers"))
+      add_demo_markers();
+   ImGui::SameLine();
+   if (ImGui::Button("Clear Markers"))
+   {
+      markers.Clear();
+      marker_ids.clear();
+      marker_lat.clear();
+      marker_lon.clear();
+      marker_heading.clear();
+   }
+   ImGui::SameLine();
+   ImGui::Checkbox("Move", &move_markers);
+}
+
+void draw_stats_panel()
+{
+   CMapStats& stats = map.GetStats();
+
+   if (!ImGui::CollapsingHeader("Map Pipeline Stats"))
+      return;
+
+   // per stage latencies, recorded in microseconds
+   if (ImGui::BeginTable("stages", 6, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg))
+   {
+      ImGui::TableSetupColumn("Stage");
+      ImGui::TableSetupColumn("Count");
+      ImGui::TableSetupColumn("Mean ms");
+      ImGui::TableSetupColumn("P50 ms");
+      ImGui::TableSetupColumn("P99 ms");
+      ImGui::TableSetupColumn("Max ms");
+      ImGui::TableHeadersRow();
+
+      for (int i = 0; i < (int)TileStage::NUM_STAGES; i++)
+      {
+         const CLatencyHistogram& latency = stats.GetLatency((TileStage)i);
+
+         ImGui::TableNextRow();
+         ImGui::TableNextColumn();
+         ImGui::Text("%s", CMapStats::GetStageName((TileStage)i));
+         ImGui::TableNextColumn();
+         ImGui::Text("%lu", (unsigned long)latency.GetCount());
+         ImGui::TableNextColumn();
+         ImGui::Text("%.3f", latency.GetMean() / 1000.0);
+         ImGui::TableNextColumn();
+         ImGui::Text("%.3f", latency.GetPercentile(50.0) / 1000.0);
+         ImGui::TableNextColumn();
+         ImGui::Text("%.3f", latency.GetPercentile(99.0) / 1000.0);
+         ImGui::TableNextColumn();
+         ImGui::Text("%.3f", latency.GetMax() / 1000.0);
+      }
+
+      ImGui::EndTable();
+   }
+
+   // hit rates for each place a tile can come from
+   if (ImGui::BeginTable("tiers", 4, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg))
+   {
+      ImGui::TableSetupColumn("Cache Tier");
+      ImGui::TableSetupColumn("Hits");
+      ImGui::TableSetupColumn("Misses");
+      ImGui::TableSetupColumn("Hit Rate");
+      ImGui::TableHeadersRow();
+
+      for (int i = 0; i < (int)CacheTier::NUM_TIERS; i++)
+      {
+         ImGui::TableNextRow();
+         ImGui::TableNextColumn();
+         ImGui::Text("%s", CMapStats::GetTierName((CacheTier)i));
+         ImGui::TableNextColumn();
+         ImGui::Text("%lu", (unsigned long)stats.GetHits((CacheTier)i));
+         ImGui::TableNextColumn();
+         ImGui::Text("%lu", (unsigned long)stats.GetMisses((CacheTier)i));
+         ImGui::TableNextColumn();
+         ImGui::Text("%.1f%%", stats.GetHitRate((CacheTier)i) * 100.0);
+      }
+
+      ImGui::EndTable();
+   }
+
+   // render passes, gpu time from timer queries next to the cpu submission time
+   if (ImGui::BeginTable("passes", 5, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg))
+   {
+      ImGui::TableSetupColumn("Pass");
+      ImGui::TableSetupColumn("GPU ms");
+      ImGui::TableSetupColumn("GPU Max ms");
+      ImGui::TableSetupColumn("CPU ms");
+      ImGui::TableSetupColumn("CPU Max ms");
+      ImGui::TableHeadersRow();
+
+      for (int i = 0; i < (int)DrawPass::NUM_PASSES; i++)
+      {
+         const CGlTimerQuery& timer = map.GetPassTimer((DrawPass)i);
+
+         ImGui::TableNextRow();
+         ImGui::TableNextColumn();
+         ImGui::Text("%s", COpenStreetMap::GetPassName((DrawPass)i));
+         ImGui::TableNextColumn();
+         ImGui::Text("%.3f", timer.GetGpuMs());
+         ImGui::TableNextColumn();
+         ImGui::Text("%.3f", timer.GetGpuMaxMs());
+         ImGui::TableNextColumn();
+         ImGui::Text("%.3f", timer.GetCpuMs());
+         ImGui::TableNextColumn();
+         ImGui::Text("%.3f", timer.GetCpuMaxMs());
+      }
+
+      ImGui::EndTable();
+   }
+
+   // heap allocations, the render thread's whole frame and the map's passes,
+   // a steady view should make none
+   ImGui::Text("Heap allocations: %lu last frame, %.1f per draw, %.1f per coverage pass",
+               (unsigned long)frame_allocations,
+               stats.GetAllocations(AllocPass::DRAW).GetMean(),
+               stats.GetAllocations(AllocPass::COVERAGE).GetMean());
+
+   ImGui::Text("Fetched: %.2f MB, Read from disk: %.2f MB",
+               stats.GetBytesFetched() / 1048576.0,
+               stats.GetBytesRead() / 1048576.0);
+   ImGui::Text("Zoom level changes: %lu", (unsigned long)stats.GetZoomChanges());
+
+   // 0 for what hasn't happened yet
+   ImGui::Text("Startup: open %.1f ms, first tiles %.1f ms, server online %.1f ms",
+               stats.GetStartupUs(StartupEvent::OPEN) / 1000.0,
+               stats.GetStartupUs(StartupEvent::FIRST_TILES) / 1000.0,
+               stats.GetStartupUs(StartupEvent::SERVER_ONLINE) / 1000.0);
+
+   // png files under the cache path, 0 MB is no budget
+   CDiskCache&     disk_cache = map.GetTileService()->GetDiskCache();
+   TDiskCacheStats disk = disk_cache.GetStats();
+
+   ImGui::Text("Disk cache: %.2f MB in %lu tiles, %lu pinned",
+               disk.Bytes / 1048576.0,
+               (unsigned long)disk.Tiles,
+               (unsigned long)disk.PinnedTiles);
+   ImGui::Text("Evicted: %lu tiles, %.2f MB over %lu collections, last took %.1f ms",
+               (unsigned long)disk.EvictedTiles,
+               disk.EvictedBytes / 1048576.0,
+               (unsigned long)disk.Collections,
+               disk.LastCollectionMs);
+
+   if (ImGui::SliderInt("Disk Budget MB", &disk_budget_mb, 0, 4096))
+      disk_cache.SetBudget((uint64_t)disk_budget_mb * 1048576);
+
+   // fetches and textures shared by the map and the minimap
+   TTileServiceStats service = map.GetTileService()->GetStats();
+
+   static const char* server_states[] = { "none", "discovering", "online", "offline" };
+
+   ImGui::Text("Tile service: %lu maps, %lu tiles recorded, %lu shared fetches",
+               (unsigned long)service.Views,
+               (unsigned long)service.Records,
+               (unsigned long)service.SharedFetches);
+   ImGui::Text("Tile server: %s, discovered in %.1f ms",
+               server_states[(int)service.State],
+               service.DiscoveryMs);
+   ImGui::Text("Tile textures: %lu resident, %lu in use, %lu evicted, %lu waiting to be deleted",
+               (unsigned long)service.Textures,
+               (unsigned long)service.ReferencedTextures,
+               (unsigned long)service.EvictedTextures,
+               (unsigned long)service.PendingDeletes);
+
+   CSharedTilePool& shared_pool = map.GetTileService()->GetSharedPool();
+
+   if (shared_pool.IsOpen())
+   {
+      TSharedTilePoolStats pool = shared_pool.GetStats();
+
+      ImGui::Text("Shared pool: %lu tiles of %.0f MB, %lu processes, %lu hits, %lu decodes, %lu evicted, %lu reaped",
+                  (unsigned long)pool.Tiles,
+                  pool.BudgetBytes / 1048576.0,
+                  (unsigned long)pool.Clients,
+                  (unsigned long)pool.Hits,
+                  (unsigned long)pool.Decodes,
+                  (unsigned long)pool.Evictions,
+                  (unsigned long)pool.ReapedClients);
+   }
+   else
+   {
+      ImGui::Text("Shared pool: off, --shared-pool MB turns it on");
+   }
+
+   if (ImGui::Button("Reset Stats"))
+   {
+      stats.Reset();
+      map.ResetPassTimers();
+   }
+
+   // chrome trace-event timeline of the pipeline threads
+   ImGui::SameLine();
+   if (ImGui::Checkbox("Trace", &enable_trace))
+      CTrace::Enable(enable_trace);
+   ImGui::SameLine();
+   if (ImGui::Button("Dump Trace"))
+      CTrace::Dump(TRACE_FILENAME);
+}
+
 int main(int argc, char* argv[])
 {
    GLFWwindow* window = nullptr;
+   bool        exec_export = false;
+   const char* record = nullptr;
+   int         shared_pool_mb = 0;
+
+   // --exec publishes the map's metrics to the exec frontend, --record FILE
+   // writes the main map's view inputs every frame for osm_replay, --demo
+   // adds the minimap on the shared tile service and the track and marker
+   // overlays, --shared-pool MB decodes tiles into a pool shared with the
+   // other displays on the host instead of each process on its own
+   for (int i = 1; i < argc; i++)
+   {
+      if (strcmp(argv[i], "--exec") == 0)
+         exec_export = true;
+      else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+         record = argv[++i];
+      else if (strcmp(argv[i], "--demo") == 0)
+         show_demo = true;
+      else if (strcmp(argv[i], "--shared-pool") == 0 && i + 1 < argc)
+         shared_pool_mb = atoi(argv[++i]);
+   }
 
    // initialize glfw
    if (!glfwInit())
@@ -241,6 +639,9 @@ int main(int argc, char* argv[])
    // Load shaders
    shader_rect = std::make_shared<CShader>("data/shaders/rect.vert", "data/shaders/rect.frag");
    shader_line = std::make_shared<CShader>("data/shaders/line.vert", "data/shaders/line.frag");
+   shader_polyline = std::make_shared<CShader>("data/shaders/polyline.vert", "data/shaders/polyline.frag");
+   shader_marker = std::make_shared<CShader>("data/shaders/marker.vert", "data/shaders/marker.frag");
+   shader_tile = std::make_shared<CShader>("data/shaders/tile.vert", "data/shaders/tile.frag");
 
    texture = GetOrCreateTexture("logo_icon.png");
 
@@ -248,28 +649,89 @@ int main(int argc, char* argv[])
    using framerate = std::chrono::duration<double, std::ratio<1, FRAME_RATE>>;
    auto frame_time = std::chrono::high_resolution_clock::now() + framerate{1};
 
-   map.Open(true, "192.168.1.151:8080", true, "data/map");
+   if (shared_pool_mb > 0)
+      CTileService::EnableSharedPool((uint64_t)shared_pool_mb * 1048576);
+
+   map.Open(true, "192.168.1.151:8080", true, "data/map", "map");
    map.SetCoverageRadiusScaleFactor(1.0f);
    map.SetMapRotation(0.0f);
+
+   // pick up where the last run left off
+   TMapSession session;
+
+   if (map.GetSession(session))
+   {
+      latitude = session.Latitude;
+      longitude = session.Longitude;
+      map_rotation = session.RotationDeg;
+      map_scale_factor = session.ScaleFactor;
+   }
    map.SetBorderColor(glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
-   map.SetShaders(shader_rect, shader_line);
+   map.SetShaders(shader_rect, shader_line, shader_tile);
+
+   if (show_demo)
+   {
+      minimap.Open(true, "192.168.1.151:8080", true, "data/map", "minimap");
+      minimap.SetCoverageRadiusScaleFactor(1.0f);
+      minimap.SetBorderColor(glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+      minimap.SetShaders(shader_rect, shader_line, shader_tile);
+      minimap.EnableBorder(true);
+      minimap.EnableClip(true);
+      show_minimap = true;
+   }
+
+   if (exec_export)
+   {
+      ExecApiInit(argc, argv);
+      map_export.Open("Map", 1000.0 / FRAME_RATE);
+   }
+
+   if (record)
+      view_recorder.Open(record, FRAME_RATE);
+
+   tracks.Open(shader_polyline);
+   map.AddLayer(&tracks);
+   markers.Open(shader_marker);
+   map.AddLayer(&markers);
+
+   CTrace::SetThreadName("Render");
 
    while (window)
    {
+      auto     frame_start = std::chrono::steady_clock::now();
+      uint64_t frame_allocations_start = GetThreadAllocations();
+
       // Poll events
       glfwPollEvents();
 
       if (glfwWindowShouldClose(window))
       {
+         if (enable_trace)
+            CTrace::Dump(TRACE_FILENAME);
+
+         map.RemoveLayer(&markers);
+         markers.Close();
+         map.RemoveLayer(&tracks);
+         tracks.Close();
+         map.Close();
+         minimap.Close();
+         view_recorder.Close();
+         CTileService::DeleteTextures();
          CTexture::DeleteTextures();
          glfwDestroyWindow(window);
          glfwTerminate();
          window = nullptr;
+
+         if (exec_export)
+            ExecApiShutdown();
          break;
       }
 
       GLCALL(glClear(GL_COLOR_BUFFER_BIT));
 
+      if (show_demo)
+         move_demo_markers();
+
       render();
 
       // Start the Dear ImGui frame
@@ -284,7 +746,24 @@ int main(int argc, char* argv[])
       ImGui::SameLine();
       ImGui::Checkbox("Draw Boundaries", &draw_boundaries);
       ImGui::Checkbox("Enable Easing", &enable_easing);
-      ImGui::Text("Textures loaded: %ld, FPS: %.1f", CTexture::TextureMap.size(), ImGui::GetIO().Framerate);
+      if (show_demo)
+      {
+         ImGui::SameLine();
+         ImGui::Checkbox("Minimap", &show_minimap);
+      }
+      ImGui::Text("Textures loaded: %lu, FPS: %.1f", (unsigned long)CTextureRegistry::GetGlobal().GetStats().Textures, ImGui::GetIO().Framerate);
+      if (ImGui::TreeNode("Named Textures"))
+      {
+         for (const auto& name : CTextureRegistry::GetGlobal().GetNames())
+            ImGui::TextUnformatted(name.c_str());
+         ImGui::TreePop();
+      }
+      draw_stats_panel();
+      if (show_demo)
+      {
+         draw_tracks_panel();
+         draw_markers_panel();
+      }
       ImGui::SliderFloat("Map Rotation", &map_rotation, -180.0f, 180.0f);
       ImGui::SliderFloat("Map Scale Factor", &map_scale_factor, 35000.0f, 10000000.0f);
       ImGui::SliderInt("Map Offset X", &map_offset_x, -500, 500);
@@ -301,7 +780,21 @@ int main(int argc, char* argv[])
       ImGui::Render();
       ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 
-      glfwSwapBuffers(window);
+      {
+         TRACE_SCOPE("SwapBuffers", "render");
+         glfwSwapBuffers(window);
+      }
+
+      CTrace::Record("Frame", "render", frame_start);
+
+      // the frame's transient memory goes back, what it took from the heap
+      // is shown in the stats panel
+      frame_arena.Reset();
+      frame_allocations = GetThreadAllocations() - frame_allocations_start;
+
+      map_export.RecordFrame(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frame_start).count(),
+                             frame_allocations);
+      map_export.Update(map);
 
       // wait until next frame
       std::this_thread::sleep_until(frame_time);